@@ -187,7 +187,7 @@ int MainCmds::benchmark(int argc, const char* const* argv) {
   NNEvaluator* nnEval;
   {
     Setup::initializeSession(cfg);
-    int maxConcurrentEvals = maxNumThreadsInATest * 2 + 16; // * 2 + 16 just to give plenty of headroom
+    int maxConcurrentEvals = maxNumThreadsInATest * params.getMaxNNEvalsInFlightPerThread() * 2 + 16; // * 2 + 16 just to give plenty of headroom
     nnEval = Setup::initializeNNEvaluator(
       modelFile,modelFile,cfg,logger,seedRand,maxConcurrentEvals,
       sgf->xSize,sgf->ySize
@@ -11,6 +11,7 @@
 #include <atomic>
 #include <cstdlib>
 #include <ctime>
+#include <limits>
 #include <sstream>
 
 #include "../core/global.h"
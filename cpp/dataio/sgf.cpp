@@ -824,7 +824,7 @@ void WriteSgf::writeSgf(
   const BoardHistory& hist,
   const FinishedGameData* gameData
 ) {
-  const Board& initialBoard = hist.initialBoard;
+  const Board initialBoard = hist.getInitialBoard();
   int xSize = initialBoard.x_size;
   int ySize = initialBoard.y_size;
   out << "(;FF[4]GM[1]";
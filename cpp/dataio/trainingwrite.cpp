@@ -55,6 +55,7 @@ FinishedGameData::FinishedGameData()
 
    startBoard(),
    startHist(),
+   endBoard(),
    endHist(),
    startPla(P_BLACK),
    gameHash(),
@@ -103,7 +104,7 @@ void FinishedGameData::printDebug(ostream& out) const {
   out << "start" << endl;
   startHist.printDebugInfo(out,startBoard);
   out << "end" << endl;
-  endHist.printDebugInfo(out,endHist.getRecentBoard(0));
+  endHist.printDebugInfo(out,endBoard);
   out << "gameHash " << gameHash << endl;
   out << "hitTurnLimit " << hitTurnLimit << endl;
   out << "numExtraBlack " << numExtraBlack << endl;
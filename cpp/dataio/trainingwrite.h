@@ -50,6 +50,7 @@ struct FinishedGameData {
 
   Board startBoard; //Board as of the end of startHist, beginning of training period
   BoardHistory startHist; //Board history as of start of training period
+  Board endBoard; //Board as of the end of endHist
   BoardHistory endHist; //Board history as of end of training period
   Player startPla; //Player to move as of end of startHist.
   Hash128 gameHash;
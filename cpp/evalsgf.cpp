@@ -201,7 +201,7 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
   NNEvaluator* nnEval;
   {
     Setup::initializeSession(cfg);
-    int maxConcurrentEvals = params.numThreads * 2 + 16; // * 2 + 16 just to give plenty of headroom
+    int maxConcurrentEvals = params.numThreads * params.getMaxNNEvalsInFlightPerThread() * 2 + 16; // * 2 + 16 just to give plenty of headroom
     nnEval = Setup::initializeNNEvaluator(
       modelFile,modelFile,cfg,logger,seedRand,maxConcurrentEvals,
       board.x_size,board.y_size
@@ -0,0 +1,264 @@
+#include "../game/areacache.h"
+
+using namespace std;
+
+typedef Board::Bitboard Bitboard;
+
+//Stones of the chain at loc, following the board's chain links rather than flood filling
+static Bitboard getChainStones(const Board& board, Loc loc) {
+  Bitboard chain;
+  chain.clear();
+  Loc cur = loc;
+  do {
+    chain.add(cur);
+    cur = board.next_in_chain[cur];
+  } while(cur != loc);
+  return chain;
+}
+
+template<typename F>
+static void forEachLoc(const Bitboard& bits, F f) {
+  for(int i = 0; i<Bitboard::NUM_WORDS; i++) {
+    uint64_t w = bits.words[i];
+    while(w != 0) {
+      f((Loc)(i * 64 + bitboardLowestBit(w)));
+      w &= w - 1;
+    }
+  }
+}
+
+AreaCache::AreaCache()
+  :numRegionsKept(0),numRegionsTraced(0),
+   hasBoard(false),xSize(0),ySize(0),multiStoneSuicideLegal(false),
+   regionsByPla(),newRegions()
+{
+  for(int i = 0; i<3; i++)
+    prevColorBits[i].clear();
+}
+
+AreaCache::~AreaCache()
+{}
+
+void AreaCache::clear() {
+  hasBoard = false;
+  regionsByPla[0].clear();
+  regionsByPla[1].clear();
+}
+
+void AreaCache::calculateArea(
+  const Board& board,
+  Color* result,
+  bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal
+) {
+  if(!hasBoard || board.x_size != xSize || board.y_size != ySize || isMultiStoneSuicideLegal != multiStoneSuicideLegal) {
+    clear();
+    hasBoard = true;
+    xSize = board.x_size;
+    ySize = board.y_size;
+    multiStoneSuicideLegal = isMultiStoneSuicideLegal;
+    for(int i = 0; i<3; i++)
+      prevColorBits[i].clear();
+  }
+
+  Bitboard changed =
+    (board.color_bits[C_EMPTY] ^ prevColorBits[C_EMPTY]) |
+    (board.color_bits[C_BLACK] ^ prevColorBits[C_BLACK]) |
+    (board.color_bits[C_WHITE] ^ prevColorBits[C_WHITE]);
+
+  for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+    result[i] = C_EMPTY;
+  calculateAreaForPla(board,P_BLACK,changed,safeBigTerritories,unsafeBigTerritories,result);
+  calculateAreaForPla(board,P_WHITE,changed,safeBigTerritories,unsafeBigTerritories,result);
+
+  if(nonPassAliveStones) {
+    for(int y = 0; y < ySize; y++) {
+      for(int x = 0; x < xSize; x++) {
+        Loc loc = Location::getLoc(x,y,xSize);
+        if(result[loc] == C_EMPTY)
+          result[loc] = board.colors[loc];
+      }
+    }
+  }
+
+  for(int i = 0; i<3; i++)
+    prevColorBits[i] = board.color_bits[i];
+}
+
+//Same as Board::calculateAreaForPla, see there for the details of the marking
+void AreaCache::calculateAreaForPla(
+  const Board& board,
+  Player pla,
+  const Bitboard& changed,
+  bool safeBigTerritories, bool unsafeBigTerritories,
+  Color* result
+) {
+  Player opp = getOpp(pla);
+  const Bitboard& emptyBits = board.color_bits[C_EMPTY];
+  const Bitboard& plaBits = board.color_bits[pla];
+  const Bitboard& oppBits = board.color_bits[opp];
+  Bitboard emptyOrOppBits = emptyBits | oppBits;
+
+  //Every pla chain that isn't exactly a chain of the last board has a stone next to a location that changed.
+  //A region that doesn't touch any of these chains or changed locations has the same spaces and the same
+  //bordering chains as before, so everything we know about it still holds.
+  Bitboard changedChains;
+  changedChains.clear();
+  forEachLoc(board.getExpandedBits(changed) & plaBits, [&board,&changedChains](Loc loc) {
+    if(!changedChains.contains(loc))
+      changedChains |= getChainStones(board,loc);
+  });
+  Bitboard touched = board.getExpandedBits(changed | changedChains);
+
+  vector<Region>& regions = regionsByPla[pla-1];
+  newRegions.clear();
+  Bitboard kept;
+  kept.clear();
+  for(const Region& region: regions) {
+    if((region.locs & touched).isEmpty()) {
+      newRegions.push_back(region);
+      kept |= region.locs;
+      numRegionsKept++;
+    }
+  }
+
+  //Trace the rest, from each empty space not in a kept region
+  Bitboard plaAdjacent = board.getExpandedBits(plaBits);
+  Bitboard remaining = emptyBits.andNot(kept);
+  while(!remaining.isEmpty()) {
+    Loc head = remaining.first();
+    Bitboard seed;
+    seed.clear();
+    seed.add(head);
+
+    Region region;
+    region.locs = board.floodFillBits(seed,emptyOrOppBits);
+    region.numVitalFor = 0;
+    Bitboard vitalSpaces = multiStoneSuicideLegal ? region.locs : (region.locs & emptyBits);
+    for(int i = 0; i<4; i++) {
+      Loc adj = head + board.adj_offsets[i];
+      if(board.colors[adj] != pla)
+        continue;
+      bool alreadyPresent = false;
+      for(int j = 0; j<region.numVitalFor; j++) {
+        if(board.chain_head[region.vitalFor[j]] == board.chain_head[adj]) {
+          alreadyPresent = true;
+          break;
+        }
+      }
+      if(alreadyPresent)
+        continue;
+      if(vitalSpaces.andNot(board.getExpandedBits(getChainStones(board,adj))).isEmpty())
+        region.vitalFor[region.numVitalFor++] = adj;
+    }
+    int numInternalSpaces = region.locs.andNot(plaAdjacent).count();
+    region.numInternalSpacesMax2 = (uint8_t)(numInternalSpaces < 2 ? numInternalSpaces : 2);
+    region.containsOpp = !(region.locs & oppBits).isEmpty();
+
+    newRegions.push_back(region);
+    remaining = remaining.andNot(region.locs);
+    numRegionsTraced++;
+  }
+  std::swap(regions,newRegions);
+
+  bool atLeastOnePla = !plaBits.isEmpty();
+  if(!atLeastOnePla)
+    return;
+
+  int numPlaHeads = 0;
+  Loc allPlaHeads[Board::MAX_PLAY_SIZE];
+  for(int y = 0; y < ySize; y++) {
+    for(int x = 0; x < xSize; x++) {
+      Loc loc = Location::getLoc(x,y,xSize);
+      if(board.colors[loc] == pla && board.chain_head[loc] == loc)
+        allPlaHeads[numPlaHeads++] = loc;
+    }
+  }
+  bool plaHasBeenKilled[Board::MAX_PLAY_SIZE];
+  for(int i = 0; i<numPlaHeads; i++)
+    plaHasBeenKilled[i] = false;
+
+  static constexpr int maxRegions = (Board::MAX_LEN * Board::MAX_LEN + 1)/2 + 1;
+  static constexpr uint16_t NO_REGION = 0xFFFF;
+  int numRegions = (int)regions.size();
+  assert(numRegions <= maxRegions);
+  uint16_t regionIdxByLoc[Board::MAX_ARR_SIZE];
+  for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+    regionIdxByLoc[i] = NO_REGION;
+  for(int r = 0; r<numRegions; r++) {
+    forEachLoc(regions[r].locs, [&regionIdxByLoc,r](Loc loc) {
+      regionIdxByLoc[loc] = (uint16_t)r;
+    });
+  }
+
+  //Benson iteration, same as calculateAreaForPla
+  bool bordersNonPassAlivePlaByRegion[maxRegions];
+  for(int r = 0; r<numRegions; r++)
+    bordersNonPassAlivePlaByRegion[r] = false;
+  uint16_t vitalCountByPlaHead[Board::MAX_ARR_SIZE];
+  while(true) {
+    for(int i = 0; i<numPlaHeads; i++)
+      vitalCountByPlaHead[allPlaHeads[i]] = 0;
+
+    for(int r = 0; r<numRegions; r++) {
+      if(bordersNonPassAlivePlaByRegion[r])
+        continue;
+      const Region& region = regions[r];
+      for(int j = 0; j<region.numVitalFor; j++)
+        vitalCountByPlaHead[board.chain_head[region.vitalFor[j]]] += 1;
+    }
+
+    bool killedAnything = false;
+    for(int i = 0; i<numPlaHeads; i++) {
+      if(plaHasBeenKilled[i])
+        continue;
+      Loc plaHead = allPlaHeads[i];
+      if(vitalCountByPlaHead[plaHead] < 2) {
+        plaHasBeenKilled[i] = true;
+        killedAnything = true;
+        Loc cur = plaHead;
+        do {
+          for(int j = 0; j<4; j++) {
+            uint16_t r = regionIdxByLoc[cur + board.adj_offsets[j]];
+            if(r != NO_REGION)
+              bordersNonPassAlivePlaByRegion[r] = true;
+          }
+          cur = board.next_in_chain[cur];
+        } while(cur != plaHead);
+      }
+    }
+
+    if(!killedAnything)
+      break;
+  }
+
+  //Mark result with pass-alive groups
+  for(int i = 0; i<numPlaHeads; i++) {
+    if(!plaHasBeenKilled[i]) {
+      Loc plaHead = allPlaHeads[i];
+      Loc cur = plaHead;
+      do {
+        result[cur] = pla;
+        cur = board.next_in_chain[cur];
+      } while(cur != plaHead);
+    }
+  }
+
+  //Mark result with territory
+  for(int r = 0; r<numRegions; r++) {
+    const Region& region = regions[r];
+    bool bordersNonPassAlive = bordersNonPassAlivePlaByRegion[r];
+    bool shouldMark = region.numInternalSpacesMax2 <= 1 && !bordersNonPassAlive;
+    shouldMark = shouldMark || (safeBigTerritories && !region.containsOpp && !bordersNonPassAlive);
+    if(shouldMark) {
+      forEachLoc(region.locs, [result,pla](Loc loc) {
+        result[loc] = pla;
+      });
+    }
+    else if(unsafeBigTerritories && !region.containsOpp) {
+      forEachLoc(region.locs, [result,pla](Loc loc) {
+        if(result[loc] == C_EMPTY)
+          result[loc] = pla;
+      });
+    }
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef GAME_AREACACHE_H_
+#define GAME_AREACACHE_H_
+
+#include "../core/global.h"
+#include "../game/board.h"
+
+//Incremental Board::calculateArea, for when it gets called over and over on boards that differ by only a few
+//stones, such as the positions of a game in order, or nearby positions in a search tree.
+//For each player, keeps the maximal empty-or-opp regions of the last board it was used on, along with what the benson
+//algorithm needs to know about each of them - which pla chains it is vital for, how many of its spaces aren't next to pla,
+//whether it contains opp stones. Regions that don't touch a location that changed or a pla chain that changed are kept
+//as they are, only the rest get traced again. The benson iteration over chains and regions is still redone each time.
+//Changes are found by comparing against the last board, so it works for any sequence of boards, not just consecutive ones.
+//NOT threadsafe.
+class AreaCache {
+ public:
+  AreaCache();
+  ~AreaCache();
+
+  AreaCache(const AreaCache&) = delete;
+  AreaCache& operator=(const AreaCache&) = delete;
+
+  //Same as board.calculateArea(result,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal)
+  void calculateArea(
+    const Board& board,
+    Color* result,
+    bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal
+  );
+
+  //Forget the last board, so that the next call traces every region
+  void clear();
+
+  //Number of regions kept from the last board, and number traced again, over all calls so far
+  int64_t numRegionsKept;
+  int64_t numRegionsTraced;
+
+ private:
+  struct Region {
+    Board::Bitboard locs;
+    //A stone of each pla chain that the region is vital for. At most 4, since these are all next to the region's
+    //first empty space.
+    Loc vitalFor[4];
+    uint8_t numVitalFor;
+    uint8_t numInternalSpacesMax2;
+    bool containsOpp;
+  };
+
+  bool hasBoard;
+  int xSize;
+  int ySize;
+  bool multiStoneSuicideLegal;
+  Board::Bitboard prevColorBits[3];
+  //Indexed by P_BLACK-1, P_WHITE-1
+  std::vector<Region> regionsByPla[2];
+  std::vector<Region> newRegions;
+
+  void calculateAreaForPla(
+    const Board& board,
+    Player pla,
+    const Board::Bitboard& changed,
+    bool safeBigTerritories, bool unsafeBigTerritories,
+    Color* result
+  );
+};
+
+#endif  // GAME_AREACACHE_H_
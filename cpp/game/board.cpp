@@ -53,6 +53,8 @@ Board::Board(const Board& other)
 
   ko_loc = other.ko_loc;
   empty_list = other.empty_list;
+  for(int i = 0; i<3; i++)
+    color_bits[i] = other.color_bits[i];
   pos_hash = other.pos_hash;
   numBlackCaptures = other.numBlackCaptures;
   numWhiteCaptures = other.numWhiteCaptures;
@@ -71,6 +73,8 @@ void Board::init(int xS, int yS)
 
   for(int i = 0; i < MAX_ARR_SIZE; i++)
     colors[i] = C_WALL;
+  for(int i = 0; i<3; i++)
+    color_bits[i].clear();
 
   for(int y = 0; y < y_size; y++)
   {
@@ -79,6 +83,7 @@ void Board::init(int xS, int yS)
       Loc loc = (x+1) + (y+1)*(x_size+1);
       colors[loc] = C_EMPTY;
       empty_list.add(loc);
+      color_bits[C_EMPTY].add(loc);
     }
   }
 
@@ -572,8 +577,10 @@ void Board::undo(Board::MoveRecord record)
 
   //Delete the stone played here.
   pos_hash ^= ZOBRIST_BOARD_HASH[loc][colors[loc]];
+  color_bits[colors[loc]].remove(loc);
   colors[loc] = C_EMPTY;
   empty_list.add(loc);
+  color_bits[C_EMPTY].add(loc);
 
   //Uneat opp liberties
   changeSurroundingLiberties(loc, getOpp(record.pla),+1);
@@ -757,6 +764,8 @@ void Board::playMoveAssumeLegal(Loc loc, Player pla)
   chain_head[loc] = loc;
   next_in_chain[loc] = loc;
   empty_list.remove(loc);
+  color_bits[C_EMPTY].remove(loc);
+  color_bits[pla].add(loc);
 
   //Merge with surrounding friendly chains and capture any necessary opp chains
   int num_captured = 0; //Number of stones captured
@@ -940,9 +949,11 @@ int Board::removeChain(Loc loc)
   {
     //Empty out this location
     pos_hash ^= ZOBRIST_BOARD_HASH[cur][colors[cur]];
+    color_bits[colors[cur]].remove(cur);
     colors[cur] = C_EMPTY;
     num_stones_removed++;
     empty_list.add(cur);
+    color_bits[C_EMPTY].add(cur);
 
     //For each distinct opp chain around, add a liberty to it.
     changeSurroundingLiberties(cur,opp,+1);
@@ -1009,6 +1020,8 @@ Loc Board::addChainHelper(Loc head, Loc tailTarget, Loc loc, Player pla)
   chain_data[head].num_locs++;
   next_in_chain[loc] = tailTarget;
   empty_list.remove(loc);
+  color_bits[C_EMPTY].remove(loc);
+  color_bits[pla].add(loc);
 
   //Eat opp liberties
   changeSurroundingLiberties(loc,getOpp(pla),-1);
@@ -1875,6 +1888,132 @@ void Board::calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafe
 }
 
 
+Board::Bitboard Board::floodFillBits(const Bitboard& seed, const Bitboard& within) const {
+  Bitboard filled = seed & within;
+  while(true) {
+    Bitboard next = getExpandedBits(filled) & within;
+    if(next == filled)
+      return filled;
+    filled = next;
+  }
+}
+
+Board::Bitboard Board::getChainBits(Loc loc) const {
+  assert(colors[loc] == C_BLACK || colors[loc] == C_WHITE);
+  Bitboard seed;
+  seed.clear();
+  seed.add(loc);
+  return floodFillBits(seed,color_bits[colors[loc]]);
+}
+
+//Bitboard version of the benson iteration in calculateAreaForPla. Regions and chains are found by flood fill,
+//and vitality, bordering, and internal spaces are all tested by masking against expanded chains.
+Board::Bitboard Board::calculatePassAliveBits(Player pla, bool isMultiStoneSuicideLegal) const {
+  Player opp = getOpp(pla);
+  const Bitboard& emptyBits = color_bits[C_EMPTY];
+  const Bitboard& plaBits = color_bits[pla];
+  Bitboard emptyOrOppBits = emptyBits | color_bits[opp];
+
+  Bitboard result;
+  result.clear();
+  if(plaBits.isEmpty())
+    return result;
+
+  //Maximal empty-or-opp regions that contain at least one empty space
+  static constexpr int maxRegions = (MAX_LEN * MAX_LEN + 1)/2 + 1;
+  int numRegions = 0;
+  Bitboard regions[maxRegions];
+  //Spaces that have to be adjacent to a pla chain for the region to be vital for it
+  Bitboard regionVitalSpaces[maxRegions];
+  {
+    Bitboard remaining = emptyBits;
+    while(!remaining.isEmpty()) {
+      assert(numRegions < maxRegions);
+      Bitboard seed;
+      seed.clear();
+      seed.add(remaining.first());
+      Bitboard region = floodFillBits(seed,emptyOrOppBits);
+      regions[numRegions] = region;
+      regionVitalSpaces[numRegions] = isMultiStoneSuicideLegal ? region : (region & emptyBits);
+      numRegions++;
+      remaining = remaining.andNot(region);
+    }
+  }
+
+  int numChains = 0;
+  Bitboard expandedChains[MAX_PLAY_SIZE];
+  Bitboard chains[MAX_PLAY_SIZE];
+  {
+    Bitboard remaining = plaBits;
+    while(!remaining.isEmpty()) {
+      Bitboard chain = getChainBits(remaining.first());
+      chains[numChains] = chain;
+      expandedChains[numChains] = getExpandedBits(chain);
+      numChains++;
+      remaining = remaining.andNot(chain);
+    }
+  }
+
+  //For each region, the chains it is vital for, concatenated
+  static constexpr int vitalListsMaxLen = maxRegions * 4;
+  uint16_t vitalChainIdxs[vitalListsMaxLen];
+  int vitalStart[maxRegions+1];
+  int vitalTotal = 0;
+  for(int r = 0; r<numRegions; r++) {
+    vitalStart[r] = vitalTotal;
+    for(int c = 0; c<numChains; c++) {
+      if(regionVitalSpaces[r].andNot(expandedChains[c]).isEmpty()) {
+        assert(vitalTotal < vitalListsMaxLen);
+        vitalChainIdxs[vitalTotal++] = (uint16_t)c;
+      }
+    }
+  }
+  vitalStart[numRegions] = vitalTotal;
+
+  bool chainKilled[MAX_PLAY_SIZE];
+  for(int c = 0; c<numChains; c++)
+    chainKilled[c] = false;
+  //All empty-or-opp spaces adjacent to a killed chain
+  Bitboard bordersKilled;
+  bordersKilled.clear();
+
+  int vitalCountByChain[MAX_PLAY_SIZE];
+  while(true) {
+    for(int c = 0; c<numChains; c++)
+      vitalCountByChain[c] = 0;
+    for(int r = 0; r<numRegions; r++) {
+      if(!(regions[r] & bordersKilled).isEmpty())
+        continue;
+      for(int i = vitalStart[r]; i<vitalStart[r+1]; i++)
+        vitalCountByChain[vitalChainIdxs[i]] += 1;
+    }
+
+    bool killedAnything = false;
+    for(int c = 0; c<numChains; c++) {
+      if(!chainKilled[c] && vitalCountByChain[c] < 2) {
+        chainKilled[c] = true;
+        killedAnything = true;
+        bordersKilled |= expandedChains[c];
+      }
+    }
+    if(!killedAnything)
+      break;
+  }
+
+  for(int c = 0; c<numChains; c++) {
+    if(!chainKilled[c])
+      result |= chains[c];
+  }
+  //Pass-alive territory is any region bordering no killed chains with at most one space not adjacent to pla
+  Bitboard expandedPla = getExpandedBits(plaBits);
+  for(int r = 0; r<numRegions; r++) {
+    if((regions[r] & bordersKilled).isEmpty() && regions[r].andNot(expandedPla).count() <= 1)
+      result |= regions[r];
+  }
+  return result;
+}
+
+
 void Board::checkConsistency() const {
   const string errLabel = string("Board::checkConsistency(): ");
 
@@ -1962,6 +2101,20 @@ void Board::checkConsistency() const {
   if(pos_hash != tmp_pos_hash)
     throw StringError(errLabel + "Pos hash does not match expected");
 
+  for(int c = 0; c<3; c++) {
+    Bitboard expectedBits;
+    expectedBits.clear();
+    for(int y = 0; y < y_size; y++) {
+      for(int x = 0; x < x_size; x++) {
+        Loc loc = Location::getLoc(x,y,x_size);
+        if(colors[loc] == c)
+          expectedBits.add(loc);
+      }
+    }
+    if(color_bits[c] != expectedBits)
+      throw StringError(errLabel + "Color bitboard does not match colors");
+  }
+
   if(empty_list.size_ != emptyCount)
     throw StringError(errLabel + "Empty list size is not the number of empty points");
   for(int i = 0; i<emptyCount; i++) {
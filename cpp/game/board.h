@@ -128,6 +128,35 @@ struct Board
     uint8_t capDirs; //First 4 bits indicate directions of capture, fifth bit indicates suicide
   };
 
+  //Set of locations, one bit per Loc, so that whole-board queries can run as word-parallel shifts and masks.
+  //Since (x,y) is (x+1) + (y+1)*(x_size+1), shifting by 1 or by x_size+1 moves every loc to a horizontal or vertical
+  //neighbor, and anything shifted onto a wall can be masked off.
+  struct Bitboard {
+    static const int NUM_WORDS = (MAX_ARR_SIZE + 63) / 64;
+    uint64_t words[NUM_WORDS];
+
+    void clear();
+    bool contains(Loc loc) const;
+    void add(Loc loc);
+    void remove(Loc loc);
+    bool isEmpty() const;
+    int count() const;
+    //Returns the smallest loc in the set, or NULL_LOC if the set is empty
+    Loc first() const;
+
+    bool operator==(const Bitboard& other) const;
+    bool operator!=(const Bitboard& other) const;
+    Bitboard operator&(const Bitboard& other) const;
+    Bitboard operator|(const Bitboard& other) const;
+    Bitboard operator^(const Bitboard& other) const;
+    Bitboard andNot(const Bitboard& other) const;
+    Bitboard& operator&=(const Bitboard& other);
+    Bitboard& operator|=(const Bitboard& other);
+    //Shift every loc in the set by +n or -n, for 0 < n < 64. Locs shifted out of the array are dropped.
+    Bitboard shiftUp(int n) const;
+    Bitboard shiftDown(int n) const;
+  };
+
   //Constructors---------------------------------
   Board();  //Create Board of size (19,19)
   Board(int x, int y); //Create Board of size (x,y)
@@ -207,6 +236,19 @@ struct Board
   //[result] must be a buffer of size MAX_ARR_SIZE and will get filled with the result
   void calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const;
 
+  //Word-parallel queries on the bitboards in color_bits.
+  //Get all on-board locations
+  Bitboard getOnBoardBits() const;
+  //Get bits, plus all on-board locations adjacent to them
+  Bitboard getExpandedBits(const Bitboard& bits) const;
+  //Get all locations in within that connect to seed through within, by repeated expansion
+  Bitboard floodFillBits(const Bitboard& seed, const Bitboard& within) const;
+  //Get all stones of the chain at loc. Precondition: location must be black or white.
+  Bitboard getChainBits(Loc loc) const;
+  //Get pla's pass-alive stones and pass-alive territory. Same as what calculateArea marks for pla when all of
+  //nonPassAliveStones, safeBigTerritories and unsafeBigTerritories are false.
+  Bitboard calculatePassAliveBits(Player pla, bool isMultiStoneSuicideLegal) const;
+
   //Run some basic sanity checks on the board state, throws an exception if not consistent, for testing/debugging
   void checkConsistency() const;
 
@@ -227,6 +269,7 @@ struct Board
   Loc ko_loc;   //A simple ko capture was made here, making it illegal to replay here next move
 
   PointList empty_list; //List of all empty locations on board
+  Bitboard color_bits[3]; //For C_EMPTY, C_BLACK, C_WHITE, the on-board locations of that color, kept in sync with colors
 
   Hash128 pos_hash; //A zobrist hash of the current board position (does not include ko point or player to move)
 
@@ -260,6 +303,125 @@ struct Board
   //static void monteCarloOwner(Player player, Board* board, int mc_counts[]);
 };
 
+#ifdef __GNUG__
+static inline int bitboardPopcount(uint64_t w) { return __builtin_popcountll(w); }
+static inline int bitboardLowestBit(uint64_t w) { return __builtin_ctzll(w); }
+#else
+static inline int bitboardPopcount(uint64_t w) {
+  w = w - ((w >> 1) & 0x5555555555555555ULL);
+  w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+  w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((w * 0x0101010101010101ULL) >> 56);
+}
+static inline int bitboardLowestBit(uint64_t w) {
+  int n = 0;
+  while((w & 1) == 0) { w >>= 1; n++; }
+  return n;
+}
+#endif
+
+inline void Board::Bitboard::clear() {
+  for(int i = 0; i<NUM_WORDS; i++)
+    words[i] = 0;
+}
+inline bool Board::Bitboard::contains(Loc loc) const {
+  return (words[loc >> 6] >> (loc & 63)) & 1;
+}
+inline void Board::Bitboard::add(Loc loc) {
+  words[loc >> 6] |= (uint64_t)1 << (loc & 63);
+}
+inline void Board::Bitboard::remove(Loc loc) {
+  words[loc >> 6] &= ~((uint64_t)1 << (loc & 63));
+}
+inline bool Board::Bitboard::isEmpty() const {
+  uint64_t acc = 0;
+  for(int i = 0; i<NUM_WORDS; i++)
+    acc |= words[i];
+  return acc == 0;
+}
+inline int Board::Bitboard::count() const {
+  int total = 0;
+  for(int i = 0; i<NUM_WORDS; i++)
+    total += bitboardPopcount(words[i]);
+  return total;
+}
+inline Loc Board::Bitboard::first() const {
+  for(int i = 0; i<NUM_WORDS; i++) {
+    if(words[i] != 0)
+      return (Loc)(i * 64 + bitboardLowestBit(words[i]));
+  }
+  return NULL_LOC;
+}
+
+inline bool Board::Bitboard::operator==(const Bitboard& other) const {
+  for(int i = 0; i<NUM_WORDS; i++)
+    if(words[i] != other.words[i])
+      return false;
+  return true;
+}
+inline bool Board::Bitboard::operator!=(const Bitboard& other) const {
+  return !(*this == other);
+}
+inline Board::Bitboard Board::Bitboard::operator&(const Bitboard& other) const {
+  Bitboard result;
+  for(int i = 0; i<NUM_WORDS; i++)
+    result.words[i] = words[i] & other.words[i];
+  return result;
+}
+inline Board::Bitboard Board::Bitboard::operator|(const Bitboard& other) const {
+  Bitboard result;
+  for(int i = 0; i<NUM_WORDS; i++)
+    result.words[i] = words[i] | other.words[i];
+  return result;
+}
+inline Board::Bitboard Board::Bitboard::operator^(const Bitboard& other) const {
+  Bitboard result;
+  for(int i = 0; i<NUM_WORDS; i++)
+    result.words[i] = words[i] ^ other.words[i];
+  return result;
+}
+inline Board::Bitboard Board::Bitboard::andNot(const Bitboard& other) const {
+  Bitboard result;
+  for(int i = 0; i<NUM_WORDS; i++)
+    result.words[i] = words[i] & ~other.words[i];
+  return result;
+}
+inline Board::Bitboard& Board::Bitboard::operator&=(const Bitboard& other) {
+  for(int i = 0; i<NUM_WORDS; i++)
+    words[i] &= other.words[i];
+  return *this;
+}
+inline Board::Bitboard& Board::Bitboard::operator|=(const Bitboard& other) {
+  for(int i = 0; i<NUM_WORDS; i++)
+    words[i] |= other.words[i];
+  return *this;
+}
+inline Board::Bitboard Board::Bitboard::shiftUp(int n) const {
+  assert(n > 0 && n < 64);
+  Bitboard result;
+  result.words[0] = words[0] << n;
+  for(int i = 1; i<NUM_WORDS; i++)
+    result.words[i] = (words[i] << n) | (words[i-1] >> (64-n));
+  return result;
+}
+inline Board::Bitboard Board::Bitboard::shiftDown(int n) const {
+  assert(n > 0 && n < 64);
+  Bitboard result;
+  for(int i = 0; i<NUM_WORDS-1; i++)
+    result.words[i] = (words[i] >> n) | (words[i+1] << (64-n));
+  result.words[NUM_WORDS-1] = words[NUM_WORDS-1] >> n;
+  return result;
+}
+
+inline Board::Bitboard Board::getOnBoardBits() const {
+  return color_bits[C_EMPTY] | color_bits[C_BLACK] | color_bits[C_WHITE];
+}
+inline Board::Bitboard Board::getExpandedBits(const Bitboard& bits) const {
+  int stride = x_size+1;
+  Bitboard result = bits | bits.shiftUp(1) | bits.shiftDown(1) | bits.shiftUp(stride) | bits.shiftDown(stride);
+  return result & getOnBoardBits();
+}
+
 
 
 
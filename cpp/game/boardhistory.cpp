@@ -2,6 +2,8 @@
 
 #include <algorithm>
 
+#include "../game/areacache.h"
+
 using namespace std;
 
 static Hash128 getKoHash(const Rules& rules, const Board& board, Player pla, int encorePhase, Hash128 koProhibitHash) {
@@ -28,10 +30,10 @@ BoardHistory::BoardHistory()
   :rules(),
    moveHistory(),koHashHistory(),
    koHistoryLastClearedBeginningMoveIdx(0),
-   initialBoard(),
+   initialBoardCompact(),
    initialPla(P_BLACK),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   recentMoves(),
+   numMovesSinceClear(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
@@ -40,6 +42,7 @@ BoardHistory::BoardHistory()
    isGameFinished(false),winner(C_EMPTY),finalWhiteMinusBlackScore(0.0f),
    isNoResult(false),isResignation(false)
 {
+  initialBoardCompact.set(Board());
   std::fill(wasEverOccupiedOrPlayed, wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, false);
   std::fill(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, false);
   std::fill(blackKoProhibited, blackKoProhibited+Board::MAX_ARR_SIZE, false);
@@ -50,14 +53,36 @@ BoardHistory::BoardHistory()
 BoardHistory::~BoardHistory()
 {}
 
+BoardHistory::MoveRecord::MoveRecord()
+  :boardRecord(),
+   overwrittenRecentMove(),
+   wasPassForKo(false),
+   wasEverOccupiedOrPlayedBefore(false),
+   koHistoryLastClearedBeginningMoveIdx(0),
+   consecutiveEndingPasses(0),
+   encorePhase(0),koProhibitHash(),
+   whiteBonusScore(0),
+   isGameFinished(false),winner(C_EMPTY),finalWhiteMinusBlackScore(0.0f),
+   isNoResult(false),isResignation(false),
+   addedEncoreKoCapture(false),
+   savedKoProhibited(false),
+   clearedKoHashHistory(false),koHashHistory(),
+   changedEncorePhase(false),
+   hashesAfterBlackPass(),hashesAfterWhitePass(),
+   koCapturesInEncore()
+{}
+
+BoardHistory::MoveRecord::~MoveRecord()
+{}
+
 BoardHistory::BoardHistory(const Board& board, Player pla, const Rules& r, int ePhase)
   :rules(r),
    moveHistory(),koHashHistory(),
    koHistoryLastClearedBeginningMoveIdx(0),
-   initialBoard(),
+   initialBoardCompact(),
    initialPla(),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   recentMoves(),
+   numMovesSinceClear(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
@@ -79,10 +104,10 @@ BoardHistory::BoardHistory(const BoardHistory& other)
   :rules(other.rules),
    moveHistory(other.moveHistory),koHashHistory(other.koHashHistory),
    koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
-   initialBoard(other.initialBoard),
+   initialBoardCompact(other.initialBoardCompact),
    initialPla(other.initialPla),
-   recentBoards(),
-   currentRecentBoardIdx(other.currentRecentBoardIdx),
+   recentMoves(),
+   numMovesSinceClear(other.numMovesSinceClear),
    consecutiveEndingPasses(other.consecutiveEndingPasses),
    hashesAfterBlackPass(other.hashesAfterBlackPass),hashesAfterWhitePass(other.hashesAfterWhitePass),
    encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
@@ -91,7 +116,7 @@ BoardHistory::BoardHistory(const BoardHistory& other)
    isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
    isNoResult(other.isNoResult),isResignation(other.isResignation)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_MOVES, recentMoves);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
@@ -108,10 +133,10 @@ BoardHistory& BoardHistory::operator=(const BoardHistory& other)
   moveHistory = other.moveHistory;
   koHashHistory = other.koHashHistory;
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
-  initialBoard = other.initialBoard;
+  initialBoardCompact = other.initialBoardCompact;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_MOVES, recentMoves);
+  numMovesSinceClear = other.numMovesSinceClear;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
@@ -137,10 +162,10 @@ BoardHistory::BoardHistory(BoardHistory&& other) noexcept
  :rules(other.rules),
   moveHistory(std::move(other.moveHistory)),koHashHistory(std::move(other.koHashHistory)),
   koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
-  initialBoard(other.initialBoard),
+  initialBoardCompact(other.initialBoardCompact),
   initialPla(other.initialPla),
-  recentBoards(),
-  currentRecentBoardIdx(other.currentRecentBoardIdx),
+  recentMoves(),
+  numMovesSinceClear(other.numMovesSinceClear),
   consecutiveEndingPasses(other.consecutiveEndingPasses),
   hashesAfterBlackPass(std::move(other.hashesAfterBlackPass)),hashesAfterWhitePass(std::move(other.hashesAfterWhitePass)),
   encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
@@ -149,7 +174,7 @@ BoardHistory::BoardHistory(BoardHistory&& other) noexcept
   isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
   isNoResult(other.isNoResult),isResignation(other.isResignation)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_MOVES, recentMoves);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
@@ -163,10 +188,10 @@ BoardHistory& BoardHistory::operator=(BoardHistory&& other) noexcept
   moveHistory = std::move(other.moveHistory);
   koHashHistory = std::move(other.koHashHistory);
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
-  initialBoard = other.initialBoard;
+  initialBoardCompact = other.initialBoardCompact;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_MOVES, recentMoves);
+  numMovesSinceClear = other.numMovesSinceClear;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
@@ -194,14 +219,9 @@ void BoardHistory::clear(const Board& board, Player pla, const Rules& r, int ePh
   koHashHistory.clear();
   koHistoryLastClearedBeginningMoveIdx = 0;
 
-  initialBoard = board;
+  initialBoardCompact.set(board);
   initialPla = pla;
-
-  //This makes it so that if we ask for recent boards with a lookback beyond what we have a history for,
-  //we simply return copies of the starting board.
-  for(int i = 0; i<NUM_RECENT_BOARDS; i++)
-    recentBoards[i] = board;
-  currentRecentBoardIdx = 0;
+  numMovesSinceClear = 0;
 
   for(int y = 0; y<board.y_size; y++) {
     for(int x = 0; x<board.x_size; x++) {
@@ -272,10 +292,42 @@ void BoardHistory::printDebugInfo(ostream& out, const Board& board) const {
 }
 
 
-const Board& BoardHistory::getRecentBoard(int numMovesAgo) const {
+void BoardHistory::CompactBoard::set(const Board& board) {
+  xSize = board.x_size;
+  ySize = board.y_size;
+  koLoc = board.ko_loc;
+  numBlackCaptures = board.numBlackCaptures;
+  numWhiteCaptures = board.numWhiteCaptures;
+  std::copy(board.colors, board.colors+Board::MAX_ARR_SIZE, colors);
+}
+
+Board BoardHistory::CompactBoard::toBoard() const {
+  //Every chain of a board has a liberty, so placing its stones one by one never captures anything
+  Board board(xSize,ySize);
+  for(int y = 0; y<ySize; y++) {
+    for(int x = 0; x<xSize; x++) {
+      Loc loc = Location::getLoc(x,y,xSize);
+      if(colors[loc] != C_EMPTY)
+        board.setStone(loc,colors[loc]);
+    }
+  }
+  board.ko_loc = koLoc;
+  board.numBlackCaptures = numBlackCaptures;
+  board.numWhiteCaptures = numWhiteCaptures;
+  return board;
+}
+
+Board BoardHistory::getInitialBoard() const {
+  return initialBoardCompact.toBoard();
+}
+
+Board BoardHistory::getRecentBoard(const Board& board, int numMovesAgo) const {
   assert(numMovesAgo >= 0 && numMovesAgo < NUM_RECENT_BOARDS);
-  int idx = (currentRecentBoardIdx - numMovesAgo + NUM_RECENT_BOARDS) % NUM_RECENT_BOARDS;
-  return recentBoards[idx];
+  Board recentBoard(board);
+  int numToUndo = std::min(numMovesAgo,numMovesSinceClear);
+  for(int i = 0; i<numToUndo; i++)
+    recentBoard.undo(recentMoves[(numMovesSinceClear-1-i) % NUM_RECENT_MOVES]);
+  return recentBoard;
 }
 
 
@@ -333,6 +385,12 @@ int BoardHistory::numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHas
   return count;
 }
 
+bool BoardHistory::currentKoHashRepeatsEarlier(const KoHashTable* rootKoHashTable) const {
+  if(koHashHistory.size() <= 0)
+    return false;
+  return numberOfKoHashOccurrencesInHistory(koHashHistory[koHashHistory.size()-1], rootKoHashTable) > 1;
+}
+
 float BoardHistory::whiteKomiAdjustmentForDraws(double drawEquivalentWinsForWhite) const {
   //We fold the draw utility into the komi, for input into things like the neural net.
   //Basically we model it as if the final score were jittered by a uniform draw from [-0.5,0.5].
@@ -435,13 +493,28 @@ void BoardHistory::endAndScoreGameNow(const Board& board) {
 
 
 void BoardHistory::endGameIfAllPassAlive(const Board& board) {
-  int boardScore = 0;
+  //Only pass-alive stones and territory are needed, which the bitboard version finds faster than calculateArea
+  Board::Bitboard blackArea = board.calculatePassAliveBits(P_BLACK, rules.multiStoneSuicideLegal);
+  Board::Bitboard whiteArea = board.calculatePassAliveBits(P_WHITE, rules.multiStoneSuicideLegal);
+  if(!board.getOnBoardBits().andNot(blackArea | whiteArea).isEmpty())
+    return;
+  Color area[Board::MAX_ARR_SIZE];
+  for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+    area[i] = whiteArea.contains((Loc)i) ? C_WHITE : blackArea.contains((Loc)i) ? C_BLACK : C_EMPTY;
+  endGameIfAllPassAliveGivenArea(board,area);
+}
+
+void BoardHistory::endGameIfAllPassAlive(const Board& board, AreaCache& areaCache) {
   bool nonPassAliveStones = false;
   bool safeBigTerritories = false;
   bool unsafeBigTerritories = false;
   Color area[Board::MAX_ARR_SIZE];
-  board.calculateArea(area, nonPassAliveStones, safeBigTerritories, unsafeBigTerritories, rules.multiStoneSuicideLegal);
+  areaCache.calculateArea(board, area, nonPassAliveStones, safeBigTerritories, unsafeBigTerritories, rules.multiStoneSuicideLegal);
+  endGameIfAllPassAliveGivenArea(board,area);
+}
 
+void BoardHistory::endGameIfAllPassAliveGivenArea(const Board& board, const Color area[Board::MAX_ARR_SIZE]) {
+  int boardScore = 0;
   for(int y = 0; y<board.y_size; y++) {
     for(int x = 0; x<board.x_size; x++) {
       Loc loc = Location::getLoc(x,y,board.x_size);
@@ -566,8 +639,46 @@ bool BoardHistory::passWouldEndPhase(const Board& board, Player movePla) const {
 }
 
 void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable) {
+  makeBoardMove(board,moveLoc,movePla,rootKoHashTable,NULL);
+}
+
+void BoardHistory::makeBoardMoveRecorded(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable, MoveRecord& record) {
+  makeBoardMove(board,moveLoc,movePla,rootKoHashTable,&record);
+}
+
+void BoardHistory::makeBoardMove(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable, MoveRecord* record) {
   Loc koLocBeforeMove = board.ko_loc;
   Hash128 posHashBeforeMove = board.pos_hash;
+  Board::MoveRecord boardRecord;
+  boardRecord.pla = movePla;
+  boardRecord.loc = moveLoc;
+  boardRecord.ko_loc = koLocBeforeMove;
+  boardRecord.capDirs = 0;
+
+  if(record != NULL) {
+    record->boardRecord = boardRecord;
+    record->wasPassForKo = false;
+    record->wasEverOccupiedOrPlayedBefore = moveLoc != Board::PASS_LOC && wasEverOccupiedOrPlayed[moveLoc];
+    record->koHistoryLastClearedBeginningMoveIdx = koHistoryLastClearedBeginningMoveIdx;
+    record->consecutiveEndingPasses = consecutiveEndingPasses;
+    record->encorePhase = encorePhase;
+    record->koProhibitHash = koProhibitHash;
+    record->whiteBonusScore = whiteBonusScore;
+    record->isGameFinished = isGameFinished;
+    record->winner = winner;
+    record->finalWhiteMinusBlackScore = finalWhiteMinusBlackScore;
+    record->isNoResult = isNoResult;
+    record->isResignation = isResignation;
+    record->addedEncoreKoCapture = false;
+    std::copy(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, record->superKoBanned);
+    record->savedKoProhibited = encorePhase > 0;
+    if(record->savedKoProhibited) {
+      std::copy(blackKoProhibited, blackKoProhibited+Board::MAX_ARR_SIZE, record->blackKoProhibited);
+      std::copy(whiteKoProhibited, whiteKoProhibited+Board::MAX_ARR_SIZE, record->whiteKoProhibited);
+    }
+    record->clearedKoHashHistory = false;
+    record->changedEncorePhase = false;
+  }
 
   //If somehow we're making a move after the game was ended, just clear those values and continue
   isGameFinished = false;
@@ -583,6 +694,8 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
        (movePla == P_WHITE && whiteKoProhibited[moveLoc] && board.wouldBeKoCapture(moveLoc,P_WHITE))) {
       setKoProhibited(movePla,moveLoc,false);
       wasPassForKo = true;
+      if(record != NULL)
+        record->wasPassForKo = true;
       //Clear simple ko loc to stop it from banning the other player from moving there!
       //Since we aren't otherwise touching the board, from the board's perspective a player will be moving twice in a row.
       board.clearSimpleKoLoc();
@@ -590,13 +703,17 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
   }
   //Otherwise handle regular moves
   if(!wasPassForKo) {
-    board.playMoveAssumeLegal(moveLoc,movePla);
+    boardRecord = board.playMoveRecorded(moveLoc,movePla);
+    if(record != NULL)
+      record->boardRecord = boardRecord;
 
     if(encorePhase > 0) {
       //Update ko prohibitions and record that this was a ko capture
       if(board.ko_loc != Board::NULL_LOC) {
         setKoProhibited(getOpp(movePla),board.ko_loc,true);
         koCapturesInEncore.push_back(EncoreKoCapture(posHashBeforeMove,moveLoc,movePla));
+        if(record != NULL)
+          record->addedEncoreKoCapture = true;
         //Clear simple ko loc now that we've absorved the ko loc information into the koprohib array
         //Once we have that, the simple ko loc plays no further role in game state or legality
         board.clearSimpleKoLoc();
@@ -618,14 +735,25 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
     }
   }
 
-  //Update recent boards
-  currentRecentBoardIdx = (currentRecentBoardIdx + 1) % NUM_RECENT_BOARDS;
-  recentBoards[currentRecentBoardIdx] = board;
+  //Update recent moves. A pass for ko left the board alone except for the simple ko loc.
+  {
+    Board::MoveRecord& recentMove = recentMoves[numMovesSinceClear % NUM_RECENT_MOVES];
+    if(record != NULL)
+      record->overwrittenRecentMove = recentMove;
+    recentMove = boardRecord;
+    if(wasPassForKo)
+      recentMove.loc = Board::PASS_LOC;
+    numMovesSinceClear++;
+  }
 
   //Passes clear ko history in the main phase with spight ko rules and in the encore
   //This lifts bans in spight ko rules and lifts 3-fold-repetition checking in the encore for no-resultifying infinite cycles
   //They also clear in simple ko rules for the purpose of no-resulting long cycles, long cycles with passes do not no-result.
   if(moveLoc == Board::PASS_LOC && (encorePhase > 0 || rules.koRule == Rules::KO_SIMPLE || rules.koRule == Rules::KO_SPIGHT)) {
+    if(record != NULL) {
+      record->clearedKoHashHistory = true;
+      std::swap(koHashHistory,record->koHashHistory);
+    }
     koHashHistory.clear();
     koHistoryLastClearedBeginningMoveIdx = moveHistory.size()+1;
     //Does not clear hashesAfterBlackPass or hashesAfterWhitePass. Passes lift ko bans, but
@@ -706,6 +834,25 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
       if(encorePhase >= 2)
         endAndScoreGameNow(board);
       else {
+        if(record != NULL) {
+          record->changedEncorePhase = true;
+          std::swap(hashesAfterBlackPass,record->hashesAfterBlackPass);
+          std::swap(hashesAfterWhitePass,record->hashesAfterWhitePass);
+          std::swap(koCapturesInEncore,record->koCapturesInEncore);
+          if(!record->savedKoProhibited) {
+            record->savedKoProhibited = true;
+            std::copy(blackKoProhibited, blackKoProhibited+Board::MAX_ARR_SIZE, record->blackKoProhibited);
+            std::copy(whiteKoProhibited, whiteKoProhibited+Board::MAX_ARR_SIZE, record->whiteKoProhibited);
+          }
+          std::copy(secondEncoreStartColors, secondEncoreStartColors+Board::MAX_ARR_SIZE, record->secondEncoreStartColors);
+          //Unlike a clear on a pass, this move's ko hash was already added, so drop it from the saved copy
+          if(!record->clearedKoHashHistory) {
+            record->clearedKoHashHistory = true;
+            std::swap(koHashHistory,record->koHashHistory);
+            record->koHashHistory.pop_back();
+          }
+        }
+
         encorePhase += 1;
         if(encorePhase == 2)
           std::copy(board.colors, board.colors+Board::MAX_ARR_SIZE, secondEncoreStartColors);
@@ -739,6 +886,64 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
 }
 
 
+void BoardHistory::undoBoardMove(Board& board, MoveRecord& record) {
+  assert(numMovesSinceClear > 0);
+  Loc moveLoc = record.boardRecord.loc;
+  Player movePla = record.boardRecord.pla;
+  assert(moveHistory.size() > 0 && moveHistory.back().loc == moveLoc && moveHistory.back().pla == movePla);
+
+  //Undo in the reverse order of makeBoardMove
+  if(record.changedEncorePhase) {
+    hashesAfterBlackPass.swap(record.hashesAfterBlackPass);
+    hashesAfterWhitePass.swap(record.hashesAfterWhitePass);
+    koCapturesInEncore.swap(record.koCapturesInEncore);
+    std::copy(record.secondEncoreStartColors, record.secondEncoreStartColors+Board::MAX_ARR_SIZE, secondEncoreStartColors);
+  }
+  if(moveLoc == Board::PASS_LOC) {
+    if(movePla == P_BLACK)
+      hashesAfterBlackPass.pop_back();
+    else if(movePla == P_WHITE)
+      hashesAfterWhitePass.pop_back();
+    else
+      ASSERT_UNREACHABLE;
+  }
+
+  if(record.clearedKoHashHistory)
+    koHashHistory.swap(record.koHashHistory);
+  else
+    koHashHistory.pop_back();
+  moveHistory.pop_back();
+  if(moveLoc != Board::PASS_LOC)
+    wasEverOccupiedOrPlayed[moveLoc] = record.wasEverOccupiedOrPlayedBefore;
+  std::copy(record.superKoBanned, record.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+  if(record.savedKoProhibited) {
+    std::copy(record.blackKoProhibited, record.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
+    std::copy(record.whiteKoProhibited, record.whiteKoProhibited+Board::MAX_ARR_SIZE, whiteKoProhibited);
+  }
+  if(record.addedEncoreKoCapture)
+    koCapturesInEncore.pop_back();
+
+  numMovesSinceClear--;
+  recentMoves[numMovesSinceClear % NUM_RECENT_MOVES] = record.overwrittenRecentMove;
+
+  if(record.wasPassForKo)
+    board.ko_loc = record.boardRecord.ko_loc;
+  else
+    board.undo(record.boardRecord);
+
+  koHistoryLastClearedBeginningMoveIdx = record.koHistoryLastClearedBeginningMoveIdx;
+  consecutiveEndingPasses = record.consecutiveEndingPasses;
+  encorePhase = record.encorePhase;
+  koProhibitHash = record.koProhibitHash;
+  whiteBonusScore = record.whiteBonusScore;
+  isGameFinished = record.isGameFinished;
+  winner = record.winner;
+  finalWhiteMinusBlackScore = record.finalWhiteMinusBlackScore;
+  isNoResult = record.isNoResult;
+  isResignation = record.isResignation;
+}
+
+
 KoHashTable::KoHashTable()
   :koHashHistorySortedByLowBits(),
    koHistoryLastClearedBeginningMoveIdx(0)
@@ -7,6 +7,7 @@
 #include "../game/rules.h"
 
 struct KoHashTable;
+class AreaCache;
 
 //A data structure enabling checking of move legality, including optionally superko,
 //and implements scoring and support for various rulesets (see rules.h)
@@ -20,13 +21,32 @@ struct BoardHistory {
   std::vector<Hash128> koHashHistory;
   int koHistoryLastClearedBeginningMoveIdx;
 
+  //Just the stones and the few other values that a board starts from, which is much smaller than a whole Board
+  struct CompactBoard {
+    int xSize;
+    int ySize;
+    Loc koLoc;
+    int numBlackCaptures;
+    int numWhiteCaptures;
+    Color colors[Board::MAX_ARR_SIZE];
+
+    void set(const Board& board);
+    //Equal to the board it was set from, except maybe in the internal representation of its chains
+    Board toBoard() const;
+  };
+
   //The board and player to move as of the very start, before moveHistory.
-  Board initialBoard;
+  //Histories are copied often, so the board is kept compact, see getInitialBoard.
+  CompactBoard initialBoardCompact;
   Player initialPla;
 
+  //Rather than copies of recent boards, which are large, keep the Board::MoveRecords of the most recent moves, which
+  //are enough to undo the current board back to any recent board, see getRecentBoard. The record for move i since the
+  //last clear is at index i % NUM_RECENT_MOVES.
   static const int NUM_RECENT_BOARDS = 6;
-  Board recentBoards[NUM_RECENT_BOARDS];
-  int currentRecentBoardIdx;
+  static const int NUM_RECENT_MOVES = NUM_RECENT_BOARDS-1;
+  Board::MoveRecord recentMoves[NUM_RECENT_MOVES];
+  int numMovesSinceClear;
 
   //Did this board location ever have a stone there before, or was it ever played?
   //(Also includes locations of suicides)
@@ -68,6 +88,44 @@ struct BoardHistory {
   //True if this game is supposed to be ended but it was by resignation rather than an actual end position
   bool isResignation;
 
+  //Data passed back by makeBoardMoveRecorded to allow undoing the move with undoBoardMove.
+  //Records may hold onto vector capacity, so callers making many moves should reuse them rather than recreate them.
+  struct MoveRecord {
+    Board::MoveRecord boardRecord;
+    Board::MoveRecord overwrittenRecentMove;
+    bool wasPassForKo;
+    bool wasEverOccupiedOrPlayedBefore;
+    int koHistoryLastClearedBeginningMoveIdx;
+    int consecutiveEndingPasses;
+    int encorePhase;
+    Hash128 koProhibitHash;
+    int whiteBonusScore;
+    bool isGameFinished;
+    Player winner;
+    float finalWhiteMinusBlackScore;
+    bool isNoResult;
+    bool isResignation;
+
+    bool addedEncoreKoCapture;
+    bool superKoBanned[Board::MAX_ARR_SIZE];
+    //Only filled if the move was made during the encore
+    bool savedKoProhibited;
+    bool blackKoProhibited[Board::MAX_ARR_SIZE];
+    bool whiteKoProhibited[Board::MAX_ARR_SIZE];
+    //Only filled if the move cleared koHashHistory
+    bool clearedKoHashHistory;
+    std::vector<Hash128> koHashHistory;
+    //Only filled if the move caused a change of encore phase
+    bool changedEncorePhase;
+    std::vector<Hash128> hashesAfterBlackPass;
+    std::vector<Hash128> hashesAfterWhitePass;
+    std::vector<EncoreKoCapture> koCapturesInEncore;
+    Color secondEncoreStartColors[Board::MAX_ARR_SIZE];
+
+    MoveRecord();
+    ~MoveRecord();
+  };
+
   BoardHistory();
   ~BoardHistory();
 
@@ -87,9 +145,11 @@ struct BoardHistory {
   float whiteKomiAdjustmentForDraws(double drawEquivalentWinsForWhite) const;
   float currentSelfKomi(Player pla, double drawEquivalentWinsForWhite) const;
 
-  //Returns a reference a recent board state, where 0 is the current board, 1 is 1 move ago, etc.
+  Board getInitialBoard() const;
+  //Returns a recent board state, where 0 is the current board, 1 is 1 move ago, etc, by undoing recent moves on a copy
+  //of board, which must be the current board. Before the start of the history, returns the initial board.
   //Requires that numMovesAgo < NUM_RECENT_BOARDS
-  const Board& getRecentBoard(int numMovesAgo) const;
+  Board getRecentBoard(const Board& board, int numMovesAgo) const;
 
   //Check if a move on the board is legal, taking into account the full game state and superko
   bool isLegal(const Board& board, Loc moveLoc, Player movePla) const;
@@ -101,23 +161,36 @@ struct BoardHistory {
   //even if the move violates superko or encore ko recapture prohibitions, or is past when the game is ended.
   //This allows for robustness when this code is being used for analysis or with external data sources.
   void makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable);
+  //Same as makeBoardMoveAssumeLegal, but also fills record with what is needed to undo the move with undoBoardMove.
+  void makeBoardMoveRecorded(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable, MoveRecord& record);
+  //Undo the move given by record. Moves MUST be undone in the reverse order they were made. Leaves record ready for reuse.
+  void undoBoardMove(Board& board, MoveRecord& record);
 
   //Slightly expensive, check if the entire game is all pass-alive-territory, and if so, declare the game finished
   void endGameIfAllPassAlive(const Board& board);
+  //Same, but reusing the pass-alive regions from whatever board areaCache was last used on. Much cheaper when called
+  //on each position of a game in turn.
+  void endGameIfAllPassAlive(const Board& board, AreaCache& areaCache);
   //Score the board as-is. If the game is already finished, and is NOT a no-result, then this should be idempotent.
   void endAndScoreGameNow(const Board& board);
   void endAndScoreGameNow(const Board& board, Color area[Board::MAX_ARR_SIZE]);
 
   void setWinnerByResignation(Player pla);
 
+  //Whether the current position or situation, as the ko rules identify it, already occurred earlier in the history.
+  //Same usage of rootKoHashTable as for moves.
+  bool currentKoHashRepeatsEarlier(const KoHashTable* rootKoHashTable) const;
+
   void printDebugInfo(std::ostream& out, const Board& board) const;
 
 private:
+  void makeBoardMove(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable, MoveRecord* record);
   bool koHashOccursInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
   int numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
   void setKoProhibited(Player pla, Loc loc, bool b);
   int countAreaScoreWhiteMinusBlack(const Board& board, Color area[Board::MAX_ARR_SIZE]) const;
   int countTerritoryAreaScoreWhiteMinusBlack(const Board& board, Color area[Board::MAX_ARR_SIZE]) const;
+  void endGameIfAllPassAliveGivenArea(const Board& board, const Color area[Board::MAX_ARR_SIZE]);
   int newConsecutiveEndingPasses(Loc moveLoc, Loc koLocBeforeMove) const;
   bool wouldBeSimpleSpightOrEncoreEndingPass(Loc moveLoc, Player movePla, Hash128 koHashAfterMove) const;
 };
@@ -121,7 +121,7 @@ namespace {
         }
         else {
           BoardHistory hist = data->endHist;
-          Board endBoard = hist.getRecentBoard(0);
+          Board endBoard = data->endBoard;
           //Force game end just in caseif we crossed a move limit
           if(!hist.isGameFinished)
             hist.endAndScoreGameNow(endBoard);
@@ -346,8 +346,10 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
       return NULL;
     }
 
+    //Each search thread may have several leaves in flight or batched at once
     // * 2 + 16 just in case to have plenty of room
-    int maxConcurrentEvals = cfg.getInt("numSearchThreads") * numGameThreads * 2 + 16;
+    SearchParams baseParams = Setup::loadSingleParams(cfg);
+    int maxConcurrentEvals = baseParams.numThreads * baseParams.getMaxNNEvalsInFlightPerThread() * numGameThreads * 2 + 16;
 
     NNEvaluator* testNNEval = Setup::initializeNNEvaluator(
       testModelName,testModelFile,cfg,logger,rand,maxConcurrentEvals,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN
@@ -57,6 +57,10 @@ static const vector<string> knownCommands = {
   "lz-analyze",
   "kata-analyze",
 
+  //GTP extensions for saving a search to disk and resuming it later
+  "kata-save-tree",
+  "kata-load-tree",
+
   //Stop any ongoing ponder or analyze
   "stop",
 };
@@ -186,6 +190,13 @@ static void printGenmoveLog(ostream& out, const AsyncBot* bot, const NNEvaluator
   out << "NN rows: " << nnEval->numRowsProcessed() << endl;
   out << "NN batches: " << nnEval->numBatchesProcessed() << endl;
   out << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
+  out << "NN cache hits: " << nnEval->numCacheHits() << " misses: " << nnEval->numCacheMisses()
+      << " evictions: " << nnEval->numCacheEvictions() << " bytes: " << nnEval->numCacheBytesUsed() << endl;
+  if(nnEval->numDiskCacheHits() > 0 || nnEval->numDiskCacheMisses() > 0)
+    out << "NN disk cache hits: " << nnEval->numDiskCacheHits() << " misses: " << nnEval->numDiskCacheMisses() << endl;
+  SearchNodeArena::Stats treeStats = search->nodeArena->getStats();
+  out << "Tree nodes: " << treeStats.numLiveNodes << " slabs: " << (treeStats.numNodeSlabs + treeStats.numChildrenSlabs)
+      << " bytes: " << treeStats.numBytes << " estimated tree bytes: " << search->getTreeMemoryBytes() << endl;
   out << "PV: ";
   search->printPV(out, search->rootNode, 25);
   out << "\n";
@@ -275,7 +286,7 @@ struct GTPEngine {
       wasDefault = true;
     }
 
-    int maxConcurrentEvals = params.numThreads * 2 + 16; // * 2 + 16 just to give plenty of headroom
+    int maxConcurrentEvals = params.numThreads * params.getMaxNNEvalsInFlightPerThread() * 2 + 16; // * 2 + 16 just to give plenty of headroom
     nnEval = Setup::initializeNNEvaluator(
       nnModelFile,nnModelFile,cfg,logger,seedRand,maxConcurrentEvals,boardXSize,boardYSize
     );
@@ -608,7 +619,7 @@ struct GTPEngine {
     return lcb;
   }
 
-  void analyze(Player pla, bool kata, double secondsPerReport, int minMoves, bool showOwnership) {
+  void analyze(Player pla, bool kata, double secondsPerReport, int minMoves, bool showOwnership, bool showTreeStats) {
 
     std::function<void(Search* search)> callback;
 
@@ -647,7 +658,7 @@ struct GTPEngine {
     }
     //kata-analyze
     else {
-      callback = [minMoves,pla,showOwnership,this](Search* search) {
+      callback = [minMoves,pla,showOwnership,showTreeStats,this](Search* search) {
         vector<AnalysisData> buf;
         search->getAnalysisData(buf,minMoves,false,analysisPVLen);
         if(buf.size() <= 0)
@@ -695,6 +706,9 @@ struct GTPEngine {
             cout << " " << Location::toString(data.pv[j],board);
         }
 
+        if(showTreeStats)
+          cout << " treeStats nodes " << search->getNumTreeNodes() << " bytes " << search->getTreeMemoryBytes();
+
         if(showOwnership) {
           cout << " ";
 
@@ -1200,6 +1214,24 @@ int MainCmds::gtp(int argc, const char* const* argv) {
     else if(command == "clear_cache") {
       engine->clearCache();
     }
+    else if(command == "kata-save-tree" || command == "kata-load-tree") {
+      if(pieces.size() != 1) {
+        responseIsError = true;
+        response = "Expected one argument for " + command + " but got '" + Global::concat(pieces," ") + "'";
+      }
+      else {
+        try {
+          if(command == "kata-save-tree")
+            engine->bot->saveTree(pieces[0]);
+          else
+            engine->bot->loadTree(pieces[0]);
+        }
+        catch(const StringError& e) {
+          responseIsError = true;
+          response = e.what();
+        }
+      }
+    }
     else if(command == "showboard") {
       ostringstream sout;
       Board::printBoard(sout, engine->bot->getRootBoard(), Board::NULL_LOC, &(engine->bot->getRootHist().moveHistory));
@@ -1459,6 +1491,7 @@ int MainCmds::gtp(int argc, const char* const* argv) {
       double lzAnalyzeInterval = 1e30;
       int minMoves = 0;
       bool showOwnership = false;
+      bool showTreeStats = false;
       bool parseFailed = false;
 
       //Format:
@@ -1469,6 +1502,7 @@ int MainCmds::gtp(int argc, const char* const* argv) {
       //avoid <player> <comma-separated moves> <until movenum>
       //minmoves <int min number of moves to show>
       //ownership <bool whether to show ownership or not>
+      //treestats <bool whether to show the number of nodes and estimated memory of the search tree or not>
 
       //Parse optional player
       if(pieces.size() > numArgsParsed && tryParsePlayer(pieces[numArgsParsed],pla))
@@ -1520,6 +1554,9 @@ int MainCmds::gtp(int argc, const char* const* argv) {
         else if(command == "kata-analyze" && key == "ownership" && Global::tryStringToBool(value,showOwnership)) {
           continue;
         }
+        else if(command == "kata-analyze" && key == "treestats" && Global::tryStringToBool(value,showTreeStats)) {
+          continue;
+        }
 
         parseFailed = true;
         break;
@@ -1533,7 +1570,7 @@ int MainCmds::gtp(int argc, const char* const* argv) {
         double secondsPerReport = lzAnalyzeInterval * 0.01; //Convert from centiseconds to seconds
 
         bool kata = command == "kata-analyze";
-        engine->analyze(pla, kata, secondsPerReport, minMoves, showOwnership);
+        engine->analyze(pla, kata, secondsPerReport, minMoves, showOwnership, showTreeStats);
         currentlyAnalyzing = true;
       }
     }
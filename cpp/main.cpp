@@ -44,6 +44,8 @@ runnnontinyboardtest : Run neural net on a tiny board and dump result to stdout
 runoutputtests : Run a bunch of things and dump details to stdout
 runsearchtests : Run a bunch of things using a neural net and dump details to stdout
 runsearchtestsv3 : Run a bunch more things using a neural net and dump details to stdout
+runsearchbenchmarks : Time search overheads without a neural net
+runboardbenchmarks : Time board queries against their bitboard versions
 runselfplayinittests : Run some tests involving selfplay training init using a neural net and dump details to stdout
 
 ---Dev/experimental subcommands-------------
@@ -84,6 +86,10 @@ static int handleSubcommand(const string& subcommand, int argc, const char* argv
     return MainCmds::runsearchtests(argc-1,&argv[1]);
   else if(subcommand == "runsearchtestsv3")
     return MainCmds::runsearchtestsv3(argc-1,&argv[1]);
+  else if(subcommand == "runsearchbenchmarks")
+    return MainCmds::runsearchbenchmarks(argc-1,&argv[1]);
+  else if(subcommand == "runboardbenchmarks")
+    return MainCmds::runboardbenchmarks(argc-1,&argv[1]);
   else if(subcommand == "runselfplayinittests")
     return MainCmds::runselfplayinittests(argc-1,&argv[1]);
   else if(subcommand == "runnnonmanyposestest")
@@ -102,6 +108,8 @@ static int handleSubcommand(const string& subcommand, int argc, const char* argv
     cout << "Using CUDA backend" << endl;
     #elif defined(USE_OPENCL_BACKEND)
     cout << "Using OpenCL backend" << endl;
+    #elif defined(USE_CPU_BACKEND)
+    cout << "Using CPU backend" << endl;
     #else
     cout << "Using dummy backend" << endl;
     #endif
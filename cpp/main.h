@@ -15,6 +15,8 @@ namespace MainCmds {
   int runoutputtests(int argc, const char* const* argv);
   int runsearchtests(int argc, const char* const* argv);
   int runsearchtestsv3(int argc, const char* const* argv);
+  int runsearchbenchmarks(int argc, const char* const* argv);
+  int runboardbenchmarks(int argc, const char* const* argv);
   int runselfplayinittests(int argc, const char* const* argv);
   int runnnonmanyposestest(int argc, const char* const* argv);
 
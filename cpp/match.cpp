@@ -126,8 +126,8 @@ int MainCmds::match(int argc, const char* const* argv) {
     //Work out the max threads any one bot uses
     int maxBotThreads = 0;
     for(int i = 0; i<numBots; i++)
-      if(paramss[i].numThreads > maxBotThreads)
-        maxBotThreads = paramss[i].numThreads;
+      if(paramss[i].numThreads * paramss[i].getMaxNNEvalsInFlightPerThread() > maxBotThreads)
+        maxBotThreads = paramss[i].numThreads * paramss[i].getMaxNNEvalsInFlightPerThread();
     //Mutiply by the number of concurrent games we could have
     maxConcurrentEvals = maxBotThreads * numGameThreads;
     //Multiply by 2 and add some buffer, just so we have plenty of headroom.
@@ -397,7 +397,7 @@ int MainCmds::demoplay(int argc, const char* const* argv) {
   NNEvaluator* nnEval;
   {
     Setup::initializeSession(cfg);
-    int maxConcurrentEvals = params.numThreads * 2 + 16; // * 2 + 16 just to give plenty of headroom
+    int maxConcurrentEvals = params.numThreads * params.getMaxNNEvalsInFlightPerThread() * 2 + 16; // * 2 + 16 just to give plenty of headroom
     nnEval = Setup::initializeNNEvaluator(
       modelFile,modelFile,cfg,logger,seedRand,maxConcurrentEvals,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN
     );
@@ -490,7 +490,7 @@ int MainCmds::demoplay(int argc, const char* const* argv) {
       bool resigned = false;
       if(allowResignation) {
         const BoardHistory hist = bot->getRootHist();
-        const Board initialBoard = hist.initialBoard;
+        const Board initialBoard = hist.getInitialBoard();
 
         //Play at least some moves no matter what
         int minTurnForResignation = 1 + initialBoard.x_size * initialBoard.y_size / 6;
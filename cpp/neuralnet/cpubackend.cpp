@@ -0,0 +1,1606 @@
+#ifdef USE_CPU_BACKEND
+
+#include "../neuralnet/nninterface.h"
+#include "../neuralnet/nninputs.h"
+#include "../neuralnet/modelversion.h"
+#include "../neuralnet/desc.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+//Pure C++ neural net backend, for running on machines without a GPU.
+//All tensors are kept in NCHW format internally, one batch element at a time, and batches are split
+//across a small pool of worker threads owned by each ComputeHandle, or for batches smaller than the pool, the rows
+//of each convolution's matrix multiply are. The heavy lifting in convolutions and
+//matrix multiplies goes through a single sgemm routine with AVX2/FMA and AVX-512 inner kernels when the
+//compiler is allowed to emit them (see USE_AVX2 / USE_AVX512 in CMakeLists.txt), and a portable fallback.
+
+//SIMD KERNELS ----------------------------------------------------------------------------
+
+#if defined(__AVX512F__)
+static const char* SIMD_NAME = "AVX-512";
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+static const char* SIMD_NAME = "AVX2/FMA";
+#else
+static const char* SIMD_NAME = "none (generic C++)";
+#endif
+
+//Number of rows of A handled at a time by the inner gemm kernels.
+static const int GEMM_MR = 4;
+//Depth of a block of K, chosen so that a GEMM_MR x K strip of A and a K x (vector width) strip of B stay in L1/L2.
+static const int GEMM_KC = 256;
+
+//C[i][j] (+)= sum_k A[i][k] * B[k][j] for the block of rows [i0,i0+mr), cols [j0,j0+nr), with plain scalar code.
+static void gemmEdge(
+  int i0, int mr, int j0, int nr, int k0, int kc,
+  const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate
+) {
+  for(int i = i0; i < i0+mr; i++) {
+    float* cRow = C + (size_t)i*ldc;
+    if(!accumulate) {
+      for(int j = j0; j < j0+nr; j++)
+        cRow[j] = 0.0f;
+    }
+    const float* aRow = A + (size_t)i*lda;
+    for(int k = k0; k < k0+kc; k++) {
+      float a = aRow[k];
+      const float* bRow = B + (size_t)k*ldb;
+      for(int j = j0; j < j0+nr; j++)
+        cRow[j] += a * bRow[j];
+    }
+  }
+}
+
+#if defined(__AVX512F__)
+static const int GEMM_NR = 32;
+static inline void gemmTile(
+  int i0, int j0, int k0, int kc,
+  const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate
+) {
+  __m512 c00, c01, c10, c11, c20, c21, c30, c31;
+  float* c0 = C + (size_t)i0*ldc + j0;
+  float* c1 = c0 + ldc;
+  float* c2 = c1 + ldc;
+  float* c3 = c2 + ldc;
+  if(accumulate) {
+    c00 = _mm512_loadu_ps(c0); c01 = _mm512_loadu_ps(c0+16);
+    c10 = _mm512_loadu_ps(c1); c11 = _mm512_loadu_ps(c1+16);
+    c20 = _mm512_loadu_ps(c2); c21 = _mm512_loadu_ps(c2+16);
+    c30 = _mm512_loadu_ps(c3); c31 = _mm512_loadu_ps(c3+16);
+  }
+  else {
+    c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm512_setzero_ps();
+  }
+  const float* a0 = A + (size_t)i0*lda;
+  const float* a1 = a0 + lda;
+  const float* a2 = a1 + lda;
+  const float* a3 = a2 + lda;
+  const float* b = B + (size_t)k0*ldb + j0;
+  for(int k = k0; k < k0+kc; k++) {
+    __m512 b0 = _mm512_loadu_ps(b);
+    __m512 b1 = _mm512_loadu_ps(b+16);
+    __m512 a;
+    a = _mm512_set1_ps(a0[k]); c00 = _mm512_fmadd_ps(a,b0,c00); c01 = _mm512_fmadd_ps(a,b1,c01);
+    a = _mm512_set1_ps(a1[k]); c10 = _mm512_fmadd_ps(a,b0,c10); c11 = _mm512_fmadd_ps(a,b1,c11);
+    a = _mm512_set1_ps(a2[k]); c20 = _mm512_fmadd_ps(a,b0,c20); c21 = _mm512_fmadd_ps(a,b1,c21);
+    a = _mm512_set1_ps(a3[k]); c30 = _mm512_fmadd_ps(a,b0,c30); c31 = _mm512_fmadd_ps(a,b1,c31);
+    b += ldb;
+  }
+  _mm512_storeu_ps(c0,c00); _mm512_storeu_ps(c0+16,c01);
+  _mm512_storeu_ps(c1,c10); _mm512_storeu_ps(c1+16,c11);
+  _mm512_storeu_ps(c2,c20); _mm512_storeu_ps(c2+16,c21);
+  _mm512_storeu_ps(c3,c30); _mm512_storeu_ps(c3+16,c31);
+}
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+static const int GEMM_NR = 16;
+static inline void gemmTile(
+  int i0, int j0, int k0, int kc,
+  const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate
+) {
+  __m256 c00, c01, c10, c11, c20, c21, c30, c31;
+  float* c0 = C + (size_t)i0*ldc + j0;
+  float* c1 = c0 + ldc;
+  float* c2 = c1 + ldc;
+  float* c3 = c2 + ldc;
+  if(accumulate) {
+    c00 = _mm256_loadu_ps(c0); c01 = _mm256_loadu_ps(c0+8);
+    c10 = _mm256_loadu_ps(c1); c11 = _mm256_loadu_ps(c1+8);
+    c20 = _mm256_loadu_ps(c2); c21 = _mm256_loadu_ps(c2+8);
+    c30 = _mm256_loadu_ps(c3); c31 = _mm256_loadu_ps(c3+8);
+  }
+  else {
+    c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm256_setzero_ps();
+  }
+  const float* a0 = A + (size_t)i0*lda;
+  const float* a1 = a0 + lda;
+  const float* a2 = a1 + lda;
+  const float* a3 = a2 + lda;
+  const float* b = B + (size_t)k0*ldb + j0;
+  for(int k = k0; k < k0+kc; k++) {
+    __m256 b0 = _mm256_loadu_ps(b);
+    __m256 b1 = _mm256_loadu_ps(b+8);
+    __m256 a;
+    a = _mm256_broadcast_ss(a0+k); c00 = _mm256_fmadd_ps(a,b0,c00); c01 = _mm256_fmadd_ps(a,b1,c01);
+    a = _mm256_broadcast_ss(a1+k); c10 = _mm256_fmadd_ps(a,b0,c10); c11 = _mm256_fmadd_ps(a,b1,c11);
+    a = _mm256_broadcast_ss(a2+k); c20 = _mm256_fmadd_ps(a,b0,c20); c21 = _mm256_fmadd_ps(a,b1,c21);
+    a = _mm256_broadcast_ss(a3+k); c30 = _mm256_fmadd_ps(a,b0,c30); c31 = _mm256_fmadd_ps(a,b1,c31);
+    b += ldb;
+  }
+  _mm256_storeu_ps(c0,c00); _mm256_storeu_ps(c0+8,c01);
+  _mm256_storeu_ps(c1,c10); _mm256_storeu_ps(c1+8,c11);
+  _mm256_storeu_ps(c2,c20); _mm256_storeu_ps(c2+8,c21);
+  _mm256_storeu_ps(c3,c30); _mm256_storeu_ps(c3+8,c31);
+}
+#else
+static const int GEMM_NR = 8;
+static inline void gemmTile(
+  int i0, int j0, int k0, int kc,
+  const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate
+) {
+  //Fixed size accumulator block, simple enough for the compiler to keep in registers and vectorize
+  float acc[GEMM_MR][GEMM_NR];
+  for(int r = 0; r < GEMM_MR; r++) {
+    for(int j = 0; j < GEMM_NR; j++)
+      acc[r][j] = accumulate ? C[(size_t)(i0+r)*ldc + j0 + j] : 0.0f;
+  }
+  for(int k = k0; k < k0+kc; k++) {
+    const float* bRow = B + (size_t)k*ldb + j0;
+    for(int r = 0; r < GEMM_MR; r++) {
+      float a = A[(size_t)(i0+r)*lda + k];
+      for(int j = 0; j < GEMM_NR; j++)
+        acc[r][j] += a * bRow[j];
+    }
+  }
+  for(int r = 0; r < GEMM_MR; r++) {
+    for(int j = 0; j < GEMM_NR; j++)
+      C[(size_t)(i0+r)*ldc + j0 + j] = acc[r][j];
+  }
+}
+#endif
+
+//C = A * B (or C += A * B if accumulate), where A is M x K, B is K x N, C is M x N, all row-major.
+static void sgemm(int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate) {
+  int mMain = M - M % GEMM_MR;
+  int nMain = N - N % GEMM_NR;
+  for(int k0 = 0; k0 < K; k0 += GEMM_KC) {
+    int kc = std::min(GEMM_KC, K-k0);
+    bool acc = accumulate || k0 > 0;
+    for(int j0 = 0; j0 < nMain; j0 += GEMM_NR) {
+      for(int i0 = 0; i0 < mMain; i0 += GEMM_MR)
+        gemmTile(i0,j0,k0,kc,A,lda,B,ldb,C,ldc,acc);
+      if(mMain < M)
+        gemmEdge(mMain,M-mMain,j0,GEMM_NR,k0,kc,A,lda,B,ldb,C,ldc,acc);
+    }
+    if(nMain < N)
+      gemmEdge(0,M,nMain,N-nMain,k0,kc,A,lda,B,ldb,C,ldc,acc);
+  }
+  //Degenerate case, make sure we still fill the output
+  if(K <= 0 && !accumulate) {
+    for(int i = 0; i<M; i++)
+      std::fill(C + (size_t)i*ldc, C + (size_t)i*ldc + N, 0.0f);
+  }
+}
+
+//TENSOR HELPERS --------------------------------------------------------------------------
+
+//Convert a single batch element between NHWC and NCHW
+static void nhwcToNCHW(const float* in, float* out, int cSize, int xySize) {
+  for(int xy = 0; xy < xySize; xy++)
+    for(int c = 0; c < cSize; c++)
+      out[c*xySize + xy] = in[xy*cSize + c];
+}
+static void nchwToNHWC(const float* in, float* out, int cSize, int xySize) {
+  for(int c = 0; c < cSize; c++)
+    for(int xy = 0; xy < xySize; xy++)
+      out[xy*cSize + c] = in[c*xySize + xy];
+}
+
+//Apply symmetries to a single NCHW batch element, writing to out (which must not alias in).
+//Matches the cuda implementation: mirror y (symmetries[0]), mirror x (symmetries[1]), then transpose (symmetries[2]),
+//with the inverse performing the same in reverse order. Transposing is only done on square boards.
+static void applySymmetry(const bool* symmetries, bool inverse, int cSize, int xSize, int ySize, const float* in, float* out) {
+  bool flipY = symmetries[0];
+  bool flipX = symmetries[1];
+  bool transpose = symmetries[2] && xSize == ySize;
+  int xySize = xSize*ySize;
+  for(int c = 0; c < cSize; c++) {
+    const float* inC = in + c*xySize;
+    float* outC = out + c*xySize;
+    for(int y = 0; y < ySize; y++) {
+      for(int x = 0; x < xSize; x++) {
+        int srcX;
+        int srcY;
+        if(!transpose) {
+          srcY = flipY ? ySize-1-y : y;
+          srcX = flipX ? xSize-1-x : x;
+        }
+        else if(!inverse) {
+          srcY = flipY ? ySize-1-x : x;
+          srcX = flipX ? xSize-1-y : y;
+        }
+        else {
+          srcY = flipX ? xSize-1-x : x;
+          srcX = flipY ? ySize-1-y : y;
+        }
+        outC[y*xSize+x] = inC[srcY*xSize+srcX];
+      }
+    }
+  }
+}
+
+//THREADING -------------------------------------------------------------------------------
+
+//A fixed set of worker threads that repeatedly run a job indexed by thread, with the calling thread acting as worker 0.
+struct WorkerPool {
+  int numThreads;
+  vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable workCond;
+  std::condition_variable doneCond;
+  std::function<void(int)> job;
+  uint64_t jobGeneration;
+  int numWorking;
+  bool shouldExit;
+
+  WorkerPool(int nThreads)
+    :numThreads(nThreads),
+     threads(),
+     mutex(),
+     workCond(),
+     doneCond(),
+     job(),
+     jobGeneration(0),
+     numWorking(0),
+     shouldExit(false)
+  {
+    for(int i = 1; i<numThreads; i++)
+      threads.push_back(std::thread(&WorkerPool::workerLoop, this, i));
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shouldExit = true;
+    }
+    workCond.notify_all();
+    for(size_t i = 0; i<threads.size(); i++)
+      threads[i].join();
+  }
+
+  WorkerPool() = delete;
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void workerLoop(int threadIdx) {
+    uint64_t lastGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+      while(!shouldExit && jobGeneration == lastGeneration)
+        workCond.wait(lock);
+      if(shouldExit)
+        return;
+      lastGeneration = jobGeneration;
+      lock.unlock();
+      job(threadIdx);
+      lock.lock();
+      numWorking--;
+      if(numWorking == 0)
+        doneCond.notify_all();
+    }
+  }
+
+  //Run f(threadIdx) for every threadIdx in [0,numThreads) and wait for all of them to finish
+  void runOnAll(const std::function<void(int)>& f) {
+    if(numThreads <= 1) {
+      f(0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = f;
+      numWorking = numThreads-1;
+      jobGeneration++;
+    }
+    workCond.notify_all();
+    f(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    while(numWorking > 0)
+      doneCond.wait(lock);
+    job = std::function<void(int)>();
+  }
+};
+
+//sgemm, with the rows of A and C split across all the threads of the pool. Chunks are whole multiples of GEMM_MR rows
+//so that every element is computed by the same kernel as in the unsplit sgemm, giving exactly the same result.
+static void parallelSgemm(
+  WorkerPool* pool, int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool accumulate
+) {
+  int numTiles = (M + GEMM_MR - 1) / GEMM_MR;
+  if(pool == NULL || pool->numThreads <= 1 || numTiles <= 1) {
+    sgemm(M,N,K,A,lda,B,ldb,C,ldc,accumulate);
+    return;
+  }
+  int numThreads = pool->numThreads;
+  pool->runOnAll([&](int threadIdx) {
+    int mStart = std::min(M, (int)((int64_t)numTiles * threadIdx / numThreads) * GEMM_MR);
+    int mEnd = std::min(M, (int)((int64_t)numTiles * (threadIdx+1) / numThreads) * GEMM_MR);
+    if(mEnd > mStart)
+      sgemm(mEnd-mStart,N,K,A + (size_t)mStart*lda,lda,B,ldb,C + (size_t)mStart*ldc,ldc,accumulate);
+  });
+}
+
+//SCRATCH ---------------------------------------------------------------------------------
+
+//Growable scratch buffer, only ever reallocates upwards
+struct ScratchBuf {
+  vector<float> buf;
+  float* get(size_t n) {
+    if(buf.size() < n)
+      buf.resize(n);
+    return buf.data();
+  }
+};
+
+//Per-thread scratch space for running a single batch element through the net
+struct Scratch {
+  //If not NULL, convolutions split their work across this pool, for when there are fewer batch elements than threads
+  WorkerPool* pool = NULL;
+  ScratchBuf col;
+  ScratchBuf input;
+  ScratchBuf symInput;
+  ScratchBuf trunk;
+  ScratchBuf trunkScratch;
+  ScratchBuf trunkTip;
+  ScratchBuf regularOut;
+  ScratchBuf midIn;
+  ScratchBuf gpoolOut;
+  ScratchBuf gpoolConcat;
+  ScratchBuf gpoolBias;
+  ScratchBuf p1Out;
+  ScratchBuf g1Out;
+  ScratchBuf g1Concat;
+  ScratchBuf g1Bias;
+  ScratchBuf p2Out;
+  ScratchBuf v1Out;
+  ScratchBuf v1Mean;
+  ScratchBuf v2Out;
+  ScratchBuf ownershipScratch;
+};
+
+//LAYERS ----------------------------------------------------------------------------------
+
+struct ConvLayer {
+  string name;
+  int convYSize;
+  int convXSize;
+  int inChannels;
+  int outChannels;
+  int dilationY;
+  int dilationX;
+  //oc, ic, y, x - which is exactly a row-major outChannels x (inChannels * convYSize * convXSize) matrix
+  vector<float> weights;
+
+  ConvLayer() = delete;
+  ConvLayer(const ConvLayer&) = delete;
+  ConvLayer& operator=(const ConvLayer&) = delete;
+
+  ConvLayer(const ConvLayerDesc* desc) {
+    name = desc->name;
+    convYSize = desc->convYSize;
+    convXSize = desc->convXSize;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    dilationY = desc->dilationY;
+    dilationX = desc->dilationX;
+    assert(desc->weights.size() == (size_t)convYSize * convXSize * inChannels * outChannels);
+    if(convXSize % 2 != 1 || convYSize % 2 != 1)
+      throw StringError("Convolution filter sizes must be odd, found even sizes in " + name);
+    weights = desc->weights;
+  }
+
+  //Input is inChannels x ySize x xSize, output is outChannels x ySize x xSize.
+  void apply(int xSize, int ySize, bool accumulate, const float* input, float* output, Scratch& scratch) const {
+    int xySize = xSize*ySize;
+    int kSize = inChannels * convYSize * convXSize;
+    if(convXSize == 1 && convYSize == 1) {
+      parallelSgemm(scratch.pool, outChannels, xySize, kSize, weights.data(), kSize, input, xySize, output, xySize, accumulate);
+      return;
+    }
+
+    //im2col - each row of col is one (ic,dy,dx) tap shifted across the whole board, zero-padded at the edges
+    float* col = scratch.col.get((size_t)kSize * xySize);
+    int yRadius = convYSize / 2;
+    int xRadius = convXSize / 2;
+    for(int ic = 0; ic < inChannels; ic++) {
+      const float* inC = input + (size_t)ic*xySize;
+      for(int dy = 0; dy < convYSize; dy++) {
+        int offY = (dy - yRadius) * dilationY;
+        for(int dx = 0; dx < convXSize; dx++) {
+          int offX = (dx - xRadius) * dilationX;
+          float* colRow = col + ((size_t)(ic * convYSize + dy) * convXSize + dx) * xySize;
+          int xStart = std::max(0, -offX);
+          int xEnd = std::min(xSize, xSize - offX);
+          for(int y = 0; y < ySize; y++) {
+            float* colDst = colRow + y*xSize;
+            int srcY = y + offY;
+            if(srcY < 0 || srcY >= ySize || xStart >= xEnd) {
+              std::fill(colDst, colDst + xSize, 0.0f);
+              continue;
+            }
+            const float* srcRow = inC + srcY*xSize;
+            for(int x = 0; x < xStart; x++)
+              colDst[x] = 0.0f;
+            for(int x = xStart; x < xEnd; x++)
+              colDst[x] = srcRow[x + offX];
+            for(int x = xEnd; x < xSize; x++)
+              colDst[x] = 0.0f;
+          }
+        }
+      }
+    }
+    parallelSgemm(scratch.pool, outChannels, xySize, kSize, weights.data(), kSize, col, xySize, output, xySize, accumulate);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct BatchNormLayer {
+  string name;
+  int numChannels;
+  vector<float> mergedScale;
+  vector<float> mergedBias;
+
+  BatchNormLayer() = delete;
+  BatchNormLayer(const BatchNormLayer&) = delete;
+  BatchNormLayer& operator=(const BatchNormLayer&) = delete;
+
+  BatchNormLayer(const BatchNormLayerDesc* desc) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    float epsilon = desc->epsilon;
+    mergedScale.resize(numChannels);
+    mergedBias.resize(numChannels);
+    for(int i = 0; i<numChannels; i++) {
+      mergedScale[i] = desc->scale[i] / sqrt(desc->variance[i] + epsilon);
+      mergedBias[i] = desc->bias[i] - mergedScale[i] * desc->mean[i];
+    }
+  }
+
+  //Input and output are numChannels x xySize, and may alias. Mask is xySize or NULL if no masking is needed.
+  void apply(int xySize, bool applyRelu, const float* input, const float* mask, float* output) const {
+    for(int c = 0; c < numChannels; c++) {
+      const float* inC = input + (size_t)c*xySize;
+      float* outC = output + (size_t)c*xySize;
+      float scale = mergedScale[c];
+      float bias = mergedBias[c];
+      if(applyRelu) {
+        for(int i = 0; i < xySize; i++)
+          outC[i] = std::max(inC[i] * scale + bias, 0.0f);
+      }
+      else {
+        for(int i = 0; i < xySize; i++)
+          outC[i] = inC[i] * scale + bias;
+      }
+      if(mask != NULL) {
+        for(int i = 0; i < xySize; i++)
+          outC[i] *= mask[i];
+      }
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct MatMulLayer {
+  string name;
+  int inChannels;
+  int outChannels;
+  //ic, oc
+  vector<float> weights;
+
+  MatMulLayer() = delete;
+  MatMulLayer(const MatMulLayer&) = delete;
+  MatMulLayer& operator=(const MatMulLayer&) = delete;
+
+  MatMulLayer(const MatMulLayerDesc* desc) {
+    name = desc->name;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    assert(desc->weights.size() == (size_t)inChannels * outChannels);
+    weights = desc->weights;
+  }
+
+  //Input is inChannels, output is outChannels
+  void apply(const float* input, float* output) const {
+    sgemm(1, outChannels, inChannels, input, inChannels, weights.data(), outChannels, output, outChannels, false);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct MatBiasLayer {
+  string name;
+  int numChannels;
+  vector<float> weights;
+
+  MatBiasLayer() = delete;
+  MatBiasLayer(const MatBiasLayer&) = delete;
+  MatBiasLayer& operator=(const MatBiasLayer&) = delete;
+
+  MatBiasLayer(const MatBiasLayerDesc* desc) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    weights = desc->weights;
+  }
+
+  void apply(float* buf, bool applyRelu) const {
+    for(int c = 0; c < numChannels; c++) {
+      float a = buf[c] + weights[c];
+      buf[c] = applyRelu ? std::max(a, 0.0f) : a;
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+//Add a per-channel bias across the board, for a single cSize x xySize batch element.
+static void addChannelBiases(float* buf, const float* biases, int cSize, int xySize) {
+  for(int c = 0; c < cSize; c++) {
+    float* bufC = buf + (size_t)c*xySize;
+    float bias = biases[c];
+    for(int i = 0; i < xySize; i++)
+      bufC[i] += bias;
+  }
+}
+
+//Output is 3 * cSize: the mean, the mean scaled by board size, and the max of each channel.
+//Assumes the input has already had a relu and masking applied, so that 0 is a valid lower bound for the max.
+static void poolRowsGPool(const float* in, float* out, int cSize, int xySize, float maskSum) {
+  float sqrtdiv = sqrt(maskSum);
+  for(int c = 0; c < cSize; c++) {
+    const float* inC = in + (size_t)c*xySize;
+    float sum = 0.0f;
+    float maxVal = 0.0f;
+    for(int i = 0; i < xySize; i++) {
+      sum += inC[i];
+      maxVal = std::max(maxVal, inC[i]);
+    }
+    float mean = sum / maskSum;
+    out[c] = mean;
+    out[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+    out[c + cSize*2] = maxVal;
+  }
+}
+
+//Output is 3 * cSize: the mean, and the mean scaled linearly and quadratically by board size.
+static void poolRowsValueHead(const float* in, float* out, int cSize, int xySize, float maskSum) {
+  float sqrtdiv = sqrt(maskSum);
+  for(int c = 0; c < cSize; c++) {
+    const float* inC = in + (size_t)c*xySize;
+    float sum = 0.0f;
+    for(int i = 0; i < xySize; i++)
+      sum += inC[i];
+    float mean = sum / maskSum;
+    out[c] = mean;
+    out[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+    out[c + cSize*2] = mean * ((sqrtdiv - 14.0f) * (sqrtdiv - 14.0f) * 0.01f - 0.1f);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+struct ResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  ResidualBlock() = delete;
+  ResidualBlock(const ResidualBlock&) = delete;
+  ResidualBlock& operator=(const ResidualBlock&) = delete;
+
+  ResidualBlock(const ResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv)
+  {}
+
+  //Accumulates the result of the block into trunk.
+  void apply(int xSize, int ySize, float* trunk, const float* mask, Scratch& scratch) const {
+    int xySize = xSize*ySize;
+    float* trunkScratch = scratch.trunkScratch.get((size_t)preBN.numChannels * xySize);
+    float* mid = scratch.midIn.get((size_t)regularConv.outChannels * xySize);
+    preBN.apply(xySize,true,trunk,mask,trunkScratch);
+    regularConv.apply(xSize,ySize,false,trunkScratch,mid,scratch);
+    midBN.apply(xySize,true,mid,mask,mid);
+    finalConv.apply(xSize,ySize,true,mid,trunk,scratch);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct DilatedResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer dilatedConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  DilatedResidualBlock() = delete;
+  DilatedResidualBlock(const DilatedResidualBlock&) = delete;
+  DilatedResidualBlock& operator=(const DilatedResidualBlock&) = delete;
+
+  DilatedResidualBlock(const DilatedResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     dilatedConv(&desc->dilatedConv),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv)
+  {}
+
+  void apply(int xSize, int ySize, float* trunk, const float* mask, Scratch& scratch) const {
+    int xySize = xSize*ySize;
+    float* trunkScratch = scratch.trunkScratch.get((size_t)preBN.numChannels * xySize);
+    //Regular and dilated outputs are written side by side, which in NCHW is exactly the channel concatenation
+    float* mid = scratch.midIn.get((size_t)(regularConv.outChannels + dilatedConv.outChannels) * xySize);
+    preBN.apply(xySize,true,trunk,mask,trunkScratch);
+    regularConv.apply(xSize,ySize,false,trunkScratch,mid,scratch);
+    dilatedConv.apply(xSize,ySize,false,trunkScratch,mid + (size_t)regularConv.outChannels * xySize,scratch);
+    midBN.apply(xySize,true,mid,mask,mid);
+    finalConv.apply(xSize,ySize,true,mid,trunk,scratch);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct GlobalPoolingResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer gpoolConv;
+  BatchNormLayer gpoolBN;
+  MatMulLayer gpoolToBiasMul;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  GlobalPoolingResidualBlock() = delete;
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlock&) = delete;
+  GlobalPoolingResidualBlock& operator=(const GlobalPoolingResidualBlock&) = delete;
+
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     gpoolConv(&desc->gpoolConv),
+     gpoolBN(&desc->gpoolBN),
+     gpoolToBiasMul(&desc->gpoolToBiasMul),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv)
+  {}
+
+  void apply(int xSize, int ySize, float* trunk, const float* mask, float maskSum, Scratch& scratch) const {
+    int xySize = xSize*ySize;
+    int regularChannels = regularConv.outChannels;
+    int gpoolChannels = gpoolConv.outChannels;
+    float* trunkScratch = scratch.trunkScratch.get((size_t)preBN.numChannels * xySize);
+    float* regularOut = scratch.regularOut.get((size_t)regularChannels * xySize);
+    float* gpoolOut = scratch.gpoolOut.get((size_t)gpoolChannels * xySize);
+    float* gpoolConcat = scratch.gpoolConcat.get((size_t)gpoolChannels * 3);
+    float* gpoolBias = scratch.gpoolBias.get((size_t)regularChannels);
+
+    preBN.apply(xySize,true,trunk,mask,trunkScratch);
+    regularConv.apply(xSize,ySize,false,trunkScratch,regularOut,scratch);
+    gpoolConv.apply(xSize,ySize,false,trunkScratch,gpoolOut,scratch);
+    gpoolBN.apply(xySize,true,gpoolOut,mask,gpoolOut);
+    poolRowsGPool(gpoolOut,gpoolConcat,gpoolChannels,xySize,maskSum);
+    gpoolToBiasMul.apply(gpoolConcat,gpoolBias);
+    addChannelBiases(regularOut,gpoolBias,regularChannels,xySize);
+    midBN.apply(xySize,true,regularOut,mask,regularOut);
+    finalConv.apply(xSize,ySize,true,regularOut,trunk,scratch);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct Trunk {
+  string name;
+  int version;
+  int trunkNumChannels;
+
+  ConvLayer* initialConv;
+  MatMulLayer* initialMatMul;
+  vector<pair<int,void*>> blocks;
+  BatchNormLayer* trunkTipBN;
+
+  Trunk() = delete;
+  Trunk(const Trunk&) = delete;
+  Trunk& operator=(const Trunk&) = delete;
+
+  Trunk(const TrunkDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    trunkNumChannels = desc->trunkNumChannels;
+
+    initialConv = new ConvLayer(&desc->initialConv);
+    initialMatMul = new MatMulLayer(&desc->initialMatMul);
+    trunkTipBN = new BatchNormLayer(&desc->trunkTipBN);
+
+    assert(desc->blocks.size() == (size_t)desc->numBlocks);
+    for(int i = 0; i<desc->numBlocks; i++) {
+      if(desc->blocks[i].first == ORDINARY_BLOCK_KIND) {
+        const ResidualBlockDesc* blockDesc = (const ResidualBlockDesc*)desc->blocks[i].second;
+        blocks.push_back(make_pair(ORDINARY_BLOCK_KIND,(void*)new ResidualBlock(blockDesc)));
+      }
+      else if(desc->blocks[i].first == DILATED_BLOCK_KIND) {
+        const DilatedResidualBlockDesc* blockDesc = (const DilatedResidualBlockDesc*)desc->blocks[i].second;
+        blocks.push_back(make_pair(DILATED_BLOCK_KIND,(void*)new DilatedResidualBlock(blockDesc)));
+      }
+      else if(desc->blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        const GlobalPoolingResidualBlockDesc* blockDesc = (const GlobalPoolingResidualBlockDesc*)desc->blocks[i].second;
+        blocks.push_back(make_pair(GLOBAL_POOLING_BLOCK_KIND,(void*)new GlobalPoolingResidualBlock(blockDesc)));
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+  }
+
+  ~Trunk() {
+    delete initialConv;
+    delete initialMatMul;
+    delete trunkTipBN;
+    for(size_t i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND)
+        delete (ResidualBlock*)blocks[i].second;
+      else if(blocks[i].first == DILATED_BLOCK_KIND)
+        delete (DilatedResidualBlock*)blocks[i].second;
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND)
+        delete (GlobalPoolingResidualBlock*)blocks[i].second;
+    }
+  }
+
+  //Writes the final post-BN-relu trunk into trunkOut
+  void apply(
+    int xSize, int ySize, const float* input, const float* inputGlobal,
+    const float* mask, float maskSum, float* trunkOut, Scratch& scratch
+  ) const {
+    int xySize = xSize*ySize;
+    float* trunk = scratch.trunk.get((size_t)trunkNumChannels * xySize);
+    float* globalBias = scratch.gpoolBias.get((size_t)trunkNumChannels);
+
+    initialConv->apply(xSize,ySize,false,input,trunk,scratch);
+    initialMatMul->apply(inputGlobal,globalBias);
+    addChannelBiases(trunk,globalBias,trunkNumChannels,xySize);
+
+    for(size_t i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND)
+        ((const ResidualBlock*)blocks[i].second)->apply(xSize,ySize,trunk,mask,scratch);
+      else if(blocks[i].first == DILATED_BLOCK_KIND)
+        ((const DilatedResidualBlock*)blocks[i].second)->apply(xSize,ySize,trunk,mask,scratch);
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND)
+        ((const GlobalPoolingResidualBlock*)blocks[i].second)->apply(xSize,ySize,trunk,mask,maskSum,scratch);
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+
+    trunkTipBN->apply(xySize,true,trunk,mask,trunkOut);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct PolicyHead {
+  string name;
+  int version;
+  int p1Channels;
+  int g1Channels;
+  int p2Channels;
+
+  ConvLayer* p1Conv;
+  ConvLayer* g1Conv;
+  BatchNormLayer* g1BN;
+  MatMulLayer* gpoolToBiasMul;
+  BatchNormLayer* p1BN;
+  ConvLayer* p2Conv;
+  MatMulLayer* gpoolToPassMul;
+
+  PolicyHead() = delete;
+  PolicyHead(const PolicyHead&) = delete;
+  PolicyHead& operator=(const PolicyHead&) = delete;
+
+  PolicyHead(const PolicyHeadDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    p1Channels = desc->p1Conv.outChannels;
+    g1Channels = desc->g1Conv.outChannels;
+    p2Channels = desc->p2Conv.outChannels;
+    if(p2Channels != 1)
+      throw StringError(name + ": CPU backend only supports a single policy output channel");
+
+    p1Conv = new ConvLayer(&desc->p1Conv);
+    g1Conv = new ConvLayer(&desc->g1Conv);
+    g1BN = new BatchNormLayer(&desc->g1BN);
+    gpoolToBiasMul = new MatMulLayer(&desc->gpoolToBiasMul);
+    p1BN = new BatchNormLayer(&desc->p1BN);
+    p2Conv = new ConvLayer(&desc->p2Conv);
+    gpoolToPassMul = new MatMulLayer(&desc->gpoolToPassMul);
+  }
+
+  ~PolicyHead() {
+    delete p1Conv;
+    delete g1Conv;
+    delete g1BN;
+    delete gpoolToBiasMul;
+    delete p1BN;
+    delete p2Conv;
+    delete gpoolToPassMul;
+  }
+
+  //Writes xySize + 1 policy logits, the last being pass.
+  void apply(
+    int xSize, int ySize, const bool* symmetries, const float* trunk,
+    const float* mask, float maskSum, float* policyOut, Scratch& scratch
+  ) const {
+    int xySize = xSize*ySize;
+    float* p1Out = scratch.p1Out.get((size_t)p1Channels * xySize);
+    float* g1Out = scratch.g1Out.get((size_t)g1Channels * xySize);
+    float* g1Concat = scratch.g1Concat.get((size_t)g1Channels * 3);
+    float* g1Bias = scratch.g1Bias.get((size_t)p1Channels);
+    float* p2Out = scratch.p2Out.get((size_t)p2Channels * xySize);
+
+    p1Conv->apply(xSize,ySize,false,trunk,p1Out,scratch);
+    g1Conv->apply(xSize,ySize,false,trunk,g1Out,scratch);
+    g1BN->apply(xySize,true,g1Out,mask,g1Out);
+    poolRowsGPool(g1Out,g1Concat,g1Channels,xySize,maskSum);
+    gpoolToBiasMul->apply(g1Concat,g1Bias);
+    addChannelBiases(p1Out,g1Bias,p1Channels,xySize);
+    p1BN->apply(xySize,true,p1Out,mask,p1Out);
+    p2Conv->apply(xSize,ySize,false,p1Out,p2Out,scratch);
+
+    bool inverse = true;
+    applySymmetry(symmetries,inverse,p2Channels,xSize,ySize,p2Out,policyOut);
+    gpoolToPassMul->apply(g1Concat,policyOut + xySize);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct ValueHead {
+  string name;
+  int version;
+  int v1Channels;
+  int v2Channels;
+  int valueChannels;
+  int scoreValueChannels;
+  int ownershipChannels;
+
+  ConvLayer* v1Conv;
+  BatchNormLayer* v1BN;
+  MatMulLayer* v2Mul;
+  MatBiasLayer* v2Bias;
+  MatMulLayer* v3Mul;
+  MatBiasLayer* v3Bias;
+  MatMulLayer* sv3Mul;
+  MatBiasLayer* sv3Bias;
+  ConvLayer* vOwnershipConv;
+
+  ValueHead() = delete;
+  ValueHead(const ValueHead&) = delete;
+  ValueHead& operator=(const ValueHead&) = delete;
+
+  ValueHead(const ValueHeadDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    v1Channels = desc->v1Conv.outChannels;
+    v2Channels = desc->v2Mul.outChannels;
+    valueChannels = desc->v3Mul.outChannels;
+    scoreValueChannels = desc->sv3Mul.outChannels;
+    ownershipChannels = desc->vOwnershipConv.outChannels;
+    if(desc->v2Mul.inChannels != v1Channels * 3)
+      throw StringError(name + ": v2Mul.inChannels is not 3 times v1Conv.outChannels");
+
+    v1Conv = new ConvLayer(&desc->v1Conv);
+    v1BN = new BatchNormLayer(&desc->v1BN);
+    v2Mul = new MatMulLayer(&desc->v2Mul);
+    v2Bias = new MatBiasLayer(&desc->v2Bias);
+    v3Mul = new MatMulLayer(&desc->v3Mul);
+    v3Bias = new MatBiasLayer(&desc->v3Bias);
+    sv3Mul = new MatMulLayer(&desc->sv3Mul);
+    sv3Bias = new MatBiasLayer(&desc->sv3Bias);
+    vOwnershipConv = new ConvLayer(&desc->vOwnershipConv);
+  }
+
+  ~ValueHead() {
+    delete v1Conv;
+    delete v1BN;
+    delete v2Mul;
+    delete v2Bias;
+    delete v3Mul;
+    delete v3Bias;
+    delete sv3Mul;
+    delete sv3Bias;
+    delete vOwnershipConv;
+  }
+
+  void apply(
+    int xSize, int ySize, const bool* symmetries, const float* trunk, const float* mask, float maskSum,
+    float* valueOut, float* scoreValueOut, float* ownershipOut, Scratch& scratch
+  ) const {
+    int xySize = xSize*ySize;
+    float* v1Out = scratch.v1Out.get((size_t)v1Channels * xySize);
+    float* v1Mean = scratch.v1Mean.get((size_t)v1Channels * 3);
+    float* v2Out = scratch.v2Out.get((size_t)v2Channels);
+
+    v1Conv->apply(xSize,ySize,false,trunk,v1Out,scratch);
+    v1BN->apply(xySize,true,v1Out,mask,v1Out);
+    poolRowsValueHead(v1Out,v1Mean,v1Channels,xySize,maskSum);
+
+    v2Mul->apply(v1Mean,v2Out);
+    v2Bias->apply(v2Out,true);
+    v3Mul->apply(v2Out,valueOut);
+    v3Bias->apply(valueOut,false);
+    sv3Mul->apply(v2Out,scoreValueOut);
+    sv3Bias->apply(scoreValueOut,false);
+
+    float* ownershipScratch = scratch.ownershipScratch.get((size_t)ownershipChannels * xySize);
+    vOwnershipConv->apply(xSize,ySize,false,v1Out,ownershipScratch,scratch);
+    bool inverse = true;
+    applySymmetry(symmetries,inverse,ownershipChannels,xSize,ySize,ownershipScratch,ownershipOut);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct Model {
+  string name;
+  int version;
+  int numInputChannels;
+  int numInputGlobalChannels;
+  int numValueChannels;
+  int numScoreValueChannels;
+  int numOwnershipChannels;
+
+  Trunk* trunk;
+  PolicyHead* policyHead;
+  ValueHead* valueHead;
+
+  Model() = delete;
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  Model(const ModelDesc* desc, int nnXLen, int nnYLen) {
+    name = desc->name;
+    version = desc->version;
+
+    if(nnXLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnXLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnXLen, NNPos::MAX_BOARD_LEN
+      ));
+    if(nnYLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnYLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnYLen, NNPos::MAX_BOARD_LEN
+      ));
+
+    numInputChannels = desc->numInputChannels;
+    numInputGlobalChannels = desc->numInputGlobalChannels;
+    numValueChannels = desc->numValueChannels;
+    numScoreValueChannels = desc->numScoreValueChannels;
+    numOwnershipChannels = desc->numOwnershipChannels;
+
+    int numFeatures = NNModelVersion::getNumSpatialFeatures(version);
+    if(numInputChannels != numFeatures)
+      throw StringError(Global::strprintf("Neural net numInputChannels (%d) was not the expected number based on version (%d)",
+        numInputChannels, numFeatures
+      ));
+    int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(version);
+    if(numInputGlobalChannels != numGlobalFeatures)
+      throw StringError(Global::strprintf("Neural net numInputGlobalChannels (%d) was not the expected number based on version (%d)",
+        numInputGlobalChannels, numGlobalFeatures
+      ));
+
+    trunk = new Trunk(&desc->trunk);
+    policyHead = new PolicyHead(&desc->policyHead);
+    valueHead = new ValueHead(&desc->valueHead);
+  }
+
+  ~Model() {
+    delete valueHead;
+    delete policyHead;
+    delete trunk;
+  }
+
+  //Evaluate a single batch element. Input is NCHW and already has the symmetry applied.
+  void apply(
+    int xSize, int ySize, bool requireExactNNLen, const bool* symmetries,
+    const float* input, const float* inputGlobal,
+    float* policyOut, float* valueOut, float* scoreValueOut, float* ownershipOut,
+    Scratch& scratch
+  ) const {
+    int xySize = xSize*ySize;
+
+    //Channel 0 is the on-board mask
+    const float* mask = input;
+    float maskSum = 0.0f;
+    for(int i = 0; i<xySize; i++)
+      maskSum += mask[i];
+    //Don't do any masking if we know the board is exactly the desired size.
+    //The global pooling structures still need maskSum for normalizing based on it and its sqrt.
+    if(requireExactNNLen)
+      mask = NULL;
+
+    //Tip of the trunk needs its own buffer since the blocks themselves use the other trunk scratch buffers
+    float* trunkTip = scratch.trunkTip.get((size_t)trunk->trunkNumChannels * xySize);
+    trunk->apply(xSize,ySize,input,inputGlobal,mask,maskSum,trunkTip,scratch);
+    policyHead->apply(xSize,ySize,symmetries,trunkTip,mask,maskSum,policyOut,scratch);
+    valueHead->apply(xSize,ySize,symmetries,trunkTip,mask,maskSum,valueOut,scoreValueOut,ownershipOut,scratch);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct LoadedModel {
+  ModelDesc modelDesc;
+
+  LoadedModel(const string& fileName) {
+    ModelDesc::loadFromFileMaybeGZipped(fileName,modelDesc);
+  }
+
+  LoadedModel() = delete;
+  LoadedModel(const LoadedModel&) = delete;
+  LoadedModel& operator=(const LoadedModel&) = delete;
+};
+
+void NeuralNet::globalInitialize() {
+  // Do nothing, no global state needed for the CPU backend
+}
+
+void NeuralNet::globalCleanup() {
+  // Do nothing, no global state needed for the CPU backend
+}
+
+LoadedModel* NeuralNet::loadModelFile(const string& file, int modelFileIdx) {
+  (void)modelFileIdx;
+  LoadedModel* loadedModel = new LoadedModel(file);
+  return loadedModel;
+}
+
+void NeuralNet::freeLoadedModel(LoadedModel* loadedModel) {
+  delete loadedModel;
+}
+
+int NeuralNet::getModelVersion(const LoadedModel* loadedModel) {
+  return loadedModel->modelDesc.version;
+}
+
+Rules NeuralNet::getSupportedRules(const LoadedModel* loadedModel, const Rules& desiredRules, bool& supported) {
+  return loadedModel->modelDesc.getSupportedRules(desiredRules, supported);
+}
+
+//------------------------------------------------------------------------------
+
+struct ComputeContext {
+  int numThreadsPerHandle;
+};
+
+ComputeContext* NeuralNet::createComputeContext(
+  const std::vector<int>& gpuIdxs,
+  Logger* logger,
+  int nnXLen,
+  int nnYLen,
+  string openCLTunerFile,
+  bool openCLReTunePerBoardSize,
+  int cpuNumThreadsPerServer,
+  const LoadedModel* loadedModel
+) {
+  (void)gpuIdxs;
+  (void)logger;
+  (void)nnXLen;
+  (void)nnYLen;
+  (void)openCLTunerFile;
+  (void)openCLReTunePerBoardSize;
+  (void)loadedModel;
+  ComputeContext* context = new ComputeContext();
+  context->numThreadsPerHandle = cpuNumThreadsPerServer;
+  if(context->numThreadsPerHandle <= 0)
+    context->numThreadsPerHandle = (int)std::thread::hardware_concurrency();
+  if(context->numThreadsPerHandle <= 0)
+    context->numThreadsPerHandle = 1;
+  return context;
+}
+
+void NeuralNet::freeComputeContext(ComputeContext* computeContext) {
+  delete computeContext;
+}
+
+//------------------------------------------------------------------------------
+
+struct ComputeHandle {
+  Model* model;
+  WorkerPool* pool;
+  vector<Scratch> scratches;
+  int nnXLen;
+  int nnYLen;
+  bool requireExactNNLen;
+  bool inputsUseNHWC;
+  int policySize;
+
+  ComputeHandle(
+    const LoadedModel* loadedModel,
+    int xLen,
+    int yLen,
+    bool rExactNNLen,
+    bool inputsNHWC,
+    int numThreads
+  ) {
+    model = new Model(&(loadedModel->modelDesc),xLen,yLen);
+    nnXLen = xLen;
+    nnYLen = yLen;
+    requireExactNNLen = rExactNNLen;
+    inputsUseNHWC = inputsNHWC;
+    policySize = NNPos::getPolicySize(nnXLen, nnYLen);
+
+    //Batches smaller than the number of threads have their convolutions split across the threads instead
+    numThreads = std::max(1, numThreads);
+    pool = new WorkerPool(numThreads);
+    scratches.resize(numThreads);
+  }
+  ~ComputeHandle() {
+    delete pool;
+    delete model;
+  }
+
+  ComputeHandle() = delete;
+  ComputeHandle(const ComputeHandle&) = delete;
+  ComputeHandle& operator=(const ComputeHandle&) = delete;
+};
+
+ComputeHandle* NeuralNet::createComputeHandle(
+  ComputeContext* context,
+  const LoadedModel* loadedModel,
+  Logger* logger,
+  int maxBatchSize,
+  int nnXLen,
+  int nnYLen,
+  bool requireExactNNLen,
+  bool inputsUseNHWC,
+  int gpuIdxForThisThread,
+  bool useFP16,
+  bool useNHWC
+) {
+  (void)gpuIdxForThisThread;
+  //Internally we always compute in fp32 NCHW, these only affect GPU backends
+  (void)useNHWC;
+
+  int numThreads = context->numThreadsPerHandle;
+
+  if(logger != NULL) {
+    logger->write("CPU backend: SIMD kernels " + string(SIMD_NAME));
+    logger->write(
+      "CPU backend: Using " + Global::intToString(numThreads) +
+      " threads per compute handle for batches of up to " + Global::intToString(maxBatchSize)
+    );
+    logger->write("CPU backend: Model version " + Global::intToString(loadedModel->modelDesc.version));
+    if(useFP16)
+      logger->write("CPU backend: useFP16 is not supported, computing in FP32 instead");
+  }
+
+  ComputeHandle* handle = new ComputeHandle(loadedModel,nnXLen,nnYLen,requireExactNNLen,inputsUseNHWC,numThreads);
+  return handle;
+}
+
+void NeuralNet::freeComputeHandle(ComputeHandle* handle) {
+  delete handle;
+}
+
+//------------------------------------------------------------------------------
+
+struct InputBuffers {
+  int maxBatchSize;
+
+  size_t singleInputElts;
+  size_t singleInputGlobalElts;
+  size_t singlePolicyResultElts;
+  size_t singleValueResultElts;
+  size_t singleScoreValueResultElts;
+  size_t singleOwnershipResultElts;
+
+  float* userInputBuffer;
+  float* userInputGlobalBuffer;
+  bool* symmetriesBuffer; //NUM_SYMMETRY_BOOLS per batch element
+
+  float* policyResults;
+  float* valueResults;
+  float* scoreValueResults;
+  float* ownershipResults;
+
+  InputBuffers(const LoadedModel* loadedModel, int maxBatchSz, int nnXLen, int nnYLen) {
+    const ModelDesc& m = loadedModel->modelDesc;
+
+    int xSize = nnXLen;
+    int ySize = nnYLen;
+
+    maxBatchSize = maxBatchSz;
+    singleInputElts = (size_t)m.numInputChannels * xSize * ySize;
+    singleInputGlobalElts = (size_t)m.numInputGlobalChannels;
+    singlePolicyResultElts = (size_t)(1 + xSize * ySize);
+    singleValueResultElts = (size_t)m.numValueChannels;
+    singleScoreValueResultElts = (size_t)m.numScoreValueChannels;
+    singleOwnershipResultElts = (size_t)m.numOwnershipChannels * xSize * ySize;
+
+    assert(NNModelVersion::getNumSpatialFeatures(m.version) == m.numInputChannels);
+    assert(NNModelVersion::getNumGlobalFeatures(m.version) == m.numInputGlobalChannels);
+
+    userInputBuffer = new float[singleInputElts * maxBatchSize];
+    userInputGlobalBuffer = new float[singleInputGlobalElts * maxBatchSize];
+    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS * maxBatchSize];
+
+    policyResults = new float[singlePolicyResultElts * maxBatchSize];
+    valueResults = new float[singleValueResultElts * maxBatchSize];
+    scoreValueResults = new float[singleScoreValueResultElts * maxBatchSize];
+    ownershipResults = new float[singleOwnershipResultElts * maxBatchSize];
+  }
+
+  ~InputBuffers() {
+    delete[] userInputBuffer;
+    delete[] userInputGlobalBuffer;
+    delete[] symmetriesBuffer;
+    delete[] policyResults;
+    delete[] valueResults;
+    delete[] scoreValueResults;
+    delete[] ownershipResults;
+  }
+
+  InputBuffers() = delete;
+  InputBuffers(const InputBuffers&) = delete;
+  InputBuffers& operator=(const InputBuffers&) = delete;
+
+};
+
+InputBuffers* NeuralNet::createInputBuffers(const LoadedModel* loadedModel, int maxBatchSize, int nnXLen, int nnYLen) {
+  return new InputBuffers(loadedModel,maxBatchSize,nnXLen,nnYLen);
+}
+void NeuralNet::freeInputBuffers(InputBuffers* inputBuffers) {
+  delete inputBuffers;
+}
+
+float* NeuralNet::getBatchEltSpatialInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputBuffer + (inputBuffers->singleInputElts * nIdx);
+}
+
+float* NeuralNet::getBatchEltGlobalInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputGlobalBuffer + (inputBuffers->singleInputGlobalElts * nIdx);
+}
+
+int NeuralNet::getBatchEltSpatialLen(const InputBuffers* inputBuffers) {
+  return (int)inputBuffers->singleInputElts;
+}
+int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
+  return (int)inputBuffers->singleInputGlobalElts;
+}
+
+bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->symmetriesBuffer + NNInputs::NUM_SYMMETRY_BOOLS * nIdx;
+}
+
+//---------------------------------------------------------------------------------------
+
+void NeuralNet::getOutput(ComputeHandle* handle, InputBuffers* inputBuffers, int numBatchEltsFilled, vector<NNOutput*>& outputs) {
+  assert(numBatchEltsFilled <= inputBuffers->maxBatchSize);
+  assert(numBatchEltsFilled > 0);
+  int batchSize = numBatchEltsFilled;
+  int nnXLen = handle->nnXLen;
+  int nnYLen = handle->nnYLen;
+  int xySize = nnXLen * nnYLen;
+  const Model* model = handle->model;
+  int version = model->version;
+  assert(inputBuffers->singlePolicyResultElts == handle->policySize);
+  assert(inputBuffers->singleOwnershipResultElts == xySize * model->numOwnershipChannels);
+
+  int numThreads = handle->pool->numThreads;
+  //With at least a row for every thread, split the batch into contiguous chunks of rows, one per thread.
+  //Otherwise, go through the rows one at a time on this thread, splitting each convolution across all the threads.
+  bool splitByRows = batchSize >= numThreads;
+
+  std::function<void(int)> runRows = [&](int threadIdx) {
+    Scratch& scratch = handle->scratches[threadIdx];
+    scratch.pool = splitByRows ? NULL : handle->pool;
+    int rowStart = splitByRows ? (int)((int64_t)batchSize * threadIdx / numThreads) : 0;
+    int rowEnd = splitByRows ? (int)((int64_t)batchSize * (threadIdx+1) / numThreads) : batchSize;
+    for(int row = rowStart; row < rowEnd; row++) {
+      const bool* symmetries = inputBuffers->symmetriesBuffer + NNInputs::NUM_SYMMETRY_BOOLS * row;
+      const float* rowInput = inputBuffers->userInputBuffer + inputBuffers->singleInputElts * row;
+      float* nchwInput = scratch.input.get(inputBuffers->singleInputElts);
+      float* symInput = scratch.symInput.get(inputBuffers->singleInputElts);
+      if(handle->inputsUseNHWC) {
+        nhwcToNCHW(rowInput,nchwInput,model->numInputChannels,xySize);
+        rowInput = nchwInput;
+      }
+      bool inverse = false;
+      applySymmetry(symmetries,inverse,model->numInputChannels,nnXLen,nnYLen,rowInput,symInput);
+
+      model->apply(
+        nnXLen,nnYLen,handle->requireExactNNLen,symmetries,
+        symInput,
+        inputBuffers->userInputGlobalBuffer + inputBuffers->singleInputGlobalElts * row,
+        inputBuffers->policyResults + inputBuffers->singlePolicyResultElts * row,
+        inputBuffers->valueResults + inputBuffers->singleValueResultElts * row,
+        inputBuffers->scoreValueResults + inputBuffers->singleScoreValueResultElts * row,
+        inputBuffers->ownershipResults + inputBuffers->singleOwnershipResultElts * row,
+        scratch
+      );
+    }
+  };
+  if(splitByRows)
+    handle->pool->runOnAll(runRows);
+  else
+    runRows(0);
+
+  assert(outputs.size() == batchSize);
+
+  for(int row = 0; row < batchSize; row++) {
+    NNOutput* output = outputs[row];
+    assert(output->nnXLen == nnXLen);
+    assert(output->nnYLen == nnYLen);
+
+    float* policyProbs = output->policyProbs;
+
+    //These are not actually correct, the client does the postprocessing to turn them into
+    //policy probabilities and white game outcome probabilities
+    //Also we don't fill in the nnHash here either
+    std::copy(
+      inputBuffers->policyResults + row * handle->policySize,
+      inputBuffers->policyResults + (row+1) * handle->policySize,
+      policyProbs
+    );
+
+    int numValueChannels = model->numValueChannels;
+    assert(numValueChannels == 3);
+    output->whiteWinProb = inputBuffers->valueResults[row * numValueChannels];
+    output->whiteLossProb = inputBuffers->valueResults[row * numValueChannels + 1];
+    output->whiteNoResultProb = inputBuffers->valueResults[row * numValueChannels + 2];
+
+    //As above, these are NOT actually from white's perspective, but rather the player to move.
+    //As usual the client does the postprocessing.
+    if(output->whiteOwnerMap != NULL) {
+      assert(model->numOwnershipChannels == 1);
+      std::copy(
+        inputBuffers->ownershipResults + row * xySize,
+        inputBuffers->ownershipResults + (row+1) * xySize,
+        output->whiteOwnerMap
+      );
+    }
+
+    if(version >= 4) {
+      int numScoreValueChannels = model->numScoreValueChannels;
+      assert(numScoreValueChannels == 2);
+      output->whiteScoreMean = inputBuffers->scoreValueResults[row * numScoreValueChannels];
+      output->whiteScoreMeanSq = inputBuffers->scoreValueResults[row * numScoreValueChannels + 1];
+    }
+    else if(version >= 3) {
+      int numScoreValueChannels = model->numScoreValueChannels;
+      assert(numScoreValueChannels == 1);
+      output->whiteScoreMean = inputBuffers->scoreValueResults[row * numScoreValueChannels];
+      //Version 3 neural nets don't have any second moment output, implicitly already folding it in, so we just use the mean squared
+      output->whiteScoreMeanSq = output->whiteScoreMean * output->whiteScoreMean;
+    }
+    else {
+      ASSERT_UNREACHABLE;
+    }
+  }
+}
+
+//TESTING ----------------------------------------------------------------------------------
+
+//The testing functions below take and return whole batches in either NHWC or NCHW, convert to the
+//per-batch-element NCHW used internally and run each element through the layer.
+
+static void batchToNCHW(const vector<float>& in, vector<float>& out, int batchSize, int cSize, int xySize, bool useNHWC) {
+  out.resize(in.size());
+  size_t eltSize = (size_t)cSize * xySize;
+  for(int n = 0; n < batchSize; n++) {
+    if(useNHWC)
+      nhwcToNCHW(in.data() + n*eltSize, out.data() + n*eltSize, cSize, xySize);
+    else
+      std::copy(in.data() + n*eltSize, in.data() + (n+1)*eltSize, out.data() + n*eltSize);
+  }
+}
+static void batchFromNCHW(const vector<float>& in, vector<float>& out, int batchSize, int cSize, int xySize, bool useNHWC) {
+  out.resize(in.size());
+  size_t eltSize = (size_t)cSize * xySize;
+  for(int n = 0; n < batchSize; n++) {
+    if(useNHWC)
+      nchwToNHWC(in.data() + n*eltSize, out.data() + n*eltSize, cSize, xySize);
+    else
+      std::copy(in.data() + n*eltSize, in.data() + (n+1)*eltSize, out.data() + n*eltSize);
+  }
+}
+
+bool NeuralNet::testEvaluateConv(
+  const ConvLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  vector<float>& outputBuffer
+) {
+  (void)useFP16;
+  int xySize = nnXLen * nnYLen;
+  size_t numInputFloats = (size_t)batchSize * xySize * desc->inChannels;
+  size_t numOutputFloats = (size_t)batchSize * xySize * desc->outChannels;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateConv: unexpected input buffer size");
+
+  ConvLayer layer(desc);
+  Scratch scratch;
+  vector<float> input;
+  vector<float> output(numOutputFloats);
+  batchToNCHW(inputBuffer,input,batchSize,desc->inChannels,xySize,useNHWC);
+  for(int n = 0; n < batchSize; n++) {
+    layer.apply(
+      nnXLen,nnYLen,false,
+      input.data() + (size_t)n * xySize * desc->inChannels,
+      output.data() + (size_t)n * xySize * desc->outChannels,
+      scratch
+    );
+  }
+  batchFromNCHW(output,outputBuffer,batchSize,desc->outChannels,xySize,useNHWC);
+  return true;
+}
+
+bool NeuralNet::testEvaluateBatchNorm(
+  const BatchNormLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  (void)useFP16;
+  int xySize = nnXLen * nnYLen;
+  size_t numInputFloats = (size_t)batchSize * xySize * desc->numChannels;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateBatchNorm: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateBatchNorm: unexpected mask buffer size");
+
+  BatchNormLayer layer(desc);
+  vector<float> input;
+  vector<float> output(numInputFloats);
+  batchToNCHW(inputBuffer,input,batchSize,desc->numChannels,xySize,useNHWC);
+  bool applyRelu = false;
+  for(int n = 0; n < batchSize; n++) {
+    layer.apply(
+      xySize,applyRelu,
+      input.data() + (size_t)n * xySize * desc->numChannels,
+      maskBuffer.data() + (size_t)n * xySize,
+      output.data() + (size_t)n * xySize * desc->numChannels
+    );
+  }
+  batchFromNCHW(output,outputBuffer,batchSize,desc->numChannels,xySize,useNHWC);
+  return true;
+}
+
+bool NeuralNet::testEvaluateResidualBlock(
+  const ResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  (void)useFP16;
+  int xySize = nnXLen * nnYLen;
+  int cSize = desc->preBN.numChannels;
+  size_t numInputFloats = (size_t)batchSize * xySize * cSize;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected mask buffer size");
+
+  ResidualBlock block(desc);
+  Scratch scratch;
+  vector<float> trunk;
+  batchToNCHW(inputBuffer,trunk,batchSize,cSize,xySize,useNHWC);
+  for(int n = 0; n < batchSize; n++)
+    block.apply(nnXLen,nnYLen,trunk.data() + (size_t)n * xySize * cSize,maskBuffer.data() + (size_t)n * xySize,scratch);
+  batchFromNCHW(trunk,outputBuffer,batchSize,cSize,xySize,useNHWC);
+  return true;
+}
+
+bool NeuralNet::testEvaluateGlobalPoolingResidualBlock(
+  const GlobalPoolingResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  (void)useFP16;
+  int xySize = nnXLen * nnYLen;
+  int cSize = desc->preBN.numChannels;
+  size_t numInputFloats = (size_t)batchSize * xySize * cSize;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateGlobalPoolingResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateGlobalPoolingResidualBlock: unexpected mask buffer size");
+
+  GlobalPoolingResidualBlock block(desc);
+  Scratch scratch;
+  vector<float> trunk;
+  batchToNCHW(inputBuffer,trunk,batchSize,cSize,xySize,useNHWC);
+  for(int n = 0; n < batchSize; n++) {
+    const float* mask = maskBuffer.data() + (size_t)n * xySize;
+    float maskSum = 0.0f;
+    for(int i = 0; i<xySize; i++)
+      maskSum += mask[i];
+    block.apply(nnXLen,nnYLen,trunk.data() + (size_t)n * xySize * cSize,mask,maskSum,scratch);
+  }
+  batchFromNCHW(trunk,outputBuffer,batchSize,cSize,xySize,useNHWC);
+  return true;
+}
+
+bool NeuralNet::testEvaluateSymmetry(
+  int batchSize,
+  int numChannels,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const bool* symmetries,
+  const vector<float>& inputBuffer,
+  vector<float>& outputBuffer
+) {
+  (void)useFP16;
+  int xySize = nnXLen * nnYLen;
+  size_t numInputFloats = (size_t)batchSize * xySize * numChannels;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateSymmetry: unexpected input buffer size");
+
+  vector<float> input;
+  vector<float> output(numInputFloats);
+  batchToNCHW(inputBuffer,input,batchSize,numChannels,xySize,useNHWC);
+  bool inverse = false;
+  for(int n = 0; n < batchSize; n++) {
+    applySymmetry(
+      symmetries,inverse,numChannels,nnXLen,nnYLen,
+      input.data() + (size_t)n * xySize * numChannels,
+      output.data() + (size_t)n * xySize * numChannels
+    );
+  }
+  batchFromNCHW(output,outputBuffer,batchSize,numChannels,xySize,useNHWC);
+  return true;
+}
+
+#endif  // USE_CPU_BACKEND
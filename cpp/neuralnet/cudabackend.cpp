@@ -1497,6 +1497,48 @@ static void applySymmetriesNHWC(
   }
 }
 
+static bool allRowsHaveSameSymmetry(const bool* symmetriesBuffer, int batchSize) {
+  for(int row = 1; row < batchSize; row++) {
+    for(int i = 0; i < NNInputs::NUM_SYMMETRY_BOOLS; i++) {
+      if(symmetriesBuffer[row * NNInputs::NUM_SYMMETRY_BOOLS + i] != symmetriesBuffer[i])
+        return false;
+    }
+  }
+  return true;
+}
+
+//Same as applySymmetriesNCHW, but symmetriesBuffer holds NUM_SYMMETRY_BOOLS per batch element. If they are not all equal,
+//uses rowSymmetriesBuf, a device array holding the same symmetries with one int per batch element.
+template <typename T>
+static void applyRowSymmetriesNCHW(
+  const bool* symmetriesBuffer, const int* rowSymmetriesBuf, bool inverse, int batchSize, int cSize, int xSize, int ySize,
+  T* inputBuf, T* inputScratchBuf
+) {
+  if(allRowsHaveSameSymmetry(symmetriesBuffer,batchSize)) {
+    applySymmetriesNCHW<T>(symmetriesBuffer, inverse, batchSize, cSize, xSize, ySize, inputBuf, inputScratchBuf);
+    return;
+  }
+  customCudaRowSymmetriesNCHW(inputBuf, inputScratchBuf, batchSize, cSize, ySize, xSize, rowSymmetriesBuf, inverse);
+  CUDA_ERR("applyRowSymmetriesNCHW",cudaPeekAtLastError());
+  cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
+  CUDA_ERR("applyRowSymmetriesNCHW",cudaPeekAtLastError());
+}
+
+template <typename T>
+static void applyRowSymmetriesNHWC(
+  const bool* symmetriesBuffer, const int* rowSymmetriesBuf, bool inverse, int batchSize, int cSize, int xSize, int ySize,
+  T* inputBuf, T* inputScratchBuf
+) {
+  if(allRowsHaveSameSymmetry(symmetriesBuffer,batchSize)) {
+    applySymmetriesNHWC<T>(symmetriesBuffer, inverse, batchSize, cSize, xSize, ySize, inputBuf, inputScratchBuf);
+    return;
+  }
+  customCudaRowSymmetriesNHWC(inputBuf, inputScratchBuf, batchSize, ySize, xSize, cSize, rowSymmetriesBuf, inverse);
+  CUDA_ERR("applyRowSymmetriesNHWC",cudaPeekAtLastError());
+  cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
+  CUDA_ERR("applyRowSymmetriesNHWC",cudaPeekAtLastError());
+}
+
 static void fillMaskFloatBufAndMaskSumBuf(void* maskBuf, float*& maskFloatBuf, float*& maskSumBuf, bool usingFP16, int batchSize, int xSize, int ySize) {
   if(!usingFP16) {
     maskFloatBuf = (float*)maskBuf;
@@ -1716,6 +1758,7 @@ struct PolicyHead {
     CudaHandles* cudaHandles,
     const cudnnTensorDescriptor_t& trunkDescriptor,
     const bool* symmetriesBuffer,
+    const int* rowSymmetriesBuf,
     int batchSize,
     void* maskBuf,
     float* maskFloatBuf,
@@ -1796,9 +1839,9 @@ struct PolicyHead {
 
     bool inverse = true;
     if(!usingNHWC)
-      applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
+      applyRowSymmetriesNCHW<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
     else
-      applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
+      applyRowSymmetriesNHWC<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
 
     gpoolToPassMul->apply(cudaHandles,batchSize,g1ConcatBuf,g1PassBuf,&zero,&one,workspaceBuf,workspaceBytes);
 
@@ -1997,6 +2040,7 @@ struct ValueHead {
     CudaHandles* cudaHandles,
     const cudnnTensorDescriptor_t& trunkDescriptor,
     const bool* symmetriesBuffer,
+    const int* rowSymmetriesBuf,
     int batchSize,
     void* maskBuf,
     float* maskSumBuf,
@@ -2056,16 +2100,16 @@ struct ValueHead {
     if(!usingFP16) {
       vOwnershipConv->apply(cudaHandles,v1OutDescriptor,vOwnershipOutDescriptor,batchSize,false,v1OutBuf2,ownershipBuf,workspaceBuf,workspaceBytes);
       if(!usingNHWC)
-        applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
+        applyRowSymmetriesNCHW<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
       else
-        applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
+        applyRowSymmetriesNHWC<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
     }
     else {
       vOwnershipConv->apply(cudaHandles,v1OutDescriptor,vOwnershipOutDescriptor,batchSize,false,v1OutBuf2,ownershipScratchBuf,workspaceBuf,workspaceBytes);
       if(!usingNHWC)
-        applySymmetriesNCHW<half>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
+        applyRowSymmetriesNCHW<half>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
       else
-        applySymmetriesNHWC<half>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
+        applyRowSymmetriesNHWC<half>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
 
       customCudaCopyFromHalf((const half*)ownershipScratchBuf,(float*)ownershipBuf,batchSize*ownershipChannels*xSize*ySize);
       CUDA_ERR("vOwnership copy",cudaPeekAtLastError());
@@ -2210,7 +2254,8 @@ struct Model {
     CudaHandles* cudaHandles,
     int batchSize,
     bool requireExactNNLen,
-    bool* symmetriesBuffer,
+    const bool* symmetriesBuffer,
+    const int* rowSymmetriesBuf,
 
     void* inputBuf,
     void* inputScratchBuf,
@@ -2261,16 +2306,16 @@ struct Model {
     if(!usingFP16) {
       bool inverse = false;
       if(inputsUsingNHWC)
-        applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
+        applyRowSymmetriesNHWC<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
       else
-        applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
+        applyRowSymmetriesNCHW<float>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
     }
     else {
       bool inverse = false;
       if(inputsUsingNHWC)
-        applySymmetriesNHWC<half>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
+        applyRowSymmetriesNHWC<half>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
       else
-        applySymmetriesNCHW<half>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
+        applyRowSymmetriesNCHW<half>(symmetriesBuffer, rowSymmetriesBuf, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
     }
 
     if(!usingFP16) {
@@ -2327,6 +2372,7 @@ struct Model {
       cudaHandles,
       trunkDescriptor,
       symmetriesBuffer,
+      rowSymmetriesBuf,
       batchSize,
       maskBuf,
       maskFloatBuf,
@@ -2348,6 +2394,7 @@ struct Model {
       cudaHandles,
       trunkDescriptor,
       symmetriesBuffer,
+      rowSymmetriesBuf,
       batchSize,
       maskBuf,
       maskSumBuf,
@@ -2410,6 +2457,7 @@ struct Buffers {
   void* inputScratchBuf;
   float* inputGlobalBufFloat;
   void* inputGlobalBuf;
+  int* rowSymmetriesBuf;
   size_t inputBufBytesFloat;
   size_t inputBufBytes;
   size_t inputGlobalBufBytesFloat;
@@ -2481,6 +2529,7 @@ struct Buffers {
     CUDA_ERR("Buffers",cudaMalloc(&inputScratchBuf, inputBufBytes));
     CUDA_ERR("Buffers",cudaMalloc(&inputGlobalBufFloat, inputGlobalBufBytesFloat));
     CUDA_ERR("Buffers",cudaMalloc(&inputGlobalBuf, inputGlobalBufBytes));
+    CUDA_ERR("Buffers",cudaMalloc(&rowSymmetriesBuf, m.maxBatchSize * sizeof(int)));
 
     CUDA_ERR("Buffers",cudaMalloc(&maskBuf, batchXYBytes));
     CUDA_ERR("Buffers",cudaMalloc(&maskFloatBuf, batchXYFloatBytes));
@@ -2549,6 +2598,7 @@ struct Buffers {
     cudaFree(inputScratchBuf);
     cudaFree(inputGlobalBufFloat);
     cudaFree(inputGlobalBuf);
+    cudaFree(rowSymmetriesBuf);
 
     cudaFree(maskBuf);
     cudaFree(maskFloatBuf);
@@ -2603,6 +2653,7 @@ ComputeContext* NeuralNet::createComputeContext(
   int nnYLen,
   string openCLTunerFile,
   bool openCLReTunePerBoardSize,
+  int cpuNumThreadsPerServer,
   const LoadedModel* loadedModel
 ) {
   (void)gpuIdxs;
@@ -2611,6 +2662,7 @@ ComputeContext* NeuralNet::createComputeContext(
   (void)nnYLen;
   (void)openCLTunerFile;
   (void)openCLReTunePerBoardSize;
+  (void)cpuNumThreadsPerServer;
   (void)loadedModel;
   return NULL;
 }
@@ -2738,7 +2790,8 @@ struct InputBuffers {
 
   float* userInputBuffer; //Host pointer
   float* userInputGlobalBuffer; //Host pointer
-  bool* symmetriesBuffer; //Host pointer
+  bool* symmetriesBuffer; //Host pointer, NUM_SYMMETRY_BOOLS per batch element
+  int* rowSymmetries; //Host pointer, symmetriesBuffer packed into one int per batch element
 
   float* policyResults; //Host pointer
   float* valueResults; //Host pointer
@@ -2777,7 +2830,8 @@ struct InputBuffers {
 
     userInputBuffer = new float[(size_t)m.numInputChannels * maxBatchSize * xSize * ySize];
     userInputGlobalBuffer = new float[(size_t)m.numInputGlobalChannels * maxBatchSize];
-    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    symmetriesBuffer = new bool[(size_t)maxBatchSize * NNInputs::NUM_SYMMETRY_BOOLS];
+    rowSymmetries = new int[maxBatchSize];
 
     policyResults = new float[(size_t)maxBatchSize * (1 + xSize * ySize)];
     valueResults = new float[(size_t)maxBatchSize * m.numValueChannels];
@@ -2790,6 +2844,7 @@ struct InputBuffers {
     delete[] userInputBuffer;
     delete[] userInputGlobalBuffer;
     delete[] symmetriesBuffer;
+    delete[] rowSymmetries;
     delete[] policyResults;
     delete[] valueResults;
     delete[] scoreValueResults;
@@ -2826,8 +2881,9 @@ int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
   return inputBuffers->singleInputGlobalElts;
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
-  return inputBuffers->symmetriesBuffer;
+bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->symmetriesBuffer + (NNInputs::NUM_SYMMETRY_BOOLS * nIdx);
 }
 
 
@@ -2885,11 +2941,18 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
     CUDA_ERR("getOutput",cudaPeekAtLastError());
   }
 
+  for(int row = 0; row < batchSize; row++) {
+    const bool* rowBools = inputBuffers->symmetriesBuffer + (NNInputs::NUM_SYMMETRY_BOOLS * row);
+    inputBuffers->rowSymmetries[row] = (rowBools[0] ? 1 : 0) | (rowBools[1] ? 2 : 0) | (rowBools[2] ? 4 : 0);
+  }
+  CUDA_ERR("getOutput",cudaMemcpy(buffers->rowSymmetriesBuf, inputBuffers->rowSymmetries, sizeof(int)*batchSize, cudaMemcpyHostToDevice));
+
   gpuHandle->model->apply(
     gpuHandle->cudaHandles,
     batchSize,
     gpuHandle->requireExactNNLen,
     inputBuffers->symmetriesBuffer,
+    buffers->rowSymmetriesBuf,
 
     buffers->inputBuf,
     buffers->inputScratchBuf,
@@ -1051,6 +1051,101 @@ void customCudaMirrorNHWC(const half *in, half* out, int batchSize, int ySize, i
   customCudaMirrorNHWCTemplate<half>(in,out,batchSize,ySize,xSize,cSize,mirrorY,mirrorX);
 }
 
+//--------------------------------------------------------------------------------------------------------------
+
+//Find where on the input board the value for (y,x) on the output board comes from, for the given symmetry.
+//Forwards is mirror y (bit 0), mirror x (bit 1), then transpose (bit 2, only for square boards), inverse is the reverse.
+__device__
+void symmetrySourceYX(int y, int x, int ySize, int xSize, int symmetry, bool inverse, int& srcY, int& srcX)
+{
+  bool mirrorY = (symmetry & 0x1) != 0;
+  bool mirrorX = (symmetry & 0x2) != 0;
+  bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
+  if(!inverse) {
+    int my = transpose ? x : y;
+    int mx = transpose ? y : x;
+    srcY = mirrorY ? ySize-1-my : my;
+    srcX = mirrorX ? xSize-1-mx : mx;
+  }
+  else {
+    int ty = mirrorY ? ySize-1-y : y;
+    int tx = mirrorX ? xSize-1-x : x;
+    srcY = transpose ? tx : ty;
+    srcX = transpose ? ty : tx;
+  }
+}
+
+template <typename T>
+__global__
+void rowSymmetriesNCHWKernel(const T *in, T* out, int cSize, int ySize, int xSize, const int* symmetries, bool inverse)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  int batchIdx = blockIdx.z;
+  int xySize = ySize * xSize;
+  if(idx < cSize * xySize) {
+    int cIdx = idx / xySize;
+    int xyIdx = idx % xySize;
+    int srcY;
+    int srcX;
+    symmetrySourceYX(xyIdx / xSize, xyIdx % xSize, ySize, xSize, symmetries[batchIdx], inverse, srcY, srcX);
+    int base = (batchIdx * cSize + cIdx) * xySize;
+    out[base + xyIdx] = in[base + srcY * xSize + srcX];
+  }
+}
+
+template <typename T>
+__global__
+void rowSymmetriesNHWCKernel(const T *in, T* out, int ySize, int xSize, int cSize, const int* symmetries, bool inverse)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  int batchIdx = blockIdx.z;
+  int xySize = ySize * xSize;
+  if(idx < xySize * cSize) {
+    int xyIdx = idx / cSize;
+    int cIdx = idx % cSize;
+    int srcY;
+    int srcX;
+    symmetrySourceYX(xyIdx / xSize, xyIdx % xSize, ySize, xSize, symmetries[batchIdx], inverse, srcY, srcX);
+    int base = batchIdx * xySize;
+    out[(base + xyIdx) * cSize + cIdx] = in[(base + srcY * xSize + srcX) * cSize + cIdx];
+  }
+}
+
+template <typename T>
+void customCudaRowSymmetriesNCHWTemplate(const T *in, T* out, int batchSize, int cSize, int ySize, int xSize, const int* symmetries, bool inverse) {
+  if(batchSize > 65536)
+    throw std::runtime_error("customCudaRowSymmetriesNCHW: batchSize too large");
+  int n = cSize * ySize * xSize;
+  int threads = targetNumThreads;
+  int blocks = (n + threads - 1) / threads;
+  dim3 grid(blocks,1,batchSize);
+  rowSymmetriesNCHWKernel<<<grid,threads>>>(in,out,cSize,ySize,xSize,symmetries,inverse);
+}
+
+template <typename T>
+void customCudaRowSymmetriesNHWCTemplate(const T *in, T* out, int batchSize, int ySize, int xSize, int cSize, const int* symmetries, bool inverse) {
+  if(batchSize > 65536)
+    throw std::runtime_error("customCudaRowSymmetriesNHWC: batchSize too large");
+  int n = ySize * xSize * cSize;
+  int threads = targetNumThreads;
+  int blocks = (n + threads - 1) / threads;
+  dim3 grid(blocks,1,batchSize);
+  rowSymmetriesNHWCKernel<<<grid,threads>>>(in,out,ySize,xSize,cSize,symmetries,inverse);
+}
+
+void customCudaRowSymmetriesNCHW(const float *in, float* out, int batchSize, int cSize, int ySize, int xSize, const int* symmetries, bool inverse) {
+  customCudaRowSymmetriesNCHWTemplate<float>(in,out,batchSize,cSize,ySize,xSize,symmetries,inverse);
+}
+void customCudaRowSymmetriesNHWC(const float *in, float* out, int batchSize, int ySize, int xSize, int cSize, const int* symmetries, bool inverse) {
+  customCudaRowSymmetriesNHWCTemplate<float>(in,out,batchSize,ySize,xSize,cSize,symmetries,inverse);
+}
+void customCudaRowSymmetriesNCHW(const half *in, half* out, int batchSize, int cSize, int ySize, int xSize, const int* symmetries, bool inverse) {
+  customCudaRowSymmetriesNCHWTemplate<half>(in,out,batchSize,cSize,ySize,xSize,symmetries,inverse);
+}
+void customCudaRowSymmetriesNHWC(const half *in, half* out, int batchSize, int ySize, int xSize, int cSize, const int* symmetries, bool inverse) {
+  customCudaRowSymmetriesNHWCTemplate<half>(in,out,batchSize,ySize,xSize,cSize,symmetries,inverse);
+}
+
 
 //--------------------------------------------------------------------------------------------------------------
 
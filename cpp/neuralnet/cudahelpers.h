@@ -41,6 +41,13 @@ void customCudaMirror(const half *in, half* out, int batchSize, int mSize, int s
 void customCudaMirrorNCHW(const half *in, half* out, int batchSize, int cSize, int ySize, int xSize, bool mirrorY, bool mirrorX);
 void customCudaMirrorNHWC(const half *in, half* out, int batchSize, int ySize, int xSize, int cSize, bool mirrorY, bool mirrorX);
 
+//Apply a possibly different symmetry to each batch element. symmetries is a device array of length batchSize where
+//bit 0 is mirror y, bit 1 is mirror x, and bit 2 is transpose (ignored for non-square boards).
+void customCudaRowSymmetriesNCHW(const float *in, float* out, int batchSize, int cSize, int ySize, int xSize, const int* symmetries, bool inverse);
+void customCudaRowSymmetriesNHWC(const float *in, float* out, int batchSize, int ySize, int xSize, int cSize, const int* symmetries, bool inverse);
+void customCudaRowSymmetriesNCHW(const half *in, half* out, int batchSize, int cSize, int ySize, int xSize, const int* symmetries, bool inverse);
+void customCudaRowSymmetriesNHWC(const half *in, half* out, int batchSize, int ySize, int xSize, int cSize, const int* symmetries, bool inverse);
+
 void customCudaCopyToHalf(const float* in, half* out, int n);
 void customCudaCopyFromHalf(const half* in, float* out, int n);
 
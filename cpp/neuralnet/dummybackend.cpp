@@ -20,6 +20,7 @@ ComputeContext* NeuralNet::createComputeContext(
   int nnYLen,
   string openCLTunerFile,
   bool openCLReTunePerBoardSize,
+  int cpuNumThreadsPerServer,
   const LoadedModel* loadedModel
 ) {
   (void)gpuIdxs;
@@ -28,6 +29,7 @@ ComputeContext* NeuralNet::createComputeContext(
   (void)nnYLen;
   (void)openCLTunerFile;
   (void)openCLReTunePerBoardSize;
+  (void)cpuNumThreadsPerServer;
   (void)loadedModel;
   throw StringError("Dummy neural net backend: NeuralNet::createComputeContext unimplemented");
 }
@@ -116,8 +118,9 @@ float* NeuralNet::getBatchEltGlobalInplace(InputBuffers* buffers, int nIdx) {
   throw StringError("Dummy neural net backend: NeuralNet::getBatchEltGlobalInplace unimplemented");
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* buffers) {
+bool* NeuralNet::getSymmetriesInplace(InputBuffers* buffers, int nIdx) {
   (void)buffers;
+  (void)nIdx;
   throw StringError("Dummy neural net backend: NeuralNet::getSymmetriesInplace unimplemented");
 }
 
@@ -0,0 +1,443 @@
+#include "../neuralnet/nndiskcache.h"
+
+#include "../core/sha2.h"
+
+#ifdef OS_IS_WINDOWS
+  #include <windows.h>
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+  #include <fcntl.h>
+  #include <sys/file.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+//File layout: a FileHeader padded to HEADER_BYTES, followed by numSlots slots of slotBytes each.
+//Each slot is a SlotHeader followed by the bytes of an NNCompactOutput without ownership. A slot whose seq is odd
+//is being written. A freshly created file is all zeros, which reads as every slot being empty.
+//The header's inUse is set while any process has the file open, so if it's set when nobody does, some process died
+//without closing it and may have left slots it was writing locked.
+static const char DISK_CACHE_MAGIC[8] = {'K','A','T','A','N','N','D','C'};
+static const uint32_t DISK_CACHE_FORMAT_VERSION = 1;
+static const uint64_t HEADER_BYTES = 64;
+static const uint64_t SLOT_ALIGN = 64;
+
+namespace {
+  struct FileHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t compactOutputHeaderBytes;
+    uint64_t numSlots;
+    uint64_t slotBytes;
+    int32_t nnXLen;
+    int32_t nnYLen;
+    uint32_t inUse;
+    uint32_t unused;
+  };
+  static_assert(sizeof(FileHeader) <= HEADER_BYTES, "");
+
+  struct SlotHeader {
+    uint64_t seq;
+    uint64_t key0;
+    uint64_t key1;
+    uint32_t len;
+    uint32_t unused;
+  };
+  static_assert(sizeof(SlotHeader) == 32, "");
+  static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "");
+}
+
+static inline std::atomic<uint64_t>* slotSeq(char* slot) {
+  return reinterpret_cast<std::atomic<uint64_t>*>(slot);
+}
+
+NNDiskCache::NNDiskCache(const string& fName, int64_t maxBytes, int xLen, int yLen, Hash128 identity, Logger* logger)
+  :fileName(fName),
+   modelIdentity(identity),
+   nnXLen(xLen),
+   nnYLen(yLen),
+   numSlots(0),
+   slotBytes(0),
+   maxPayloadBytes(0),
+   mapping(NULL),
+   mappingBytes(0),
+#ifdef OS_IS_WINDOWS
+   fileHandle(NULL),
+   mappingHandle(NULL),
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+   fileDescriptor(-1),
+#endif
+   m_numHits(0),
+   m_numMisses(0)
+{
+  maxPayloadBytes = NNCompactOutput::sizeInBytes(nnXLen,nnYLen,false);
+  slotBytes = (sizeof(SlotHeader) + maxPayloadBytes + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+  uint64_t desiredNumSlots = 1;
+  if(maxBytes > 0 && (uint64_t)maxBytes > HEADER_BYTES + slotBytes)
+    desiredNumSlots = ((uint64_t)maxBytes - HEADER_BYTES) / slotBytes;
+
+  FileHeader expected;
+  std::memset(&expected,0,sizeof(FileHeader));
+  std::memcpy(expected.magic,DISK_CACHE_MAGIC,sizeof(DISK_CACHE_MAGIC));
+  expected.formatVersion = DISK_CACHE_FORMAT_VERSION;
+  expected.compactOutputHeaderBytes = (uint32_t)sizeof(NNCompactOutput);
+  expected.numSlots = desiredNumSlots;
+  expected.slotBytes = slotBytes;
+  expected.nnXLen = nnXLen;
+  expected.nnYLen = nnYLen;
+
+  //Every process with the file open holds a shared lock on it. An opening process first tries for an exclusive lock,
+  //which it only gets if nobody else has the file open, and then it's the one to initialize a new file and to unlock
+  //any slots a dead process left locked. Otherwise it waits for a shared lock, which it gets once whoever is
+  //initializing the file is done.
+  bool created = false;
+  bool soleUser = false;
+#ifdef OS_IS_WINDOWS
+  HANDLE file = CreateFileA(
+    fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+  );
+  if(file == INVALID_HANDLE_VALUE)
+    throw StringError("Could not open nn disk cache file: " + fileName);
+  fileHandle = file;
+  OVERLAPPED overlapped;
+  std::memset(&overlapped,0,sizeof(OVERLAPPED));
+  soleUser = LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped) != 0;
+  if(!soleUser && !LockFileEx(file, 0, 0, 1, 0, &overlapped)) {
+    CloseHandle(file);
+    throw StringError("Could not lock nn disk cache file: " + fileName);
+  }
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file,&fileSize)) {
+    CloseHandle(file);
+    throw StringError("Could not get size of nn disk cache file: " + fileName);
+  }
+  if(fileSize.QuadPart == 0) {
+    if(!soleUser) {
+      CloseHandle(file);
+      throw StringError("nn disk cache file is empty, another process may have failed to create it: " + fileName);
+    }
+    created = true;
+    mappingBytes = HEADER_BYTES + desiredNumSlots * slotBytes;
+  }
+  else
+    mappingBytes = (uint64_t)fileSize.QuadPart;
+
+  HANDLE fileMapping = CreateFileMappingA(
+    file, NULL, PAGE_READWRITE, (DWORD)(mappingBytes >> 32), (DWORD)(mappingBytes & 0xFFFFFFFFULL), NULL
+  );
+  if(fileMapping == NULL) {
+    CloseHandle(file);
+    throw StringError("Could not create mapping of nn disk cache file: " + fileName);
+  }
+  mappingHandle = fileMapping;
+  mapping = (char*)MapViewOfFile(fileMapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)mappingBytes);
+  if(mapping == NULL) {
+    CloseHandle(fileMapping);
+    CloseHandle(file);
+    throw StringError("Could not map nn disk cache file: " + fileName);
+  }
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+  int fd = open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+  if(fd < 0)
+    throw StringError("Could not open nn disk cache file: " + fileName);
+  fileDescriptor = fd;
+  soleUser = flock(fd, LOCK_EX | LOCK_NB) == 0;
+  if(!soleUser && flock(fd, LOCK_SH) != 0) {
+    close(fd);
+    throw StringError("Could not lock nn disk cache file: " + fileName);
+  }
+  struct stat fileStat;
+  if(fstat(fd,&fileStat) != 0) {
+    close(fd);
+    throw StringError("Could not get size of nn disk cache file: " + fileName);
+  }
+  if(fileStat.st_size == 0) {
+    if(!soleUser) {
+      close(fd);
+      throw StringError("nn disk cache file is empty, another process may have failed to create it: " + fileName);
+    }
+    created = true;
+    mappingBytes = HEADER_BYTES + desiredNumSlots * slotBytes;
+    if(ftruncate(fd,(off_t)mappingBytes) != 0) {
+      close(fd);
+      throw StringError("Could not resize nn disk cache file: " + fileName);
+    }
+  }
+  else
+    mappingBytes = (uint64_t)fileStat.st_size;
+
+  if(mappingBytes < HEADER_BYTES) {
+    close(fd);
+    throw StringError("File is not an nn disk cache: " + fileName);
+  }
+  void* mem = mmap(NULL, (size_t)mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mem == MAP_FAILED) {
+    close(fd);
+    throw StringError("Could not map nn disk cache file: " + fileName);
+  }
+  mapping = (char*)mem;
+#endif
+
+  string error;
+  if(created)
+    std::memcpy(mapping,&expected,sizeof(FileHeader));
+  else if(mappingBytes < HEADER_BYTES)
+    error = "File is not an nn disk cache: " + fileName;
+  else {
+    FileHeader header;
+    std::memcpy(&header,mapping,sizeof(FileHeader));
+    if(std::memcmp(header.magic,DISK_CACHE_MAGIC,sizeof(DISK_CACHE_MAGIC)) != 0)
+      error = "File is not an nn disk cache: " + fileName;
+    else if(header.formatVersion != DISK_CACHE_FORMAT_VERSION || header.compactOutputHeaderBytes != sizeof(NNCompactOutput))
+      error = "nn disk cache file was written by an incompatible version or build: " + fileName;
+    else if(header.nnXLen != nnXLen || header.nnYLen != nnYLen || header.slotBytes != slotBytes)
+      error = "nn disk cache file was created for nnXLen = " + Global::intToString(header.nnXLen) +
+        " nnYLen = " + Global::intToString(header.nnYLen) +
+        " but this process uses nnXLen = " + Global::intToString(nnXLen) +
+        " nnYLen = " + Global::intToString(nnYLen) + ": " + fileName;
+    else if(header.numSlots <= 0 || HEADER_BYTES + header.numSlots * header.slotBytes != mappingBytes)
+      error = "nn disk cache file has an inconsistent size, it may be truncated or corrupt: " + fileName;
+    else
+      numSlots = header.numSlots;
+  }
+  if(created)
+    numSlots = desiredNumSlots;
+
+  //Nobody else has the file open, so if it's still marked in use, any slot that's locked will never be unlocked
+  //by whoever locked it.
+  uint64_t numUnlocked = 0;
+  if(error == "" && soleUser) {
+    FileHeader* header = reinterpret_cast<FileHeader*>(mapping);
+    if(header->inUse != 0)
+      numUnlocked = unlockInterruptedSlots();
+    header->inUse = 1;
+#ifdef OS_IS_WINDOWS
+    UnlockFileEx(file, 0, 1, 0, &overlapped);
+    if(!LockFileEx(file, 0, 0, 1, 0, &overlapped))
+      error = "Could not lock nn disk cache file: " + fileName;
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+    if(flock(fd, LOCK_SH) != 0)
+      error = "Could not lock nn disk cache file: " + fileName;
+#endif
+  }
+
+  if(error != "") {
+#ifdef OS_IS_WINDOWS
+    UnmapViewOfFile(mapping);
+    CloseHandle(fileMapping);
+    CloseHandle(file);
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+    munmap(mapping,(size_t)mappingBytes);
+    close(fd);
+#endif
+    throw StringError(error);
+  }
+
+  if(logger != NULL) {
+    logger->write(
+      string(created ? "Created" : "Opened") + " nn disk cache " + fileName + " with " +
+      Global::uint64ToString(numSlots) + " slots (" + Global::uint64ToString(mappingBytes / 1048576) + " MB)"
+    );
+    if(numUnlocked > 0)
+      logger->write(
+        "nn disk cache was not closed cleanly, emptied " + Global::uint64ToString(numUnlocked) +
+        " slots that were left in the middle of being written"
+      );
+  }
+}
+
+NNDiskCache::~NNDiskCache() {
+  //If we can get an exclusive lock, we're the last one with the file open and it's no longer in use.
+  //Either way, closing the file drops our lock.
+  FileHeader* header = reinterpret_cast<FileHeader*>(mapping);
+#ifdef OS_IS_WINDOWS
+  HANDLE file = (HANDLE)fileHandle;
+  OVERLAPPED overlapped;
+  std::memset(&overlapped,0,sizeof(OVERLAPPED));
+  UnlockFileEx(file, 0, 1, 0, &overlapped);
+  if(LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped)) {
+    header->inUse = 0;
+    UnlockFileEx(file, 0, 1, 0, &overlapped);
+  }
+  UnmapViewOfFile(mapping);
+  CloseHandle((HANDLE)mappingHandle);
+  CloseHandle(file);
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+  if(flock(fileDescriptor, LOCK_EX | LOCK_NB) == 0)
+    header->inUse = 0;
+  munmap(mapping,(size_t)mappingBytes);
+  close(fileDescriptor);
+#endif
+}
+
+uint64_t NNDiskCache::getNumSlots() const {
+  return numSlots;
+}
+uint64_t NNDiskCache::numHits() const {
+  return m_numHits.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::numMisses() const {
+  return m_numMisses.load(std::memory_order_relaxed);
+}
+
+void NNDiskCache::clearStats() {
+  m_numHits.store(0);
+  m_numMisses.store(0);
+}
+
+char* NNDiskCache::getSlot(Hash128 key) const {
+  return mapping + HEADER_BYTES + (key.hash0 % numSlots) * slotBytes;
+}
+
+//Only safe when no other process has the file open.
+uint64_t NNDiskCache::unlockInterruptedSlots() {
+  uint64_t numUnlocked = 0;
+  for(uint64_t i = 0; i<numSlots; i++) {
+    char* slot = mapping + HEADER_BYTES + i * slotBytes;
+    std::atomic<uint64_t>* seq = slotSeq(slot);
+    uint64_t seqValue = seq->load(std::memory_order_relaxed);
+    if((seqValue & 1) != 0) {
+      //Whatever was partly written is garbage, so leave the slot empty
+      std::memset(slot+sizeof(uint64_t),0,sizeof(SlotHeader)-sizeof(uint64_t));
+      seq->store(seqValue+1,std::memory_order_release);
+      numUnlocked++;
+    }
+  }
+  return numUnlocked;
+}
+
+void NNDiskCache::debugSimulateInterruptedWrites(const string& fileName) {
+  fstream file(fileName, ios::in | ios::out | ios::binary);
+  FileHeader header;
+  if(!file.read(reinterpret_cast<char*>(&header),sizeof(FileHeader)))
+    throw StringError("Could not read nn disk cache file: " + fileName);
+  header.inUse = 1;
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header),sizeof(FileHeader));
+  for(uint64_t i = 0; i<header.numSlots; i++) {
+    uint64_t seq;
+    file.seekg((streamoff)(HEADER_BYTES + i * header.slotBytes));
+    file.read(reinterpret_cast<char*>(&seq),sizeof(uint64_t));
+    seq |= 1;
+    file.seekp((streamoff)(HEADER_BYTES + i * header.slotBytes));
+    file.write(reinterpret_cast<const char*>(&seq),sizeof(uint64_t));
+  }
+  if(!file.good())
+    throw StringError("Could not write nn disk cache file: " + fileName);
+}
+
+bool NNDiskCache::get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret) {
+  ret = nullptr;
+  Hash128 key = nnHash ^ modelIdentity;
+  char* slot = getSlot(key);
+
+  //Seqlock read - copy everything out, then check that no writer touched the slot meanwhile.
+  std::atomic<uint64_t>* seq = slotSeq(slot);
+  uint64_t seqBefore = seq->load(std::memory_order_acquire);
+  bool found = false;
+  NNCompactOutput* compact = NULL;
+  if((seqBefore & 1) == 0) {
+    SlotHeader header;
+    std::memcpy(&header,slot,sizeof(SlotHeader));
+    if(header.key0 == key.hash0 && header.key1 == key.hash1 && header.len > 0 && header.len <= maxPayloadBytes) {
+      std::vector<char> payload(header.len);
+      std::memcpy(payload.data(),slot+sizeof(SlotHeader),header.len);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(seq->load(std::memory_order_relaxed) == seqBefore) {
+        compact = NNCompactOutput::fromBytes(payload.data(),payload.size());
+        if(compact != NULL && compact->nnHash == nnHash && compact->nnXLen == nnXLen && compact->nnYLen == nnYLen)
+          found = true;
+      }
+    }
+  }
+
+  if(found) {
+    NNOutput* output = new NNOutput();
+    compact->decompress(*output);
+    ret = std::shared_ptr<NNOutput>(output);
+    m_numHits.fetch_add(1,std::memory_order_relaxed);
+  }
+  else
+    m_numMisses.fetch_add(1,std::memory_order_relaxed);
+  NNCompactOutput::destroy(compact);
+  return found;
+}
+
+void NNDiskCache::set(const NNOutput& output, int boardXSize, int boardYSize) {
+  Hash128 key = output.nnHash ^ modelIdentity;
+  char* slot = getSlot(key);
+
+  std::atomic<uint64_t>* seq = slotSeq(slot);
+  uint64_t seqBefore = seq->load(std::memory_order_relaxed);
+  //Someone else is writing this slot, rather than wait just let them have it.
+  if((seqBefore & 1) != 0)
+    return;
+  //Already there, avoid dirtying the page
+  {
+    SlotHeader header;
+    std::memcpy(&header,slot,sizeof(SlotHeader));
+    if(header.key0 == key.hash0 && header.key1 == key.hash1 && header.len > 0)
+      return;
+  }
+
+  NNCompactOutput* compact = NNCompactOutput::compress(output,boardXSize,boardYSize,false);
+  size_t len = compact->sizeInBytes();
+  assert(len <= maxPayloadBytes);
+
+  if(seq->compare_exchange_strong(seqBefore, seqBefore+1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    std::atomic_thread_fence(std::memory_order_release);
+    SlotHeader header;
+    header.seq = seqBefore+1;
+    header.key0 = key.hash0;
+    header.key1 = key.hash1;
+    header.len = (uint32_t)len;
+    header.unused = 0;
+    std::memcpy(slot+sizeof(uint64_t),reinterpret_cast<const char*>(&header)+sizeof(uint64_t),sizeof(SlotHeader)-sizeof(uint64_t));
+    std::memcpy(slot+sizeof(SlotHeader),compact->bytes(),len);
+    seq->store(seqBefore+2,std::memory_order_release);
+  }
+  NNCompactOutput::destroy(compact);
+}
+
+Hash128 NNDiskCache::computeModelIdentity(
+  const string& modelFile, int modelVersion, int nnXLen, int nnYLen, float nnPolicyTemperature
+) {
+  uint64_t hash[4];
+  ifstream in(modelFile, ios::in | ios::binary);
+  if(in.good()) {
+    //Models can be large, so rather than reading the whole file, hash it a chunk at a time and chain the chunk hashes.
+    //buf holds the hash so far followed by the hash of the next chunk.
+    std::fill(hash,hash+4,(uint64_t)0);
+    uint64_t buf[8];
+    vector<char> chunk(1 << 20);
+    while(in.read(chunk.data(),chunk.size()) || in.gcount() > 0) {
+      std::copy(hash,hash+4,buf);
+      SHA2::get256((const uint8_t*)chunk.data(),(size_t)in.gcount(),buf+4);
+      SHA2::get256((const uint8_t*)buf,sizeof(buf),hash);
+    }
+  }
+  else {
+    SHA2::get256((const uint8_t*)modelFile.data(),modelFile.size(),hash);
+  }
+
+  uint32_t temperatureBits;
+  static_assert(sizeof(float) == sizeof(uint32_t), "");
+  std::memcpy(&temperatureBits,&nnPolicyTemperature,sizeof(float));
+
+  Hash128 identity(hash[0] ^ hash[2], hash[1] ^ hash[3]);
+  identity.hash0 = Hash::murmurMix(identity.hash0 ^ Hash::combine((uint32_t)modelVersion,temperatureBits));
+  identity.hash1 = Hash::murmurMix(identity.hash1 ^ Hash::combine((uint32_t)nnXLen,(uint32_t)nnYLen));
+  return identity;
+}
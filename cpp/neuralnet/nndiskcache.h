@@ -0,0 +1,78 @@
+#ifndef NEURALNET_NNDISKCACHE_H_
+#define NEURALNET_NNDISKCACHE_H_
+
+#include <memory>
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/logger.h"
+#include "../core/multithread.h"
+#include "../core/os.h"
+#include "../neuralnet/nninputs.h"
+
+//Persistent nn cache in a memory-mapped file, so that evaluations survive restarts and can be shared by several
+//processes on the same machine. Entries are keyed by the nn input hash combined with a hash identifying the model
+//and the settings that affect its outputs, so processes using different models can share a file without ever seeing
+//each other's entries.
+//The file is a fixed number of slots, each position can only go in one slot and simply replaces whatever was there.
+//Every slot is guarded by a sequence lock in the file itself - readers never block, and writers skip any slot another
+//writer is in the middle of. A process that dies in the middle of a write leaves its slot locked, so the file also
+//records whether it is in use, and the next process to open it with nobody else using it unlocks any such slots.
+//Only the policy and values are stored, not ownership.
+//The file format is specific to the machine's endianness and struct layout.
+class NNDiskCache {
+ public:
+  //Open fileName, creating it with room for about maxBytes of entries if it doesn't exist yet. An existing file keeps
+  //the size it was created with. Throws StringError if the file is not a cache for nnXLen x nnYLen.
+  NNDiskCache(const std::string& fileName, int64_t maxBytes, int nnXLen, int nnYLen, Hash128 modelIdentity, Logger* logger);
+  ~NNDiskCache();
+
+  NNDiskCache(const NNDiskCache& other) = delete;
+  NNDiskCache& operator=(const NNDiskCache& other) = delete;
+
+  //These are thread-safe, and safe with other processes using the same file.
+  //For get, ret will be set to nullptr upon a failure to find.
+  bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
+  void set(const NNOutput& output, int boardXSize, int boardYSize);
+
+  uint64_t getNumSlots() const;
+  uint64_t numHits() const;
+  uint64_t numMisses() const;
+  void clearStats();
+
+  //Identity of a model for keying entries. If modelFile is readable, hashes its contents, else only its name.
+  static Hash128 computeModelIdentity(
+    const std::string& modelFile, int modelVersion, int nnXLen, int nnYLen, float nnPolicyTemperature
+  );
+
+  //For testing, leave every slot of fileName locked and the file marked in use, as if a process died in the middle
+  //of writing to all of them. fileName must not be open by anything.
+  static void debugSimulateInterruptedWrites(const std::string& fileName);
+
+ private:
+  std::string fileName;
+  Hash128 modelIdentity;
+  int nnXLen;
+  int nnYLen;
+  uint64_t numSlots;
+  uint64_t slotBytes;
+  uint64_t maxPayloadBytes;
+
+  char* mapping;
+  uint64_t mappingBytes;
+#ifdef OS_IS_WINDOWS
+  void* fileHandle;
+  void* mappingHandle;
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+  int fileDescriptor;
+#endif
+
+  std::atomic<uint64_t> m_numHits;
+  std::atomic<uint64_t> m_numMisses;
+
+  char* getSlot(Hash128 key) const;
+  uint64_t unlockInterruptedSlots();
+};
+
+#endif  // NEURALNET_NNDISKCACHE_H_
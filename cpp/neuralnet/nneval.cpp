@@ -1,4 +1,5 @@
 #include "../neuralnet/nneval.h"
+#include "../core/timer.h"
 #include "../neuralnet/modelversion.h"
 
 using namespace std;
@@ -17,7 +18,12 @@ NNResultBuf::NNResultBuf()
     rowSpatial(NULL),
     rowGlobal(NULL),
     result(nullptr),
-    errorLogLockout(false)
+    errorLogLockout(false),
+    needsPostprocess(false),
+    nnHash(),
+    nextPlayer(C_EMPTY),
+    noResultPossible(false),
+    resultWithoutOwnerMap(nullptr)
 {}
 
 NNResultBuf::~NNResultBuf() {
@@ -65,11 +71,12 @@ NNEvaluator::NNEvaluator(
   bool rExactNNLen,
   bool iUseNHWC,
   int nnCacheSizePowerOfTwo,
-  int nnMutexPoolSizePowerofTwo,
+  int64_t nnCacheMaxBytes,
   bool skipNeuralNet,
   float nnPolicyTemp,
   string openCLTunerFile,
-  bool openCLReTunePerBoardSize
+  bool openCLReTunePerBoardSize,
+  int cpuNumThreadsPerServer
 )
   :modelName(mName),
    modelFileName(mFileName),
@@ -81,6 +88,7 @@ NNEvaluator::NNEvaluator(
    computeContext(NULL),
    loadedModel(NULL),
    nnCacheTable(NULL),
+   nnDiskCache(NULL),
    debugSkipNeuralNet(skipNeuralNet),
    nnPolicyInvTemperature(1.0f/nnPolicyTemp),
    serverThreads(),
@@ -92,6 +100,17 @@ NNEvaluator::NNEvaluator(
    numResultBufssMask(),
    m_numRowsProcessed(0),
    m_numBatchesProcessed(0),
+   minBatchFill(1),
+   maxBatchWaitSeconds(0.0),
+   adaptiveBatching(false),
+   m_batchFillTarget(1),
+   m_batchWaitSeconds(0.0),
+   m_batchSecondsByNumRows(maxBatchSize+1,-1.0),
+   m_currentBatchDeadline(),
+   debugLatencyFixedSeconds(0.0),
+   debugLatencyPerRowSeconds(0.0),
+   debugShouldThrow(false),
+   debugEvaluatesBeforeThrow(0),
    m_resultBufss(NULL),
    m_currentResultBufsLen(0),
    m_currentResultBufsIdx(0),
@@ -116,14 +135,16 @@ NNEvaluator::NNEvaluator(
   }
   numResultBufssMask = numResultBufss - 1;
 
-  if(nnCacheSizePowerOfTwo >= 0)
-    nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo, nnMutexPoolSizePowerofTwo);
+  if(nnCacheMaxBytes > 0)
+    nnCacheTable = new NNCacheTable(nnCacheMaxBytes, nnXLen, nnYLen);
+  else if(nnCacheSizePowerOfTwo >= 0)
+    nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo);
 
   if(!debugSkipNeuralNet) {
     loadedModel = NeuralNet::loadModelFile(modelFileName, modelFileIdx);
     modelVersion = NeuralNet::getModelVersion(loadedModel);
     inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
-    computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,nnXLen,nnYLen,openCLTunerFile,openCLReTunePerBoardSize,loadedModel);
+    computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,nnXLen,nnYLen,openCLTunerFile,openCLReTunePerBoardSize,cpuNumThreadsPerServer,loadedModel);
   }
   else {
     modelVersion = NNModelVersion::defaultModelVersion;
@@ -159,6 +180,7 @@ NNEvaluator::~NNEvaluator() {
   computeContext = NULL;
 
   delete nnCacheTable;
+  delete nnDiskCache;
 }
 
 string NNEvaluator::getModelName() const {
@@ -189,10 +211,32 @@ uint64_t NNEvaluator::numBatchesProcessed() const {
 double NNEvaluator::averageProcessedBatchSize() const {
   return (double)numRowsProcessed() / (double)numBatchesProcessed();
 }
+uint64_t NNEvaluator::numCacheHits() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->numHits();
+}
+uint64_t NNEvaluator::numCacheMisses() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->numMisses();
+}
+uint64_t NNEvaluator::numCacheEvictions() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->numEvictions();
+}
+int64_t NNEvaluator::numCacheBytesUsed() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->numBytesUsed();
+}
+uint64_t NNEvaluator::numDiskCacheHits() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->numHits();
+}
+uint64_t NNEvaluator::numDiskCacheMisses() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->numMisses();
+}
 
 void NNEvaluator::clearStats() {
   m_numRowsProcessed.store(0);
   m_numBatchesProcessed.store(0);
+  if(nnCacheTable != NULL)
+    nnCacheTable->clearStats();
+  if(nnDiskCache != NULL)
+    nnDiskCache->clearStats();
 }
 
 void NNEvaluator::clearCache() {
@@ -200,8 +244,88 @@ void NNEvaluator::clearCache() {
     nnCacheTable->clear();
 }
 
+void NNEvaluator::setDiskCache(const string& fileName, int64_t maxBytes, Logger* logger) {
+  if(nnDiskCache != NULL)
+    throw StringError("NNEvaluator: disk cache was already set");
+  Hash128 modelIdentity = NNDiskCache::computeModelIdentity(modelFileName, modelVersion, nnXLen, nnYLen, 1.0f/nnPolicyInvTemperature);
+  nnDiskCache = new NNDiskCache(fileName, maxBytes, nnXLen, nnYLen, modelIdentity, logger);
+}
+
+void NNEvaluator::setBatchingPolicy(int minFill, double maxWaitMicroseconds, bool adaptive) {
+  if(minFill < 1)
+    throw StringError("NNEvaluator: minBatchFill must be at least 1: " + Global::intToString(minFill));
+  if(!(maxWaitMicroseconds >= 0.0))
+    throw StringError("NNEvaluator: maxBatchWaitMicroseconds must be nonnegative: " + Global::doubleToString(maxWaitMicroseconds));
+  lock_guard<std::mutex> lock(bufferMutex);
+  minBatchFill = std::min(minFill,maxNumRows);
+  maxBatchWaitSeconds = maxWaitMicroseconds * 1e-6;
+  adaptiveBatching = adaptive;
+  updateBatchFillTarget();
+}
+
+void NNEvaluator::setDebugLatencyModel(double fixedMicroseconds, double perRowMicroseconds) {
+  if(!(fixedMicroseconds >= 0.0) || !(perRowMicroseconds >= 0.0))
+    throw StringError("NNEvaluator: debug latencies must be nonnegative");
+  lock_guard<std::mutex> lock(bufferMutex);
+  debugLatencyFixedSeconds = fixedMicroseconds * 1e-6;
+  debugLatencyPerRowSeconds = perRowMicroseconds * 1e-6;
+}
+
+void NNEvaluator::setDebugThrowAfterEvaluates(int64_t numEvaluates) {
+  debugEvaluatesBeforeThrow.store(numEvaluates,std::memory_order_relaxed);
+  debugShouldThrow.store(numEvaluates >= 0,std::memory_order_release);
+}
+
+int NNEvaluator::getBatchFillTarget() const {
+  return m_batchFillTarget.load(std::memory_order_relaxed);
+}
+
+void NNEvaluator::recordBatchLatency(int numRows, double seconds) {
+  assert(numRows >= 1 && numRows <= maxNumRows);
+  double& avg = m_batchSecondsByNumRows[numRows];
+  if(avg < 0.0)
+    avg = seconds;
+  else
+    avg = avg + 0.1 * (seconds - avg);
+  if(adaptiveBatching)
+    updateBatchFillTarget();
+}
+
+void NNEvaluator::updateBatchFillTarget() {
+  if(!adaptiveBatching) {
+    m_batchFillTarget.store(minBatchFill,std::memory_order_relaxed);
+    m_batchWaitSeconds = maxBatchWaitSeconds;
+    return;
+  }
+
+  double bestSecondsPerRow = -1.0;
+  for(int n = 1; n <= maxNumRows; n++) {
+    double seconds = m_batchSecondsByNumRows[n];
+    if(seconds >= 0.0 && (bestSecondsPerRow < 0.0 || seconds / n < bestSecondsPerRow))
+      bestSecondsPerRow = seconds / n;
+  }
+  //Nothing measured yet
+  if(bestSecondsPerRow < 0.0) {
+    m_batchFillTarget.store(minBatchFill,std::memory_order_relaxed);
+    m_batchWaitSeconds = maxBatchWaitSeconds;
+    return;
+  }
+
+  int target = maxNumRows;
+  for(int n = 1; n <= maxNumRows; n++) {
+    double seconds = m_batchSecondsByNumRows[n];
+    if(seconds >= 0.0 && seconds / n <= bestSecondsPerRow * 1.1) {
+      target = n;
+      break;
+    }
+  }
+  m_batchFillTarget.store(target,std::memory_order_relaxed);
+  //Waiting any longer than a whole batch takes can't pay off
+  m_batchWaitSeconds = std::min(maxBatchWaitSeconds, m_batchSecondsByNumRows[target]);
+}
+
 static void serveEvals(
-  int threadIdx, bool doRandomize, string randSeed, int defaultSymmetry, Logger* logger,
+  int threadIdx, bool doRandomize, string randSeed, int defaultSymmetry, int numSymmetriesToAverage, Logger* logger,
   NNEvaluator* nnEval, const LoadedModel* loadedModel,
   int gpuIdxForThisThread,
   bool useFP16,
@@ -213,7 +337,7 @@ static void serveEvals(
   //Used to have a try catch around this but actually we're in big trouble if this raises an exception
   //and causes possibly the only nnEval thread to die, so actually go ahead and let the exception escape to
   //toplevel for easier debugging
-  nnEval->serve(*buf,rand,logger,doRandomize,defaultSymmetry,gpuIdxForThisThread,useFP16,useNHWC);
+  nnEval->serve(*buf,rand,logger,doRandomize,defaultSymmetry,numSymmetriesToAverage,gpuIdxForThisThread,useFP16,useNHWC);
   delete buf;
 }
 
@@ -222,6 +346,7 @@ void NNEvaluator::spawnServerThreads(
   bool doRandomize,
   string randSeed,
   int defaultSymmetry,
+  int numSymmetriesToAverage,
   Logger& logger,
   vector<int> gpuIdxByServerThread,
   bool useFP16,
@@ -231,11 +356,15 @@ void NNEvaluator::spawnServerThreads(
     throw StringError("NNEvaluator::spawnServerThreads called when threads were already running!");
   if(gpuIdxByServerThread.size() != numThreads)
     throw StringError("gpuIdxByServerThread.size() != numThreads");
+  if(numSymmetriesToAverage < 1 || numSymmetriesToAverage > NNInputs::NUM_SYMMETRY_COMBINATIONS)
+    throw StringError("numSymmetriesToAverage must be from 1 to " + Global::intToString(NNInputs::NUM_SYMMETRY_COMBINATIONS));
+  if(numSymmetriesToAverage > maxNumRows)
+    throw StringError("numSymmetriesToAverage is larger than the max batch size: " + Global::intToString(numSymmetriesToAverage));
 
   for(int i = 0; i<numThreads; i++) {
     int gpuIdxForThisThread = gpuIdxByServerThread[i];
     std::thread* thread = new std::thread(
-      &serveEvals,i,doRandomize,randSeed,defaultSymmetry,&logger,this,loadedModel,gpuIdxForThisThread,useFP16,useNHWC
+      &serveEvals,i,doRandomize,randSeed,defaultSymmetry,numSymmetriesToAverage,&logger,this,loadedModel,gpuIdxForThisThread,useFP16,useNHWC
     );
     serverThreads.push_back(thread);
   }
@@ -257,8 +386,109 @@ void NNEvaluator::killServerThreads() {
   isKilled = false;
 }
 
+//Pick numSymmetries distinct symmetries to evaluate a single position with.
+static void chooseSymmetries(Rand& rand, bool doRandomize, int defaultSymmetry, int numSymmetries, int* symmetries) {
+  if(!doRandomize) {
+    for(int i = 0; i<numSymmetries; i++)
+      symmetries[i] = defaultSymmetry ^ i;
+    return;
+  }
+  //Partial Fisher-Yates shuffle
+  int candidates[NNInputs::NUM_SYMMETRY_COMBINATIONS];
+  for(int i = 0; i<NNInputs::NUM_SYMMETRY_COMBINATIONS; i++)
+    candidates[i] = i;
+  for(int i = 0; i<numSymmetries; i++) {
+    int j = i + (int)rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS - i);
+    std::swap(candidates[i],candidates[j]);
+    symmetries[i] = candidates[i];
+  }
+}
+
+//Average the raw outputs of the same position under different symmetries into outputs[0].
+//Outputs here are still unnormalized, so policy and value logits are averaged as probabilities and converted back to
+//logits, and ownership is averaged after the tanh. The score is averaged as what postprocessResult turns it into and
+//converted back - for model version 3 the score value, and after that the mean and the mean square, i.e. the mean
+//squared plus the variance of each symmetry, with the stdev derived only from the averages. Averaging the stdevs
+//instead would miss the spread between the symmetries' means.
+static void averageSymmetryOutputs(NNOutput** outputs, int numSymmetries, int policySize, int ownerMapSize, int modelVersion) {
+  NNOutput* averaged = outputs[0];
+  const double minProb = 1e-30;
+
+  {
+    double probSums[NNPos::MAX_NN_POLICY_SIZE];
+    for(int i = 0; i<policySize; i++)
+      probSums[i] = 0.0;
+    for(int s = 0; s<numSymmetries; s++) {
+      const float* policy = outputs[s]->policyProbs;
+      float maxPolicy = policy[0];
+      for(int i = 1; i<policySize; i++)
+        maxPolicy = std::max(maxPolicy,policy[i]);
+      double sum = 0.0;
+      for(int i = 0; i<policySize; i++)
+        sum += exp((double)(policy[i] - maxPolicy));
+      for(int i = 0; i<policySize; i++)
+        probSums[i] += exp((double)(policy[i] - maxPolicy)) / sum;
+    }
+    for(int i = 0; i<policySize; i++)
+      averaged->policyProbs[i] = (float)log(std::max(probSums[i] / numSymmetries, minProb));
+  }
+
+  {
+    double winProbSum = 0.0;
+    double lossProbSum = 0.0;
+    double noResultProbSum = 0.0;
+    double scoreSum = 0.0;
+    double scoreMeanSqSum = 0.0;
+    for(int s = 0; s<numSymmetries; s++) {
+      const NNOutput* output = outputs[s];
+      double maxLogits = std::max(std::max(output->whiteWinProb,output->whiteLossProb),output->whiteNoResultProb);
+      double winProb = exp(output->whiteWinProb - maxLogits);
+      double lossProb = exp(output->whiteLossProb - maxLogits);
+      double noResultProb = exp(output->whiteNoResultProb - maxLogits);
+      double probSum = winProb + lossProb + noResultProb;
+      winProbSum += winProb / probSum;
+      lossProbSum += lossProb / probSum;
+      noResultProbSum += noResultProb / probSum;
+      if(modelVersion == 3)
+        scoreSum += atan((double)output->whiteScoreMean);
+      else {
+        //Same as postprocessResult, in units of its 20 points
+        double scoreMean = output->whiteScoreMean;
+        double scoreStdevPreSoftplus = output->whiteScoreMeanSq;
+        double scoreStdev = scoreStdevPreSoftplus > 40.0 ? scoreStdevPreSoftplus / 20.0 : log(1.0 + exp(scoreStdevPreSoftplus));
+        scoreSum += scoreMean;
+        scoreMeanSqSum += scoreMean * scoreMean + scoreStdev * scoreStdev;
+      }
+    }
+    averaged->whiteWinProb = (float)log(std::max(winProbSum / numSymmetries, minProb));
+    averaged->whiteLossProb = (float)log(std::max(lossProbSum / numSymmetries, minProb));
+    averaged->whiteNoResultProb = (float)log(std::max(noResultProbSum / numSymmetries, minProb));
+    if(modelVersion == 3) {
+      averaged->whiteScoreMean = (float)tan(scoreSum / numSymmetries);
+    }
+    else {
+      double scoreMean = scoreSum / numSymmetries;
+      double scoreVariance = std::max(scoreMeanSqSum / numSymmetries - scoreMean * scoreMean, 0.0);
+      double scoreStdev = std::max(sqrt(scoreVariance), 1e-10);
+      averaged->whiteScoreMean = (float)scoreMean;
+      //Inverse of the softplus, such that postprocessResult gives back this stdev on either side of its cutoff against blowup
+      averaged->whiteScoreMeanSq = (float)(scoreStdev * 20.0 > 40.0 ? scoreStdev * 20.0 : log(expm1(scoreStdev)));
+    }
+  }
+
+  if(averaged->whiteOwnerMap != NULL) {
+    for(int i = 0; i<ownerMapSize; i++) {
+      double ownershipSum = 0.0;
+      for(int s = 0; s<numSymmetries; s++)
+        ownershipSum += tanh((double)outputs[s]->whiteOwnerMap[i]);
+      double ownership = std::min(std::max(ownershipSum / numSymmetries, -1.0 + 1e-7), 1.0 - 1e-7);
+      averaged->whiteOwnerMap[i] = (float)atanh(ownership);
+    }
+  }
+}
+
 void NNEvaluator::serve(
-  NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
+  NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry, int numSymmetriesToAverage,
   int gpuIdxForThisThread, bool useFP16, bool useNHWC
 ) {
 
@@ -279,12 +509,28 @@ void NNEvaluator::serve(
     );
 
   vector<NNOutput*> outputBuf;
+  //Latencies of the batches done since we last held the lock, as (number of positions, seconds)
+  vector<std::pair<int,double>> batchLatencies;
 
   unique_lock<std::mutex> lock(bufferMutex,std::defer_lock);
   while(true) {
     lock.lock();
-    while(m_currentResultBufsLen <= 0 && m_currentResultBufsIdx == m_oldestResultBufsIdx && !isKilled)
-      serverWaitingForBatchStart.wait(lock);
+    for(size_t i = 0; i<batchLatencies.size(); i++)
+      recordBatchLatency(batchLatencies[i].first,batchLatencies[i].second);
+    batchLatencies.clear();
+
+    while(!isKilled) {
+      //A full buffer that clients have already moved on from, or enough rows in the current one
+      if(m_currentResultBufsIdx != m_oldestResultBufsIdx || m_currentResultBufsLen >= m_batchFillTarget.load(std::memory_order_relaxed))
+        break;
+      if(m_currentResultBufsLen <= 0) {
+        serverWaitingForBatchStart.wait(lock);
+        continue;
+      }
+      if(std::chrono::steady_clock::now() >= m_currentBatchDeadline)
+        break;
+      serverWaitingForBatchStart.wait_until(lock,m_currentBatchDeadline);
+    }
 
     if(isKilled)
       break;
@@ -305,9 +551,16 @@ void NNEvaluator::serve(
       numRows = maxNumRows;
     }
 
+    double debugLatencySeconds = debugLatencyFixedSeconds + debugLatencyPerRowSeconds * numRows;
     lock.unlock();
 
     if(debugSkipNeuralNet) {
+      ClockTimer timer;
+      if(debugLatencySeconds > 0.0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(debugLatencySeconds));
+      m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
+      m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+
       for(int row = 0; row < numRows; row++) {
         assert(buf.resultBufs[row] != NULL);
         NNResultBuf* resultBuf = buf.resultBufs[row];
@@ -368,30 +621,10 @@ void NNEvaluator::serve(
         resultBuf->clientWaitingForResult.notify_all();
         resultLock.unlock();
       }
+      batchLatencies.push_back(std::make_pair(numRows,timer.getSeconds()));
       continue;
     }
 
-    int symmetry = defaultSymmetry;
-    if(doRandomize)
-      symmetry = rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS);
-    bool* symmetriesBuffer = NeuralNet::getSymmetriesInplace(buf.inputBuffers);
-    symmetriesBuffer[0] = (symmetry & 0x1) != 0;
-    symmetriesBuffer[1] = (symmetry & 0x2) != 0;
-    symmetriesBuffer[2] = (symmetry & 0x4) != 0;
-
-    outputBuf.clear();
-    for(int row = 0; row<numRows; row++) {
-      NNOutput* emptyOutput = new NNOutput();
-      assert(buf.resultBufs[row] != NULL);
-      emptyOutput->nnXLen = nnXLen;
-      emptyOutput->nnYLen = nnYLen;
-      if(buf.resultBufs[row]->includeOwnerMap)
-        emptyOutput->whiteOwnerMap = new float[nnXLen*nnYLen];
-      else
-        emptyOutput->whiteOwnerMap = NULL;
-      outputBuf.push_back(emptyOutput);
-    }
-
     int numSpatialFeatures = NNModelVersion::getNumSpatialFeatures(modelVersion);
     int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(modelVersion);
     int rowSpatialLen = numSpatialFeatures * nnXLen * nnYLen;
@@ -399,33 +632,71 @@ void NNEvaluator::serve(
     assert(rowSpatialLen == NeuralNet::getBatchEltSpatialLen(buf.inputBuffers));
     assert(rowGlobalLen == NeuralNet::getBatchEltGlobalLen(buf.inputBuffers));
 
-    for(int row = 0; row<numRows; row++) {
-      float* rowSpatialInput = NeuralNet::getBatchEltSpatialInplace(buf.inputBuffers,row);
-      float* rowGlobalInput = NeuralNet::getBatchEltGlobalInplace(buf.inputBuffers,row);
+    //Each position occupies numSymmetriesToAverage consecutive nn rows, each row with its own symmetry, so
+    //randomization costs nothing in batch size. If the expanded rows don't fit in one batch, split into several.
+    int maxPositionsPerBatch = maxNumRows / numSymmetriesToAverage;
+    for(int posStart = 0; posStart < numRows; posStart += maxPositionsPerBatch) {
+      int numPositions = std::min(maxPositionsPerBatch, numRows - posStart);
+      int numNNRows = numPositions * numSymmetriesToAverage;
+
+      outputBuf.clear();
+      for(int pos = 0; pos<numPositions; pos++) {
+        const NNResultBuf* resultBuf = buf.resultBufs[posStart+pos];
+        assert(resultBuf != NULL);
+
+        int symmetries[NNInputs::NUM_SYMMETRY_COMBINATIONS];
+        chooseSymmetries(rand, doRandomize, defaultSymmetry, numSymmetriesToAverage, symmetries);
+
+        for(int s = 0; s<numSymmetriesToAverage; s++) {
+          int row = pos * numSymmetriesToAverage + s;
+          bool* symmetriesBuffer = NeuralNet::getSymmetriesInplace(buf.inputBuffers,row);
+          symmetriesBuffer[0] = (symmetries[s] & 0x1) != 0;
+          symmetriesBuffer[1] = (symmetries[s] & 0x2) != 0;
+          symmetriesBuffer[2] = (symmetries[s] & 0x4) != 0;
+
+          float* rowSpatialInput = NeuralNet::getBatchEltSpatialInplace(buf.inputBuffers,row);
+          float* rowGlobalInput = NeuralNet::getBatchEltGlobalInplace(buf.inputBuffers,row);
+          std::copy(resultBuf->rowSpatial,resultBuf->rowSpatial+rowSpatialLen,rowSpatialInput);
+          std::copy(resultBuf->rowGlobal,resultBuf->rowGlobal+rowGlobalLen,rowGlobalInput);
+
+          NNOutput* emptyOutput = new NNOutput();
+          emptyOutput->nnXLen = nnXLen;
+          emptyOutput->nnYLen = nnYLen;
+          if(resultBuf->includeOwnerMap)
+            emptyOutput->whiteOwnerMap = new float[nnXLen*nnYLen];
+          else
+            emptyOutput->whiteOwnerMap = NULL;
+          outputBuf.push_back(emptyOutput);
+        }
+      }
 
-      const float* rowSpatial = buf.resultBufs[row]->rowSpatial;
-      const float* rowGlobal = buf.resultBufs[row]->rowGlobal;
-      std::copy(rowSpatial,rowSpatial+rowSpatialLen,rowSpatialInput);
-      std::copy(rowGlobal,rowGlobal+rowGlobalLen,rowGlobalInput);
-    }
+      ClockTimer timer;
+      NeuralNet::getOutput(gpuHandle, buf.inputBuffers, numNNRows, outputBuf);
+      assert(outputBuf.size() == numNNRows);
+      batchLatencies.push_back(std::make_pair(numPositions,timer.getSeconds()));
 
-    NeuralNet::getOutput(gpuHandle, buf.inputBuffers, numRows, outputBuf);
-    assert(outputBuf.size() == numRows);
+      m_numRowsProcessed.fetch_add(numNNRows, std::memory_order_relaxed);
+      m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
 
-    m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
-    m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+      for(int pos = 0; pos < numPositions; pos++) {
+        NNOutput** outputs = &outputBuf[pos * numSymmetriesToAverage];
+        if(numSymmetriesToAverage > 1) {
+          averageSymmetryOutputs(outputs, numSymmetriesToAverage, policySize, nnXLen*nnYLen, modelVersion);
+          for(int s = 1; s<numSymmetriesToAverage; s++)
+            delete outputs[s];
+        }
 
-    for(int row = 0; row < numRows; row++) {
-      assert(buf.resultBufs[row] != NULL);
-      NNResultBuf* resultBuf = buf.resultBufs[row];
-      buf.resultBufs[row] = NULL;
+        assert(buf.resultBufs[posStart+pos] != NULL);
+        NNResultBuf* resultBuf = buf.resultBufs[posStart+pos];
+        buf.resultBufs[posStart+pos] = NULL;
 
-      unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
-      assert(resultBuf->hasResult == false);
-      resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
-      resultBuf->hasResult = true;
-      resultBuf->clientWaitingForResult.notify_all();
-      resultLock.unlock();
+        unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
+        assert(resultBuf->hasResult == false);
+        resultBuf->result = std::shared_ptr<NNOutput>(outputs[0]);
+        resultBuf->hasResult = true;
+        resultBuf->clientWaitingForResult.notify_all();
+        resultLock.unlock();
+      }
     }
 
     continue;
@@ -444,8 +715,51 @@ void NNEvaluator::evaluate(
   bool skipCache,
   bool includeOwnerMap
 ) {
+  if(submitEvaluate(board,history,nextPlayer,drawEquivalentWinsForWhite,buf,logger,skipCache,includeOwnerMap))
+    return;
+
+  unique_lock<std::mutex> resultLock(buf.resultMutex);
+  while(!buf.hasResult)
+    buf.clientWaitingForResult.wait(resultLock);
+  resultLock.unlock();
+
+  postprocessResult(buf,logger,&board,&history);
+}
+
+bool NNEvaluator::submitEvaluate(
+  Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  double drawEquivalentWinsForWhite,
+  NNResultBuf& buf,
+  Logger* logger,
+  bool skipCache,
+  bool includeOwnerMap
+) {
+  if(prepareEvaluate(board,history,nextPlayer,drawEquivalentWinsForWhite,buf,logger,skipCache,includeOwnerMap))
+    return true;
+  NNResultBuf* bufPtr = &buf;
+  queueEvaluates(&bufPtr,1);
+  return false;
+}
+
+bool NNEvaluator::prepareEvaluate(
+  Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  double drawEquivalentWinsForWhite,
+  NNResultBuf& buf,
+  Logger* logger,
+  bool skipCache,
+  bool includeOwnerMap
+) {
+  (void)logger;
   assert(!isKilled);
   buf.hasResult = false;
+  buf.needsPostprocess = false;
+
+  if(debugShouldThrow.load(std::memory_order_acquire) && debugEvaluatesBeforeThrow.fetch_sub(1,std::memory_order_relaxed) <= 0)
+    throw StringError("NNEvaluator: debug throw for testing");
 
   if(board.x_size > nnXLen || board.y_size > nnYLen)
     throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
@@ -469,17 +783,28 @@ void NNEvaluator::evaluate(
   else
     ASSERT_UNREACHABLE;
 
-  bool hadResultWithoutOwnerMap = false;
-  shared_ptr<NNOutput> resultWithoutOwnerMap;
+  buf.resultWithoutOwnerMap = nullptr;
   if(nnCacheTable != NULL && !skipCache && nnCacheTable->get(nnHash,buf.result)) {
     if(!(includeOwnerMap && buf.result->whiteOwnerMap == NULL))
     {
       buf.hasResult = true;
-      return;
+      return true;
+    }
+    else {
+      buf.resultWithoutOwnerMap = std::move(buf.result);
+      buf.result = nullptr;
+    }
+  }
+  //The disk cache never has ownership, so if that's all we were missing there's no point looking.
+  else if(nnDiskCache != NULL && !skipCache && nnDiskCache->get(nnHash,buf.result)) {
+    if(nnCacheTable != NULL)
+      nnCacheTable->set(*buf.result,board.x_size,board.y_size);
+    if(!includeOwnerMap) {
+      buf.hasResult = true;
+      return true;
     }
     else {
-      hadResultWithoutOwnerMap = true;
-      resultWithoutOwnerMap = std::move(buf.result);
+      buf.resultWithoutOwnerMap = std::move(buf.result);
       buf.result = nullptr;
     }
   }
@@ -488,6 +813,19 @@ void NNEvaluator::evaluate(
   buf.boardXSizeForServer = board.x_size;
   buf.boardYSizeForServer = board.y_size;
 
+  //Record everything postprocessing needs from the board and history, so that the caller is free to
+  //change them while the evaluation is in flight.
+  buf.nnHash = nnHash;
+  buf.nextPlayer = nextPlayer;
+  buf.noResultPossible = !(history.rules.koRule != Rules::KO_SIMPLE && history.rules.scoringRule != Rules::SCORING_TERRITORY);
+  if(buf.resultWithoutOwnerMap == nullptr) {
+    for(int i = 0; i<policySize; i++) {
+      Loc loc = NNPos::posToLoc(i,board.x_size,board.y_size,nnXLen,nnYLen);
+      buf.isLegal[i] = history.isLegal(board,loc,nextPlayer);
+    }
+  }
+  buf.needsPostprocess = true;
+
   if(!debugSkipNeuralNet) {
     int rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
     if(buf.rowSpatial == NULL) {
@@ -521,19 +859,32 @@ void NNEvaluator::evaluate(
     else
       ASSERT_UNREACHABLE;
   }
+  return false;
+}
 
-  unique_lock<std::mutex> lock(bufferMutex);
-
-  m_resultBufss[m_currentResultBufsIdx][m_currentResultBufsLen] = &buf;
-  m_currentResultBufsLen += 1;
-  if(m_currentResultBufsLen == 1 && m_currentResultBufsIdx == m_oldestResultBufsIdx)
-    serverWaitingForBatchStart.notify_one();
-
+void NNEvaluator::queueEvaluates(NNResultBuf* const* bufs, int numBufs) {
+  assert(!isKilled);
   bool overlooped = false;
-  if(m_currentResultBufsLen >= maxNumRows) {
-    m_currentResultBufsLen = 0;
-    m_currentResultBufsIdx = (m_currentResultBufsIdx + 1) & numResultBufssMask;
-    overlooped = m_currentResultBufsIdx == m_oldestResultBufsIdx;
+  unique_lock<std::mutex> lock(bufferMutex);
+  for(int i = 0; i<numBufs; i++) {
+    assert(bufs[i]->needsPostprocess && !bufs[i]->hasResult);
+    m_resultBufss[m_currentResultBufsIdx][m_currentResultBufsLen] = bufs[i];
+    m_currentResultBufsLen += 1;
+    if(m_currentResultBufsLen == 1)
+      m_currentBatchDeadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(m_batchWaitSeconds)
+      );
+    //Wake a server thread when the batch starts and whenever it may be full enough. Since we hold the lock, a server
+    //woken partway through a group only sees the group once it is all queued.
+    if(m_currentResultBufsIdx == m_oldestResultBufsIdx &&
+       (m_currentResultBufsLen == 1 || m_currentResultBufsLen >= m_batchFillTarget.load(std::memory_order_relaxed)))
+      serverWaitingForBatchStart.notify_one();
+
+    if(m_currentResultBufsLen >= maxNumRows) {
+      m_currentResultBufsLen = 0;
+      m_currentResultBufsIdx = (m_currentResultBufsIdx + 1) & numResultBufssMask;
+      overlooped = overlooped || m_currentResultBufsIdx == m_oldestResultBufsIdx;
+    }
   }
   lock.unlock();
 
@@ -541,18 +892,44 @@ void NNEvaluator::evaluate(
   //circular buffer.
   assert(!overlooped);
   (void)overlooped; //Avoid unused variable when asserts disabled
+}
+
+bool NNEvaluator::pollEvaluate(NNResultBuf& buf, Logger* logger) {
+  unique_lock<std::mutex> resultLock(buf.resultMutex);
+  bool hasResult = buf.hasResult;
+  resultLock.unlock();
+  if(!hasResult)
+    return false;
+  if(buf.needsPostprocess)
+    postprocessResult(buf,logger,NULL,NULL);
+  return true;
+}
 
+void NNEvaluator::waitForEvaluate(NNResultBuf& buf, Logger* logger) {
   unique_lock<std::mutex> resultLock(buf.resultMutex);
   while(!buf.hasResult)
     buf.clientWaitingForResult.wait(resultLock);
   resultLock.unlock();
+  if(buf.needsPostprocess)
+    postprocessResult(buf,logger,NULL,NULL);
+}
+
+void NNEvaluator::postprocessResult(NNResultBuf& buf, Logger* logger, const Board* board, const BoardHistory* history) {
+  assert(buf.hasResult);
+  assert(buf.needsPostprocess);
+  buf.needsPostprocess = false;
+
+  const Player nextPlayer = buf.nextPlayer;
+  const int xSize = buf.boardXSizeForServer;
+  const int ySize = buf.boardYSizeForServer;
 
   //Perform postprocessing on the result - turn the nn output into probabilities
   //As a hack though, if the only thing we were missing was the ownermap, just grab the old policy and values
   //and use those. This avoids recomputing in a randomly different orientation when we just need the ownermap
   //and causing policy weights to be different, which would reduce performance of successive searches in a game
   //by making the successive searches distribute their playouts less coherently and using the cache more poorly.
-  if(hadResultWithoutOwnerMap) {
+  if(buf.resultWithoutOwnerMap != nullptr) {
+    const shared_ptr<NNOutput>& resultWithoutOwnerMap = buf.resultWithoutOwnerMap;
     buf.result->whiteWinProb = resultWithoutOwnerMap->whiteWinProb;
     buf.result->whiteLossProb = resultWithoutOwnerMap->whiteLossProb;
     buf.result->whiteNoResultProb = resultWithoutOwnerMap->whiteNoResultProb;
@@ -566,16 +943,10 @@ void NNEvaluator::evaluate(
   else {
     float* policy = buf.result->policyProbs;
 
-    int xSize = board.x_size;
-    int ySize = board.y_size;
-
     float maxPolicy = -1e25f;
-    bool isLegal[NNPos::MAX_NN_POLICY_SIZE];
+    const bool* isLegal = buf.isLegal;
     int legalCount = 0;
     for(int i = 0; i<policySize; i++) {
-      Loc loc = NNPos::posToLoc(i,xSize,ySize,nnXLen,nnYLen);
-      isLegal[i] = history.isLegal(board,loc,nextPlayer);
-
       float policyValue;
       if(isLegal[i]) {
         legalCount += 1;
@@ -599,7 +970,8 @@ void NNEvaluator::evaluate(
 
     if(isnan(policySum)) {
       cout << "Got nan for policy sum" << endl;
-      history.printDebugInfo(cout,board);
+      if(board != NULL && history != NULL)
+        history->printDebugInfo(cout,*board);
       throw StringError("Got nan for policy sum");
     }
 
@@ -664,14 +1036,14 @@ void NNEvaluator::evaluate(
         buf.result->whiteWinProb = (float)winProb;
         buf.result->whiteLossProb = (float)lossProb;
         buf.result->whiteNoResultProb = (float)noResultProb;
-        buf.result->whiteScoreMean = (float)ScoreValue::approxWhiteScoreOfScoreValueSmooth(scoreValue,0.0,2.0,board);
+        buf.result->whiteScoreMean = (float)ScoreValue::approxWhiteScoreOfScoreValueSmooth(scoreValue,0.0,2.0,xSize,ySize);
         buf.result->whiteScoreMeanSq = buf.result->whiteScoreMean * buf.result->whiteScoreMean;
       }
       else {
         buf.result->whiteWinProb = (float)lossProb;
         buf.result->whiteLossProb = (float)winProb;
         buf.result->whiteNoResultProb = (float)noResultProb;
-        buf.result->whiteScoreMean = -(float)ScoreValue::approxWhiteScoreOfScoreValueSmooth(scoreValue,0.0,2.0,board);
+        buf.result->whiteScoreMean = -(float)ScoreValue::approxWhiteScoreOfScoreValueSmooth(scoreValue,0.0,2.0,xSize,ySize);
         buf.result->whiteScoreMeanSq = buf.result->whiteScoreMean * buf.result->whiteScoreMean;
       }
 
@@ -689,7 +1061,7 @@ void NNEvaluator::evaluate(
         double scoreMeanPreScaled = buf.result->whiteScoreMean;
         double scoreStdevPreSoftplus = buf.result->whiteScoreMeanSq;
 
-        if(history.rules.koRule != Rules::KO_SIMPLE && history.rules.scoringRule != Rules::SCORING_TERRITORY)
+        if(!buf.noResultPossible)
           noResultLogits -= 100000.0;
 
         //Softmax
@@ -698,7 +1070,7 @@ void NNEvaluator::evaluate(
         lossProb = exp(lossLogits - maxLogits);
         noResultProb = exp(noResultLogits - maxLogits);
 
-        if(history.rules.koRule != Rules::KO_SIMPLE && history.rules.scoringRule != Rules::SCORING_TERRITORY)
+        if(!buf.noResultPossible)
           noResultProb = 0.0;
 
         double probSum = winProb + lossProb + noResultProb;
@@ -756,7 +1128,7 @@ void NNEvaluator::evaluate(
       for(int pos = 0; pos<nnXLen*nnYLen; pos++) {
         int y = pos / nnXLen;
         int x = pos % nnXLen;
-        if(y >= board.y_size || x >= board.x_size)
+        if(y >= ySize || x >= xSize)
           buf.result->whiteOwnerMap[pos] = 0.0f;
         else {
           //Similarly as mentioned above, the result we get back from the net is actually not from white's perspective,
@@ -774,41 +1146,105 @@ void NNEvaluator::evaluate(
   }
 
 
-  //And record the nnHash in the result and put it into the table
-  buf.result->nnHash = nnHash;
+  //Policy and values that came from a cache were already offered to the disk cache when first computed
+  bool isFreshEval = buf.resultWithoutOwnerMap == nullptr;
+  buf.resultWithoutOwnerMap = nullptr;
+
+  //And record the nnHash in the result and put it into the tables
+  buf.result->nnHash = buf.nnHash;
   if(nnCacheTable != NULL)
-    nnCacheTable->set(buf.result);
+    nnCacheTable->set(*buf.result,xSize,ySize);
+  if(nnDiskCache != NULL && isFreshEval)
+    nnDiskCache->set(*buf.result,xSize,ySize);
 
 }
 
 //Uncomment this to lower the effective hash size down to one where we get true collisions
 //#define SIMULATE_TRUE_HASH_COLLISIONS
 
-NNCacheTable::Entry::Entry()
-  :ptr(nullptr)
-{}
-NNCacheTable::Entry::~Entry()
+NNCacheTable::Bucket::Bucket()
+{
+  for(int i = 0; i<BUCKET_SIZE; i++) {
+    fingerprints[i].store(0,std::memory_order_relaxed);
+    hits[i] = 0;
+    ptrs[i] = NULL;
+  }
+}
+NNCacheTable::Bucket::~Bucket()
+{
+  for(int i = 0; i<BUCKET_SIZE; i++)
+    NNCompactOutput::destroy(ptrs[i]);
+}
+
+NNCacheTable::StatsStripe::StatsStripe()
+  :numHits(0),numMisses(0),numEvictions(0),numBytes(0),evictCursor(0)
 {}
 
-NNCacheTable::NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo) {
+static inline uint32_t cacheFingerprint(Hash128 nnHash) {
+#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
+  return (uint32_t)(nnHash.hash0 & 0xFFF) | 0x1000;
+#else
+  //Never zero, since zero marks an empty entry
+  return (uint32_t)(nnHash.hash1 >> 32) | 1;
+#endif
+}
+
+static inline bool cacheHashMatches(const NNCompactOutput& output, Hash128 nnHash) {
+#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
+  return ((output.nnHash.hash0 ^ nnHash.hash0) & 0xFFF) == 0;
+#else
+  return output.nnHash == nnHash;
+#endif
+}
+
+NNCacheTable::NNCacheTable(int sizePowerOfTwo) {
   if(sizePowerOfTwo < 0 || sizePowerOfTwo > 63)
     throw StringError("NNCacheTable: Invalid sizePowerOfTwo: " + Global::intToString(sizePowerOfTwo));
-  if(mutexPoolSizePowerOfTwo < 0 || mutexPoolSizePowerOfTwo > 31)
-    throw StringError("NNCacheTable: Invalid mutexPoolSizePowerOfTwo: " + Global::intToString(mutexPoolSizePowerOfTwo));
 #if defined(SIMULATE_TRUE_HASH_COLLISIONS)
   sizePowerOfTwo = sizePowerOfTwo > 12 ? 12 : sizePowerOfTwo;
 #endif
-
-  tableSize = ((uint64_t)1) << sizePowerOfTwo;
-  tableMask = tableSize-1;
-  entries = new Entry[tableSize];
-  uint32_t mutexPoolSize = ((uint32_t)1) << mutexPoolSizePowerOfTwo;
-  mutexPoolMask = mutexPoolSize-1;
-  mutexPool = new MutexPool(mutexPoolSize);
+  init(((uint64_t)1) << sizePowerOfTwo);
+  maxBytesPerStripe = 0;
+}
+NNCacheTable::NNCacheTable(int64_t maxBytes, int nnXLen, int nnYLen) {
+  if(maxBytes <= 0)
+    throw StringError("NNCacheTable: Invalid maxBytes: " + Global::int64ToString(maxBytes));
+  //Enough slots for the budget to fill up with entries for boards as small as 9x9, larger entries are limited by the byte budget instead
+  int slotXLen = std::min(nnXLen,9);
+  int slotYLen = std::min(nnYLen,9);
+  uint64_t numEntries = (uint64_t)maxBytes / approxBytesPerEntry(slotXLen,slotYLen,false);
+#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
+  numEntries = numEntries > 4096 ? 4096 : numEntries;
+#endif
+  init(numEntries);
+  int64_t tableBytes = (int64_t)(numBuckets * sizeof(Bucket) + NUM_STATS_STRIPES * sizeof(StatsStripe));
+  int64_t entryBytes = std::max(maxBytes - tableBytes, (int64_t)NUM_STATS_STRIPES);
+  maxBytesPerStripe = entryBytes / NUM_STATS_STRIPES;
+}
+void NNCacheTable::init(uint64_t numEntries) {
+  numBuckets = numEntries >= BUCKET_SIZE ? numEntries / BUCKET_SIZE : 1;
+  buckets = new Bucket[numBuckets];
+  statsBuf = new char[NUM_STATS_STRIPES * sizeof(StatsStripe) + alignof(StatsStripe)];
+  uintptr_t statsAddr = (uintptr_t)statsBuf;
+  statsAddr = (statsAddr + alignof(StatsStripe) - 1) & ~(uintptr_t)(alignof(StatsStripe) - 1);
+  stats = reinterpret_cast<StatsStripe*>(statsAddr);
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    new (&stats[i]) StatsStripe();
 }
 NNCacheTable::~NNCacheTable() {
-  delete[] entries;
-  delete mutexPool;
+  delete[] buckets;
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    stats[i].~StatsStripe();
+  delete[] statsBuf;
+}
+
+size_t NNCacheTable::approxBytesPerEntry(int xSize, int ySize, bool hasOwnerMap) {
+  //Plus the slot in the bucket and some allocator overhead
+  return NNCompactOutput::sizeInBytes(xSize,ySize,hasOwnerMap) + sizeof(Bucket) / BUCKET_SIZE + 16;
+}
+
+uint64_t NNCacheTable::getNumEntries() const {
+  return numBuckets * BUCKET_SIZE;
 }
 
 bool NNCacheTable::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
@@ -816,56 +1252,189 @@ bool NNCacheTable::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
   if(ret != nullptr)
     ret.reset();
 
-  uint64_t idx = nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t idx = nnHash.hash0 % numBuckets;
+  Bucket& bucket = buckets[idx];
+  StatsStripe& stripe = stats[idx & (NUM_STATS_STRIPES-1)];
+  uint32_t fingerprint = cacheFingerprint(nnHash);
 
-  std::lock_guard<std::mutex> lock(mutex);
+  //Most lookups miss, and for those we don't need to lock at all
+  bool maybeFound = false;
+  for(int i = 0; i<BUCKET_SIZE; i++) {
+    if(bucket.fingerprints[i].load(std::memory_order_relaxed) == fingerprint) {
+      maybeFound = true;
+      break;
+    }
+  }
 
   bool found = false;
-#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
-  if(entry.ptr != nullptr && ((entry.ptr->nnHash.hash0 ^ nnHash.hash0) & 0xFFF) == 0) {
-    ret = entry.ptr;
-    found = true;
-  }
-#else
-  if(entry.ptr != nullptr && entry.ptr->nnHash == nnHash) {
-    ret = entry.ptr;
-    found = true;
+  if(maybeFound) {
+    //Allocate before locking, decompressing into it is cheap
+    ret = std::make_shared<NNOutput>();
+    while(bucket.lock.test_and_set(std::memory_order_acquire));
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      if(bucket.ptrs[i] != NULL && cacheHashMatches(*bucket.ptrs[i],nnHash)) {
+        bucket.ptrs[i]->decompress(*ret);
+        if(bucket.hits[i] < 0xFFFF)
+          bucket.hits[i] += 1;
+        found = true;
+        break;
+      }
+    }
+    bucket.lock.clear(std::memory_order_release);
+    if(!found)
+      ret.reset();
   }
-#endif
+
+  if(found)
+    stripe.numHits.fetch_add(1,std::memory_order_relaxed);
+  else
+    stripe.numMisses.fetch_add(1,std::memory_order_relaxed);
   return found;
 }
 
-void NNCacheTable::set(const shared_ptr<NNOutput>& p) {
-  //Immediately copy p right now, before locking, to avoid any expensive operations while locked.
-  shared_ptr<NNOutput> buf(p);
+void NNCacheTable::set(const NNOutput& output, int boardXSize, int boardYSize) {
+  //Compress right now, before locking, to avoid any expensive operations while locked.
+  NNCompactOutput* buf = NNCompactOutput::compress(output,boardXSize,boardYSize);
+  int64_t bytesAdded = (int64_t)buf->sizeInBytes();
 
-  uint64_t idx = p->nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t idx = output.nnHash.hash0 % numBuckets;
+  Bucket& bucket = buckets[idx];
+  uint32_t fingerprint = cacheFingerprint(output.nnHash);
+  bool evicted = false;
 
-  {
-    std::lock_guard<std::mutex> lock(mutex);
-    //Perform a swap, to avoid any expensive free under the mutex.
-    entry.ptr.swap(buf);
+  while(bucket.lock.test_and_set(std::memory_order_acquire));
+
+  //Replace the same position if present, else fill an empty slot, else evict the least used entry
+  int slot = -1;
+  for(int i = 0; i<BUCKET_SIZE; i++) {
+    if(bucket.ptrs[i] != NULL && cacheHashMatches(*bucket.ptrs[i],output.nnHash)) {
+      slot = i;
+      break;
+    }
+  }
+  if(slot < 0) {
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      if(bucket.ptrs[i] == NULL) {
+        slot = i;
+        break;
+      }
+    }
+  }
+  if(slot < 0) {
+    slot = 0;
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      //Decay, so that entries that were popular long ago don't stay forever
+      bucket.hits[i] /= 2;
+      if(bucket.hits[i] < bucket.hits[slot])
+        slot = i;
+    }
+    evicted = true;
   }
+  if(bucket.ptrs[slot] == NULL || evicted)
+    bucket.hits[slot] = 0;
+  //Perform a swap, to avoid any expensive free under the lock.
+  std::swap(bucket.ptrs[slot],buf);
+  bucket.fingerprints[slot].store(fingerprint,std::memory_order_relaxed);
+  bucket.lock.clear(std::memory_order_release);
+
+  StatsStripe& stripe = stats[idx & (NUM_STATS_STRIPES-1)];
+  if(evicted)
+    stripe.numEvictions.fetch_add(1,std::memory_order_relaxed);
+  stripe.numBytes.fetch_add(bytesAdded - (buf == NULL ? 0 : (int64_t)buf->sizeInBytes()),std::memory_order_relaxed);
+
+  //No longer locked, free whatever used to be present in the table.
+  NNCompactOutput::destroy(buf);
+
+  if(maxBytesPerStripe > 0)
+    evictOverBudget(idx & (NUM_STATS_STRIPES-1));
+}
+
+void NNCacheTable::evictOverBudget(uint64_t stripeIdx) {
+  StatsStripe& stripe = stats[stripeIdx];
+  //Buckets idx with (idx & (NUM_STATS_STRIPES-1)) == stripeIdx belong to this stripe. Sweep over them like a clock hand,
+  //taking the least used entry of each. Bounded, so that a set never takes long, each set only adds one entry anyways.
+  uint64_t numStripeBuckets = (numBuckets - stripeIdx + NUM_STATS_STRIPES - 1) / NUM_STATS_STRIPES;
+  static constexpr int MAX_BUCKETS_TO_TRY = 8;
+  for(int tries = 0; tries < MAX_BUCKETS_TO_TRY; tries++) {
+    if(stripe.numBytes.load(std::memory_order_relaxed) <= maxBytesPerStripe)
+      break;
+    uint64_t cursor = stripe.evictCursor.fetch_add(1,std::memory_order_relaxed);
+    Bucket& bucket = buckets[stripeIdx + (cursor % numStripeBuckets) * NUM_STATS_STRIPES];
+
+    NNCompactOutput* buf = NULL;
+    while(bucket.lock.test_and_set(std::memory_order_acquire));
+    int slot = -1;
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      if(bucket.ptrs[i] != NULL && (slot < 0 || bucket.hits[i] < bucket.hits[slot]))
+        slot = i;
+    }
+    if(slot >= 0) {
+      buf = bucket.ptrs[slot];
+      bucket.ptrs[slot] = NULL;
+      bucket.hits[slot] = 0;
+      bucket.fingerprints[slot].store(0,std::memory_order_relaxed);
+    }
+    bucket.lock.clear(std::memory_order_release);
 
-  //No longer locked, allow buf to fall out of scope now, will free whatever used to be present in the table.
+    if(buf != NULL) {
+      stripe.numEvictions.fetch_add(1,std::memory_order_relaxed);
+      stripe.numBytes.fetch_add(-(int64_t)buf->sizeInBytes(),std::memory_order_relaxed);
+      NNCompactOutput::destroy(buf);
+    }
+  }
 }
 
 void NNCacheTable::clear() {
-  shared_ptr<NNOutput> buf;
-  for(size_t idx = 0; idx<tableSize; idx++) {
-    Entry& entry = entries[idx];
-    uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-    std::mutex& mutex = mutexPool->getMutex(mutexIdx);
-    {
-      std::lock_guard<std::mutex> lock(mutex);
-      entry.ptr.swap(buf);
+  NNCompactOutput* buf[BUCKET_SIZE];
+  for(uint64_t idx = 0; idx<numBuckets; idx++) {
+    Bucket& bucket = buckets[idx];
+    while(bucket.lock.test_and_set(std::memory_order_acquire));
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      bucket.fingerprints[i].store(0,std::memory_order_relaxed);
+      bucket.hits[i] = 0;
+      buf[i] = bucket.ptrs[i];
+      bucket.ptrs[i] = NULL;
     }
-    buf.reset();
+    bucket.lock.clear(std::memory_order_release);
+
+    int64_t bytesFreed = 0;
+    for(int i = 0; i<BUCKET_SIZE; i++) {
+      if(buf[i] != NULL)
+        bytesFreed += (int64_t)buf[i]->sizeInBytes();
+      NNCompactOutput::destroy(buf[i]);
+    }
+    stats[idx & (NUM_STATS_STRIPES-1)].numBytes.fetch_add(-bytesFreed,std::memory_order_relaxed);
+  }
+}
+
+uint64_t NNCacheTable::numHits() const {
+  uint64_t total = 0;
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    total += stats[i].numHits.load(std::memory_order_relaxed);
+  return total;
+}
+uint64_t NNCacheTable::numMisses() const {
+  uint64_t total = 0;
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    total += stats[i].numMisses.load(std::memory_order_relaxed);
+  return total;
+}
+uint64_t NNCacheTable::numEvictions() const {
+  uint64_t total = 0;
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    total += stats[i].numEvictions.load(std::memory_order_relaxed);
+  return total;
+}
+int64_t NNCacheTable::numBytesUsed() const {
+  int64_t total = 0;
+  for(int i = 0; i<NUM_STATS_STRIPES; i++)
+    total += stats[i].numBytes.load(std::memory_order_relaxed);
+  return total;
+}
+void NNCacheTable::clearStats() {
+  for(int i = 0; i<NUM_STATS_STRIPES; i++) {
+    stats[i].numHits.store(0,std::memory_order_relaxed);
+    stats[i].numMisses.store(0,std::memory_order_relaxed);
+    stats[i].numEvictions.store(0,std::memory_order_relaxed);
   }
 }
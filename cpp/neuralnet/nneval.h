@@ -1,6 +1,7 @@
 #ifndef NEURALNET_NNEVAL_H_
 #define NEURALNET_NNEVAL_H_
 
+#include <chrono>
 #include <memory>
 
 #include "../core/global.h"
@@ -8,36 +9,83 @@
 #include "../core/multithread.h"
 #include "../game/board.h"
 #include "../game/boardhistory.h"
+#include "../neuralnet/nndiskcache.h"
 #include "../neuralnet/nninputs.h"
 #include "../neuralnet/nninterface.h"
-#include "../search/mutexpool.h"
 
 class NNEvaluator;
 
+//Set-associative cache of nn outputs, stored as NNCompactOutput. Each bucket holds a few entries along with a fingerprint of each one's hash,
+//so that lookups that miss (most of them, for new leaves) only read the fingerprints and never lock anything.
+//Lookups that might hit and all writes lock just the one bucket, with a spinlock.
+//When a bucket is full, the entry that has been looked up the least (with older lookups decaying) is replaced,
+//so that positions that the search keeps coming back to stay in the cache.
+//Entries are kept at half precision, so a hit returns values rounded slightly differently than the fresh evaluation
+//that was stored, see NNCompactOutput.
 class NNCacheTable {
-  struct Entry {
-    std::shared_ptr<NNOutput> ptr;
-    Entry();
-    ~Entry();
+ public:
+  static constexpr int BUCKET_SIZE = 4;
+
+ private:
+  struct Bucket {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    std::atomic<uint32_t> fingerprints[BUCKET_SIZE]; //0 if empty
+    uint32_t hits[BUCKET_SIZE]; //Decaying count of lookups of each entry
+    NNCompactOutput* ptrs[BUCKET_SIZE];
+    Bucket();
+    ~Bucket();
   };
+  //Striped so that counting doesn't itself become a point of contention, one cache line each
+  struct alignas(64) StatsStripe {
+    std::atomic<uint64_t> numHits;
+    std::atomic<uint64_t> numMisses;
+    std::atomic<uint64_t> numEvictions;
+    std::atomic<int64_t> numBytes;
+    std::atomic<uint64_t> evictCursor; //Which of this stripe's buckets to evict from next when over the byte budget
+    StatsStripe();
+  };
+  static constexpr int NUM_STATS_STRIPES = 64;
+
+  Bucket* buckets;
+  uint64_t numBuckets;
+  StatsStripe* stats;
+  //Backing memory for stats, allocated with room to align them to a cache line. new only guarantees that from C++17.
+  char* statsBuf;
+  //Budget for the bytes of entries in the buckets of each stats stripe, 0 if the table is only limited by its number of entries.
+  int64_t maxBytesPerStripe;
 
-  Entry* entries;
-  MutexPool* mutexPool;
-  uint64_t tableSize;
-  uint64_t tableMask;
-  uint32_t mutexPoolMask;
+  void init(uint64_t numEntries);
+  void evictOverBudget(uint64_t stripeIdx);
 
  public:
-  NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo);
+  //Holds 2 ** sizePowerOfTwo entries
+  NNCacheTable(int sizePowerOfTwo);
+  //Uses about maxBytes in total. The table has enough slots for small boards, and entries are counted by their actual size
+  //(board area and whether they have an owner map), evicting least used entries once the stored entries exceed the budget.
+  NNCacheTable(int64_t maxBytes, int nnXLen, int nnYLen);
   ~NNCacheTable();
 
+  //Approximate memory for one entry on an xSize x ySize board, including the table's own overhead.
+  static size_t approxBytesPerEntry(int xSize, int ySize, bool hasOwnerMap);
+
   NNCacheTable(const NNCacheTable& other) = delete;
   NNCacheTable& operator=(const NNCacheTable& other) = delete;
 
-  //These are thread-safe. For get, ret will be set to nullptr upon a failure to find.
+  //These are thread-safe. For get, ret will be set to nullptr upon a failure to find, else to a fresh
+  //decompressed copy of the entry, with values rounded to half precision and the policy renormalized.
   bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
-  void set(const std::shared_ptr<NNOutput>& p);
+  void set(const NNOutput& output, int boardXSize, int boardYSize);
   void clear();
+
+  uint64_t getNumEntries() const;
+
+  //Also thread-safe, although not synchronized with concurrent gets and sets.
+  uint64_t numHits() const;
+  uint64_t numMisses() const;
+  uint64_t numEvictions() const;
+  //Bytes of entries currently stored, not counting the table itself.
+  int64_t numBytesUsed() const;
+  void clearStats();
 };
 
 //Each thread should allocate and re-use one of these
@@ -55,6 +103,14 @@ struct NNResultBuf {
   std::shared_ptr<NNOutput> result;
   bool errorLogLockout; //error flag to restrict log to 1 error to prevent spam
 
+  //What the client needs to postprocess the raw result, recorded when the evaluation is submitted
+  bool needsPostprocess;
+  Hash128 nnHash;
+  Player nextPlayer;
+  bool noResultPossible;
+  bool isLegal[NNPos::MAX_NN_POLICY_SIZE];
+  std::shared_ptr<NNOutput> resultWithoutOwnerMap;
+
   NNResultBuf();
   ~NNResultBuf();
   NNResultBuf(const NNResultBuf& other) = delete;
@@ -87,11 +143,12 @@ class NNEvaluator {
     bool requireExactNNLen,
     bool inputsUseNHWC,
     int nnCacheSizePowerOfTwo,
-    int nnMutexPoolSizePowerofTwo,
+    int64_t nnCacheMaxBytes, //If positive, size the cache by this memory budget instead of by nnCacheSizePowerOfTwo
     bool debugSkipNeuralNet,
     float nnPolicyTemperature,
     std::string openCLTunerFile,
-    bool openCLReTunePerBoardSize
+    bool openCLReTunePerBoardSize,
+    int cpuNumThreadsPerServer //0 to use all hardware threads, see NeuralNet::createComputeContext
   );
   ~NNEvaluator();
 
@@ -123,15 +180,55 @@ class NNEvaluator {
     bool includeOwnerMap
   );
 
+  //Non-blocking version of evaluate, so that a single client thread can keep several evaluations in flight, each
+  //with its own NNResultBuf. Queues the position and returns immediately. Returns true if the result is already
+  //available (i.e. from the cache), in which case it is in buf.result just as after evaluate.
+  //Otherwise, call pollEvaluate or waitForEvaluate to obtain it. The board and history are not needed after this returns.
+  //This function is threadsafe.
+  bool submitEvaluate(
+    Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    double drawEquivalentWinsForWhite,
+    NNResultBuf& buf,
+    Logger* logger,
+    bool skipCache,
+    bool includeOwnerMap
+  );
+  //The two halves of submitEvaluate, so that a client can queue several positions at once, for them to be evaluated
+  //together in as few batches as possible. prepareEvaluate does all the work that needs the board and history, and
+  //returns true if the result is already available just as submitEvaluate does. Otherwise, once the positions are
+  //prepared, pass them all to queueEvaluates, and then obtain each one with pollEvaluate or waitForEvaluate.
+  //These functions are threadsafe.
+  bool prepareEvaluate(
+    Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    double drawEquivalentWinsForWhite,
+    NNResultBuf& buf,
+    Logger* logger,
+    bool skipCache,
+    bool includeOwnerMap
+  );
+  void queueEvaluates(NNResultBuf* const* bufs, int numBufs);
+  //Returns true and finishes the result in buf.result if the evaluation submitted with buf is done, else returns false.
+  bool pollEvaluate(NNResultBuf& buf, Logger* logger);
+  //Blocks until the evaluation submitted with buf is done and finishes the result in buf.result.
+  void waitForEvaluate(NNResultBuf& buf, Logger* logger);
+
   //Actually spawn threads and return the results.
   //If doRandomize, uses randSeed as a seed, further randomized per-thread
   //If not doRandomize, uses defaultSymmetry for all nn evaluations.
+  //If numSymmetriesToAverage > 1, every position is evaluated under that many distinct symmetries within the same
+  //batch and the outputs are averaged before being returned and cached. Without doRandomize, these are the symmetries
+  //defaultSymmetry ^ i for i = 0,1,...,numSymmetriesToAverage-1, with doRandomize they are a random subset.
   //This function itself is not threadsafe.
   void spawnServerThreads(
     int numThreads,
     bool doRandomize,
     std::string randSeed,
     int defaultSymmetry,
+    int numSymmetriesToAverage,
     Logger& logger,
     std::vector<int> gpuIdxByServerThread,
     bool useFP16,
@@ -142,10 +239,40 @@ class NNEvaluator {
   //should have calls to it and spawnServerThreads singlethreaded.
   void killServerThreads();
 
+  //Configure how server threads form batches. A server thread that finds only a partially filled batch waits until
+  //there are at least minBatchFill positions in it, or until maxBatchWaitMicroseconds have passed since the first of
+  //them was queued. If adaptive, minBatchFill is only the starting point, and the fill target is instead chosen from the
+  //measured backend latency by batch size - the smallest batch whose time per position is within 10% of the best
+  //measured, never waiting longer than such a batch takes to evaluate. The default of (1, 0, false) serves whatever is
+  //queued right away. This function is threadsafe.
+  void setBatchingPolicy(int minBatchFill, double maxBatchWaitMicroseconds, bool adaptive);
+  //Only for debugSkipNeuralNet, so that batching can be benchmarked without a neural net - every batch takes an extra
+  //fixedMicroseconds + perRowMicroseconds * (number of rows) to evaluate. This function is threadsafe.
+  void setDebugLatencyModel(double fixedMicroseconds, double perRowMicroseconds);
+  //Only for testing - after numEvaluates more positions are submitted for evaluation, make every further one throw.
+  //Negative to stop throwing, which is the default. This function is threadsafe.
+  void setDebugThrowAfterEvaluates(int64_t numEvaluates);
+  //The number of positions server threads currently try to fill batches up to.
+  int getBatchFillTarget() const;
+
+  //Also look up and store evaluations in a persistent cache in fileName, which may be shared with other processes,
+  //creating it with room for about maxBytes of entries if needed. See nndiskcache.h.
+  //Must be called before any evaluations are performed, NOT threadsafe.
+  void setDiskCache(const std::string& fileName, int64_t maxBytes, Logger* logger);
+
   //Some stats
+  //Rows are neural net batch rows, so when averaging symmetries every position costs numSymmetriesToAverage rows.
   uint64_t numRowsProcessed() const;
   uint64_t numBatchesProcessed() const;
   double averageProcessedBatchSize() const;
+  //Lookups in the nn cache, and entries that were pushed out of it to make room. Zero if there is no cache.
+  uint64_t numCacheHits() const;
+  uint64_t numCacheMisses() const;
+  uint64_t numCacheEvictions() const;
+  int64_t numCacheBytesUsed() const;
+  //Lookups in the nn disk cache, made only for positions missing from the nn cache. Zero if there is no disk cache.
+  uint64_t numDiskCacheHits() const;
+  uint64_t numDiskCacheMisses() const;
 
   void clearStats();
 
@@ -161,6 +288,7 @@ class NNEvaluator {
   ComputeContext* computeContext;
   LoadedModel* loadedModel;
   NNCacheTable* nnCacheTable;
+  NNDiskCache* nnDiskCache;
 
   bool debugSkipNeuralNet;
   float nnPolicyInvTemperature;
@@ -181,6 +309,19 @@ class NNEvaluator {
   std::atomic<uint64_t> m_numRowsProcessed;
   std::atomic<uint64_t> m_numBatchesProcessed;
 
+  //Batching policy, see setBatchingPolicy. Protected by bufferMutex.
+  int minBatchFill;
+  double maxBatchWaitSeconds;
+  bool adaptiveBatching;
+  std::atomic<int> m_batchFillTarget;
+  double m_batchWaitSeconds;
+  std::vector<double> m_batchSecondsByNumRows; //Moving average of the time to evaluate a batch, negative if never seen
+  std::chrono::steady_clock::time_point m_currentBatchDeadline; //Batch start plus m_batchWaitSeconds
+  double debugLatencyFixedSeconds;
+  double debugLatencyPerRowSeconds;
+  std::atomic<bool> debugShouldThrow;
+  std::atomic<int64_t> debugEvaluatesBeforeThrow;
+
   //An array of NNResultBuf** of length numResultBufss, each NNResultBuf** is an array of NNResultBuf* of length maxNumRows.
   //If a full resultBufs array fills up, client threads can move on to fill up more without waiting. Implemented basically
   //as a circular buffer.
@@ -189,10 +330,18 @@ class NNEvaluator {
   int m_currentResultBufsIdx; //Index of the current resultBufs being filled.
   int m_oldestResultBufsIdx; //Index of the oldest resultBufs that still needs to be processed by a server thread
 
+  //Turn the raw result of an evaluation into probabilities and values and cache it. Board and history are optional,
+  //only for debug output.
+  void postprocessResult(NNResultBuf& buf, Logger* logger, const Board* board, const BoardHistory* history);
+
+  //Record how long a batch took and recompute the fill target. bufferMutex must be held.
+  void recordBatchLatency(int numRows, double seconds);
+  void updateBatchFillTarget();
+
  public:
   //Helper, for internal use only
   void serve(
-    NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
+    NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry, int numSymmetriesToAverage,
     int gpuIdxForThisThread, bool useFP16, bool useNHWC
   );
 };
@@ -1,5 +1,11 @@
 #include "../neuralnet/nninputs.h"
 
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+#include "../game/areacache.h"
+
 using namespace std;
 
 int NNPos::xyToPos(int x, int y, int nnXLen) {
@@ -73,12 +79,15 @@ static double inverse_atan(double x) {
 }
 
 double ScoreValue::approxWhiteScoreOfScoreValueSmooth(double scoreValue, double center, double scale, const Board& b) {
+  return approxWhiteScoreOfScoreValueSmooth(scoreValue,center,scale,b.x_size,b.y_size);
+}
+double ScoreValue::approxWhiteScoreOfScoreValueSmooth(double scoreValue, double center, double scale, int xSize, int ySize) {
   assert(scoreValue >= -1 && scoreValue <= 1);
   double scoreUnscaled = inverse_atan(scoreValue*piOverTwo);
-  if(b.x_size == b.y_size)
-    return scoreUnscaled * (scale*b.x_size) + center;
+  if(xSize == ySize)
+    return scoreUnscaled * (scale*xSize) + center;
   else
-    return scoreUnscaled * (scale*sqrt(b.x_size*b.y_size)) + center;
+    return scoreUnscaled * (scale*sqrt(xSize*ySize)) + center;
 }
 
 double ScoreValue::whiteScoreMeanSqOfScoreGridded(double finalWhiteMinusBlackScore, double drawEquivalentWinsForWhite, const BoardHistory& hist) {
@@ -259,6 +268,177 @@ NNOutput::~NNOutput() {
   }
 }
 
+//-----------------------------------------------------------------------------------------------------------
+
+//IEEE half precision, rounding to nearest even
+uint16_t NNCompactOutput::floatToHalf(float f) {
+  uint32_t x;
+  std::memcpy(&x,&f,sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t absx = x & 0x7FFFFFFF;
+  //Inf or nan
+  if(absx >= 0x7F800000)
+    return (uint16_t)(sign | 0x7C00 | (absx > 0x7F800000 ? 0x200 : 0));
+  //Too large, rounds to inf
+  if(absx >= 0x477FF000)
+    return (uint16_t)(sign | 0x7C00);
+  //Subnormal or zero
+  if(absx < 0x38800000) {
+    if(absx < 0x33000000)
+      return (uint16_t)sign;
+    uint32_t mantissa = (absx & 0x7FFFFF) | 0x800000;
+    uint32_t shift = 126 - (absx >> 23);
+    uint32_t result = mantissa >> shift;
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if(remainder > halfway || (remainder == halfway && (result & 1)))
+      result += 1;
+    return (uint16_t)(sign | result);
+  }
+  uint32_t result = (absx - 0x38000000) >> 13;
+  uint32_t remainder = absx & 0x1FFF;
+  if(remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+    result += 1;
+  return (uint16_t)(sign | result);
+}
+
+float NNCompactOutput::halfToFloat(uint16_t h) {
+  uint32_t sign = ((uint32_t)h & 0x8000) << 16;
+  uint32_t exponent = ((uint32_t)h >> 10) & 0x1F;
+  uint32_t mantissa = (uint32_t)h & 0x3FF;
+  if(exponent == 0) {
+    float f = (float)mantissa * (1.0f / 16777216.0f);
+    return sign != 0 ? -f : f;
+  }
+  uint32_t x;
+  if(exponent == 31)
+    x = sign | 0x7F800000 | (mantissa << 13);
+  else
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float f;
+  std::memcpy(&f,&x,sizeof(f));
+  return f;
+}
+
+size_t NNCompactOutput::sizeInBytes(int boardXSize, int boardYSize, bool hasOwnerMap) {
+  int area = boardXSize * boardYSize;
+  return sizeof(NNCompactOutput) + sizeof(uint16_t) * (area + 1 + (hasOwnerMap ? area : 0));
+}
+size_t NNCompactOutput::sizeInBytes() const {
+  return sizeInBytes(boardXSize,boardYSize,hasOwnerMap);
+}
+
+NNCompactOutput* NNCompactOutput::compress(const NNOutput& output, int boardXSize, int boardYSize, bool includeOwnerMap) {
+  assert(boardXSize <= output.nnXLen && boardYSize <= output.nnYLen);
+  bool hasOwnerMap = includeOwnerMap && output.whiteOwnerMap != NULL;
+  void* mem = ::operator new(sizeInBytes(boardXSize,boardYSize,hasOwnerMap));
+  NNCompactOutput* compact = new(mem) NNCompactOutput();
+
+  compact->nnHash = output.nnHash;
+  compact->whiteWinProb = output.whiteWinProb;
+  compact->whiteLossProb = output.whiteLossProb;
+  compact->whiteNoResultProb = output.whiteNoResultProb;
+  compact->whiteScoreMean = output.whiteScoreMean;
+  compact->whiteScoreMeanSq = output.whiteScoreMeanSq;
+  compact->nnXLen = (int16_t)output.nnXLen;
+  compact->nnYLen = (int16_t)output.nnYLen;
+  compact->boardXSize = (int16_t)boardXSize;
+  compact->boardYSize = (int16_t)boardYSize;
+  compact->hasOwnerMap = hasOwnerMap;
+
+  uint16_t* policy = compact->data();
+  int area = boardXSize * boardYSize;
+  for(int y = 0; y<boardYSize; y++) {
+    for(int x = 0; x<boardXSize; x++)
+      policy[x + y * boardXSize] = floatToHalf(output.policyProbs[NNPos::xyToPos(x,y,output.nnXLen)]);
+  }
+  policy[area] = floatToHalf(output.policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,output.nnXLen,output.nnYLen)]);
+
+  if(hasOwnerMap) {
+    uint16_t* ownerMap = policy + area + 1;
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++)
+        ownerMap[x + y * boardXSize] = floatToHalf(output.whiteOwnerMap[NNPos::xyToPos(x,y,output.nnXLen)]);
+    }
+  }
+  return compact;
+}
+
+NNCompactOutput* NNCompactOutput::fromBytes(const char* bytes, size_t numBytes) {
+  if(numBytes < sizeof(NNCompactOutput))
+    return NULL;
+  char hasOwnerMapByte = bytes[offsetof(NNCompactOutput,hasOwnerMap)];
+  if(hasOwnerMapByte != 0 && hasOwnerMapByte != 1)
+    return NULL;
+  NNCompactOutput header;
+  std::memcpy(static_cast<void*>(&header),bytes,sizeof(NNCompactOutput));
+  if(header.nnXLen <= 0 || header.nnXLen > NNPos::MAX_BOARD_LEN || header.nnYLen <= 0 || header.nnYLen > NNPos::MAX_BOARD_LEN ||
+     header.boardXSize <= 0 || header.boardXSize > header.nnXLen || header.boardYSize <= 0 || header.boardYSize > header.nnYLen)
+    return NULL;
+  if(numBytes != header.sizeInBytes())
+    return NULL;
+
+  void* mem = ::operator new(numBytes);
+  NNCompactOutput* compact = new(mem) NNCompactOutput();
+  std::memcpy(static_cast<void*>(compact),bytes,numBytes);
+  return compact;
+}
+
+void NNCompactOutput::destroy(NNCompactOutput* compact) {
+  if(compact == NULL)
+    return;
+  compact->~NNCompactOutput();
+  ::operator delete(compact);
+}
+
+void NNCompactOutput::decompress(NNOutput& output) const {
+  output.nnHash = nnHash;
+  output.whiteWinProb = whiteWinProb;
+  output.whiteLossProb = whiteLossProb;
+  output.whiteNoResultProb = whiteNoResultProb;
+  output.whiteScoreMean = whiteScoreMean;
+  output.whiteScoreMeanSq = whiteScoreMeanSq;
+  output.nnXLen = nnXLen;
+  output.nnYLen = nnYLen;
+
+  const uint16_t* policy = data();
+  int area = boardXSize * boardYSize;
+  std::fill(output.policyProbs, output.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+  for(int y = 0; y<boardYSize; y++) {
+    for(int x = 0; x<boardXSize; x++)
+      output.policyProbs[NNPos::xyToPos(x,y,nnXLen)] = halfToFloat(policy[x + y * boardXSize]);
+  }
+  output.policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen)] = halfToFloat(policy[area]);
+
+  //Rounding can leave the policy summing to slightly more or less than 1, so renormalize
+  double policySum = 0.0;
+  for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++) {
+    if(output.policyProbs[i] > 0.0f)
+      policySum += output.policyProbs[i];
+  }
+  if(policySum > 0.0) {
+    float invSum = (float)(1.0 / policySum);
+    for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++) {
+      if(output.policyProbs[i] > 0.0f)
+        output.policyProbs[i] *= invSum;
+    }
+  }
+
+  if(output.whiteOwnerMap != NULL) {
+    delete[] output.whiteOwnerMap;
+    output.whiteOwnerMap = NULL;
+  }
+  if(hasOwnerMap) {
+    const uint16_t* ownerMap = policy + area + 1;
+    output.whiteOwnerMap = new float[nnXLen * nnYLen];
+    std::fill(output.whiteOwnerMap, output.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++)
+        output.whiteOwnerMap[NNPos::xyToPos(x,y,nnXLen)] = halfToFloat(ownerMap[x + y * boardXSize]);
+    }
+  }
+}
+
 
 void NNOutput::debugPrint(ostream& out, const Board& board) {
   out << "Win " << Global::strprintf("%.2fc",whiteWinProb*100) << endl;
@@ -308,6 +488,83 @@ static void setRowBinV5(float* rowBin, int pos, int feature, float value, int po
 }
 
 
+namespace {
+  //Result of the ladder search for one chain of one position. The chain is identified by its first stone in
+  //raster order, which unlike chain_head does not depend on the order the position was reached in.
+  struct LadderCacheEntry {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    Hash128 posHash; //Zero if empty
+    Loc koLoc;
+    Loc chainLoc;
+    bool laddered;
+    uint8_t numWorkingMoves;
+    Loc workingMoves[2];
+  };
+
+  static constexpr int LADDER_CACHE_SIZE_POWER_OF_TWO = 16;
+  static constexpr uint64_t LADDER_CACHE_MASK = ((uint64_t)1 << LADDER_CACHE_SIZE_POWER_OF_TWO) - 1;
+  static LadderCacheEntry ladderCache[(uint64_t)1 << LADDER_CACHE_SIZE_POWER_OF_TWO];
+  static std::atomic<uint64_t> ladderCacheHits(0);
+  static std::atomic<uint64_t> ladderCacheMisses(0);
+
+  static inline LadderCacheEntry& getLadderCacheEntry(Hash128 posHash, Loc koLoc, Loc chainLoc) {
+    uint64_t h = posHash.hash0 ^ ((uint64_t)chainLoc * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)koLoc * 0xC2B2AE3D27D4EB4FULL);
+    return ladderCache[(h ^ (h >> 32)) & LADDER_CACHE_MASK];
+  }
+
+  static bool ladderCacheGet(Hash128 posHash, Loc koLoc, Loc chainLoc, bool& laddered, vector<Loc>& workingMoves) {
+    LadderCacheEntry& entry = getLadderCacheEntry(posHash,koLoc,chainLoc);
+    while(entry.lock.test_and_set(std::memory_order_acquire));
+    bool found = entry.posHash == posHash && entry.koLoc == koLoc && entry.chainLoc == chainLoc;
+    if(found) {
+      laddered = entry.laddered;
+      workingMoves.clear();
+      for(int i = 0; i<entry.numWorkingMoves; i++)
+        workingMoves.push_back(entry.workingMoves[i]);
+    }
+    entry.lock.clear(std::memory_order_release);
+    if(found)
+      ladderCacheHits.fetch_add(1,std::memory_order_relaxed);
+    else
+      ladderCacheMisses.fetch_add(1,std::memory_order_relaxed);
+    return found;
+  }
+
+  static void ladderCachePut(Hash128 posHash, Loc koLoc, Loc chainLoc, bool laddered, const vector<Loc>& workingMoves) {
+    assert(workingMoves.size() <= 2);
+    LadderCacheEntry& entry = getLadderCacheEntry(posHash,koLoc,chainLoc);
+    while(entry.lock.test_and_set(std::memory_order_acquire));
+    entry.posHash = posHash;
+    entry.koLoc = koLoc;
+    entry.chainLoc = chainLoc;
+    entry.laddered = laddered;
+    entry.numWorkingMoves = (uint8_t)workingMoves.size();
+    for(size_t i = 0; i<workingMoves.size(); i++)
+      entry.workingMoves[i] = workingMoves[i];
+    entry.lock.clear(std::memory_order_release);
+  }
+}
+
+void NNInputs::clearLadderCache() {
+  for(uint64_t i = 0; i <= LADDER_CACHE_MASK; i++) {
+    LadderCacheEntry& entry = ladderCache[i];
+    while(entry.lock.test_and_set(std::memory_order_acquire));
+    entry.posHash = Hash128();
+    entry.lock.clear(std::memory_order_release);
+  }
+  ladderCacheHits.store(0);
+  ladderCacheMisses.store(0);
+}
+
+void NNInputs::getLadderCacheStats(uint64_t& numHits, uint64_t& numMisses) {
+  numHits = ladderCacheHits.load();
+  numMisses = ladderCacheMisses.load();
+}
+
+//Each thread filling rows tends to go through positions of the same game or search tree, which share most of their
+//pass-alive regions, so the area features reuse those of the last position the thread filled.
+static thread_local AreaCache areaCache;
+
 //Calls f on each location that is part of an inescapable atari, or a group that can be put into inescapable atari
 static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,int,const vector<Loc>&)> f) {
   int xSize = board.x_size;
@@ -316,7 +573,8 @@ static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,i
   Loc chainHeadsSolved[Board::MAX_PLAY_SIZE];
   bool chainHeadsSolvedValue[Board::MAX_PLAY_SIZE];
   int numChainHeadsSolved = 0;
-  Board copy(board);
+  //Only copied once some chain actually needs a search
+  Board* copy = NULL;
   vector<Loc> buf;
   vector<Loc> workingMoves;
 
@@ -341,13 +599,20 @@ static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,i
             }
           }
           if(!alreadySolved) {
-            //Perform search on copy so as not to mess up tracking of solved heads
+            //Scanning in raster order, this is the first stone of the chain, which identifies it in the cache
             bool laddered;
-            if(libs == 1)
-              laddered = copy.searchIsLadderCaptured(loc,true,buf);
-            else {
+            if(!ladderCacheGet(board.pos_hash,board.ko_loc,loc,laddered,workingMoves)) {
+              //Perform search on copy so as not to mess up tracking of solved heads
+              if(copy == NULL)
+                copy = new Board(board);
               workingMoves.clear();
-              laddered = copy.searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+              if(libs == 1)
+                laddered = copy->searchIsLadderCaptured(loc,true,buf);
+              else
+                laddered = copy->searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+              if(!laddered)
+                workingMoves.clear();
+              ladderCachePut(board.pos_hash,board.ko_loc,loc,laddered,workingMoves);
             }
 
             chainHeadsSolved[numChainHeadsSolved] = head;
@@ -360,6 +625,7 @@ static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,i
       }
     }
   }
+  delete copy;
 }
 
 
@@ -578,7 +844,7 @@ void NNInputs::fillRowV3(
 
   iterLadders(board, nnXLen, addLadderFeature);
 
-  const Board& prevBoard = hist.getRecentBoard(1);
+  const Board prevBoard = hist.getRecentBoard(board,1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -588,7 +854,7 @@ void NNInputs::fillRowV3(
   };
   iterLadders(prevBoard, nnXLen, addPrevLadderFeature);
 
-  const Board& prevPrevBoard = hist.getRecentBoard(2);
+  const Board prevPrevBoard = hist.getRecentBoard(board,2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -604,13 +870,13 @@ void NNInputs::fillRowV3(
     bool nonPassAliveStones = true;
     bool safeBigTerritories = true;
     bool unsafeBigTerritories = true;
-    board.calculateArea(area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
+    areaCache.calculateArea(board,area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
   }
   else if(hist.rules.scoringRule == Rules::SCORING_TERRITORY) {
     bool nonPassAliveStones = false;
     bool safeBigTerritories = true;
     bool unsafeBigTerritories = false;
-    board.calculateArea(area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
+    areaCache.calculateArea(board,area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
   }
   else {
     ASSERT_UNREACHABLE;
@@ -970,7 +1236,7 @@ void NNInputs::fillRowV4(
 
   iterLadders(board, nnXLen, addLadderFeature);
 
-  const Board& prevBoard = hist.getRecentBoard(1);
+  const Board prevBoard = hist.getRecentBoard(board,1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -980,7 +1246,7 @@ void NNInputs::fillRowV4(
   };
   iterLadders(prevBoard, nnXLen, addPrevLadderFeature);
 
-  const Board& prevPrevBoard = hist.getRecentBoard(2);
+  const Board prevPrevBoard = hist.getRecentBoard(board,2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -996,7 +1262,7 @@ void NNInputs::fillRowV4(
     bool nonPassAliveStones = false;
     bool safeBigTerritories = true;
     bool unsafeBigTerritories = false;
-    board.calculateArea(area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
+    areaCache.calculateArea(board,area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,hist.rules.multiStoneSuicideLegal);
   }
 
   for(int y = 0; y<ySize; y++) {
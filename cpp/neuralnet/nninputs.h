@@ -64,6 +64,11 @@ namespace NNInputs {
     double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, float* rowBin, float* rowGlobal
   );
 
+  //The ladder features solve the ladders of the current board and the previous two boards. Results are cached
+  //process-wide by position and chain, so that the previous boards mostly reuse what was solved back when they
+  //were the current board. Threadsafe.
+  void clearLadderCache();
+  void getLadderCacheStats(uint64_t& numHits, uint64_t& numMisses);
 }
 
 struct NNOutput {
@@ -98,6 +103,53 @@ struct NNOutput {
   void debugPrint(std::ostream& out, const Board& board);
 };
 
+//Compact copy of an NNOutput, for storing many of them in the nn cache. Lives in a single allocation, with the policy
+//and ownership stored inline in half precision and only for the actual board area, rather than the full nn area.
+//Decompressing gives back the values rounded to half precision, illegal and off-board policy as -1, and off-board
+//ownership as 0. The policy is renormalized after rounding. Fresh nn evaluations are not rounded, so a position's values
+//differ slightly (by up to about 1 part in 2000) between a cache hit and a miss, and a search is only reproducible
+//given the same cache contents.
+class NNCompactOutput {
+ public:
+  Hash128 nnHash;
+  float whiteWinProb;
+  float whiteLossProb;
+  float whiteNoResultProb;
+  float whiteScoreMean;
+  float whiteScoreMeanSq;
+  int16_t nnXLen;
+  int16_t nnYLen;
+  int16_t boardXSize;
+  int16_t boardYSize;
+  bool hasOwnerMap;
+
+  static NNCompactOutput* compress(const NNOutput& output, int boardXSize, int boardYSize, bool includeOwnerMap = true);
+  static void destroy(NNCompactOutput* compact);
+  //The whole object is these sizeInBytes() bytes, which can be copied elsewhere and turned back into one with
+  //fromBytes. Returns NULL if the bytes are not consistent with a valid NNCompactOutput of that size.
+  const char* bytes() const { return reinterpret_cast<const char*>(this); }
+  static NNCompactOutput* fromBytes(const char* bytes, size_t numBytes);
+  //output should be freshly constructed
+  void decompress(NNOutput& output) const;
+
+  size_t sizeInBytes() const;
+  static size_t sizeInBytes(int boardXSize, int boardYSize, bool hasOwnerMap);
+
+  //IEEE half precision conversions used for the policy and ownership, rounding to nearest even. Exposed for testing.
+  static uint16_t floatToHalf(float f);
+  static float halfToFloat(uint16_t h);
+
+  NNCompactOutput(const NNCompactOutput& other) = delete;
+  NNCompactOutput& operator=(const NNCompactOutput& other) = delete;
+
+ private:
+  NNCompactOutput() {}
+  ~NNCompactOutput() {}
+  //boardXSize*boardYSize+1 policy values, followed by boardXSize*boardYSize ownership values if hasOwnerMap
+  uint16_t* data() { return reinterpret_cast<uint16_t*>(this+1); }
+  const uint16_t* data() const { return reinterpret_cast<const uint16_t*>(this+1); }
+};
+
 //Utility functions for computing the "scoreValue", the unscaled utility of various numbers of points, prior to multiplication by
 //staticScoreUtilityFactor or dynamicScoreUtilityFactor (see searchparams.h)
 namespace ScoreValue {
@@ -115,6 +167,7 @@ namespace ScoreValue {
   double whiteScoreValueOfScoreSmoothNoDrawAdjust(double finalWhiteMinusBlackScore, double center, double scale, const Board& b);
   //Approximately invert whiteScoreValueOfScoreSmooth
   double approxWhiteScoreOfScoreValueSmooth(double scoreValue, double center, double scale, const Board& b);
+  double approxWhiteScoreOfScoreValueSmooth(double scoreValue, double center, double scale, int xSize, int ySize);
 
   //Compute what the scoreMeanSq should be for a final game result
   //It is NOT simply the same as finalWhiteMinusBlackScore^2 because for integer komi we model it as a distribution where with the appropriate probability
@@ -52,6 +52,8 @@ namespace NeuralNet {
     int nnYLen,
     std::string openCLTunerFile,
     bool openCLReTunePerBoardSize,
+    //Threads for each compute handle of the CPU backend, 0 to use all hardware threads
+    int cpuNumThreadsPerServer,
     const LoadedModel* loadedModel
   );
   //A ComputeContext should NOT be freed until all ComputeHandles created using it have also been freed.
@@ -102,8 +104,9 @@ namespace NeuralNet {
   float* getBatchEltGlobalInplace(InputBuffers* buffers, int nIdx);
 
   // Returns a pointer to bool array of length 3 to input the board symmetries that should
-  // be used to rotate/reflect the board for the neural net.
-  bool* getSymmetriesInplace(InputBuffers* buffers);
+  // be used to rotate/reflect the board for the neural net, for batch element nIdx.
+  // Different batch elements may use different symmetries.
+  bool* getSymmetriesInplace(InputBuffers* buffers, int nIdx);
 
   // The total number of spatial features ("C"), times nnYLen ("H"), times nnXLen ("W")
   int getBatchEltSpatialLen(const InputBuffers* buffers);
@@ -120,6 +120,7 @@ struct CompiledPrograms {
   cl_program addCBiasesNCReluProgram;
   cl_program transposeNCHWProgram;
   cl_program mirrorProgram;
+  cl_program rowSymmetriesNCHWProgram;
   cl_program extractChannel0NCHWProgram;
   cl_program xgemmDirectProgram;
 
@@ -159,6 +160,7 @@ struct CompiledPrograms {
       tuneParams.transpose.compileOptions()
     );
     mirrorProgram = compileProgram("mirrorProgram", context, deviceIdsToUse, OpenCLKernels::mirror, "");
+    rowSymmetriesNCHWProgram = compileProgram("rowSymmetriesNCHWProgram", context, deviceIdsToUse, OpenCLKernels::rowSymmetriesNCHW, "");
     extractChannel0NCHWProgram = compileProgram("extractChannel0NCHWProgram", context, deviceIdsToUse, OpenCLKernels::extractChannel0NCHW, "");
     xgemmDirectProgram = compileProgram("xgemmDirectProgram", context, deviceIdsToUse, OpenCLKernels::xgemmDirect, tuneParams.xGemmDirect.compileOptions());
   }
@@ -178,6 +180,7 @@ struct CompiledPrograms {
     clReleaseProgram(addCBiasesNCReluProgram);
     clReleaseProgram(transposeNCHWProgram);
     clReleaseProgram(mirrorProgram);
+    clReleaseProgram(rowSymmetriesNCHWProgram);
     clReleaseProgram(extractChannel0NCHWProgram);
     clReleaseProgram(xgemmDirectProgram);
   }
@@ -253,8 +256,10 @@ ComputeContext* NeuralNet::createComputeContext(
   int nnYLen,
   string openCLTunerFile,
   bool openCLReTunePerBoardSize,
+  int cpuNumThreadsPerServer,
   const LoadedModel* loadedModel
 ) {
+  (void)cpuNumThreadsPerServer;
   if(gpuIdxs.size() <= 0)
     throw StringError("NeuralNet::createComputeContext - specified no gpus to use");
 
@@ -296,6 +301,7 @@ struct ComputeHandleInternal {
   cl_kernel addCBiasesNCReluKernel;
   cl_kernel transposeNCHWKernel;
   cl_kernel mirrorKernel;
+  cl_kernel rowSymmetriesNCHWKernel;
   cl_kernel extractChannel0NCHWKernel;
   cl_kernel xgemmDirectBatchedNNKernel;
   cl_kernel xgemmDirectBatchedTTKernel;
@@ -358,6 +364,8 @@ struct ComputeHandleInternal {
     CHECK_ERR(err);
     mirrorKernel = clCreateKernel(progs->mirrorProgram, "mirror", &err);
     CHECK_ERR(err);
+    rowSymmetriesNCHWKernel = clCreateKernel(progs->rowSymmetriesNCHWProgram, "rowSymmetriesNCHW", &err);
+    CHECK_ERR(err);
     extractChannel0NCHWKernel = clCreateKernel(progs->extractChannel0NCHWProgram, "extractChannel0NCHW", &err);
     CHECK_ERR(err);
     xgemmDirectBatchedNNKernel = clCreateKernel(progs->xgemmDirectProgram, "XgemmDirectBatchedNN", &err);
@@ -390,6 +398,7 @@ struct ComputeHandleInternal {
     clReleaseKernel(addCBiasesNCReluKernel);
     clReleaseKernel(transposeNCHWKernel);
     clReleaseKernel(mirrorKernel);
+    clReleaseKernel(rowSymmetriesNCHWKernel);
     clReleaseKernel(extractChannel0NCHWKernel);
     clReleaseKernel(xgemmDirectBatchedNNKernel);
     clReleaseKernel(xgemmDirectBatchedTTKernel);
@@ -566,6 +575,56 @@ static void applySymmetriesNCHW(
   }
 }
 
+static bool allRowsHaveSameSymmetry(const bool* symmetriesBuffer, int batchSize) {
+  for(int row = 1; row < batchSize; row++) {
+    for(int i = 0; i < NNInputs::NUM_SYMMETRY_BOOLS; i++) {
+      if(symmetriesBuffer[row * NNInputs::NUM_SYMMETRY_BOOLS + i] != symmetriesBuffer[i])
+        return false;
+    }
+  }
+  return true;
+}
+
+//Same as applySymmetriesNCHW, but symmetriesBuffer holds NUM_SYMMETRY_BOOLS per batch element. If they are not all equal,
+//uses rowSymmetries, a device buffer holding the same symmetries with one int per batch element.
+static void applyRowSymmetriesNCHW(
+  ComputeHandleInternal* handle,
+  const bool* symmetriesBuffer, cl_mem rowSymmetries, bool inverse, int batchSize, int cSize, int nnXLen, int nnYLen,
+  cl_mem input, cl_mem inputScratch
+) {
+  if(allRowsHaveSameSymmetry(symmetriesBuffer,batchSize)) {
+    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, cSize, nnXLen, nnYLen, input, inputScratch);
+    return;
+  }
+
+  cl_int err;
+  static constexpr int nKernelDims = 3;
+  size_t globalSizes[nKernelDims] = {powerOf2ify(nnXLen*nnYLen),powerOf2ify(cSize),powerOf2ify(batchSize)};
+  size_t* localSizes = NULL;
+
+  int inverseInt = inverse ? 1 : 0;
+  cl_kernel kernel = handle->rowSymmetriesNCHWKernel;
+  clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&input);
+  clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&inputScratch);
+  clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&rowSymmetries);
+  clSetKernelArg(kernel, 3, sizeof(int), (void *)&inverseInt);
+  clSetKernelArg(kernel, 4, sizeof(int), (void *)&batchSize);
+  clSetKernelArg(kernel, 5, sizeof(int), (void *)&cSize);
+  clSetKernelArg(kernel, 6, sizeof(int), (void *)&nnYLen);
+  clSetKernelArg(kernel, 7, sizeof(int), (void *)&nnXLen);
+
+  MAYBE_EVENT;
+  err = clEnqueueNDRangeKernel(
+    handle->commandQueue, kernel, nKernelDims, NULL, globalSizes, localSizes, 0, NULL, MAYBE_EVENTREF
+  );
+  CHECK_ERR(err);
+  MAYBE_PROFILE("RowSymmetriesNCHW");
+  MAYBE_FREE_EVENT;
+
+  err = clEnqueueCopyBuffer(handle->commandQueue, inputScratch, input, 0, 0, sizeof(float)*batchSize*cSize*nnYLen*nnXLen, 0, NULL, NULL);
+  CHECK_ERR(err);
+}
+
 
 #ifdef DEBUG_INTERMEDIATE_VALUES
 static void debugPrint2D(const string& name, ComputeHandleInternal* handle, cl_mem deviceBuf, int batchSize, int cSize) {
@@ -1597,6 +1656,7 @@ struct PolicyHead {
   void apply(
     ComputeHandleInternal* handle,
     const bool* symmetriesBuffer,
+    cl_mem rowSymmetries,
     int batchSize,
     cl_mem mask,
     cl_mem maskSum,
@@ -1642,7 +1702,7 @@ struct PolicyHead {
     p2Conv->apply(handle,batchSize,p1OutB,policy,convWorkspace,convWorkspace2);
 
     bool inverse = true;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, p2Channels, nnXLen, nnYLen, policy, p2Out);
+    applyRowSymmetriesNCHW(handle, symmetriesBuffer, rowSymmetries, inverse, batchSize, p2Channels, nnXLen, nnYLen, policy, p2Out);
 
     gpoolToPassMul->apply(handle,batchSize,gpoolConcat,policyPass);
 
@@ -1738,6 +1798,7 @@ struct ValueHead {
   void apply(
     ComputeHandleInternal* handle,
     const bool* symmetriesBuffer,
+    cl_mem rowSymmetries,
     int batchSize,
     cl_mem mask,
     cl_mem maskSum,
@@ -1778,7 +1839,7 @@ struct ValueHead {
     vOwnershipConv->apply(handle,batchSize,v1Out2,ownership,convWorkspace,convWorkspace2);
 
     bool inverse = true;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, ownershipChannels, nnXLen, nnYLen, ownership, ownershipScratch);
+    applyRowSymmetriesNCHW(handle, symmetriesBuffer, rowSymmetries, inverse, batchSize, ownershipChannels, nnXLen, nnYLen, ownership, ownershipScratch);
   }
 
 };
@@ -1904,7 +1965,8 @@ struct Model {
   void apply(
     ComputeHandleInternal* handle,
     int batchSize,
-    bool* symmetriesBuffer,
+    const bool* symmetriesBuffer,
+    cl_mem rowSymmetries,
 
     cl_mem input,
     cl_mem inputScratch,
@@ -1940,7 +2002,7 @@ struct Model {
   ) {
 
     bool inverse = false;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, numInputChannels, nnXLen, nnYLen, input, inputScratch);
+    applyRowSymmetriesNCHW(handle, symmetriesBuffer, rowSymmetries, inverse, batchSize, numInputChannels, nnXLen, nnYLen, input, inputScratch);
 
     {
       cl_kernel kernel = handle->extractChannel0NCHWKernel;
@@ -1987,6 +2049,7 @@ struct Model {
     policyHead->apply(
       handle,
       symmetriesBuffer,
+      rowSymmetries,
       batchSize,
       mask,
       maskSum,
@@ -2006,6 +2069,7 @@ struct Model {
     valueHead->apply(
       handle,
       symmetriesBuffer,
+      rowSymmetries,
       batchSize,
       mask,
       maskSum,
@@ -2031,6 +2095,7 @@ struct Buffers {
   cl_mem input;
   cl_mem inputScratch;
   cl_mem inputGlobal;
+  cl_mem rowSymmetries;
   size_t inputElts;
   size_t inputGlobalElts;
 
@@ -2083,6 +2148,8 @@ struct Buffers {
     input = createReadWriteBuffer(handle, inputElts);
     inputScratch = createReadWriteBuffer(handle, inputElts);
     inputGlobal = createReadWriteBuffer(handle, inputGlobalElts);
+    //Holds one int per batch element, same size as a float
+    rowSymmetries = createReadWriteBuffer(handle, batchElts);
 
     mask = createReadWriteBuffer(handle, batchXYElts);
     maskSum = createReadWriteBuffer(handle, batchElts);
@@ -2131,6 +2198,7 @@ struct Buffers {
     clReleaseMemObject(input);
     clReleaseMemObject(inputScratch);
     clReleaseMemObject(inputGlobal);
+    clReleaseMemObject(rowSymmetries);
 
     clReleaseMemObject(mask);
     clReleaseMemObject(maskSum);
@@ -2256,7 +2324,8 @@ struct InputBuffers {
 
   float* userInputBuffer; //Host pointer
   float* userInputGlobalBuffer; //Host pointer
-  bool* symmetriesBuffer; //Host pointer
+  bool* symmetriesBuffer; //Host pointer, NUM_SYMMETRY_BOOLS per batch element
+  int* rowSymmetries; //Host pointer, symmetriesBuffer packed into one int per batch element
 
   float* policyPassResults; //Host pointer
   float* policyResults; //Host pointer
@@ -2299,7 +2368,8 @@ struct InputBuffers {
 
     userInputBuffer = new float[(size_t)m.numInputChannels * maxBatchSize * xSize * ySize];
     userInputGlobalBuffer = new float[(size_t)m.numInputGlobalChannels * maxBatchSize];
-    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    symmetriesBuffer = new bool[(size_t)maxBatchSize * NNInputs::NUM_SYMMETRY_BOOLS];
+    rowSymmetries = new int[maxBatchSize];
 
     policyPassResults = new float[(size_t)maxBatchSize * 1];
     policyResults = new float[(size_t)maxBatchSize * xSize * ySize];
@@ -2313,6 +2383,7 @@ struct InputBuffers {
     delete[] userInputBuffer;
     delete[] userInputGlobalBuffer;
     delete[] symmetriesBuffer;
+    delete[] rowSymmetries;
     delete[] policyPassResults;
     delete[] policyResults;
     delete[] valueResults;
@@ -2351,8 +2422,9 @@ int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
   return inputBuffers->singleInputGlobalElts;
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
-  return inputBuffers->symmetriesBuffer;
+bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->symmetriesBuffer + (NNInputs::NUM_SYMMETRY_BOOLS * nIdx);
 }
 
 
@@ -2411,10 +2483,28 @@ void NeuralNet::getOutput(
   );
   CHECK_ERR(err);
 
+  for(int row = 0; row < batchSize; row++) {
+    const bool* rowBools = inputBuffers->symmetriesBuffer + (NNInputs::NUM_SYMMETRY_BOOLS * row);
+    inputBuffers->rowSymmetries[row] = (rowBools[0] ? 1 : 0) | (rowBools[1] ? 2 : 0) | (rowBools[2] ? 4 : 0);
+  }
+  err = clEnqueueWriteBuffer(
+    handle->commandQueue,
+    buffers->rowSymmetries,
+    CL_FALSE,
+    0,
+    sizeof(int)*batchSize,
+    inputBuffers->rowSymmetries,
+    0,
+    NULL,
+    NULL
+  );
+  CHECK_ERR(err);
+
   gpuHandle->model->apply(
     handle,
     batchSize,
     inputBuffers->symmetriesBuffer,
+    buffers->rowSymmetries,
 
     buffers->input,
     buffers->inputScratch,
@@ -802,6 +802,50 @@ __kernel void mirror(__global float* in, __global float* out, int batchSize, int
 }
 )%%";
 
+string OpenCLKernels::rowSymmetriesNCHW = R"%%(
+//Applies a possibly different symmetry to each batch element, gathering from in to out.
+//Symmetry bits are mirror y (1), mirror x (2), then transpose (4, only for square boards), inverse is the reverse.
+__kernel void rowSymmetriesNCHW(
+  __global float* in,  //N, c, H, W
+  __global float* out, //N, c, H, W
+  __global int* symmetries, //N
+  int inverse,
+  int batchSize,
+  int cSize,
+  int ySize,
+  int xSize
+) {
+  const int xyIdx = get_global_id(0);
+  const int cIdx = get_global_id(1);
+  const int batchIdx = get_global_id(2);
+  const int xySize = ySize * xSize;
+  if(xyIdx < xySize && cIdx < cSize && batchIdx < batchSize) {
+    const int symmetry = symmetries[batchIdx];
+    const bool mirrorY = (symmetry & 0x1) != 0;
+    const bool mirrorX = (symmetry & 0x2) != 0;
+    const bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
+    const int y = xyIdx / xSize;
+    const int x = xyIdx % xSize;
+    int srcY;
+    int srcX;
+    if(!inverse) {
+      int my = transpose ? x : y;
+      int mx = transpose ? y : x;
+      srcY = mirrorY ? ySize-1-my : my;
+      srcX = mirrorX ? xSize-1-mx : mx;
+    }
+    else {
+      int ty = mirrorY ? ySize-1-y : y;
+      int tx = mirrorX ? xSize-1-x : x;
+      srcY = transpose ? tx : ty;
+      srcX = transpose ? ty : tx;
+    }
+    const int base = (batchIdx * cSize + cIdx) * xySize;
+    out[base + xyIdx] = in[base + srcY * xSize + srcX];
+  }
+}
+)%%";
+
 
 string OpenCLKernels::extractChannel0NCHW = R"%%(
 __kernel void extractChannel0NCHW(__global float* in, __global float* out, int nSize, int cSize, int xySize)
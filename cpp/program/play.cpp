@@ -1,6 +1,7 @@
 #include "../program/play.h"
 
 #include "../core/global.h"
+#include "../game/areacache.h"
 #include "../program/setup.h"
 #include "../search/asyncbot.h"
 
@@ -709,9 +710,7 @@ static void recordTreePositionsRec(
   int64_t bestChildVisits = 0;
   for(int i = 1; i<node->numChildren; i++) {
     const SearchNode* child = node->children[i];
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t numVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    int64_t numVisits = child->stats.visits.load(std::memory_order_acquire);
     if(numVisits > bestChildVisits) {
       bestChildVisits = numVisits;
       bestChildIdx = i;
@@ -726,19 +725,18 @@ static void recordTreePositionsRec(
       continue;
 
     const SearchNode* child = node->children[i];
-    if(child->prevMoveLoc == excludeLoc0 || child->prevMoveLoc == excludeLoc1)
+    Loc moveLoc = toMoveBot->getChildMoveLoc(*node,i);
+    if(moveLoc == excludeLoc0 || moveLoc == excludeLoc1)
       continue;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t numVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    int64_t numVisits = child->stats.visits.load(std::memory_order_acquire);
 
     if(numVisits < minVisitsAtNode)
       continue;
 
     Board copy = board;
     BoardHistory histCopy = hist;
-    histCopy.makeBoardMoveAssumeLegal(copy, child->prevMoveLoc, pla, NULL);
+    histCopy.makeBoardMoveAssumeLegal(copy, moveLoc, pla, NULL);
     Player nextPla = getOpp(pla);
     recordTreePositionsRec(
       gameData,
@@ -929,6 +927,10 @@ FinishedGameData* Play::runGame(
     }
   };
 
+  //Positions only change by a move at a time from here on, so checking for the end of the game can reuse the regions
+  //of the previous position
+  AreaCache areaCache;
+
   if(fancyModes.initGamesWithPolicy && allowPolicyInit) {
     //Try playing a bunch of pure policy moves instead of playing from the start to initialize the board
     //and add entropy
@@ -948,7 +950,7 @@ FinishedGameData* Play::runGame(
 
         //Rarely, playing the random moves out this way will end the game
         if(doEndGameIfAllPassAlive)
-          hist.endGameIfAllPassAlive(board);
+          hist.endGameIfAllPassAlive(board,areaCache);
         if(hist.isGameFinished)
           break;
       }
@@ -984,7 +986,7 @@ FinishedGameData* Play::runGame(
   //Main play loop
   for(int i = 0; i<maxMovesPerGame; i++) {
     if(doEndGameIfAllPassAlive)
-      hist.endGameIfAllPassAlive(board);
+      hist.endGameIfAllPassAlive(board,areaCache);
     if(hist.isGameFinished)
       break;
     if(shouldStop(stopConditions))
@@ -1184,6 +1186,7 @@ FinishedGameData* Play::runGame(
     pla = getOpp(pla);
   }
 
+  gameData->endBoard = board;
   gameData->endHist = hist;
   if(hist.isGameFinished)
     gameData->hitTurnLimit = false;
@@ -1341,10 +1344,10 @@ void Play::maybeForkGame(
   if(finishedGameData->startHist.encorePhase != 0)
     return;
 
-  assert(finishedGameData->startHist.initialBoard.pos_hash == finishedGameData->endHist.initialBoard.pos_hash);
+  assert(finishedGameData->startHist.getInitialBoard().pos_hash == finishedGameData->endHist.getInitialBoard().pos_hash);
   assert(finishedGameData->startHist.initialPla == finishedGameData->endHist.initialPla);
 
-  Board board = finishedGameData->startHist.initialBoard;
+  Board board = finishedGameData->startHist.getInitialBoard();
   Player pla = finishedGameData->startHist.initialPla;
   BoardHistory hist(board,pla,finishedGameData->startHist.rules,finishedGameData->startHist.encorePhase);
 
@@ -44,6 +44,8 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
   string backendPrefix = "cuda";
   #elif defined(USE_OPENCL_BACKEND)
   string backendPrefix = "opencl";
+  #elif defined(USE_CPU_BACKEND)
+  string backendPrefix = "cpu";
   #else
   string backendPrefix = "dummybackend";
   #endif
@@ -54,9 +56,17 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     cfg.markAllKeysUsedWithPrefix("cuda");
   if(backendPrefix != "opencl")
     cfg.markAllKeysUsedWithPrefix("opencl");
+  if(backendPrefix != "cpu")
+    cfg.markAllKeysUsedWithPrefix("cpu");
   if(backendPrefix != "dummybackend")
     cfg.markAllKeysUsedWithPrefix("dummybackend");
 
+  //Deprecated, the nnCache locks each of its buckets separately
+  if(cfg.contains("nnMutexPoolSizePowerOfTwo")) {
+    cfg.markAllKeysUsedWithPrefix("nnMutexPoolSizePowerOfTwo");
+    logger.write("WARNING: nnMutexPoolSizePowerOfTwo is deprecated and ignored");
+  }
+
   for(size_t i = 0; i<nnModelFiles.size(); i++) {
     string idxStr = Global::intToString(i);
     const string& nnModelName = nnModelNames[i];
@@ -167,6 +177,15 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     if(cfg.contains("openclReTunePerBoardSize"))
       openCLReTunePerBoardSize = cfg.getBool("openclReTunePerBoardSize");
 
+    //Unless specified, share the machine's cores between all the server threads of all the models
+    int cpuNumThreadsPerServer;
+    if(cfg.contains("cpuNumThreadsPerServer"))
+      cpuNumThreadsPerServer = cfg.getInt("cpuNumThreadsPerServer",1,1024);
+    else {
+      int numServerThreads = numNNServerThreadsPerModel * (int)nnModelFiles.size();
+      cpuNumThreadsPerServer = std::max(1, (int)std::thread::hardware_concurrency() / numServerThreads);
+    }
+
     vector<int> gpuIdxs = gpuIdxByServerThread;
     std::sort(gpuIdxs.begin(), gpuIdxs.end());
     std::unique(gpuIdxs.begin(), gpuIdxs.end());
@@ -195,12 +214,20 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     if(cfg.contains("nnForcedSymmetry"))
       forcedSymmetry = cfg.getInt("nnForcedSymmetry",0,7);
 
+    int numSymmetriesToAverage = 1;
+    if(cfg.contains("nnNumSymmetriesToAverage"))
+      numSymmetriesToAverage = cfg.getInt("nnNumSymmetriesToAverage",1,NNInputs::NUM_SYMMETRY_COMBINATIONS);
+
     logger.write(
       "After dedups: nnModelFile" + idxStr + " = " + nnModelFile
       + " useFP16 " + Global::boolToString(useFP16)
       + " useNHWC " + Global::boolToString(useNHWC)
     );
 
+    int64_t nnCacheMaxBytes = 0;
+    if(cfg.contains("nnCacheMaxMegabytes"))
+      nnCacheMaxBytes = (int64_t)(cfg.getDouble("nnCacheMaxMegabytes",0.01,1e8) * 1024.0 * 1024.0);
+
     NNEvaluator* nnEval = new NNEvaluator(
       nnModelName,
       nnModelFile,
@@ -214,19 +241,38 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       requireExactNNLen,
       inputsUseNHWC,
       cfg.getInt("nnCacheSizePowerOfTwo", -1, 48),
-      cfg.getInt("nnMutexPoolSizePowerOfTwo", -1, 24),
+      nnCacheMaxBytes,
       debugSkipNeuralNet,
       nnPolicyTemperature,
       openCLTunerFile,
-      openCLReTunePerBoardSize
+      openCLReTunePerBoardSize,
+      cpuNumThreadsPerServer
     );
 
+    {
+      int minBatchFill = cfg.contains("nnMinBatchFill") ? cfg.getInt("nnMinBatchFill",1,65536) : 1;
+      double maxBatchWaitMicroseconds = cfg.contains("nnMaxBatchWaitMicroseconds") ? cfg.getDouble("nnMaxBatchWaitMicroseconds",0.0,1e7) : 0.0;
+      bool adaptiveBatching = cfg.contains("nnAdaptiveBatching") ? cfg.getBool("nnAdaptiveBatching") : false;
+      nnEval->setBatchingPolicy(minBatchFill,maxBatchWaitMicroseconds,adaptiveBatching);
+    }
+    if(debugSkipNeuralNet) {
+      double fixedMicroseconds = cfg.contains("debugSkipNeuralNetLatencyMicroseconds") ? cfg.getDouble("debugSkipNeuralNetLatencyMicroseconds",0.0,1e7) : 0.0;
+      double perRowMicroseconds = cfg.contains("debugSkipNeuralNetLatencyPerRowMicroseconds") ? cfg.getDouble("debugSkipNeuralNetLatencyPerRowMicroseconds",0.0,1e7) : 0.0;
+      nnEval->setDebugLatencyModel(fixedMicroseconds,perRowMicroseconds);
+    }
+
+    if(cfg.contains("nnDiskCacheFile")) {
+      double maxMegabytes = cfg.contains("nnDiskCacheMaxMegabytes") ? cfg.getDouble("nnDiskCacheMaxMegabytes",1.0,1e8) : 1024.0;
+      nnEval->setDiskCache(cfg.getString("nnDiskCacheFile"),(int64_t)(maxMegabytes * 1024.0 * 1024.0),&logger);
+    }
+
     int defaultSymmetry = forcedSymmetry >= 0 ? forcedSymmetry : 0;
     nnEval->spawnServerThreads(
       numNNServerThreadsPerModel,
       (forcedSymmetry >= 0 ? false : nnRandomize),
       nnRandSeed,
       defaultSymmetry,
+      numSymmetriesToAverage,
       logger,
       gpuIdxByServerThread,
       useFP16,
@@ -279,6 +325,11 @@ vector<SearchParams> Setup::loadParams(
     else if(cfg.contains("maxTimePondering"))   params.maxTimePondering = cfg.getDouble("maxTimePondering",        0.0, 1.0e20);
     else                                        params.maxTimePondering = params.maxTime;
 
+    if(cfg.contains("maxTreeNodes"+idxStr)) params.maxTreeNodes = cfg.getInt64("maxTreeNodes"+idxStr, (int64_t)1, (int64_t)1 << 50);
+    else if(cfg.contains("maxTreeNodes"))   params.maxTreeNodes = cfg.getInt64("maxTreeNodes",        (int64_t)1, (int64_t)1 << 50);
+    if(cfg.contains("maxTreeBytes"+idxStr)) params.maxTreeBytes = cfg.getInt64("maxTreeBytes"+idxStr, (int64_t)1, (int64_t)1 << 60);
+    else if(cfg.contains("maxTreeBytes"))   params.maxTreeBytes = cfg.getInt64("maxTreeBytes",        (int64_t)1, (int64_t)1 << 60);
+
     if(cfg.contains("lagBuffer"+idxStr)) params.lagBuffer = cfg.getDouble("lagBuffer"+idxStr, 0.0, 3600.0);
     else if(cfg.contains("lagBuffer"))   params.lagBuffer = cfg.getDouble("lagBuffer",        0.0, 3600.0);
     else                                 params.lagBuffer = 0.0;
@@ -328,6 +379,16 @@ vector<SearchParams> Setup::loadParams(
     else if(cfg.contains("scaleParentWeight")) params.scaleParentWeight = cfg.getBool("scaleParentWeight");
     else params.scaleParentWeight = true;
 
+    if(cfg.contains("useIncrementalBackup"+idxStr)) params.useIncrementalBackup = cfg.getBool("useIncrementalBackup"+idxStr);
+    else if(cfg.contains("useIncrementalBackup")) params.useIncrementalBackup = cfg.getBool("useIncrementalBackup");
+    else params.useIncrementalBackup = false;
+    if(cfg.contains("incrementalBackupRecomputePeriod"+idxStr)) params.incrementalBackupRecomputePeriod = cfg.getInt64("incrementalBackupRecomputePeriod"+idxStr, 1, (int64_t)1 << 40);
+    else if(cfg.contains("incrementalBackupRecomputePeriod")) params.incrementalBackupRecomputePeriod = cfg.getInt64("incrementalBackupRecomputePeriod", 1, (int64_t)1 << 40);
+    else params.incrementalBackupRecomputePeriod = 16;
+    if(cfg.contains("useGraphSearch"+idxStr)) params.useGraphSearch = cfg.getBool("useGraphSearch"+idxStr);
+    else if(cfg.contains("useGraphSearch")) params.useGraphSearch = cfg.getBool("useGraphSearch");
+    else params.useGraphSearch = false;
+
     if(cfg.contains("rootNoiseEnabled"+idxStr)) params.rootNoiseEnabled = cfg.getBool("rootNoiseEnabled"+idxStr);
     else                                        params.rootNoiseEnabled = cfg.getBool("rootNoiseEnabled");
     if(cfg.contains("rootDirichletNoiseTotalConcentration"+idxStr))
@@ -387,6 +448,12 @@ vector<SearchParams> Setup::loadParams(
     else                                     params.mutexPoolSize = (uint32_t)cfg.getInt("mutexPoolSize",        1, 1 << 24);
     if(cfg.contains("numVirtualLossesPerThread"+idxStr)) params.numVirtualLossesPerThread = (int32_t)cfg.getInt("numVirtualLossesPerThread"+idxStr, 1, 1000);
     else                                                 params.numVirtualLossesPerThread = (int32_t)cfg.getInt("numVirtualLossesPerThread",        1, 1000);
+    if(cfg.contains("maxLeavesInFlightPerThread"+idxStr)) params.maxLeavesInFlightPerThread = cfg.getInt("maxLeavesInFlightPerThread"+idxStr, 1, 4096);
+    else if(cfg.contains("maxLeavesInFlightPerThread"))   params.maxLeavesInFlightPerThread = cfg.getInt("maxLeavesInFlightPerThread",        1, 4096);
+    else                                                  params.maxLeavesInFlightPerThread = 1;
+    if(cfg.contains("leafBatchSizePerThread"+idxStr)) params.leafBatchSizePerThread = cfg.getInt("leafBatchSizePerThread"+idxStr, 1, 4096);
+    else if(cfg.contains("leafBatchSizePerThread"))   params.leafBatchSizePerThread = cfg.getInt("leafBatchSizePerThread",        1, 4096);
+    else                                              params.leafBatchSizePerThread = 1;
 
     paramss.push_back(params);
   }
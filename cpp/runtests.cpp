@@ -32,6 +32,7 @@ int MainCmds::runtests(int argc, const char* const* argv) {
   Tests::runRulesTests();
 
   Tests::runBoardUndoTest();
+  Tests::runBoardHistoryUndoTest();
   Tests::runBoardStressTest();
 
   Tests::runSgfTests();
@@ -101,6 +102,29 @@ int MainCmds::runsearchtestsv3(int argc, const char* const* argv) {
   return 0;
 }
 
+int MainCmds::runsearchbenchmarks(int argc, const char* const* argv) {
+  (void)argc;
+  (void)argv;
+  Board::initHash();
+  ScoreValue::initTables();
+
+  Tests::runSearchBenchmarks();
+
+  ScoreValue::freeTables();
+
+  return 0;
+}
+
+int MainCmds::runboardbenchmarks(int argc, const char* const* argv) {
+  (void)argc;
+  (void)argv;
+  Board::initHash();
+
+  Tests::runBoardBenchmarks();
+
+  return 0;
+}
+
 int MainCmds::runselfplayinittests(int argc, const char* const* argv) {
   if(argc != 2) {
     cerr << "Must supply exactly one argument: MODEL_FILE" << endl;
@@ -97,6 +97,14 @@ void AsyncBot::clearSearch() {
   stopAndWait();
   search->clearSearch();
 }
+void AsyncBot::saveTree(const string& fileName) {
+  stopAndWait();
+  search->saveTree(fileName);
+}
+void AsyncBot::loadTree(const string& fileName) {
+  stopAndWait();
+  search->loadTree(fileName);
+}
 
 bool AsyncBot::makeMove(Loc moveLoc, Player movePla) {
   stopAndWait();
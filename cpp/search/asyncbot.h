@@ -32,6 +32,8 @@ class AsyncBot {
   void setParams(SearchParams params);
   void setPlayerIfNew(Player movePla);
   void clearSearch();
+  void saveTree(const std::string& fileName);
+  void loadTree(const std::string& fileName);
 
   //Updates position and preserves the relevant subtree of search
   //Will stop any ongoing search, waiting for a full stop.
@@ -0,0 +1,207 @@
+#include "../search/childedges.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Keep every array aligned for its type and the whole block a multiple of 8 bytes, so that blocks can be packed
+//one after another in a slab.
+static size_t roundUpToMultipleOf8(size_t n) {
+  return (n + 7) & ~((size_t)7);
+}
+
+static size_t visitsOffset(int capacity) {
+  return roundUpToMultipleOf8(capacity * sizeof(SearchNode*));
+}
+static size_t utilitiesOffset(int capacity) {
+  return visitsOffset(capacity) + capacity * sizeof(double);
+}
+static size_t policyProbsOffset(int capacity) {
+  return utilitiesOffset(capacity) + capacity * sizeof(double);
+}
+static size_t virtualLossesOffset(int capacity) {
+  return policyProbsOffset(capacity) + capacity * sizeof(float);
+}
+static size_t movePosesOffset(int capacity) {
+  return virtualLossesOffset(capacity) + capacity * sizeof(int32_t);
+}
+
+SearchChildEdges::SearchChildEdges(SearchNode** block, int capacity) {
+  char* base = reinterpret_cast<char*>(block);
+  children = block;
+  visits = reinterpret_cast<double*>(base + visitsOffset(capacity));
+  utilities = reinterpret_cast<double*>(base + utilitiesOffset(capacity));
+  policyProbs = reinterpret_cast<float*>(base + policyProbsOffset(capacity));
+  virtualLosses = reinterpret_cast<int32_t*>(base + virtualLossesOffset(capacity));
+  movePoses = reinterpret_cast<int16_t*>(base + movePosesOffset(capacity));
+}
+
+size_t SearchChildEdges::bytesForCapacity(int capacity) {
+  return roundUpToMultipleOf8(movePosesOffset(capacity) + capacity * sizeof(int16_t));
+}
+
+void SearchChildEdges::copyEntry(int fromIdx, const SearchChildEdges& to, int toIdx) const {
+  to.children[toIdx] = children[fromIdx];
+  to.visits[toIdx] = visits[fromIdx];
+  to.utilities[toIdx] = utilities[fromIdx];
+  to.policyProbs[toIdx] = policyProbs[fromIdx];
+  to.virtualLosses[toIdx] = virtualLosses[fromIdx];
+  to.movePoses[toIdx] = movePoses[fromIdx];
+}
+
+//Must stay exactly in sync with Search::getExploreSelectionValue, including the order of floating point operations,
+//so that the vectorized version below and the search at the root all agree to the last bit.
+static double getExploreSelectionValueOfEdge(
+  const SearchChildEdges& edges, int i, double totalChildVisits, double fpuValue, double cpuctExploration,
+  double virtualLossUtility, Player pla, double illegalValue
+) {
+  double nnPolicyProb = edges.policyProbs[i];
+  if(nnPolicyProb < 0)
+    return illegalValue;
+
+  double childVisits = edges.visits[i];
+  double childUtility = childVisits <= 0 ? fpuValue : edges.utilities[i];
+
+  if(totalChildVisits < childVisits)
+    totalChildVisits = childVisits;
+
+  int32_t childVirtualLosses = edges.virtualLosses[i];
+  if(childVirtualLosses > 0) {
+    childVisits += childVirtualLosses;
+    double virtualLossVisitFrac = (double)childVirtualLosses / childVisits;
+    childUtility = childUtility + (virtualLossUtility - childUtility) * virtualLossVisitFrac;
+  }
+
+  double exploreComponent =
+    cpuctExploration
+    * nnPolicyProb
+    * sqrt(totalChildVisits + 0.01)
+    / (1.0 + childVisits);
+  double valueComponent = pla == P_WHITE ? childUtility : -childUtility;
+  return exploreComponent + valueComponent;
+}
+
+int SearchChildEdges::getBestExploreSelection(
+  int numChildren, int64_t totalChildVisits, double fpuValue, double cpuctExploration,
+  double virtualLossUtility, Player pla, double illegalValue, double& bestValue
+) const {
+  int bestIdx = -1;
+  bestValue = -INFINITY;
+  int i = 0;
+
+#if defined(__AVX2__)
+  if(numChildren >= 4) {
+    const __m256d totalVec = _mm256_set1_pd((double)totalChildVisits);
+    const __m256d fpuVec = _mm256_set1_pd(fpuValue);
+    const __m256d cpuctVec = _mm256_set1_pd(cpuctExploration);
+    const __m256d virtualLossUtilityVec = _mm256_set1_pd(virtualLossUtility);
+    const __m256d illegalVec = _mm256_set1_pd(illegalValue);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d pointZeroOne = _mm256_set1_pd(0.01);
+    const __m256d signFlip = pla == P_WHITE ? zero : _mm256_set1_pd(-0.0);
+
+    __m256d bestValues = _mm256_set1_pd(-INFINITY);
+    __m256d bestIdxs = _mm256_set1_pd(-1.0);
+    __m256d idxs = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+
+    for(; i + 4 <= numChildren; i += 4) {
+      __m256d nnPolicyProb = _mm256_cvtps_pd(_mm_loadu_ps(policyProbs + i));
+      __m256d childVisits = _mm256_loadu_pd(visits + i);
+      __m256d childUtility = _mm256_blendv_pd(fpuVec, _mm256_loadu_pd(utilities + i), _mm256_cmp_pd(childVisits, zero, _CMP_GT_OQ));
+      __m256d total = _mm256_blendv_pd(totalVec, childVisits, _mm256_cmp_pd(totalVec, childVisits, _CMP_LT_OQ));
+
+      __m256d childVirtualLosses = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(virtualLosses + i)));
+      __m256d hasVirtualLosses = _mm256_cmp_pd(childVirtualLosses, zero, _CMP_GT_OQ);
+      __m256d visitsWithVirtualLosses = _mm256_add_pd(childVisits, childVirtualLosses);
+      childVisits = _mm256_blendv_pd(childVisits, visitsWithVirtualLosses, hasVirtualLosses);
+      //Lanes without virtual losses may divide 0 by 0 here, but their result is blended away
+      __m256d virtualLossVisitFrac = _mm256_div_pd(childVirtualLosses, visitsWithVirtualLosses);
+      __m256d adjustedUtility = _mm256_add_pd(childUtility, _mm256_mul_pd(_mm256_sub_pd(virtualLossUtilityVec, childUtility), virtualLossVisitFrac));
+      childUtility = _mm256_blendv_pd(childUtility, adjustedUtility, hasVirtualLosses);
+
+      __m256d exploreComponent = _mm256_div_pd(
+        _mm256_mul_pd(_mm256_mul_pd(cpuctVec, nnPolicyProb), _mm256_sqrt_pd(_mm256_add_pd(total, pointZeroOne))),
+        _mm256_add_pd(one, childVisits)
+      );
+      __m256d valueComponent = _mm256_xor_pd(childUtility, signFlip);
+      __m256d value = _mm256_add_pd(exploreComponent, valueComponent);
+      value = _mm256_blendv_pd(value, illegalVec, _mm256_cmp_pd(nnPolicyProb, zero, _CMP_LT_OQ));
+
+      __m256d isBetter = _mm256_cmp_pd(value, bestValues, _CMP_GT_OQ);
+      bestValues = _mm256_blendv_pd(bestValues, value, isBetter);
+      bestIdxs = _mm256_blendv_pd(bestIdxs, idxs, isBetter);
+      idxs = _mm256_add_pd(idxs, four);
+    }
+
+    //Each lane holds its own earliest best, so take the best lane, preferring the lowest index on ties
+    double laneValues[4];
+    double laneIdxs[4];
+    _mm256_storeu_pd(laneValues, bestValues);
+    _mm256_storeu_pd(laneIdxs, bestIdxs);
+    for(int lane = 0; lane<4; lane++) {
+      int idx = (int)laneIdxs[lane];
+      if(idx < 0)
+        continue;
+      if(laneValues[lane] > bestValue || (laneValues[lane] == bestValue && idx < bestIdx)) {
+        bestValue = laneValues[lane];
+        bestIdx = idx;
+      }
+    }
+  }
+#endif
+
+  for(; i<numChildren; i++) {
+    double value = getExploreSelectionValueOfEdge(
+      *this, i, (double)totalChildVisits, fpuValue, cpuctExploration, virtualLossUtility, pla, illegalValue
+    );
+    if(value > bestValue) {
+      bestValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+int SearchChildEdges::getBestUnexpandedPos(const float* policyProbs, const bool* posesWithChild, int policySize, float& bestProb) {
+  bestProb = -1.0f;
+  int pos = 0;
+
+#if defined(__AVX2__)
+  //One pass to find the best prob, and then we only need to find where it is
+  {
+    const __m256 minusOne = _mm256_set1_ps(-1.0f);
+    __m256 bestProbs = minusOne;
+    for(; pos + 8 <= policySize; pos += 8) {
+      __m256 probs = _mm256_loadu_ps(policyProbs + pos);
+      __m128i hasChildBytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(posesWithChild + pos));
+      __m256i hasChild = _mm256_cmpgt_epi32(_mm256_cvtepu8_epi32(hasChildBytes), _mm256_setzero_si256());
+      probs = _mm256_blendv_ps(probs, minusOne, _mm256_castsi256_ps(hasChild));
+      bestProbs = _mm256_max_ps(bestProbs, probs);
+    }
+    float laneProbs[8];
+    _mm256_storeu_ps(laneProbs, bestProbs);
+    for(int lane = 0; lane<8; lane++) {
+      if(laneProbs[lane] > bestProb)
+        bestProb = laneProbs[lane];
+    }
+  }
+#endif
+
+  for(; pos<policySize; pos++) {
+    if(!posesWithChild[pos] && policyProbs[pos] > bestProb)
+      bestProb = policyProbs[pos];
+  }
+  if(bestProb <= -1.0f)
+    return -1;
+  for(pos = 0; pos<policySize; pos++) {
+    if(!posesWithChild[pos] && policyProbs[pos] == bestProb)
+      return pos;
+  }
+  assert(false);
+  return -1;
+}
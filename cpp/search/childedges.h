@@ -0,0 +1,44 @@
+#ifndef SEARCH_CHILDEDGES_H_
+#define SEARCH_CHILDEDGES_H_
+
+#include "../core/global.h"
+#include "../game/board.h"
+
+struct SearchNode;
+
+//The children of a search node, together with a copy of everything that selection needs to know about each of them.
+//All of it lives in one block from the nodeArena, as separate contiguous arrays, so that choosing which child to
+//descend scans a few dense arrays and never touches the children themselves.
+//Everything except the children pointers is protected under the mutex of the owning node. visits and utilities are
+//copied from each child whenever a playout through it finishes, so they may lag a little behind the child's own stats
+//while other threads are updating it. Except that in a search graph, where a child can have several parents, visits
+//instead counts only the playouts that went through this edge.
+struct SearchChildEdges {
+  SearchNode** children;
+  double* visits;
+  double* utilities;    //From white's perspective, only meaningful when visits > 0
+  float* policyProbs;   //Policy prob of the move in the owning node's nnOutput
+  int32_t* virtualLosses;
+  int16_t* movePoses;   //NN policy position of the move
+
+  //The arrays within a block of the given capacity, which must match the capacity the block was laid out with
+  SearchChildEdges(SearchNode** block, int capacity);
+
+  static size_t bytesForCapacity(int capacity);
+
+  void copyEntry(int fromIdx, const SearchChildEdges& to, int toIdx) const;
+
+  //Index and value of the child with the highest PUCT selection value, in the same way as
+  //Search::getExploreSelectionValue away from the root, or -1 if numChildren is 0.
+  //Ties go to the lowest index. Children with a negative policy prob get illegalValue.
+  int getBestExploreSelection(
+    int numChildren, int64_t totalChildVisits, double fpuValue, double cpuctExploration,
+    double virtualLossUtility, Player pla, double illegalValue, double& bestValue
+  ) const;
+
+  //The position with the highest policy prob greater than -1 that has no child, lowest position on ties,
+  //or -1 if there is none.
+  static int getBestUnexpandedPos(const float* policyProbs, const bool* posesWithChild, int policySize, float& bestProb);
+};
+
+#endif  // SEARCH_CHILDEDGES_H_
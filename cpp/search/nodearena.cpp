@@ -0,0 +1,483 @@
+#include "../search/nodearena.h"
+
+#include <algorithm>
+#include <type_traits>
+
+#include "../search/childedges.h"
+#include "../search/search.h"
+
+using namespace std;
+
+//How many freed nodes or children arrays a thread takes from the shared pool at a time
+static const size_t REFILL_BATCH_SIZE = 256;
+//How many nodes the reclaim thread destroys between taking the lock to hand back their memory
+static const size_t RECLAIM_BATCH_SIZE = 1024;
+
+struct SearchNodeArena::NodeSlab {
+  //Whether each slot currently holds a constructed node
+  uint8_t isLive[NODES_PER_SLAB];
+  std::aligned_storage<sizeof(SearchNode),alignof(SearchNode)>::type slots[NODES_PER_SLAB];
+
+  SearchNode* node(int idx) { return reinterpret_cast<SearchNode*>(&slots[idx]); }
+};
+
+struct SearchNodeArena::RetiredSlabs {
+  std::vector<NodeSlab*> nodeSlabs;
+  std::vector<char*> childrenSlabs;
+  int64_t numBytes;
+};
+
+//-----------------------------------------------------------------------------------------
+
+SearchNodeArena::ThreadCache::ThreadCache(SearchNodeArena* a)
+  :arena(a),
+   generation(a->generation),
+   nodeSlab(NULL),
+   nodeSlabUsed(NODES_PER_SLAB),
+   freeNodes(),
+   childrenCursor(NULL),
+   childrenEnd(NULL),
+   freeChildrenByClass()
+{}
+
+SearchNodeArena::ThreadCache::~ThreadCache() {
+  syncGeneration();
+  bool anyCached = freeNodes.size() > 0 || (nodeSlab != NULL && nodeSlabUsed < NODES_PER_SLAB);
+  for(int i = 0; i<MAX_CHILDREN_SIZE_CLASSES; i++)
+    anyCached = anyCached || freeChildrenByClass[i].size() > 0;
+  if(!anyCached)
+    return;
+
+  //Give back everything not in use so that other threads can have it
+  lock_guard<std::mutex> lock(arena->mutex);
+  arena->sharedFreeNodes.insert(arena->sharedFreeNodes.end(),freeNodes.begin(),freeNodes.end());
+  if(nodeSlab != NULL) {
+    for(int i = nodeSlabUsed; i<NODES_PER_SLAB; i++)
+      arena->sharedFreeNodes.push_back(std::make_pair(nodeSlab,i));
+  }
+  for(int i = 0; i<MAX_CHILDREN_SIZE_CLASSES; i++)
+    arena->sharedFreeChildren[i].insert(arena->sharedFreeChildren[i].end(),freeChildrenByClass[i].begin(),freeChildrenByClass[i].end());
+}
+
+void SearchNodeArena::ThreadCache::syncGeneration() {
+  if(generation == arena->generation)
+    return;
+  generation = arena->generation;
+  nodeSlab = NULL;
+  nodeSlabUsed = NODES_PER_SLAB;
+  freeNodes.clear();
+  childrenCursor = NULL;
+  childrenEnd = NULL;
+  for(int i = 0; i<MAX_CHILDREN_SIZE_CLASSES; i++)
+    freeChildrenByClass[i].clear();
+}
+
+//-----------------------------------------------------------------------------------------
+
+SearchNodeArena::SearchNodeArena()
+  :mutex(),
+   generation(0),
+   nodeSlabs(),
+   childrenSlabs(),
+   sharedFreeNodes(),
+   sharedFreeChildren(),
+   numChildrenSizeClasses(0),
+   numLiveNodes(0),
+   numLiveChildrenBytes(0),
+   numLiveNNOutputBytes(0),
+   reclaimThread(),
+   reclaimWorkCond(),
+   reclaimDoneCond(),
+   pendingSubtrees(),
+   pendingSingleNodes(),
+   pendingRetired(),
+   pendingTasks(),
+   numRetiredBytes(0),
+   reclaimBusyWithSubtree(false),
+   reclaimBusyWithRetired(false),
+   reclaimBusyWithTask(false),
+   reclaimAbortSubtree(false),
+   reclaimShouldExit(false)
+{
+  //Same growth as playoutDescend uses for children arrays, so that growing never wastes any of a size class
+  int capacity = 1;
+  while(true) {
+    assert(numChildrenSizeClasses < MAX_CHILDREN_SIZE_CLASSES);
+    childrenSizeClassCapacity[numChildrenSizeClasses] = capacity;
+    numChildrenSizeClasses++;
+    if(capacity >= 0x3FFF)
+      break;
+    capacity = capacity + (capacity / 4) + 1;
+  }
+}
+
+SearchNodeArena::~SearchNodeArena() {
+  //Let the reclaim thread finish freeing retired slabs and exit, then sweep whatever is left ourselves. Queued
+  //subtrees are all still in our slabs, so there is no need to walk them.
+  {
+    lock_guard<std::mutex> lock(mutex);
+    pendingSubtrees.clear();
+    pendingSingleNodes.clear();
+    pendingTasks.clear();
+    reclaimAbortSubtree = true;
+    reclaimShouldExit = true;
+    reclaimWorkCond.notify_all();
+  }
+  if(reclaimThread.joinable())
+    reclaimThread.join();
+  //A task that was running may have queued more
+  pendingSubtrees.clear();
+  pendingSingleNodes.clear();
+  assert(pendingRetired.size() == 0);
+  sweepAndFree(nodeSlabs,childrenSlabs);
+}
+
+int SearchNodeArena::getChildrenSizeClass(int capacity) const {
+  assert(capacity > 0);
+  for(int i = 0; i<numChildrenSizeClasses; i++) {
+    if(childrenSizeClassCapacity[i] >= capacity)
+      return i;
+  }
+  ASSERT_UNREACHABLE;
+  return -1;
+}
+
+bool SearchNodeArena::isIndividuallyAllocated(int sizeClass) const {
+  return SearchChildEdges::bytesForCapacity(childrenSizeClassCapacity[sizeClass]) > CHILDREN_SLAB_BYTES / 4;
+}
+
+SearchNodeArena::NodeSlab* SearchNodeArena::newNodeSlab() {
+  NodeSlab* slab = new NodeSlab();
+  std::fill(slab->isLive,slab->isLive+NODES_PER_SLAB,(uint8_t)0);
+  nodeSlabs.insert(std::upper_bound(nodeSlabs.begin(),nodeSlabs.end(),slab,std::less<NodeSlab*>()),slab);
+  return slab;
+}
+
+char* SearchNodeArena::newChildrenSlab() {
+  char* slab = new char[CHILDREN_SLAB_BYTES];
+  childrenSlabs.push_back(slab);
+  return slab;
+}
+
+std::pair<SearchNodeArena::NodeSlab*,int> SearchNodeArena::findNodeSlot(const SearchNode* node) const {
+  const char* addr = reinterpret_cast<const char*>(node);
+  //The last slab starting at or before node
+  auto iter = std::upper_bound(
+    nodeSlabs.begin(),nodeSlabs.end(),addr,
+    [](const char* a, const NodeSlab* slab) { return std::less<const char*>()(a,reinterpret_cast<const char*>(slab)); }
+  );
+  assert(iter != nodeSlabs.begin());
+  NodeSlab* slab = *(iter-1);
+  ptrdiff_t offset = addr - reinterpret_cast<const char*>(&slab->slots[0]);
+  assert(offset >= 0 && offset % sizeof(slab->slots[0]) == 0);
+  int idx = (int)(offset / sizeof(slab->slots[0]));
+  assert(idx < NODES_PER_SLAB);
+  return std::make_pair(slab,idx);
+}
+
+void* SearchNodeArena::allocNode(ThreadCache& cache) {
+  assert(cache.arena == this);
+  cache.syncGeneration();
+  NodeSlab* slab;
+  int idx;
+  if(cache.freeNodes.size() > 0) {
+    slab = cache.freeNodes.back().first;
+    idx = cache.freeNodes.back().second;
+    cache.freeNodes.pop_back();
+  }
+  else if(cache.nodeSlabUsed < NODES_PER_SLAB) {
+    slab = cache.nodeSlab;
+    idx = cache.nodeSlabUsed++;
+  }
+  else {
+    lock_guard<std::mutex> lock(mutex);
+    if(sharedFreeNodes.size() > 0) {
+      size_t numToTake = std::min(sharedFreeNodes.size(),REFILL_BATCH_SIZE);
+      cache.freeNodes.insert(cache.freeNodes.end(),sharedFreeNodes.end()-numToTake,sharedFreeNodes.end());
+      sharedFreeNodes.resize(sharedFreeNodes.size()-numToTake);
+      slab = cache.freeNodes.back().first;
+      idx = cache.freeNodes.back().second;
+      cache.freeNodes.pop_back();
+    }
+    else {
+      cache.nodeSlab = newNodeSlab();
+      cache.nodeSlabUsed = 0;
+      slab = cache.nodeSlab;
+      idx = cache.nodeSlabUsed++;
+    }
+  }
+  assert(slab->isLive[idx] == 0);
+  slab->isLive[idx] = 1;
+  numLiveNodes.fetch_add(1,std::memory_order_relaxed);
+  return slab->node(idx);
+}
+
+SearchNode** SearchNodeArena::allocChildren(ThreadCache& cache, int capacity) {
+  assert(cache.arena == this);
+  cache.syncGeneration();
+  int sizeClass = getChildrenSizeClass(capacity);
+  size_t bytes = SearchChildEdges::bytesForCapacity(childrenSizeClassCapacity[sizeClass]);
+  numLiveChildrenBytes.fetch_add((int64_t)bytes,std::memory_order_relaxed);
+  if(isIndividuallyAllocated(sizeClass))
+    return new SearchNode*[(bytes + sizeof(SearchNode*) - 1) / sizeof(SearchNode*)];
+
+  vector<SearchNode**>& freeList = cache.freeChildrenByClass[sizeClass];
+  if(freeList.size() > 0) {
+    SearchNode** children = freeList.back();
+    freeList.pop_back();
+    return children;
+  }
+
+  if(cache.childrenCursor == NULL || (size_t)(cache.childrenEnd - cache.childrenCursor) < bytes) {
+    lock_guard<std::mutex> lock(mutex);
+    vector<SearchNode**>& sharedFreeList = sharedFreeChildren[sizeClass];
+    if(sharedFreeList.size() > 0) {
+      size_t numToTake = std::min(sharedFreeList.size(),REFILL_BATCH_SIZE);
+      freeList.insert(freeList.end(),sharedFreeList.end()-numToTake,sharedFreeList.end());
+      sharedFreeList.resize(sharedFreeList.size()-numToTake);
+      SearchNode** children = freeList.back();
+      freeList.pop_back();
+      return children;
+    }
+    cache.childrenCursor = newChildrenSlab();
+    cache.childrenEnd = cache.childrenCursor + CHILDREN_SLAB_BYTES;
+  }
+  SearchNode** children = reinterpret_cast<SearchNode**>(cache.childrenCursor);
+  cache.childrenCursor += bytes;
+  return children;
+}
+
+void SearchNodeArena::freeChildren(ThreadCache& cache, SearchNode** children, int capacity) {
+  assert(cache.arena == this);
+  cache.syncGeneration();
+  int sizeClass = getChildrenSizeClass(capacity);
+  numLiveChildrenBytes.fetch_sub((int64_t)SearchChildEdges::bytesForCapacity(childrenSizeClassCapacity[sizeClass]),std::memory_order_relaxed);
+  if(isIndividuallyAllocated(sizeClass))
+    delete[] children;
+  else
+    cache.freeChildrenByClass[sizeClass].push_back(children);
+}
+
+void SearchNodeArena::destroySubtree(SearchNode* root) {
+  if(root == NULL)
+    return;
+  lock_guard<std::mutex> lock(mutex);
+  pendingSubtrees.push_back(root);
+  startReclaimThreadIfNeeded();
+  reclaimWorkCond.notify_all();
+}
+
+void SearchNodeArena::destroyNodes(const std::vector<SearchNode*>& nodes) {
+  if(nodes.size() <= 0)
+    return;
+  lock_guard<std::mutex> lock(mutex);
+  pendingSingleNodes.insert(pendingSingleNodes.end(),nodes.begin(),nodes.end());
+  startReclaimThreadIfNeeded();
+  reclaimWorkCond.notify_all();
+}
+
+void SearchNodeArena::runInBackground(std::function<void()> task) {
+  lock_guard<std::mutex> lock(mutex);
+  pendingTasks.push_back(std::move(task));
+  startReclaimThreadIfNeeded();
+  reclaimWorkCond.notify_all();
+}
+
+void SearchNodeArena::releaseAll() {
+  unique_lock<std::mutex> lock(mutex);
+  //A running task may be using nodes, so let it finish first
+  pendingTasks.clear();
+  while(reclaimBusyWithTask)
+    reclaimDoneCond.wait(lock);
+  //Every node of a subtree still waiting to be destroyed is in these slabs, so it will get swept along with them
+  pendingSubtrees.clear();
+  pendingSingleNodes.clear();
+  //And if one is being destroyed right now, stop that, since it looks up nodes in the slabs we are about to take away
+  reclaimAbortSubtree = true;
+  while(reclaimBusyWithSubtree)
+    reclaimDoneCond.wait(lock);
+  reclaimAbortSubtree = false;
+
+  if(nodeSlabs.size() > 0 || childrenSlabs.size() > 0) {
+    RetiredSlabs* retired = new RetiredSlabs();
+    retired->nodeSlabs.swap(nodeSlabs);
+    retired->childrenSlabs.swap(childrenSlabs);
+    retired->numBytes = (int64_t)(retired->nodeSlabs.size() * sizeof(NodeSlab) + retired->childrenSlabs.size() * CHILDREN_SLAB_BYTES);
+    numRetiredBytes += retired->numBytes;
+    pendingRetired.push_back(retired);
+    startReclaimThreadIfNeeded();
+    reclaimWorkCond.notify_all();
+  }
+
+  sharedFreeNodes.clear();
+  sharedFreeNodes.shrink_to_fit();
+  for(int i = 0; i<MAX_CHILDREN_SIZE_CLASSES; i++) {
+    sharedFreeChildren[i].clear();
+    sharedFreeChildren[i].shrink_to_fit();
+  }
+  numLiveNodes.store(0);
+  numLiveChildrenBytes.store(0);
+  numLiveNNOutputBytes.store(0);
+  generation++;
+}
+
+void SearchNodeArena::waitForReclamation() {
+  unique_lock<std::mutex> lock(mutex);
+  while(
+    pendingSubtrees.size() > 0 || pendingSingleNodes.size() > 0 || pendingRetired.size() > 0 || pendingTasks.size() > 0 ||
+    reclaimBusyWithSubtree || reclaimBusyWithRetired || reclaimBusyWithTask
+  )
+    reclaimDoneCond.wait(lock);
+}
+
+void SearchNodeArena::startReclaimThreadIfNeeded() {
+  if(!reclaimThread.joinable())
+    reclaimThread = std::thread(&SearchNodeArena::reclaimLoop, this);
+}
+
+void SearchNodeArena::sweepAndFree(std::vector<NodeSlab*>& slabs, std::vector<char*>& children) {
+  for(size_t i = 0; i<slabs.size(); i++) {
+    NodeSlab* slab = slabs[i];
+    for(int idx = 0; idx<NODES_PER_SLAB; idx++) {
+      if(slab->isLive[idx]) {
+        SearchNode* node = slab->node(idx);
+        if(node->children != NULL && isIndividuallyAllocated(getChildrenSizeClass(node->childrenCapacity)))
+          delete[] node->children;
+        node->children = NULL;
+        node->~SearchNode();
+      }
+    }
+    delete slab;
+  }
+  slabs.clear();
+  for(size_t i = 0; i<children.size(); i++)
+    delete[] children[i];
+  children.clear();
+}
+
+void SearchNodeArena::reclaimLoop() {
+  vector<SearchNode*> stack;
+  vector<SearchNode*> batchNodes;
+  vector<std::pair<SearchNode**,int>> batchChildren;
+
+  unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    if(pendingRetired.size() > 0) {
+      RetiredSlabs* retired = pendingRetired.front();
+      pendingRetired.pop_front();
+      reclaimBusyWithRetired = true;
+      lock.unlock();
+      sweepAndFree(retired->nodeSlabs,retired->childrenSlabs);
+      lock.lock();
+      numRetiredBytes -= retired->numBytes;
+      delete retired;
+      reclaimBusyWithRetired = false;
+      reclaimDoneCond.notify_all();
+      continue;
+    }
+
+    if(pendingTasks.size() > 0) {
+      std::function<void()> task = std::move(pendingTasks.front());
+      pendingTasks.pop_front();
+      reclaimBusyWithTask = true;
+      lock.unlock();
+      task();
+      lock.lock();
+      reclaimBusyWithTask = false;
+      reclaimDoneCond.notify_all();
+      continue;
+    }
+
+    if(pendingSubtrees.size() > 0 || pendingSingleNodes.size() > 0) {
+      //Either a whole subtree, or all the single nodes queued so far, which are destroyed the same way except that
+      //their children are left alone
+      stack.clear();
+      bool followChildren = pendingSubtrees.size() > 0;
+      if(followChildren) {
+        stack.push_back(pendingSubtrees.front());
+        pendingSubtrees.pop_front();
+      }
+      else
+        stack.swap(pendingSingleNodes);
+      reclaimBusyWithSubtree = true;
+      while(stack.size() > 0 && !reclaimAbortSubtree) {
+        //Destroy a batch of nodes without holding the lock, then briefly take it to hand back their memory
+        lock.unlock();
+        batchNodes.clear();
+        batchChildren.clear();
+        int64_t batchNNOutputBytes = 0;
+        while(stack.size() > 0 && batchNodes.size() < RECLAIM_BATCH_SIZE) {
+          SearchNode* node = stack.back();
+          stack.pop_back();
+          if(node->children != NULL) {
+            for(int i = 0; followChildren && i<node->numChildren; i++) {
+              if(node->children[i] != NULL)
+                stack.push_back(node->children[i]);
+            }
+            batchChildren.push_back(std::make_pair(node->children,(int)node->childrenCapacity));
+            node->children = NULL;
+          }
+          batchNNOutputBytes += node->getNNOutputBytes();
+          node->~SearchNode();
+          batchNodes.push_back(node);
+        }
+        lock.lock();
+        for(size_t i = 0; i<batchNodes.size(); i++) {
+          std::pair<NodeSlab*,int> slot = findNodeSlot(batchNodes[i]);
+          assert(slot.first->isLive[slot.second] == 1);
+          slot.first->isLive[slot.second] = 0;
+          sharedFreeNodes.push_back(slot);
+        }
+        int64_t batchChildrenBytes = 0;
+        for(size_t i = 0; i<batchChildren.size(); i++) {
+          int sizeClass = getChildrenSizeClass(batchChildren[i].second);
+          batchChildrenBytes += (int64_t)SearchChildEdges::bytesForCapacity(childrenSizeClassCapacity[sizeClass]);
+          if(isIndividuallyAllocated(sizeClass))
+            delete[] batchChildren[i].first;
+          else
+            sharedFreeChildren[sizeClass].push_back(batchChildren[i].first);
+        }
+        numLiveNodes.fetch_sub((int64_t)batchNodes.size(),std::memory_order_relaxed);
+        numLiveChildrenBytes.fetch_sub(batchChildrenBytes,std::memory_order_relaxed);
+        numLiveNNOutputBytes.fetch_sub(batchNNOutputBytes,std::memory_order_relaxed);
+      }
+      //If aborted, whatever is left on the stack is still marked live and releaseAll will sweep it
+      stack.clear();
+      reclaimBusyWithSubtree = false;
+      reclaimDoneCond.notify_all();
+      continue;
+    }
+
+    if(reclaimShouldExit)
+      break;
+    reclaimWorkCond.wait(lock);
+  }
+}
+
+SearchNodeArena::Stats SearchNodeArena::getStats() const {
+  lock_guard<std::mutex> lock(mutex);
+  Stats stats;
+  stats.numLiveNodes = numLiveNodes.load(std::memory_order_relaxed);
+  stats.numLiveChildrenBytes = numLiveChildrenBytes.load(std::memory_order_relaxed);
+  stats.numNodeSlabs = (int64_t)nodeSlabs.size();
+  stats.numChildrenSlabs = (int64_t)childrenSlabs.size();
+  stats.numBytes = (int64_t)(nodeSlabs.size() * sizeof(NodeSlab) + childrenSlabs.size() * CHILDREN_SLAB_BYTES) + numRetiredBytes;
+  return stats;
+}
+
+int64_t SearchNodeArena::getNumLiveNodes() const {
+  return numLiveNodes.load(std::memory_order_relaxed);
+}
+
+int64_t SearchNodeArena::getNumLiveChildrenBytes() const {
+  return numLiveChildrenBytes.load(std::memory_order_relaxed);
+}
+
+void SearchNodeArena::addNNOutputBytes(int64_t bytes) {
+  if(bytes != 0)
+    numLiveNNOutputBytes.fetch_add(bytes,std::memory_order_relaxed);
+}
+
+int64_t SearchNodeArena::getNumLiveNNOutputBytes() const {
+  return numLiveNNOutputBytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,151 @@
+#ifndef SEARCH_NODEARENA_H_
+#define SEARCH_NODEARENA_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+#include <deque>
+#include <functional>
+
+struct SearchNode;
+
+//Slab allocator for the SearchNodes of a search tree and for their arrays of children, each array being a block laid
+//out as SearchChildEdges.
+//Each search thread allocates through its own ThreadCache, carving nodes and arrays out of slabs and reusing freed
+//memory without taking any lock except to occasionally grab a new slab or a batch of freed memory.
+//Destroying a subtree runs the node destructors and keeps the memory for reuse. Discarding the whole tree with
+//releaseAll is a single linear pass over the slabs to destroy whatever is still alive, after which every slab is freed
+//at once, rather than a recursive walk of the tree freeing nodes one by one.
+//Both happen on a background thread, started the first time there is anything to reclaim, so that discarding even a
+//huge tree costs the caller almost nothing.
+class SearchNodeArena {
+ public:
+  static constexpr int NODES_PER_SLAB = 1024;
+  static constexpr size_t CHILDREN_SLAB_BYTES = 1 << 16;
+  //Children arrays are rounded up to one of these many capacities. Bigger arrays than fit nicely in a slab are
+  //allocated individually.
+  static constexpr int MAX_CHILDREN_SIZE_CLASSES = 48;
+
+  struct NodeSlab;
+
+  //Allocation state belonging to a single thread. Must be destroyed before the arena.
+  struct ThreadCache {
+    SearchNodeArena* arena;
+    uint64_t generation;
+
+    NodeSlab* nodeSlab;
+    int nodeSlabUsed;
+    std::vector<std::pair<NodeSlab*,int>> freeNodes;
+
+    char* childrenCursor;
+    char* childrenEnd;
+    std::vector<SearchNode**> freeChildrenByClass[MAX_CHILDREN_SIZE_CLASSES];
+
+    ThreadCache(SearchNodeArena* arena);
+    ~ThreadCache();
+
+    ThreadCache(const ThreadCache&) = delete;
+    ThreadCache& operator=(const ThreadCache&) = delete;
+
+    //Forget everything cached if the arena has been released since it was cached
+    void syncGeneration();
+  };
+
+  struct Stats {
+    int64_t numLiveNodes;
+    int64_t numLiveChildrenBytes;
+    int64_t numNodeSlabs;
+    int64_t numChildrenSlabs;
+    int64_t numBytes;
+  };
+
+  SearchNodeArena();
+  ~SearchNodeArena();
+
+  SearchNodeArena(const SearchNodeArena&) = delete;
+  SearchNodeArena& operator=(const SearchNodeArena&) = delete;
+
+  //Threadsafe, given that each ThreadCache is used by only one thread at a time.
+  //Memory for a single SearchNode, to be constructed in place by the caller.
+  void* allocNode(ThreadCache& cache);
+  SearchNode** allocChildren(ThreadCache& cache, int capacity);
+  //For an array that is no longer used by any node, such as when growing the children of a node
+  void freeChildren(ThreadCache& cache, SearchNode** children, int capacity);
+
+  //Queue node, all of its descendants, and their children arrays to be destroyed in the background, keeping the memory
+  //for reuse. Threadsafe, but nothing else may use any of the nodes afterwards.
+  void destroySubtree(SearchNode* node);
+  //Queue exactly these nodes and their children arrays to be destroyed in the background, without following children,
+  //for a search graph where nodes may have several parents. Same threadsafety as destroySubtree.
+  void destroyNodes(const std::vector<SearchNode*>& nodes);
+  //Run task on the background thread, such as finding which nodes to destroy, so that the caller doesn't wait on it.
+  //Threadsafe. task may use destroySubtree and destroyNodes. releaseAll drops tasks not yet started and waits for the
+  //one running, so tasks may use nodes as long as they are only released with releaseAll.
+  void runInBackground(std::function<void()> task);
+
+  //Discard every node still alive, and queue them all to be destroyed and all memory to be freed in the background.
+  //NOT threadsafe, nothing may be allocating or using any nodes. ThreadCaches notice this by themselves and simply
+  //start over.
+  void releaseAll();
+
+  //Block until everything queued so far has been destroyed or freed, and every task has run.
+  void waitForReclamation();
+
+  //Threadsafe, the live counts might be slightly stale while other threads allocate. They also count nodes and children
+  //arrays of subtrees not yet destroyed in the background, and numBytes counts memory not yet freed.
+  Stats getStats() const;
+  //Lock-free versions of the same counts, cheap enough to check after every playout
+  int64_t getNumLiveNodes() const;
+  int64_t getNumLiveChildrenBytes() const;
+
+  //The memory of the nn outputs that live nodes hold, see SearchNode::getNNOutputBytes. The arena only knows when
+  //they go away with their nodes, so whoever sets or replaces a node's nn output must add the difference. Threadsafe.
+  void addNNOutputBytes(int64_t bytes);
+  int64_t getNumLiveNNOutputBytes() const;
+
+ private:
+  mutable std::mutex mutex;
+  uint64_t generation;
+
+  //Sorted by address, so that the slab of a node can be found
+  std::vector<NodeSlab*> nodeSlabs;
+  std::vector<char*> childrenSlabs;
+  std::vector<std::pair<NodeSlab*,int>> sharedFreeNodes;
+  std::vector<SearchNode**> sharedFreeChildren[MAX_CHILDREN_SIZE_CLASSES];
+
+  int numChildrenSizeClasses;
+  int childrenSizeClassCapacity[MAX_CHILDREN_SIZE_CLASSES];
+
+  std::atomic<int64_t> numLiveNodes;
+  std::atomic<int64_t> numLiveChildrenBytes;
+  std::atomic<int64_t> numLiveNNOutputBytes;
+
+  //Background reclamation, all protected by mutex
+  struct RetiredSlabs;
+  std::thread reclaimThread;
+  std::condition_variable reclaimWorkCond;
+  std::condition_variable reclaimDoneCond;
+  std::deque<SearchNode*> pendingSubtrees;
+  std::vector<SearchNode*> pendingSingleNodes;
+  std::deque<RetiredSlabs*> pendingRetired;
+  std::deque<std::function<void()>> pendingTasks;
+  int64_t numRetiredBytes;
+  bool reclaimBusyWithSubtree;
+  bool reclaimBusyWithRetired;
+  bool reclaimBusyWithTask;
+  bool reclaimAbortSubtree;
+  bool reclaimShouldExit;
+
+  int getChildrenSizeClass(int capacity) const;
+  bool isIndividuallyAllocated(int sizeClass) const;
+  //These require mutex to be held
+  NodeSlab* newNodeSlab();
+  char* newChildrenSlab();
+  std::pair<NodeSlab*,int> findNodeSlot(const SearchNode* node) const;
+  void startReclaimThreadIfNeeded();
+
+  void reclaimLoop();
+  void sweepAndFree(std::vector<NodeSlab*>& slabs, std::vector<char*>& children);
+};
+
+#endif  // SEARCH_NODEARENA_H_
@@ -0,0 +1,64 @@
+#include "../search/nodetable.h"
+
+#include "../search/search.h"
+
+using namespace std;
+
+SearchNodeTable::SearchNodeTable() {
+  shards = new Shard[NUM_SHARDS];
+}
+
+SearchNodeTable::~SearchNodeTable() {
+  delete[] shards;
+}
+
+bool SearchNodeTable::isReachable(const SearchNode* node, uint64_t epoch) {
+  return node->reachEpoch.load(std::memory_order_relaxed) >= epoch;
+}
+
+void SearchNodeTable::insert(Hash128 key, SearchNode* node) {
+  Shard& shard = getShard(key);
+  lock_guard<std::mutex> lock(shard.mutex);
+  shard.nodes[key] = node;
+}
+
+int64_t SearchNodeTable::size() const {
+  int64_t total = 0;
+  for(int i = 0; i<NUM_SHARDS; i++) {
+    lock_guard<std::mutex> lock(shards[i].mutex);
+    total += (int64_t)(shards[i].nodes.size() + shards[i].replaced.size());
+  }
+  return total;
+}
+
+void SearchNodeTable::removeUnreachable(uint64_t epoch, std::vector<SearchNode*>& removed) {
+  for(int i = 0; i<NUM_SHARDS; i++) {
+    lock_guard<std::mutex> lock(shards[i].mutex);
+    auto& nodes = shards[i].nodes;
+    for(auto iter = nodes.begin(); iter != nodes.end(); ) {
+      if(!isReachable(iter->second,epoch)) {
+        removed.push_back(iter->second);
+        iter = nodes.erase(iter);
+      }
+      else
+        ++iter;
+    }
+    vector<SearchNode*>& replaced = shards[i].replaced;
+    size_t numKept = 0;
+    for(size_t j = 0; j<replaced.size(); j++) {
+      if(!isReachable(replaced[j],epoch))
+        removed.push_back(replaced[j]);
+      else
+        replaced[numKept++] = replaced[j];
+    }
+    replaced.resize(numKept);
+  }
+}
+
+void SearchNodeTable::clear() {
+  for(int i = 0; i<NUM_SHARDS; i++) {
+    shards[i].nodes.clear();
+    shards[i].nodes.rehash(0);
+    shards[i].replaced.clear();
+  }
+}
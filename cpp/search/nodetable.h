@@ -0,0 +1,78 @@
+#ifndef SEARCH_NODETABLE_H_
+#define SEARCH_NODETABLE_H_
+
+#include <unordered_map>
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/multithread.h"
+
+struct SearchNode;
+
+//Concurrent table of the nodes of a search graph, for useGraphSearch, so that positions reached by different
+//orders of moves can share a single node. Split into independently locked shards by key.
+//Nodes are marked with the epoch in which they were last known to be reachable from the root, see
+//Search::destroyUnreachableNodes. Only nodes of the current epoch are handed out, so that a node that is about to be
+//destroyed is never linked into the graph again.
+class SearchNodeTable {
+ public:
+  static constexpr int NUM_SHARDS = 64;
+
+  SearchNodeTable();
+  ~SearchNodeTable();
+
+  SearchNodeTable(const SearchNodeTable&) = delete;
+  SearchNodeTable& operator=(const SearchNodeTable&) = delete;
+
+  //Threadsafe. Returns the node for key if it is marked reachable in epoch or later, or else adds and returns the one
+  //made by create(), which is called while holding the lock of the shard and must not use the table. A node replaced
+  //this way is still kept track of, in case it turns out to be reachable after all.
+  template<typename CreateFunc>
+  SearchNode* findOrCreate(Hash128 key, uint64_t epoch, CreateFunc create);
+
+  //Threadsafe
+  void insert(Hash128 key, SearchNode* node);
+  //Threadsafe. Number of nodes kept track of, including ones that findOrCreate replaced.
+  int64_t size() const;
+
+  //Threadsafe. Remove every node not marked reachable in epoch or later and append them to removed.
+  void removeUnreachable(uint64_t epoch, std::vector<SearchNode*>& removed);
+  //NOT threadsafe
+  void clear();
+
+ private:
+  struct KeyHasher {
+    size_t operator()(const Hash128& key) const { return (size_t)key.hash0; }
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Hash128,SearchNode*,KeyHasher> nodes;
+    //Nodes no longer in nodes because findOrCreate replaced them, but that may still be reachable
+    std::vector<SearchNode*> replaced;
+  };
+  Shard* shards;
+
+  static bool isReachable(const SearchNode* node, uint64_t epoch);
+
+  Shard& getShard(Hash128 key) { return shards[key.hash1 % NUM_SHARDS]; }
+};
+
+template<typename CreateFunc>
+SearchNode* SearchNodeTable::findOrCreate(Hash128 key, uint64_t epoch, CreateFunc create) {
+  Shard& shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.nodes.find(key);
+  if(iter != shard.nodes.end()) {
+    if(isReachable(iter->second,epoch))
+      return iter->second;
+    shard.replaced.push_back(iter->second);
+    SearchNode* node = create();
+    iter->second = node;
+    return node;
+  }
+  SearchNode* node = create();
+  shard.nodes.emplace(key,node);
+  return node;
+}
+
+#endif  // SEARCH_NODETABLE_H_
@@ -2,9 +2,11 @@
 
 #include <algorithm>
 #include <inttypes.h>
+#include <new>
 
 #include "../core/fancymath.h"
 #include "../core/timer.h"
+#include "../game/areacache.h"
 #include "../search/distributiontable.h"
 
 using namespace std;
@@ -51,6 +53,53 @@ double NodeStats::getResultUtilitySum(const SearchParams& searchParams) const {
   );
 }
 
+NodeStatsAtomic::NodeStatsAtomic()
+  :visits(0),
+   winValueSum(0.0),
+   noResultValueSum(0.0),
+   scoreMeanSum(0.0),
+   scoreMeanSqSum(0.0),
+   utilitySum(0.0),
+   utilitySqSum(0.0),
+   weightSum(0.0),
+   weightSqSum(0.0)
+{}
+NodeStatsAtomic::~NodeStatsAtomic()
+{}
+
+NodeStatsAtomic::NodeStatsAtomic(const NodeStatsAtomic& other)
+  :NodeStatsAtomic()
+{
+  *this = other;
+}
+NodeStatsAtomic& NodeStatsAtomic::operator=(const NodeStatsAtomic& other) {
+  NodeStats s = other.snapshot();
+  winValueSum.store(s.winValueSum,std::memory_order_relaxed);
+  noResultValueSum.store(s.noResultValueSum,std::memory_order_relaxed);
+  scoreMeanSum.store(s.scoreMeanSum,std::memory_order_relaxed);
+  scoreMeanSqSum.store(s.scoreMeanSqSum,std::memory_order_relaxed);
+  utilitySum.store(s.utilitySum,std::memory_order_relaxed);
+  utilitySqSum.store(s.utilitySqSum,std::memory_order_relaxed);
+  weightSum.store(s.weightSum,std::memory_order_relaxed);
+  weightSqSum.store(s.weightSqSum,std::memory_order_relaxed);
+  visits.store(s.visits,std::memory_order_release);
+  return *this;
+}
+
+NodeStats NodeStatsAtomic::snapshot() const {
+  NodeStats s;
+  s.visits = visits.load(std::memory_order_acquire);
+  s.winValueSum = winValueSum.load(std::memory_order_relaxed);
+  s.noResultValueSum = noResultValueSum.load(std::memory_order_relaxed);
+  s.scoreMeanSum = scoreMeanSum.load(std::memory_order_relaxed);
+  s.scoreMeanSqSum = scoreMeanSqSum.load(std::memory_order_relaxed);
+  s.utilitySum = utilitySum.load(std::memory_order_relaxed);
+  s.utilitySqSum = utilitySqSum.load(std::memory_order_relaxed);
+  s.weightSum = weightSum.load(std::memory_order_relaxed);
+  s.weightSqSum = weightSqSum.load(std::memory_order_relaxed);
+  return s;
+}
+
 static double getResultUtility(double winValue, double noResultValue, const SearchParams& searchParams) {
   return (
     (2.0*winValue - 1.0 + noResultValue) * searchParams.winLossUtilityFactor +
@@ -75,26 +124,22 @@ static double getScoreStdev(double scoreMean, double scoreMeanSq) {
 //-----------------------------------------------------------------------------------------
 
 SearchNode::SearchNode(Search& search, SearchThread& thread, Loc moveLoc)
-  :lockIdx(),nextPla(thread.pla),prevMoveLoc(moveLoc),
-   nnOutput(),
+  :lockIdx(),nextPla(thread.pla),prevMoveLoc(moveLoc),graphHash(),
+   nnOutput(),nnEvalPending(false),isCollapsed(false),
    children(NULL),numChildren(0),childrenCapacity(0),
-   stats(),virtualLosses(0)
+   stats(),reachEpoch(search.graphReachEpoch)
 {
   lockIdx = thread.rand.nextUInt(search.mutexPool->getNumMutexes());
 }
+//Children and the children array are destroyed and freed by the nodeArena, never by the node itself
 SearchNode::~SearchNode() {
-  if(children != NULL) {
-    for(int i = 0; i<numChildren; i++)
-      delete children[i];
-  }
-  delete[] children;
 }
 
 SearchNode::SearchNode(SearchNode&& other) noexcept
 :lockIdx(other.lockIdx),
-  nextPla(other.nextPla),prevMoveLoc(other.prevMoveLoc),
-  nnOutput(std::move(other.nnOutput)),
-  stats(other.stats),virtualLosses(other.virtualLosses)
+  nextPla(other.nextPla),prevMoveLoc(other.prevMoveLoc),graphHash(other.graphHash),
+  nnOutput(std::move(other.nnOutput)),nnEvalPending(other.nnEvalPending),isCollapsed(other.isCollapsed),
+  stats(other.stats),reachEpoch(other.reachEpoch.load(std::memory_order_relaxed))
 {
   children = other.children;
   other.children = NULL;
@@ -105,16 +150,57 @@ SearchNode& SearchNode::operator=(SearchNode&& other) noexcept {
   lockIdx = other.lockIdx;
   nextPla = other.nextPla;
   prevMoveLoc = other.prevMoveLoc;
+  graphHash = other.graphHash;
   nnOutput = std::move(other.nnOutput);
+  nnEvalPending = other.nnEvalPending;
+  isCollapsed = other.isCollapsed;
   children = other.children;
   other.children = NULL;
   numChildren = other.numChildren;
   childrenCapacity = other.childrenCapacity;
   stats = other.stats;
-  virtualLosses = other.virtualLosses;
+  reachEpoch.store(other.reachEpoch.load(std::memory_order_relaxed),std::memory_order_relaxed);
   return *this;
 }
 
+SearchChildEdges SearchNode::getChildEdges() const {
+  assert(children != NULL);
+  return SearchChildEdges(children,childrenCapacity);
+}
+
+int64_t SearchNode::getNNOutputBytes() const {
+  const NNOutput* output = nnOutput.get();
+  if(output == NULL)
+    return 0;
+  int64_t bytes = (int64_t)sizeof(NNOutput);
+  if(output->whiteOwnerMap != NULL)
+    bytes += (int64_t)(output->nnXLen * output->nnYLen * sizeof(float));
+  return bytes;
+}
+
+//For useGraphSearch, the graphHash of the node for the situation at the end of hist, reached from a node with
+//parentGraphHash by moveLoc. Usually just the situation, the same as the superko hash under situational rules but
+//always including the player to move, the encore phase, and the simple ko, so that every order of moves reaching it
+//shares one node. But after a pass, once the game is over, or when the situation repeats an earlier one, what happens
+//next depends on how we got here, so then it is chained to the parent instead.
+//rootKoHashTable is as for BoardHistory::currentKoHashRepeatsEarlier.
+static Hash128 getGraphHash(
+  Hash128 parentGraphHash, const Board& board, const BoardHistory& hist, Player nextPla, Loc moveLoc,
+  const KoHashTable* rootKoHashTable
+) {
+  Hash128 hash = board.pos_hash ^ Board::ZOBRIST_PLAYER_HASH[nextPla] ^ Board::ZOBRIST_ENCORE_HASH[hist.encorePhase] ^ hist.koProhibitHash;
+  if(board.ko_loc != Board::NULL_LOC)
+    hash ^= Board::ZOBRIST_KO_LOC_HASH[board.ko_loc];
+
+  bool dependsOnPath =
+    moveLoc == Board::PASS_LOC ||
+    hist.isGameFinished ||
+    hist.currentKoHashRepeatsEarlier(rootKoHashTable);
+  if(dependsOnPath)
+    hash ^= Hash128(Hash::murmurMix(parentGraphHash.hash0 + 0x9e3779b97f4a7c15ULL), Hash::murmurMix(parentGraphHash.hash1 + 0xc2b2ae3d27d4eb4fULL));
+  return hash;
+}
+
 //-----------------------------------------------------------------------------------------
 
 static string makeSeed(const Search& search, int threadIdx) {
@@ -149,7 +235,13 @@ SearchThread::SearchThread(int tIdx, const Search& search, Logger* lg)
    utilityBuf(),
    utilitySqBuf(),
    selfUtilityBuf(),
-   visitsBuf()
+   visitsBuf(),
+   moveRecords(),
+   descentPath(),
+   descentChildIdxs(),
+   pendingLeaves(),
+   freePendingLeaves(),
+   nodeAllocCache(search.nodeArena)
 {
   if(logger != NULL)
     logStream = logger->createOStream();
@@ -169,27 +261,78 @@ SearchThread::SearchThread(int tIdx, const Search& search, Logger* lg)
 
 }
 SearchThread::~SearchThread() {
+  //Normally the search finishes all leaves in flight, but if it was aborted, the nn server may still write to these
+  for(size_t i = 0; i<pendingLeaves.size(); i++) {
+    NNResultBuf& buf = pendingLeaves[i]->nnResultBuf;
+    std::unique_lock<std::mutex> resultLock(buf.resultMutex);
+    while(!buf.hasResult)
+      buf.clientWaitingForResult.wait(resultLock);
+    resultLock.unlock();
+    delete pendingLeaves[i];
+  }
+  pendingLeaves.clear();
+  for(size_t i = 0; i<freePendingLeaves.size(); i++)
+    delete freePendingLeaves[i];
+  freePendingLeaves.clear();
+
   if(logStream != NULL)
     delete logStream;
   logStream = NULL;
   logger = NULL;
 }
 
+void SearchThread::resetForSearch(const Search& search, Logger* lg) {
+  //Search::runSinglePlayout leaves nothing behind, even when it throws
+  assert(pendingLeaves.size() == 0);
+  assert(descentPath.size() == 0);
+  assert(descentChildIdxs.size() == 0);
+  pla = search.rootPla;
+  board = search.rootBoard;
+  history = search.rootHistory;
+  rand.init(makeSeed(search,threadIdx));
+  if(logger != lg) {
+    if(logStream != NULL)
+      delete logStream;
+    logStream = NULL;
+    logger = lg;
+    if(logger != NULL)
+      logStream = logger->createOStream();
+  }
+}
+
 //-----------------------------------------------------------------------------------------
 
 static const double VALUE_WEIGHT_DEGREES_OF_FREEDOM = 3.0;
 
 static const int64_t MIN_VISITS_FOR_LCB = 3;
 
+//When the tree goes over maxTreeNodes or maxTreeBytes, collapse subtrees until it is back down to this proportion of
+//them, so that the search can run a good while before having to stop and collapse again
+static const double TREE_BUDGET_COLLAPSE_TARGET = 0.75;
+
+//getGraphHash should keep a search graph acyclic, but just in case it doesn't, a playout this deep must be going around a
+//cycle, so stop it there rather than descend forever
+static const size_t MAX_GRAPH_DESCENT_DEPTH = 10000;
+
 Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   :rootPla(P_BLACK),rootBoard(),rootHistory(),rootPassLegal(true),
-   rootSafeArea(NULL),
+   rootSafeArea(NULL),rootAreaCache(NULL),
    recentScoreCenter(0.0),
    alwaysIncludeOwnerMap(false),
    searchParams(params),numSearchesBegun(0),randSeed(rSeed),
    normToTApproxZ(0.0),
    nnEvaluator(nnEval),
-   nonSearchRand(rSeed + string("$nonSearchRand"))
+   nonSearchRand(rSeed + string("$nonSearchRand")),
+   searchThreads(),
+   searchWorkers(),
+   searchWorkersMutex(),
+   searchWorkersStartCond(),
+   searchWorkersDoneCond(),
+   searchWorkersTask(),
+   searchWorkersTaskGeneration(0),
+   searchWorkersNumRunning(0),
+   searchWorkersShouldExit(false),
+   searchWorkersException()
 {
   nnXLen = nnEval->getNNXLen();
   nnYLen = nnEval->getNNYLen();
@@ -199,6 +342,7 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   rootKoHashTable = new KoHashTable();
 
   rootSafeArea = new Color[Board::MAX_ARR_SIZE];
+  rootAreaCache = new AreaCache();
 
   valueWeightDistribution = new DistributionTable(
     [](double z) { return FancyMath::tdistpdf(z,VALUE_WEIGHT_DEGREES_OF_FREEDOM); },
@@ -209,6 +353,10 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   );
 
   rootNode = NULL;
+  nodeArena = new SearchNodeArena();
+  usingGraphSearch = false;
+  nodeTable = new SearchNodeTable();
+  graphReachEpoch = 0;
   mutexPool = new MutexPool(params.mutexPoolSize);
 
   rootHistory.clear(rootBoard,rootPla,Rules(),0);
@@ -216,10 +364,19 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
 }
 
 Search::~Search() {
+  stopSearchWorkers();
+  for(size_t i = 0; i<searchThreads.size(); i++)
+    delete searchThreads[i];
+  searchThreads.clear();
+
   delete[] rootSafeArea;
+  delete rootAreaCache;
   delete rootKoHashTable;
   delete valueWeightDistribution;
-  delete rootNode;
+  rootNode = NULL;
+  //The arena's background thread may still be using the table and the mutexes
+  delete nodeArena;
+  delete nodeTable;
   delete mutexPool;
 }
 
@@ -295,7 +452,9 @@ void Search::setNNEval(NNEvaluator* nnEval) {
 }
 
 void Search::clearSearch() {
-  delete rootNode;
+  //Frees the whole tree at once
+  nodeArena->releaseAll();
+  nodeTable->clear();
   rootNode = NULL;
 }
 
@@ -337,13 +496,21 @@ bool Search::makeMove(Loc moveLoc, Player movePla) {
     bool foundChild = false;
     for(int i = 0; i<rootNode->numChildren; i++) {
       SearchNode* child = rootNode->children[i];
-      if(child->prevMoveLoc == moveLoc) {
-        //Grab out the node to prevent its deletion along with the root
-        SearchNode* node = new SearchNode(std::move(*child));
-        //Delete the root and replace it with the child
-        delete rootNode;
-        rootNode = node;
-        rootNode->prevMoveLoc = Board::NULL_LOC;
+      if(getChildMoveLoc(*rootNode,i) == moveLoc) {
+        if(usingGraphSearch) {
+          //Other children may share nodes with this one, so rather than deleting them, delete whatever is left over
+          rootNode = child;
+          rootNode->prevMoveLoc = Board::NULL_LOC;
+          destroyUnreachableNodes();
+        }
+        else {
+          //Detach the child to prevent its deletion along with the root
+          rootNode->children[i] = NULL;
+          //Delete the root and replace it with the child
+          nodeArena->destroySubtree(rootNode);
+          rootNode = child;
+          rootNode->prevMoveLoc = Board::NULL_LOC;
+        }
         foundChild = true;
         break;
       }
@@ -404,12 +571,9 @@ bool Search::getPlaySelectionValuesAlreadyLocked(
 
   //Store up basic visit counts
   for(int i = 0; i<numChildren; i++) {
-    SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
+    Loc moveLoc = getChildMoveLoc(node,i);
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    int64_t childVisits = getChildEdgeVisits(node,i);
 
     locs.push_back(moveLoc);
     playSelectionValues.push_back(childVisits);
@@ -430,14 +594,13 @@ bool Search::getPlaySelectionValuesAlreadyLocked(
   //Possibly reduce visits on children that we spend too many visits on in retrospect
   if(&node == rootNode && searchParams.rootDesiredPerChildVisitsCoeff > 0 && numChildren > 0) {
 
-    const SearchNode* bestChild = node.children[mostVisitedIdx];
     double fpuValue = -10.0; //dummy, not actually used since these childs all should actually have visits
     bool isRootDuringSearch = false;
-    double bestChildExploreSelectionValue = getExploreSelectionValue(node,bestChild,totalChildVisits,fpuValue,isRootDuringSearch);
+    double bestChildExploreSelectionValue = getExploreSelectionValue(node,mostVisitedIdx,totalChildVisits,fpuValue,isRootDuringSearch);
 
     for(int i = 0; i<numChildren; i++) {
       if(i != mostVisitedIdx)
-        playSelectionValues[i] = getReducedPlaySelectionVisits(node, node.children[i], totalChildVisits, bestChildExploreSelectionValue);
+        playSelectionValues[i] = getReducedPlaySelectionVisits(node, i, totalChildVisits, bestChildExploreSelectionValue);
     }
   }
 
@@ -446,7 +609,7 @@ bool Search::getPlaySelectionValuesAlreadyLocked(
     double bestLcb = -1e10;
     int bestLcbIndex = -1;
     for(int i = 0; i<numChildren; i++) {
-      getSelfUtilityLCBAndRadius(node,node.children[i],lcbBuf[i],radiusBuf[i]);
+      getSelfUtilityLCBAndRadius(node,i,lcbBuf[i],radiusBuf[i]);
       //Check if this node is eligible to be considered for best LCB
       double visits = playSelectionValues[i];
       if(visits >= MIN_VISITS_FOR_LCB && visits >= searchParams.minVisitPropForLCB * mostVisitedChildVisits) {
@@ -561,13 +724,11 @@ bool Search::getNodeValues(const SearchNode& node, ReportedSearchValues& values)
   if(nnOutput == nullptr)
     return false;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  double winValueSum = node.stats.winValueSum;
-  double noResultValueSum = node.stats.noResultValueSum;
-  double scoreMeanSum = node.stats.scoreMeanSum;
-  double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-  double weightSum = node.stats.weightSum;
-  node.statsLock.clear(std::memory_order_release);
+  double winValueSum = node.stats.winValueSum.load(std::memory_order_relaxed);
+  double noResultValueSum = node.stats.noResultValueSum.load(std::memory_order_relaxed);
+  double scoreMeanSum = node.stats.scoreMeanSum.load(std::memory_order_relaxed);
+  double scoreMeanSqSum = node.stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+  double weightSum = node.stats.weightSum.load(std::memory_order_relaxed);
 
   assert(weightSum > 0.0);
 
@@ -633,10 +794,8 @@ double Search::getRootUtility() const {
   assert(rootNode != NULL);
   const SearchNode& node = *rootNode;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  double utilitySum = node.stats.utilitySum;
-  double weightSum = node.stats.weightSum;
-  node.statsLock.clear(std::memory_order_release);
+  double utilitySum = node.stats.utilitySum.load(std::memory_order_relaxed);
+  double weightSum = node.stats.weightSum.load(std::memory_order_relaxed);
 
   assert(weightSum > 0.0);
   return utilitySum / weightSum;
@@ -646,9 +805,7 @@ int64_t Search::getRootVisits() const {
   assert(rootNode != NULL);
   const SearchNode& node = *rootNode;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  int64_t numVisits = node.stats.visits;
-  node.statsLock.clear(std::memory_order_release);
+  int64_t numVisits = node.stats.visits.load(std::memory_order_acquire);
 
   return numVisits;
 }
@@ -794,9 +951,11 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
       (*recordUtilities)[i] = NAN;
   }
 
-  auto searchLoop = [this,&timer,&numPlayoutsShared,numNonPlayoutVisits,&logger,&shouldStopNow,&recordUtilities,maxVisits,maxPlayouts,maxTime](int threadIdx) {
-    SearchThread* stbuf = new SearchThread(threadIdx,*this,&logger);
+  //Set by any thread that finds the tree over its memory budget, to have all threads pause while it is collapsed
+  std::atomic<bool> shouldCollapseNow(false);
+  bool enforceTreeBudget = true;
 
+  auto searchLoop = [this,&timer,&numPlayoutsShared,numNonPlayoutVisits,&logger,&shouldStopNow,&shouldCollapseNow,&enforceTreeBudget,&recordUtilities,maxVisits,maxPlayouts,maxTime](SearchThread& thread) {
     int64_t numPlayouts = numPlayoutsShared.load(std::memory_order_relaxed);
     try {
       while(true) {
@@ -809,11 +968,21 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
           shouldStopNow.store(true,std::memory_order_relaxed);
           break;
         }
+        if(enforceTreeBudget && isTreeOverBudget())
+          shouldCollapseNow.store(true,std::memory_order_relaxed);
+        if(shouldCollapseNow.load(std::memory_order_relaxed))
+          break;
 
-        runSinglePlayout(*stbuf);
+        //So that a batch of leaves doesn't run past the limits
+        int64_t maxPlayoutsToStart = std::min(maxPlayouts - numPlayouts, maxVisits - numPlayouts - numNonPlayoutVisits);
+        int numStarted = runSinglePlayout(thread,maxPlayoutsToStart);
+        if(numStarted <= 0) {
+          numPlayouts = numPlayoutsShared.load(std::memory_order_relaxed);
+          continue;
+        }
 
-        numPlayouts = numPlayoutsShared.fetch_add((int64_t)1, std::memory_order_relaxed);
-        numPlayouts += 1;
+        numPlayouts = numPlayoutsShared.fetch_add((int64_t)numStarted, std::memory_order_relaxed);
+        numPlayouts += numStarted;
 
         //Test and see if the altered training target has an effect in a real training run.
         if(searchParams.numThreads == 1 && recordUtilities != NULL) {
@@ -824,39 +993,143 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
         }
 
       }
+      finishPendingPlayouts(thread);
     }
     catch(const exception& e) {
       logger.write(string("ERROR: Search thread failed: ") + e.what());
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
     catch(const string& e) {
       logger.write("ERROR: Search thread failed: " + e);
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
     catch(...) {
       logger.write("ERROR: Search thread failed with unexpected throw");
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
-
-    delete stbuf;
   };
 
-  if(searchParams.numThreads <= 1)
-    searchLoop(0);
+  prepareSearchThreads(searchParams.numThreads,&logger);
+  while(true) {
+    runOnAllSearchThreads(searchLoop);
+    if(!shouldCollapseNow.load(std::memory_order_relaxed) || shouldStopNow.load(std::memory_order_relaxed))
+      break;
+    //With every thread stopped, nothing else is touching the tree, so we can collapse it and then carry on.
+    //If there is nothing left to collapse, just let the tree go over budget for the rest of this search.
+    if(!collapseLowVisitSubtrees(logger))
+      enforceTreeBudget = false;
+    shouldCollapseNow.store(false,std::memory_order_relaxed);
+  }
+}
+
+
+void Search::prepareSearchThreads(int numThreads, Logger* logger) {
+  if(numThreads < 1)
+    numThreads = 1;
+  //Thread count changed since the last search, restart the workers
+  if(searchThreads.size() != numThreads) {
+    stopSearchWorkers();
+    for(size_t i = 0; i<searchThreads.size(); i++)
+      delete searchThreads[i];
+    searchThreads.clear();
+    for(int threadIdx = 0; threadIdx<numThreads; threadIdx++)
+      searchThreads.push_back(new SearchThread(threadIdx,*this,logger));
+    //New workers must only pick up tasks posted after this point, not the generation of the last search
+    uint64_t startGeneration;
+    {
+      std::lock_guard<std::mutex> lock(searchWorkersMutex);
+      startGeneration = searchWorkersTaskGeneration;
+    }
+    for(int threadIdx = 1; threadIdx<numThreads; threadIdx++)
+      searchWorkers.push_back(std::thread(&Search::searchWorkerLoop,this,threadIdx,startGeneration));
+  }
   else {
-    std::thread* threads = new std::thread[searchParams.numThreads-1];
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i] = std::thread(searchLoop,i+1);
-    searchLoop(0);
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i].join();
-    delete[] threads;
+    for(int threadIdx = 0; threadIdx<numThreads; threadIdx++)
+      searchThreads[threadIdx]->resetForSearch(*this,logger);
+  }
+}
+
+void Search::searchWorkerLoop(int threadIdx, uint64_t lastGeneration) {
+  std::unique_lock<std::mutex> lock(searchWorkersMutex);
+  while(true) {
+    while(!searchWorkersShouldExit && searchWorkersTaskGeneration == lastGeneration)
+      searchWorkersStartCond.wait(lock);
+    if(searchWorkersShouldExit)
+      return;
+    lastGeneration = searchWorkersTaskGeneration;
+    //Only ever start on a task that runOnAllSearchThreads posted and is still waiting on
+    assert(searchWorkersTask && searchWorkersNumRunning > 0);
+    lock.unlock();
+
+    std::exception_ptr exception;
+    try {
+      searchWorkersTask(*searchThreads[threadIdx]);
+    }
+    catch(...) {
+      exception = std::current_exception();
+    }
+
+    lock.lock();
+    if(exception && !searchWorkersException)
+      searchWorkersException = exception;
+    searchWorkersNumRunning--;
+    if(searchWorkersNumRunning <= 0)
+      searchWorkersDoneCond.notify_all();
+  }
+}
+
+void Search::runOnAllSearchThreads(const std::function<void(SearchThread&)>& f) {
+  assert(searchThreads.size() == searchWorkers.size() + 1);
+  if(searchWorkers.size() <= 0) {
+    f(*searchThreads[0]);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(searchWorkersMutex);
+    searchWorkersTask = f;
+    searchWorkersException = std::exception_ptr();
+    searchWorkersNumRunning = (int)searchWorkers.size();
+    searchWorkersTaskGeneration++;
+  }
+  searchWorkersStartCond.notify_all();
+
+  std::exception_ptr exception;
+  try {
+    f(*searchThreads[0]);
+  }
+  catch(...) {
+    exception = std::current_exception();
   }
+
+  std::unique_lock<std::mutex> lock(searchWorkersMutex);
+  while(searchWorkersNumRunning > 0)
+    searchWorkersDoneCond.wait(lock);
+  searchWorkersTask = std::function<void(SearchThread&)>();
+  if(!exception)
+    exception = searchWorkersException;
+  searchWorkersException = std::exception_ptr();
+  lock.unlock();
+
+  if(exception)
+    std::rethrow_exception(exception);
 }
 
+void Search::stopSearchWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(searchWorkersMutex);
+    searchWorkersShouldExit = true;
+  }
+  searchWorkersStartCond.notify_all();
+  for(size_t i = 0; i<searchWorkers.size(); i++)
+    searchWorkers[i].join();
+  searchWorkers.clear();
+  std::lock_guard<std::mutex> lock(searchWorkersMutex);
+  searchWorkersShouldExit = false;
+}
 
 void Search::beginSearch(Logger& logger) {
   if(rootBoard.x_size > nnXLen || rootBoard.y_size > nnYLen)
@@ -883,59 +1156,92 @@ void Search::beginSearch(Logger& logger) {
   if(!rootPassLegal && searchParams.rootPruneUselessMoves)
     throw StringError("Both rootPassLegal=false and searchParams.rootPruneUselessMoves=true are specified, this could leave the bot without legal moves!");
 
+  //A tree and a graph don't mix, so start over if the params switched between them
+  if(rootNode != NULL && usingGraphSearch != searchParams.useGraphSearch)
+    clearSearch();
+
   SearchThread dummyThread(-1, *this, NULL);
 
   if(rootNode == NULL) {
-    rootNode = new SearchNode(*this, dummyThread, Board::NULL_LOC);
+    usingGraphSearch = searchParams.useGraphSearch;
+    rootNode = new(nodeArena->allocNode(dummyThread.nodeAllocCache)) SearchNode(*this, dummyThread, Board::NULL_LOC);
+    if(usingGraphSearch) {
+      rootNode->graphHash = getGraphHash(Hash128(), rootBoard, rootHistory, rootPla, Board::NULL_LOC, NULL);
+      nodeTable->insert(rootNode->graphHash, rootNode);
+    }
   }
   else {
-    //If the root node has any existing children, then prune things down if there are moves that should not be allowed at the root.
     SearchNode& node = *rootNode;
+
+    //A collapsed node that became the root has nothing but its summary, so search it afresh from its own nn eval
+    if(node.isCollapsed) {
+      node.isCollapsed = false;
+      while(node.statsWriteLock.test_and_set(std::memory_order_acquire));
+      node.stats.visits.store(1,std::memory_order_release);
+      node.statsWriteLock.clear(std::memory_order_release);
+      recomputeNodeStats(node, dummyThread, 0, true);
+    }
+
+    //If the root node has any existing children, then prune things down if there are moves that should not be allowed at the root.
     int numChildren = node.numChildren;
     if(node.children != NULL && numChildren > 0) {
       assert(node.nnOutput != NULL);
 
       //Perform the filtering
+      //Nothing else is searching, but in a graph, the nodeArena may still be marking what is reachable
+      std::mutex& rootMutex = mutexPool->getMutex(node.lockIdx);
+      unique_lock<std::mutex> rootLock(rootMutex);
+      SearchChildEdges edges = node.getChildEdges();
       int numGoodChildren = 0;
       for(int i = 0; i<numChildren; i++) {
         SearchNode* child = node.children[i];
-        node.children[i] = NULL;
-        if(isAllowedRootMove(child->prevMoveLoc))
-          node.children[numGoodChildren++] = child;
+        if(isAllowedRootMove(getChildMoveLoc(node,i))) {
+          if(numGoodChildren != i) {
+            edges.copyEntry(i,edges,numGoodChildren);
+            node.children[i] = NULL;
+          }
+          numGoodChildren++;
+        }
         else {
-          delete child;
+          node.children[i] = NULL;
+          //In a graph, the child may be shared with other children, so wait and see what is unreachable at the end
+          if(!usingGraphSearch)
+            nodeArena->destroySubtree(child);
         }
       }
       bool anyFiltered = numChildren != numGoodChildren;
       node.numChildren = numGoodChildren;
       numChildren = numGoodChildren;
+      rootLock.unlock();
+      if(anyFiltered && usingGraphSearch)
+        destroyUnreachableNodes();
 
       if(anyFiltered) {
         //Fix up the number of visits of the root node after doing this filtering
         int64_t newNumVisits = 0;
-        for(int i = 0; i<numChildren; i++) {
-          const SearchNode* child = node.children[i];
-          while(child->statsLock.test_and_set(std::memory_order_acquire));
-          int64_t childVisits = child->stats.visits;
-          child->statsLock.clear(std::memory_order_release);
-          newNumVisits += childVisits;
-        }
+        for(int i = 0; i<numChildren; i++)
+          newNumVisits += getChildEdgeVisits(node,i);
         //For the node's own visit itself
         newNumVisits += 1;
 
         //Set the visits in place
-        while(node.statsLock.test_and_set(std::memory_order_acquire));
-        node.stats.visits = newNumVisits;
-        node.statsLock.clear(std::memory_order_release);
+        while(node.statsWriteLock.test_and_set(std::memory_order_acquire));
+        node.stats.visits.store(newNumVisits,std::memory_order_release);
+        node.statsWriteLock.clear(std::memory_order_release);
 
         //Update all other stats
-        recomputeNodeStats(node, dummyThread, 0, 0, true);
+        recomputeNodeStats(node, dummyThread, 0, true);
       }
     }
 
     //Recursively update all stats in the tree if we have dynamic score values
     if(searchParams.dynamicScoreUtilityFactor != 0) {
-      recursivelyRecomputeStats(node,dummyThread,true);
+      if(usingGraphSearch) {
+        std::unordered_set<const SearchNode*> visited;
+        recursivelyRecomputeStats(node,dummyThread,true,&visited);
+      }
+      else
+        recursivelyRecomputeStats(node,dummyThread,true,NULL);
     }
 
   }
@@ -958,7 +1264,22 @@ double Search::getNormToTApproxForLCB(int64_t numVisits) const {
   return normToTApproxTable[idx];
 }
 
-void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot) {
+void Search::recomputeAllNodeStats() {
+  if(rootNode == NULL)
+    return;
+  SearchThread dummyThread(-1, *this, NULL);
+  if(usingGraphSearch) {
+    std::unordered_set<const SearchNode*> visited;
+    recursivelyRecomputeStats(*rootNode,dummyThread,true,&visited);
+  }
+  else
+    recursivelyRecomputeStats(*rootNode,dummyThread,true,NULL);
+}
+
+void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot, std::unordered_set<const SearchNode*>* visited) {
+  if(visited != NULL && !visited->insert(&node).second)
+    return;
+
   //First, recompute all children.
   vector<SearchNode*> children;
   children.reserve(rootBoard.x_size * rootBoard.y_size + 1);
@@ -976,7 +1297,7 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
   }
 
   for(int i = 0; i<numChildren; i++) {
-    recursivelyRecomputeStats(*(children[i]),thread,false);
+    recursivelyRecomputeStats(*(children[i]),thread,false,visited);
   }
 
   //If this node has no nnOutput, then it must also have no children, because it's
@@ -986,13 +1307,12 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
 
   //If the node has no children, then just update its utility directly
   if(numChildren <= 0) {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double resultUtilitySum = node.stats.getResultUtilitySum(searchParams);
-    double scoreMeanSum = node.stats.scoreMeanSum;
-    double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-    double weightSum = node.stats.weightSum;
-    int64_t numVisits = node.stats.visits;
-    node.statsLock.clear(std::memory_order_release);
+    NodeStats stats = node.stats.snapshot();
+    double resultUtilitySum = stats.getResultUtilitySum(searchParams);
+    double scoreMeanSum = stats.scoreMeanSum;
+    double scoreMeanSqSum = stats.scoreMeanSqSum;
+    double weightSum = stats.weightSum;
+    int64_t numVisits = stats.visits;
 
     //It's possible that this node has 0 weight in the case where it's the root node
     //and has 0 visits because we began a search and then stopped it before any playouts happened.
@@ -1008,26 +1328,188 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
       double newUtilitySum = newUtility * weightSum;
       double newUtilitySqSum = newUtility * newUtility * weightSum;
 
-      while(node.statsLock.test_and_set(std::memory_order_acquire));
-      node.stats.utilitySum = newUtilitySum;
-      node.stats.utilitySqSum = newUtilitySqSum;
-      node.statsLock.clear(std::memory_order_release);
+      while(node.statsWriteLock.test_and_set(std::memory_order_acquire));
+      node.stats.utilitySum.store(newUtilitySum,std::memory_order_relaxed);
+      node.stats.utilitySqSum.store(newUtilitySqSum,std::memory_order_relaxed);
+      node.statsWriteLock.clear(std::memory_order_release);
     }
   }
   else {
+    //The children changed, so their edges are out of date too
+    {
+      std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
+      lock_guard<std::mutex> lock(mutex);
+      for(int i = 0; i<numChildren; i++)
+        updateChildEdge(node,i,0,false);
+    }
     //Otherwise recompute it using the usual method
-    recomputeNodeStats(node, thread, 0, 0, isRoot);
+    recomputeNodeStats(node, thread, 0, isRoot);
   }
 }
 
 
+void Search::destroyUnreachableNodes() {
+  assert(usingGraphSearch);
+  //Nodes made from now on are in the new epoch, and nodeTable only hands out nodes already marked with it.
+  //So while the marking runs, the search may go on, and can't link in again anything that is about to be destroyed.
+  graphReachEpoch++;
+  uint64_t epoch = graphReachEpoch;
+  SearchNode* root = rootNode;
+  nodeArena->runInBackground([this,root,epoch]() {
+    vector<SearchNode*> stack;
+    if(root != NULL && root->reachEpoch.load(std::memory_order_relaxed) < epoch) {
+      root->reachEpoch.store(epoch,std::memory_order_relaxed);
+      stack.push_back(root);
+    }
+    while(stack.size() > 0) {
+      SearchNode* node = stack.back();
+      stack.pop_back();
+      //Search threads may be growing the children array
+      std::mutex& mutex = mutexPool->getMutex(node->lockIdx);
+      lock_guard<std::mutex> lock(mutex);
+      for(int i = 0; i<node->numChildren; i++) {
+        SearchNode* child = node->children[i];
+        if(child != NULL && child->reachEpoch.load(std::memory_order_relaxed) < epoch) {
+          child->reachEpoch.store(epoch,std::memory_order_relaxed);
+          stack.push_back(child);
+        }
+      }
+    }
+
+    vector<SearchNode*> unreachable;
+    nodeTable->removeUnreachable(epoch,unreachable);
+    nodeArena->destroyNodes(unreachable);
+  });
+}
+
+int64_t Search::getNumTreeNodes() const {
+  return nodeArena->getNumLiveNodes();
+}
+
+int64_t Search::getTreeMemoryBytes() const {
+  return nodeArena->getNumLiveNodes() * (int64_t)sizeof(SearchNode) + nodeArena->getNumLiveChildrenBytes() +
+    nodeArena->getNumLiveNNOutputBytes();
+}
+
+bool Search::isTreeOverBudget() const {
+  return getNumTreeNodes() > searchParams.maxTreeNodes || getTreeMemoryBytes() > searchParams.maxTreeBytes;
+}
+
+bool Search::collapseLowVisitSubtrees(Logger& logger) {
+  //Discarded nodes still count until destroyed in the background, such as the old tree after makeMove
+  nodeArena->waitForReclamation();
+  int64_t oldNumNodes = getNumTreeNodes();
+  int64_t oldNumBytes = getTreeMemoryBytes();
+  if(!isTreeOverBudget())
+    return true;
+  int64_t numNodesToFree = oldNumNodes - (int64_t)(searchParams.maxTreeNodes * TREE_BUDGET_COLLAPSE_TARGET);
+  int64_t numBytesToFree = oldNumBytes - (int64_t)(searchParams.maxTreeBytes * TREE_BUDGET_COLLAPSE_TARGET);
+
+  //Find what collapsing each node other than the root would free by itself, namely its children and their array.
+  //In a tree, no node has more visits than its parent, so collapsing every node with up to some number of visits
+  //frees the total of that for all of those nodes. In a graph, this is only roughly true.
+  struct CollapseCandidate {
+    int64_t visits;
+    int64_t numNodes;
+    int64_t numBytes;
+  };
+  vector<CollapseCandidate> candidates;
+  std::unordered_set<const SearchNode*> visited;
+  vector<const SearchNode*> stack;
+  stack.push_back(rootNode);
+  while(stack.size() > 0) {
+    const SearchNode* node = stack.back();
+    stack.pop_back();
+    if(node != rootNode && node->numChildren > 0) {
+      CollapseCandidate candidate;
+      candidate.visits = node->stats.visits.load(std::memory_order_acquire);
+      candidate.numNodes = node->numChildren;
+      candidate.numBytes = (int64_t)SearchChildEdges::bytesForCapacity(node->childrenCapacity);
+      for(int i = 0; i<node->numChildren; i++)
+        candidate.numBytes += (int64_t)sizeof(SearchNode) + node->children[i]->getNNOutputBytes();
+      candidates.push_back(candidate);
+    }
+    for(int i = 0; i<node->numChildren; i++) {
+      const SearchNode* child = node->children[i];
+      if(!usingGraphSearch || visited.insert(child).second)
+        stack.push_back(child);
+    }
+  }
+  std::sort(
+    candidates.begin(), candidates.end(),
+    [](const CollapseCandidate& a, const CollapseCandidate& b) { return a.visits < b.visits; }
+  );
+  int64_t maxVisitsToCollapse = -1;
+  int64_t numNodesFreed = 0;
+  int64_t numBytesFreed = 0;
+  for(size_t i = 0; i<candidates.size(); i++) {
+    if(numNodesFreed >= numNodesToFree && numBytesFreed >= numBytesToFree)
+      break;
+    maxVisitsToCollapse = candidates[i].visits;
+    numNodesFreed += candidates[i].numNodes;
+    numBytesFreed += candidates[i].numBytes;
+  }
+  if(maxVisitsToCollapse < 0) {
+    logger.write(
+      "Search tree over budget with " + Global::int64ToString(oldNumNodes) + " nodes and " +
+      Global::int64ToString(oldNumBytes) + " bytes but nothing left to collapse"
+    );
+    return false;
+  }
+
+  //Collapse the topmost nodes with few enough visits, which takes all the rest below them along
+  SearchNodeArena::ThreadCache& cache = searchThreads[0]->nodeAllocCache;
+  int numCollapsed = 0;
+  visited.clear();
+  vector<SearchNode*> collapseStack;
+  collapseStack.push_back(rootNode);
+  while(collapseStack.size() > 0) {
+    SearchNode* node = collapseStack.back();
+    collapseStack.pop_back();
+    if(node != rootNode && node->numChildren > 0 && node->stats.visits.load(std::memory_order_acquire) <= maxVisitsToCollapse) {
+      //In a graph, children may still be reachable some other way, so leave it to destroyUnreachableNodes
+      if(!usingGraphSearch) {
+        for(int i = 0; i<node->numChildren; i++)
+          nodeArena->destroySubtree(node->children[i]);
+      }
+      //Nothing else is searching, but in a graph, the nodeArena may still be marking what is reachable
+      std::mutex& mutex = mutexPool->getMutex(node->lockIdx);
+      lock_guard<std::mutex> lock(mutex);
+      nodeArena->freeChildren(cache,node->children,node->childrenCapacity);
+      node->children = NULL;
+      node->numChildren = 0;
+      node->childrenCapacity = 0;
+      node->isCollapsed = true;
+      numCollapsed++;
+      continue;
+    }
+    for(int i = 0; i<node->numChildren; i++) {
+      SearchNode* child = node->children[i];
+      if(!usingGraphSearch || visited.insert(child).second)
+        collapseStack.push_back(child);
+    }
+  }
+  if(usingGraphSearch)
+    destroyUnreachableNodes();
+  nodeArena->waitForReclamation();
+
+  logger.write(
+    "Search tree over budget with " + Global::int64ToString(oldNumNodes) + " nodes and " +
+    Global::int64ToString(oldNumBytes) + " bytes, collapsed " + Global::intToString(numCollapsed) +
+    " subtrees with up to " + Global::int64ToString(maxVisitsToCollapse) + " visits, leaving " +
+    Global::int64ToString(getNumTreeNodes()) + " nodes and " + Global::int64ToString(getTreeMemoryBytes()) + " bytes"
+  );
+  return true;
+}
+
 void Search::computeRootValues(Logger& logger) {
   //rootSafeArea is strictly pass-alive groups and strictly safe territory.
   bool nonPassAliveStones = false;
   bool safeBigTerritories = false;
   bool unsafeBigTerritories = false;
   bool isMultiStoneSuicideLegal = rootHistory.rules.multiStoneSuicideLegal;
-  rootBoard.calculateArea(
+  rootAreaCache->calculateArea(
+    rootBoard,
     rootSafeArea,
     nonPassAliveStones,
     safeBigTerritories,
@@ -1058,9 +1540,7 @@ void Search::computeRootValues(Logger& logger) {
 int64_t Search::numRootVisits() const {
   if(rootNode == NULL)
     return 0;
-  while(rootNode->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t n = rootNode->stats.visits;
-  rootNode->statsLock.clear(std::memory_order_release);
+  int64_t n = rootNode->stats.visits.load(std::memory_order_acquire);
   return n;
 }
 
@@ -1254,15 +1734,14 @@ void Search::getValueChildWeights(
 }
 
 //Parent must be locked
-void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNode* child, double& lcbBuf, double& radiusBuf) const {
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  double utilitySum = child->stats.utilitySum;
-  double utilitySqSum = child->stats.utilitySqSum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  double weightSqSum = child->stats.weightSqSum;
-  child->statsLock.clear(std::memory_order_release);
+void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, int childIdx, double& lcbBuf, double& radiusBuf) const {
+  const SearchNode* child = parent.children[childIdx];
+  double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+  double utilitySqSum = child->stats.utilitySqSum.load(std::memory_order_relaxed);
+  double scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+  double scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+  double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+  double weightSqSum = child->stats.weightSqSum.load(std::memory_order_relaxed);
 
   radiusBuf = 2.0 * (searchParams.winLossUtilityFactor + searchParams.staticScoreUtilityFactor + searchParams.dynamicScoreUtilityFactor);
   lcbBuf = -radiusBuf;
@@ -1276,7 +1755,7 @@ void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNo
     return;
 
   double utilityNoBonus = utilitySum / weightSum;
-  double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+  double endingScoreBonus = getEndingWhiteScoreBonus(parent,getChildMoveLoc(parent,childIdx));
   double utilityDiff = getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
   double utilityWithBonus = utilityNoBonus + utilityDiff;
   double selfUtility = parent.nextPla == P_WHITE ? utilityWithBonus : -utilityWithBonus;
@@ -1309,8 +1788,8 @@ double Search::getExploreSelectionValue(
 }
 
 //Parent must be locked
-double Search::getEndingWhiteScoreBonus(const SearchNode& parent, const SearchNode* child) const {
-  if(&parent != rootNode || child->prevMoveLoc == Board::NULL_LOC)
+double Search::getEndingWhiteScoreBonus(const SearchNode& parent, Loc moveLoc) const {
+  if(&parent != rootNode || moveLoc == Board::NULL_LOC)
     return 0.0;
   if(parent.nnOutput == nullptr || parent.nnOutput->whiteOwnerMap == NULL)
     return 0.0;
@@ -1320,7 +1799,6 @@ double Search::getEndingWhiteScoreBonus(const SearchNode& parent, const SearchNo
   assert(parent.nnOutput->nnXLen == nnXLen);
   assert(parent.nnOutput->nnYLen == nnYLen);
   float* whiteOwnerMap = parent.nnOutput->whiteOwnerMap;
-  Loc moveLoc = child->prevMoveLoc;
 
   //Extra points from the perspective of the root player
   double extraRootPoints = 0.0;
@@ -1378,19 +1856,18 @@ int Search::getPos(Loc moveLoc) const {
 }
 
 //Parent must be locked
-double Search::getExploreSelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const {
-  Loc moveLoc = child->prevMoveLoc;
+double Search::getExploreSelectionValue(const SearchNode& parent, int childIdx, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const {
+  const SearchNode* child = parent.children[childIdx];
+  Loc moveLoc = getChildMoveLoc(parent,childIdx);
   int movePos = getPos(moveLoc);
   float nnPolicyProb = parent.nnOutput->policyProbs[movePos];
 
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t childVisits = child->stats.visits;
-  double utilitySum = child->stats.utilitySum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  int32_t childVirtualLosses = child->virtualLosses;
-  child->statsLock.clear(std::memory_order_release);
+  int64_t childVisits = getChildEdgeVisits(parent,childIdx);
+  double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+  double scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+  double scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+  double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+  int32_t childVirtualLosses = parent.getChildEdges().virtualLosses[childIdx];
 
   //It's possible that childVisits is actually 0 here with multithreading because we're visiting this node while a child has
   //been expanded but its thread not yet finished its first visit
@@ -1402,7 +1879,7 @@ double Search::getExploreSelectionValue(const SearchNode& parent, const SearchNo
     childUtility = utilitySum / weightSum;
 
     //Tiny adjustment for passing
-    double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+    double endingScoreBonus = getEndingWhiteScoreBonus(parent,moveLoc);
     if(endingScoreBonus != 0)
       childUtility += getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
   }
@@ -1438,26 +1915,29 @@ double Search::getNewExploreSelectionValue(const SearchNode& parent, float nnPol
 }
 
 //Parent must be locked
-int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double bestChildExploreSelectionValue) const {
+int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, int childIdx, int64_t totalChildVisits, double bestChildExploreSelectionValue) const {
   assert(&parent == rootNode);
-  Loc moveLoc = child->prevMoveLoc;
+  const SearchNode* child = parent.children[childIdx];
+  Loc moveLoc = getChildMoveLoc(parent,childIdx);
   int movePos = getPos(moveLoc);
   float nnPolicyProb = parent.nnOutput->policyProbs[movePos];
 
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t childVisits = child->stats.visits;
-  double utilitySum = child->stats.utilitySum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  child->statsLock.clear(std::memory_order_release);
+  int64_t childVisits = getChildEdgeVisits(parent,childIdx);
+  double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+  double scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+  double scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+  double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
 
   //getReducedPlaySelectionValue only happens after the search, so there should be no multithreading shenanigans that give us a 0-visit child.
-  assert(childVisits > 0);
+  //Except in a graph, where a playout can link a new edge to a node some other thread is still evaluating and back off.
+  if(childVisits <= 0) {
+    assert(usingGraphSearch);
+    return 0;
+  }
   assert(weightSum > 0.0);
 
   //Tiny adjustment for passing
-  double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+  double endingScoreBonus = getEndingWhiteScoreBonus(parent,moveLoc);
   double childUtility = utilitySum / weightSum;
   if(endingScoreBonus != 0)
     childUtility += getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
@@ -1478,12 +1958,21 @@ int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, const Se
   return childVisits;
 }
 
+Loc Search::getChildMoveLoc(const SearchNode& node, int childIdx) const {
+  return NNPos::posToLoc(node.getChildEdges().movePoses[childIdx],rootBoard.x_size,rootBoard.y_size,nnXLen,nnYLen);
+}
+
+//Parent must be locked
+int64_t Search::getChildEdgeVisits(const SearchNode& parent, int childIdx) const {
+  if(usingGraphSearch)
+    return (int64_t)parent.getChildEdges().visits[childIdx];
+  return parent.children[childIdx]->stats.visits.load(std::memory_order_acquire);
+}
+
 double Search::getFpuValueForChildrenAssumeVisited(const SearchNode& node, Player pla, bool isRoot, double policyProbMassVisited, double& parentUtility) const {
   if(searchParams.fpuUseParentAverage) {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double utilitySum = node.stats.utilitySum;
-    double weightSum = node.stats.weightSum;
-    node.statsLock.clear(std::memory_order_release);
+    double utilitySum = node.stats.utilitySum.load(std::memory_order_relaxed);
+    double weightSum = node.stats.weightSum.load(std::memory_order_relaxed);
 
     assert(weightSum > 0.0);
     parentUtility = utilitySum / weightSum;
@@ -1522,20 +2011,28 @@ void Search::selectBestChildToDescend(
 
   int numChildren = node.numChildren;
 
+  //Away from the root, everything needed is in the edges. The root reads its children directly, since it has a few
+  //extra adjustments that need them, and is only one node anyways.
   double policyProbMassVisited = 0.0;
   int64_t totalChildVisits = 0;
-  for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
-    int movePos = getPos(moveLoc);
-    float nnPolicyProb = node.nnOutput->policyProbs[movePos];
-    policyProbMassVisited += nnPolicyProb;
+  if(isRoot) {
+    for(int i = 0; i<numChildren; i++) {
+      Loc moveLoc = getChildMoveLoc(node,i);
+      int movePos = getPos(moveLoc);
+      float nnPolicyProb = node.nnOutput->policyProbs[movePos];
+      policyProbMassVisited += nnPolicyProb;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+      int64_t childVisits = getChildEdgeVisits(node,i);
 
-    totalChildVisits += childVisits;
+      totalChildVisits += childVisits;
+    }
+  }
+  else if(numChildren > 0) {
+    SearchChildEdges edges = node.getChildEdges();
+    for(int i = 0; i<numChildren; i++) {
+      policyProbMassVisited += edges.policyProbs[i];
+      totalChildVisits += (int64_t)edges.visits[i];
+    }
   }
   //Probability mass should not sum to more than 1, giving a generous allowance
   //for floating point error.
@@ -1548,46 +2045,72 @@ void Search::selectBestChildToDescend(
   std::fill(posesWithChildBuf,posesWithChildBuf+NNPos::MAX_NN_POLICY_SIZE,false);
 
   //Try all existing children
-  for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
-    bool isRootDuringSearch = isRoot;
-    double selectionValue = getExploreSelectionValue(node,child,totalChildVisits,fpuValue,isRootDuringSearch);
+  if(isRoot) {
+    for(int i = 0; i<numChildren; i++) {
+      Loc moveLoc = getChildMoveLoc(node,i);
+      bool isRootDuringSearch = isRoot;
+      double selectionValue = getExploreSelectionValue(node,i,totalChildVisits,fpuValue,isRootDuringSearch);
+      if(selectionValue > maxSelectionValue) {
+        maxSelectionValue = selectionValue;
+        bestChildIdx = i;
+        bestChildMoveLoc = moveLoc;
+      }
+
+      posesWithChildBuf[getPos(moveLoc)] = true;
+    }
+  }
+  else if(numChildren > 0) {
+    SearchChildEdges edges = node.getChildEdges();
+    double utilityRadius = searchParams.winLossUtilityFactor + searchParams.staticScoreUtilityFactor + searchParams.dynamicScoreUtilityFactor;
+    double virtualLossUtility = (node.nextPla == P_WHITE ? -utilityRadius : utilityRadius);
+    double selectionValue;
+    int idx = edges.getBestExploreSelection(
+      numChildren, totalChildVisits, fpuValue, searchParams.cpuctExploration,
+      virtualLossUtility, node.nextPla, POLICY_ILLEGAL_SELECTION_VALUE, selectionValue
+    );
     if(selectionValue > maxSelectionValue) {
       maxSelectionValue = selectionValue;
-      bestChildIdx = i;
-      bestChildMoveLoc = moveLoc;
+      bestChildIdx = idx;
+      bestChildMoveLoc = getChildMoveLoc(node,idx);
     }
 
-    posesWithChildBuf[getPos(moveLoc)] = true;
+    for(int i = 0; i<numChildren; i++)
+      posesWithChildBuf[edges.movePoses[i]] = true;
   }
 
   //Try the new child with the best policy value
   Loc bestNewMoveLoc = Board::NULL_LOC;
   float bestNewNNPolicyProb = -1.0f;
-  for(int movePos = 0; movePos<policySize; movePos++) {
-    bool alreadyTried = posesWithChildBuf[movePos];
-    if(alreadyTried)
-      continue;
+  if(isRoot) {
+    for(int movePos = 0; movePos<policySize; movePos++) {
+      bool alreadyTried = posesWithChildBuf[movePos];
+      if(alreadyTried)
+        continue;
 
-    Loc moveLoc = NNPos::posToLoc(movePos,thread.board.x_size,thread.board.y_size,nnXLen,nnYLen);
-    if(moveLoc == Board::NULL_LOC)
-      continue;
+      Loc moveLoc = NNPos::posToLoc(movePos,thread.board.x_size,thread.board.y_size,nnXLen,nnYLen);
+      if(moveLoc == Board::NULL_LOC)
+        continue;
 
-    //Special logic for the root
-    if(isRoot) {
+      //Special logic for the root
       assert(thread.board.pos_hash == rootBoard.pos_hash);
       assert(thread.pla == rootPla);
       if(!isAllowedRootMove(moveLoc))
         continue;
-    }
 
-    float nnPolicyProb = node.nnOutput->policyProbs[movePos];
-    if(nnPolicyProb > bestNewNNPolicyProb) {
-      bestNewNNPolicyProb = nnPolicyProb;
-      bestNewMoveLoc = moveLoc;
+      float nnPolicyProb = node.nnOutput->policyProbs[movePos];
+      if(nnPolicyProb > bestNewNNPolicyProb) {
+        bestNewNNPolicyProb = nnPolicyProb;
+        bestNewMoveLoc = moveLoc;
+      }
     }
   }
+  else {
+    //Positions off the board always have policy prob -1, so we can search the policy directly
+    int movePos = SearchChildEdges::getBestUnexpandedPos(node.nnOutput->policyProbs,posesWithChildBuf,policySize,bestNewNNPolicyProb);
+    if(movePos >= 0)
+      bestNewMoveLoc = NNPos::posToLoc(movePos,thread.board.x_size,thread.board.y_size,nnXLen,nnYLen);
+    assert(movePos < 0 || bestNewMoveLoc != Board::NULL_LOC);
+  }
   if(bestNewMoveLoc != Board::NULL_LOC) {
     double selectionValue = getNewExploreSelectionValue(node,bestNewNNPolicyProb,totalChildVisits,fpuValue);
     if(selectionValue > maxSelectionValue) {
@@ -1598,13 +2121,51 @@ void Search::selectBestChildToDescend(
   }
 
 }
-void Search::updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int32_t virtualLossesToSubtract, bool isRoot) {
-  recomputeNodeStats(node,thread,1,virtualLossesToSubtract,isRoot);
+void Search::updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, bool isRoot, int childIdx) {
+  //In a graph, a node's children also get visits from its other parents, so its stats are not the sum of its playouts
+  if(searchParams.useIncrementalBackup && !usingGraphSearch) {
+    //Without any reweighting, a node's stats are exactly its own eval plus the sum of its children's stats, so adding
+    //the leaf of this playout is the same as recomputing. With reweighting, the leaf gets the average weight per visit
+    //of the node, and we periodically recompute to bring the weights back in line with the children's current values.
+    bool isReweighted =
+      searchParams.valueWeightExponent > 0 ||
+      searchParams.visitsExponent != 1.0 ||
+      (isRoot && searchParams.rootNoiseEnabled && (searchParams.chosenMoveSubtract > 0 || searchParams.chosenMovePrune > 0));
+    int64_t oldVisits = node.stats.visits.load(std::memory_order_acquire);
+    double oldWeightSum = node.stats.weightSum.load(std::memory_order_relaxed);
+    int64_t period = searchParams.incrementalBackupRecomputePeriod;
+    if(!isReweighted || (oldVisits >= period && (oldVisits + 1) % period != 0 && oldWeightSum > 0.0)) {
+      //Adding the delta is lock-free, so only the edge needs the lock
+      if(childIdx >= 0) {
+        std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
+        lock_guard<std::mutex> lock(mutex);
+        updateChildEdge(node,childIdx,searchParams.numVirtualLossesPerThread,true);
+      }
+      if(!isReweighted) {
+        addStatsDelta(node,thread.leafStats);
+        return;
+      }
+      //Give the leaf the average weight per visit that reweighting has left this node with
+      double scale = oldWeightSum / oldVisits;
+      NodeStats delta = thread.leafStats;
+      delta.winValueSum *= scale;
+      delta.noResultValueSum *= scale;
+      delta.scoreMeanSum *= scale;
+      delta.scoreMeanSqSum *= scale;
+      delta.utilitySum *= scale;
+      delta.utilitySqSum *= scale;
+      delta.weightSum *= scale;
+      delta.weightSqSum *= scale * scale;
+      addStatsDelta(node,delta);
+      return;
+    }
+  }
+  recomputeNodeStats(node,thread,1,isRoot,childIdx);
 }
 
-//Recompute all the stats of this node based on its children, except its visits and virtual losses, which are not child-dependent and
-//are updated in the manner specified.
-void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, int32_t virtualLossesToSubtract, bool isRoot) {
+//Recompute all the stats of this node based on its children, except its visits, which are not child-dependent and
+//are updated in the manner specified. If childIdxToUpdate >= 0, first finishes a playout's edge to that child.
+void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, bool isRoot, int childIdxToUpdate) {
   //Find all children and compute weighting of the children based on their values
   vector<double>& weightFactors = thread.weightFactorBuf;
   vector<double>& winValues = thread.winValuesBuf;
@@ -1623,23 +2184,24 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
 
   std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
   unique_lock<std::mutex> lock(mutex);
+  if(childIdxToUpdate >= 0)
+    updateChildEdge(node,childIdxToUpdate,searchParams.numVirtualLossesPerThread,true);
 
   int numChildren = node.numChildren;
   int numGoodChildren = 0;
   for(int i = 0; i<numChildren; i++) {
     const SearchNode* child = node.children[i];
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    double winValueSum = child->stats.winValueSum;
-    double noResultValueSum = child->stats.noResultValueSum;
-    double scoreMeanSum = child->stats.scoreMeanSum;
-    double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    double weightSum = child->stats.weightSum;
-    double weightSqSum = child->stats.weightSqSum;
-    double utilitySum = child->stats.utilitySum;
-    double utilitySqSum = child->stats.utilitySqSum;
-    child->statsLock.clear(std::memory_order_release);
+    //In a graph, each child is weighted by the visits through this node, but still with its average value from all of them
+    int64_t childVisits = usingGraphSearch ? (int64_t)node.getChildEdges().visits[i] : child->stats.visits.load(std::memory_order_acquire);
+    double winValueSum = child->stats.winValueSum.load(std::memory_order_relaxed);
+    double noResultValueSum = child->stats.noResultValueSum.load(std::memory_order_relaxed);
+    double scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+    double scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+    double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+    double weightSqSum = child->stats.weightSqSum.load(std::memory_order_relaxed);
+    double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+    double utilitySqSum = child->stats.utilitySqSum.load(std::memory_order_relaxed);
 
     if(childVisits <= 0)
       continue;
@@ -1748,76 +2310,324 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
     weightSqSum += desiredWeight * desiredWeight;
   }
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  node.stats.visits += numVisitsToAdd;
+  while(node.statsWriteLock.test_and_set(std::memory_order_acquire));
   //It's possible that these values are a bit wrong if there's a race and two threads each try to update this
   //each of them only having some of the latest updates for all the children. We just accept this and let the
   //error persist, it will get fixed the next time a visit comes through here and the values will at least
-  //be consistent with each other within this node, since statsLock at least ensures these three are set atomically.
-  node.stats.winValueSum = winValueSum;
-  node.stats.noResultValueSum = noResultValueSum;
-  node.stats.scoreMeanSum = scoreMeanSum;
-  node.stats.scoreMeanSqSum = scoreMeanSqSum;
-  node.stats.utilitySum = utilitySum;
-  node.stats.utilitySqSum = utilitySqSum;
-  node.stats.weightSum = weightSum;
-  node.stats.weightSqSum = weightSqSum;
-  node.virtualLosses -= virtualLossesToSubtract;
-  node.statsLock.clear(std::memory_order_release);
-}
-
-void Search::runSinglePlayout(SearchThread& thread) {
-  bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE];
-  playoutDescend(thread,*rootNode,posesWithChildBuf,true,0);
-
-  //Restore thread state back to the root state
+  //be consistent with each other within this node, since statsWriteLock at least ensures these are written together.
+  node.stats.winValueSum.store(winValueSum,std::memory_order_relaxed);
+  node.stats.noResultValueSum.store(noResultValueSum,std::memory_order_relaxed);
+  node.stats.scoreMeanSum.store(scoreMeanSum,std::memory_order_relaxed);
+  node.stats.scoreMeanSqSum.store(scoreMeanSqSum,std::memory_order_relaxed);
+  node.stats.utilitySum.store(utilitySum,std::memory_order_relaxed);
+  node.stats.utilitySqSum.store(utilitySqSum,std::memory_order_relaxed);
+  node.stats.weightSum.store(weightSum,std::memory_order_relaxed);
+  node.stats.weightSqSum.store(weightSqSum,std::memory_order_relaxed);
+  node.stats.visits.store(node.stats.visits.load(std::memory_order_relaxed) + numVisitsToAdd,std::memory_order_release);
+  node.statsWriteLock.clear(std::memory_order_release);
+}
+
+int Search::runSinglePlayout(SearchThread& thread, int64_t maxPlayoutsToStart) {
+  assert(maxPlayoutsToStart > 0);
+  try {
+    if(searchParams.leafBatchSizePerThread > 1)
+      return runLeafBatchPlayouts(thread,(int)std::min(maxPlayoutsToStart,(int64_t)searchParams.leafBatchSizePerThread));
+    return runUnbatchedPlayout(thread);
+  }
+  catch(...) {
+    cleanUpFailedPlayout(thread);
+    throw;
+  }
+}
+
+void Search::cleanUpFailedPlayout(SearchThread& thread) {
+  //The descent stopped wherever it threw, with virtual losses still on every edge down to there
+  assert(thread.descentPath.size() == 0 || thread.descentPath.size() == thread.descentChildIdxs.size() + 1);
+  for(size_t i = thread.descentChildIdxs.size(); i > 0; i--) {
+    SearchNode& node = *(thread.descentPath[i-1]);
+    std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
+    lock_guard<std::mutex> lock(mutex);
+    node.getChildEdges().virtualLosses[thread.descentChildIdxs[i-1]] -= searchParams.numVirtualLossesPerThread;
+  }
+  thread.descentPath.clear();
+  thread.descentChildIdxs.clear();
   thread.pla = rootPla;
   thread.board = rootBoard;
   thread.history = rootHistory;
+
+  //The nn may still be writing the results of leaves in flight, so wait for them, and back them up as usual
+  finishPendingPlayouts(thread);
+}
+
+int Search::runUnbatchedPlayout(SearchThread& thread) {
+  //When not waiting on leaves, first back up whatever has already returned, and make room for a new leaf if needed
+  if(searchParams.maxLeavesInFlightPerThread > 1) {
+    finishReadyPendingLeaves(thread);
+    if(thread.pendingLeaves.size() >= (size_t)searchParams.maxLeavesInFlightPerThread)
+      finishPendingLeaf(thread,0);
+  }
+
+  bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE];
+  thread.descentPath.push_back(rootNode);
+  int outcome = playoutDescend(thread,*rootNode,posesWithChildBuf,true);
+  thread.descentPath.pop_back();
+
+  //playoutDescend undoes its moves on the way back up, so the thread should be back at the root state
+  assert(thread.pla == rootPla);
+  assert(thread.board.pos_hash == rootBoard.pos_hash);
+  assert(thread.history.moveHistory.size() == rootHistory.moveHistory.size());
+  assert(thread.descentPath.size() == 0);
+  assert(thread.descentChildIdxs.size() == 0);
+
+  if(outcome == PLAYOUT_COLLIDED) {
+    //Rather than spin trying to descend again, wait for one of our own leaves to return
+    if(thread.pendingLeaves.size() > 0)
+      finishPendingLeaf(thread,0);
+    else
+      std::this_thread::yield();
+    return 0;
+  }
+  return 1;
+}
+
+int Search::runLeafBatchPlayouts(SearchThread& thread, int batchSize) {
+  assert(thread.pendingLeaves.size() == 0);
+  assert(batchSize > 0);
+  //Virtual losses steer each descent away from the leaves already collected, but in a small tree, descents may still
+  //keep colliding with them, so give up on filling the batch after a while
+  const int maxDescents = batchSize * 2;
+
+  auto queuePendingLeaves = [this,&thread]() {
+    thread.pendingResultBufs.clear();
+    for(size_t i = 0; i<thread.pendingLeaves.size(); i++)
+      thread.pendingResultBufs.push_back(&(thread.pendingLeaves[i]->nnResultBuf));
+    nnEvaluator->queueEvaluates(thread.pendingResultBufs.data(),(int)thread.pendingResultBufs.size());
+  };
+
+  bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE];
+  int numStarted = 0;
+  try {
+    for(int i = 0; i<maxDescents && numStarted < batchSize; i++) {
+      thread.descentPath.push_back(rootNode);
+      int outcome = playoutDescend(thread,*rootNode,posesWithChildBuf,true);
+      thread.descentPath.pop_back();
+      assert(thread.descentPath.size() == 0);
+      assert(thread.descentChildIdxs.size() == 0);
+      if(outcome != PLAYOUT_COLLIDED)
+        numStarted++;
+    }
+  }
+  catch(...) {
+    //Send off the leaves collected so far anyways, so that cleanUpFailedPlayout can finish them like any others
+    if(thread.pendingLeaves.size() > 0)
+      queuePendingLeaves();
+    throw;
+  }
+  assert(thread.pla == rootPla);
+  assert(thread.board.pos_hash == rootBoard.pos_hash);
+  assert(thread.history.moveHistory.size() == rootHistory.moveHistory.size());
+
+  if(thread.pendingLeaves.size() > 0) {
+    queuePendingLeaves();
+    finishPendingPlayouts(thread);
+  }
+  else if(numStarted <= 0)
+    std::this_thread::yield();
+  return numStarted;
+}
+
+void Search::finishPendingPlayouts(SearchThread& thread) {
+  while(thread.pendingLeaves.size() > 0)
+    finishPendingLeaf(thread,0);
+}
+
+void Search::finishReadyPendingLeaves(SearchThread& thread) {
+  size_t idx = 0;
+  while(idx < thread.pendingLeaves.size()) {
+    if(nnEvaluator->pollEvaluate(thread.pendingLeaves[idx]->nnResultBuf,thread.logger))
+      finishPendingLeaf(thread,idx);
+    else
+      idx++;
+  }
+}
+
+void Search::finishPendingLeaf(SearchThread& thread, size_t idx) {
+  assert(idx < thread.pendingLeaves.size());
+  SearchThread::PendingLeaf* pendingLeaf = thread.pendingLeaves[idx];
+  thread.pendingLeaves.erase(thread.pendingLeaves.begin() + idx);
+
+  //No-op if it was already polled as done
+  nnEvaluator->waitForEvaluate(pendingLeaf->nnResultBuf,thread.logger);
+
+  const vector<SearchNode*>& path = pendingLeaf->path;
+  const vector<int>& childIdxs = pendingLeaf->childIdxs;
+  assert(path.size() > 0);
+  assert(path[0] == rootNode);
+  assert(childIdxs.size() == path.size()-1);
+  {
+    SearchNode& leaf = *(path[path.size()-1]);
+    bool isRoot = path.size() == 1;
+    std::mutex& mutex = mutexPool->getMutex(leaf.lockIdx);
+    unique_lock<std::mutex> lock(mutex);
+    assert(leaf.nnEvalPending);
+    leaf.nnEvalPending = false;
+    setNodeNNOutput(thread,leaf,pendingLeaf->nnResultBuf,isRoot,false);
+  }
+  //Update stats going back up, just as playoutDescend would have if it had waited
+  for(size_t i = path.size()-1; i > 0; i--) {
+    SearchNode& node = *(path[i-1]);
+    bool isRoot = i-1 == 0;
+    updateStatsAfterPlayout(node,thread,isRoot,childIdxs[i-1]);
+  }
+
+  thread.freePendingLeaves.push_back(pendingLeaf);
+}
+
+void Search::updateChildEdge(SearchNode& node, int childIdx, int32_t virtualLossesToSubtract, bool addVisit) const {
+  assert(childIdx >= 0 && childIdx < node.numChildren);
+  SearchChildEdges edges = node.getChildEdges();
+  const SearchNode* child = node.children[childIdx];
+  int64_t childVisits = child->stats.visits.load(std::memory_order_acquire);
+  double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+  double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+  if(usingGraphSearch) {
+    if(addVisit)
+      edges.visits[childIdx] += 1.0;
+  }
+  else
+    edges.visits[childIdx] = (double)childVisits;
+  if(childVisits > 0) {
+    assert(weightSum > 0.0);
+    edges.utilities[childIdx] = utilitySum / weightSum;
+  }
+  edges.virtualLosses[childIdx] -= virtualLossesToSubtract;
+  assert(edges.virtualLosses[childIdx] >= 0);
+}
+
+void Search::updateChildEdgePolicyProbs(SearchNode& node) const {
+  if(node.children == NULL)
+    return;
+  SearchChildEdges edges = node.getChildEdges();
+  for(int i = 0; i<node.numChildren; i++)
+    edges.policyProbs[i] = node.nnOutput->policyProbs[edges.movePoses[i]];
 }
 
-void Search::addLeafValue(SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain) {
+void Search::addLeafValue(SearchThread& thread, SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, bool isCertain) {
   double utility =
     getResultUtility(winValue, noResultValue, searchParams)
     + getScoreUtility(scoreMean, scoreMeanSq, 1.0);
 
   double newWeightSq = isCertain ? 0.001 : 1.0;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  node.stats.visits += 1;
-  node.stats.winValueSum += winValue;
-  node.stats.noResultValueSum += noResultValue;
-  node.stats.scoreMeanSum += scoreMean;
-  node.stats.scoreMeanSqSum += scoreMeanSq;
-  node.stats.utilitySum += utility;
-  node.stats.utilitySqSum += utility * utility;
-  node.stats.weightSum += 1.0;
-  node.stats.weightSqSum += newWeightSq;
-  node.virtualLosses -= virtualLossesToSubtract;
-  node.statsLock.clear(std::memory_order_release);
+  NodeStats& leafStats = thread.leafStats;
+  leafStats.visits = 1;
+  leafStats.winValueSum = winValue;
+  leafStats.noResultValueSum = noResultValue;
+  leafStats.scoreMeanSum = scoreMean;
+  leafStats.scoreMeanSqSum = scoreMeanSq;
+  leafStats.utilitySum = utility;
+  leafStats.utilitySqSum = utility * utility;
+  leafStats.weightSum = 1.0;
+  leafStats.weightSqSum = newWeightSq;
+  addStatsDelta(node,leafStats);
+}
+
+void Search::addCollapsedLeafValue(SearchThread& thread, SearchNode& node) {
+  //Add one more visit of unit weight with the node's own average values, leaving those averages unchanged
+  NodeStats stats = node.stats.snapshot();
+  assert(stats.weightSum > 0.0);
+  double scale = 1.0 / stats.weightSum;
+  NodeStats& leafStats = thread.leafStats;
+  leafStats.visits = 1;
+  leafStats.winValueSum = stats.winValueSum * scale;
+  leafStats.noResultValueSum = stats.noResultValueSum * scale;
+  leafStats.scoreMeanSum = stats.scoreMeanSum * scale;
+  leafStats.scoreMeanSqSum = stats.scoreMeanSqSum * scale;
+  leafStats.utilitySum = stats.utilitySum * scale;
+  leafStats.utilitySqSum = stats.utilitySqSum * scale;
+  leafStats.weightSum = 1.0;
+  leafStats.weightSqSum = 1.0;
+  addStatsDelta(node,leafStats);
+}
+
+void Search::addStatsDelta(SearchNode& node, const NodeStats& delta) {
+  NodeStatsAtomic& stats = node.stats;
+  while(node.statsWriteLock.test_and_set(std::memory_order_acquire));
+  stats.winValueSum.store(stats.winValueSum.load(std::memory_order_relaxed) + delta.winValueSum,std::memory_order_relaxed);
+  stats.noResultValueSum.store(stats.noResultValueSum.load(std::memory_order_relaxed) + delta.noResultValueSum,std::memory_order_relaxed);
+  stats.scoreMeanSum.store(stats.scoreMeanSum.load(std::memory_order_relaxed) + delta.scoreMeanSum,std::memory_order_relaxed);
+  stats.scoreMeanSqSum.store(stats.scoreMeanSqSum.load(std::memory_order_relaxed) + delta.scoreMeanSqSum,std::memory_order_relaxed);
+  stats.utilitySum.store(stats.utilitySum.load(std::memory_order_relaxed) + delta.utilitySum,std::memory_order_relaxed);
+  stats.utilitySqSum.store(stats.utilitySqSum.load(std::memory_order_relaxed) + delta.utilitySqSum,std::memory_order_relaxed);
+  stats.weightSum.store(stats.weightSum.load(std::memory_order_relaxed) + delta.weightSum,std::memory_order_relaxed);
+  stats.weightSqSum.store(stats.weightSqSum.load(std::memory_order_relaxed) + delta.weightSqSum,std::memory_order_relaxed);
+  stats.visits.store(stats.visits.load(std::memory_order_relaxed) + delta.visits,std::memory_order_release);
+  node.statsWriteLock.clear(std::memory_order_release);
 }
 
 void Search::initNodeNNOutput(
-  SearchThread& thread, SearchNode& node,
-  bool isRoot, bool skipCache, int32_t virtualLossesToSubtract, bool isReInit
+  SearchThread& thread, SearchNode& node, unique_lock<std::mutex>& lock,
+  bool isRoot, bool skipCache, bool isReInit
 ) {
+  assert(lock.owns_lock());
+  assert(!node.nnEvalPending);
+  //Don't hold the mutex while waiting on the nn, other nodes share it
+  node.nnEvalPending = true;
+  lock.unlock();
+
   bool includeOwnerMap = isRoot || alwaysIncludeOwnerMap;
-  nnEvaluator->evaluate(
-    thread.board, thread.history, thread.pla,
-    searchParams.drawEquivalentWinsForWhite,
-    thread.nnResultBuf, thread.logger, skipCache, includeOwnerMap
-  );
+  try {
+    nnEvaluator->evaluate(
+      thread.board, thread.history, thread.pla,
+      searchParams.drawEquivalentWinsForWhite,
+      thread.nnResultBuf, thread.logger, skipCache, includeOwnerMap
+    );
+  }
+  catch(...) {
+    //Otherwise no thread would ever evaluate this node again
+    lock.lock();
+    node.nnEvalPending = false;
+    throw;
+  }
+
+  lock.lock();
+  node.nnEvalPending = false;
+  setNodeNNOutput(thread,node,thread.nnResultBuf,isRoot,isReInit);
+}
 
-  node.nnOutput = std::move(thread.nnResultBuf.result);
+void Search::setNodeNNOutput(
+  SearchThread& thread, SearchNode& node, NNResultBuf& nnResultBuf,
+  bool isRoot, bool isReInit
+) {
+  int64_t oldNNOutputBytes = node.getNNOutputBytes();
+  shared_ptr<NNOutput> oldNNOutput = std::move(node.nnOutput);
+  node.nnOutput = std::move(nnResultBuf.result);
   maybeAddPolicyNoise(thread,node,isRoot);
+  updateChildEdgePolicyProbs(node);
+  nodeArena->addNNOutputBytes(node.getNNOutputBytes() - oldNNOutputBytes);
 
   //If this is a re-initialization of the nnOutput, we don't want to add any visits or anything.
   //Also don't bother updating any of the stats. Technically we should do so because winValueSum
   //and such will have changed potentially due to a new orientation of the neural net eval
   //slightly affecting the evals, but this is annoying to recompute from scratch, and on the next
   //visit updateStatsAfterPlayout should fix it all up anyways.
-  if(isReInit)
+  //Except with useIncrementalBackup, where nothing would ever fix it up, so swap the old eval of this node itself for the new one.
+  //Ancestors keep the old one, but this is rare and the difference slight.
+  if(isReInit) {
+    if(searchParams.useIncrementalBackup && !usingGraphSearch && oldNNOutput != nullptr) {
+      NodeStats delta;
+      delta.winValueSum = (double)node.nnOutput->whiteWinProb - (double)oldNNOutput->whiteWinProb;
+      delta.noResultValueSum = (double)node.nnOutput->whiteNoResultProb - (double)oldNNOutput->whiteNoResultProb;
+      delta.scoreMeanSum = (double)node.nnOutput->whiteScoreMean - (double)oldNNOutput->whiteScoreMean;
+      delta.scoreMeanSqSum = (double)node.nnOutput->whiteScoreMeanSq - (double)oldNNOutput->whiteScoreMeanSq;
+      double utility = getUtilityFromNN(*node.nnOutput);
+      double oldUtility = getUtilityFromNN(*oldNNOutput);
+      delta.utilitySum = utility - oldUtility;
+      delta.utilitySqSum = utility * utility - oldUtility * oldUtility;
+      addStatsDelta(node,delta);
+    }
     return;
+  }
 
   //Values in the search are from the perspective of white positive always
   double winProb = (double)node.nnOutput->whiteWinProb;
@@ -1825,13 +2635,13 @@ void Search::initNodeNNOutput(
   double scoreMean = (double)node.nnOutput->whiteScoreMean;
   double scoreMeanSq = (double)node.nnOutput->whiteScoreMeanSq;
 
-  addLeafValue(node,winProb,noResultProb,scoreMean,scoreMeanSq,virtualLossesToSubtract,false);
+  addLeafValue(thread,node,winProb,noResultProb,scoreMean,scoreMeanSq,false);
 }
 
-void Search::playoutDescend(
+int Search::playoutDescend(
   SearchThread& thread, SearchNode& node,
   bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
-  bool isRoot, int32_t virtualLossesToSubtract
+  bool isRoot
 ) {
   //Hit terminal node, finish
   //In the case where we're forcing the search to make another move at the root, don't terminate, actually run search for a move more.
@@ -1841,16 +2651,16 @@ void Search::playoutDescend(
       double noResultValue = 1.0;
       double scoreMean = 0.0;
       double scoreMeanSq = 0.0;
-      addLeafValue(node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
-      return;
+      addLeafValue(thread, node, winValue, noResultValue, scoreMean, scoreMeanSq, true);
+      return PLAYOUT_FINISHED;
     }
     else {
       double winValue = ScoreValue::whiteWinsOfWinner(thread.history.winner, searchParams.drawEquivalentWinsForWhite);
       double noResultValue = 0.0;
       double scoreMean = ScoreValue::whiteScoreDrawAdjust(thread.history.finalWhiteMinusBlackScore,searchParams.drawEquivalentWinsForWhite,thread.history);
       double scoreMeanSq = ScoreValue::whiteScoreMeanSqOfScoreGridded(thread.history.finalWhiteMinusBlackScore,searchParams.drawEquivalentWinsForWhite,thread.history);
-      addLeafValue(node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
-      return;
+      addLeafValue(thread, node, winValue, noResultValue, scoreMean, scoreMeanSq, true);
+      return PLAYOUT_FINISHED;
     }
   }
 
@@ -1859,13 +2669,86 @@ void Search::playoutDescend(
 
   //Hit leaf node, finish
   if(node.nnOutput == nullptr) {
-    initNodeNNOutput(thread,node,isRoot,false,virtualLossesToSubtract,false);
-    return;
+    //Some thread is already evaluating this leaf. Rather than wait for it, back off so that this thread can
+    //try a different path, which virtual losses should now steer it towards.
+    if(node.nnEvalPending)
+      return PLAYOUT_COLLIDED;
+
+    bool isBatchingLeaves = searchParams.leafBatchSizePerThread > 1;
+    if(searchParams.maxLeavesInFlightPerThread <= 1 && !isBatchingLeaves) {
+      initNodeNNOutput(thread,node,lock,isRoot,false,false);
+      return PLAYOUT_FINISHED;
+    }
+
+    //Submit without waiting, and also without holding the mutex while the nn inputs are filled.
+    //Or when batching leaves, only prepare the inputs, for runLeafBatchPlayouts to submit the whole batch at once.
+    node.nnEvalPending = true;
+    lock.unlock();
+    SearchThread::PendingLeaf* pendingLeaf;
+    if(thread.freePendingLeaves.size() > 0) {
+      pendingLeaf = thread.freePendingLeaves.back();
+      thread.freePendingLeaves.pop_back();
+    }
+    else
+      pendingLeaf = new SearchThread::PendingLeaf();
+
+    bool includeOwnerMap = isRoot || alwaysIncludeOwnerMap;
+    bool skipCache = false;
+    bool alreadyDone;
+    try {
+      if(isBatchingLeaves)
+        alreadyDone = nnEvaluator->prepareEvaluate(
+          thread.board, thread.history, thread.pla,
+          searchParams.drawEquivalentWinsForWhite,
+          pendingLeaf->nnResultBuf, thread.logger, skipCache, includeOwnerMap
+        );
+      else
+        alreadyDone = nnEvaluator->submitEvaluate(
+          thread.board, thread.history, thread.pla,
+          searchParams.drawEquivalentWinsForWhite,
+          pendingLeaf->nnResultBuf, thread.logger, skipCache, includeOwnerMap
+        );
+    }
+    catch(...) {
+      //Same as in initNodeNNOutput, don't leave the node pending forever
+      thread.freePendingLeaves.push_back(pendingLeaf);
+      lock.lock();
+      node.nnEvalPending = false;
+      throw;
+    }
+    if(alreadyDone) {
+      lock.lock();
+      node.nnEvalPending = false;
+      setNodeNNOutput(thread,node,pendingLeaf->nnResultBuf,isRoot,false);
+      thread.freePendingLeaves.push_back(pendingLeaf);
+      return PLAYOUT_FINISHED;
+    }
+
+    pendingLeaf->path = thread.descentPath;
+    pendingLeaf->childIdxs = thread.descentChildIdxs;
+    thread.pendingLeaves.push_back(pendingLeaf);
+    return PLAYOUT_PENDING;
+  }
+  //Collapsed to save memory, so this is a leaf now
+  if(node.isCollapsed) {
+    assert(!isRoot);
+    lock.unlock();
+    addCollapsedLeafValue(thread,node);
+    return PLAYOUT_FINISHED;
+  }
+  //Went around a cycle in the graph, so treat it the same way
+  if(usingGraphSearch && thread.descentPath.size() > MAX_GRAPH_DESCENT_DEPTH) {
+    lock.unlock();
+    if(thread.logStream != NULL)
+      (*thread.logStream) << "WARNING: Search graph descent too deep, probably a cycle, nnhash=" << node.nnOutput->nnHash << endl;
+    addCollapsedLeafValue(thread,node);
+    return PLAYOUT_FINISHED;
   }
   //For the root node, make sure we have a whiteOwnerMap
-  if(isRoot && node.nnOutput->whiteOwnerMap == NULL) {
+  //If another thread is already getting it, just keep using the output we have.
+  if(isRoot && node.nnOutput->whiteOwnerMap == NULL && !node.nnEvalPending) {
     bool isReInit = true;
-    initNodeNNOutput(thread,node,isRoot,false,0,isReInit);
+    initNodeNNOutput(thread,node,lock,isRoot,false,isReInit);
     assert(node.nnOutput->whiteOwnerMap != NULL);
     //As isReInit is true, we don't return, just keep going, since we didn't count this as a true visit in the node stats
   }
@@ -1881,8 +2764,11 @@ void Search::playoutDescend(
   //(this should only happen either on a bug or where the nnHash doesn't have full legality information or when there's an actual hash collision).
   //Regenerate the neural net call and continue
   if(!thread.history.isLegal(thread.board,bestChildMoveLoc,thread.pla)) {
+    //Another thread is already regenerating it
+    if(node.nnEvalPending)
+      return PLAYOUT_COLLIDED;
     bool isReInit = true;
-    initNodeNNOutput(thread,node,isRoot,true,0,isReInit);
+    initNodeNNOutput(thread,node,lock,isRoot,true,isReInit);
 
     if(thread.logStream != NULL)
       (*thread.logStream) << "WARNING: Chosen move not legal so regenerated nn output, nnhash=" << node.nnOutput->nnHash << endl;
@@ -1902,56 +2788,111 @@ void Search::playoutDescend(
   if(bestChildIdx >= node.childrenCapacity) {
     int newCapacity = node.childrenCapacity + (node.childrenCapacity / 4) + 1;
     assert(newCapacity < 0x3FFF);
-    SearchNode** newArr = new SearchNode*[newCapacity];
-    for(int i = 0; i<node.numChildren; i++) {
-      newArr[i] = node.children[i];
-      node.children[i] = NULL;
+    SearchNode** newArr = nodeArena->allocChildren(thread.nodeAllocCache,newCapacity);
+    if(node.children != NULL) {
+      SearchChildEdges oldEdges = node.getChildEdges();
+      SearchChildEdges newEdges(newArr,newCapacity);
+      for(int i = 0; i<node.numChildren; i++) {
+        oldEdges.copyEntry(i,newEdges,i);
+        node.children[i] = NULL;
+      }
     }
     SearchNode** oldArr = node.children;
+    int oldCapacity = node.childrenCapacity;
     node.children = newArr;
     node.childrenCapacity = (uint16_t)newCapacity;
-    delete[] oldArr;
+    if(oldArr != NULL)
+      nodeArena->freeChildren(thread.nodeAllocCache,oldArr,oldCapacity);
   }
 
   Loc moveLoc = bestChildMoveLoc;
 
+  //Make moves recorded so that we can undo them after the recursion, rather than copying the root state back after every playout
+  size_t depth = thread.history.moveHistory.size() - rootHistory.moveHistory.size();
+  if(thread.moveRecords.size() <= depth)
+    thread.moveRecords.resize(depth+1);
+
   //Allocate a new child node if necessary
   SearchNode* child;
-  if(bestChildIdx == node.numChildren) {
+  bool isNewChild = bestChildIdx == node.numChildren;
+  if(isNewChild) {
     assert(thread.history.isLegal(thread.board,moveLoc,thread.pla));
-    thread.history.makeBoardMoveAssumeLegal(thread.board,moveLoc,thread.pla,rootKoHashTable);
+    thread.history.makeBoardMoveRecorded(thread.board,moveLoc,thread.pla,rootKoHashTable,thread.moveRecords[depth]);
     thread.pla = getOpp(thread.pla);
 
+    if(usingGraphSearch) {
+      //Link to the node of this situation if some other path already reached it
+      Hash128 graphHash = getGraphHash(node.graphHash, thread.board, thread.history, thread.pla, moveLoc, rootKoHashTable);
+      child = nodeTable->findOrCreate(
+        graphHash,graphReachEpoch,
+        [&]() {
+          SearchNode* newNode = new(nodeArena->allocNode(thread.nodeAllocCache)) SearchNode(*this,thread,moveLoc);
+          newNode->graphHash = graphHash;
+          return newNode;
+        }
+      );
+    }
+    else
+      child = new(nodeArena->allocNode(thread.nodeAllocCache)) SearchNode(*this,thread,moveLoc);
     node.numChildren++;
-    child = new SearchNode(*this,thread,moveLoc);
     node.children[bestChildIdx] = child;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    child->virtualLosses += searchParams.numVirtualLossesPerThread;
-    child->statsLock.clear(std::memory_order_release);
-
-    lock.unlock();
+    SearchChildEdges edges = node.getChildEdges();
+    int movePos = getPos(moveLoc);
+    edges.visits[bestChildIdx] = 0.0;
+    edges.utilities[bestChildIdx] = 0.0;
+    edges.policyProbs[bestChildIdx] = node.nnOutput->policyProbs[movePos];
+    edges.virtualLosses[bestChildIdx] = 0;
+    edges.movePoses[bestChildIdx] = (int16_t)movePos;
   }
   else {
     child = node.children[bestChildIdx];
+  }
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    child->virtualLosses += searchParams.numVirtualLossesPerThread;
-    child->statsLock.clear(std::memory_order_release);
-
-    //Unlock before making moves if the child already exists since we don't depend on it at this point
+  //In a graph, if the child already knows more than it has told us through this edge, because of visits through
+  //its other parents, then catch up on those by counting one of them as this playout, rather than searching deeper.
+  if(usingGraphSearch && child->stats.visits.load(std::memory_order_acquire) > (int64_t)node.getChildEdges().visits[bestChildIdx]) {
+    updateChildEdge(node,bestChildIdx,0,true);
     lock.unlock();
+    if(isNewChild) {
+      thread.history.undoBoardMove(thread.board,thread.moveRecords[depth]);
+      thread.pla = getOpp(thread.pla);
+    }
+    updateStatsAfterPlayout(node,thread,isRoot,-1);
+    return PLAYOUT_FINISHED;
+  }
+
+  node.getChildEdges().virtualLosses[bestChildIdx] += searchParams.numVirtualLossesPerThread;
+  lock.unlock();
 
+  //Make the move for an existing child only now, since we don't need the lock for it
+  if(!isNewChild) {
     assert(thread.history.isLegal(thread.board,moveLoc,thread.pla));
-    thread.history.makeBoardMoveAssumeLegal(thread.board,moveLoc,thread.pla,rootKoHashTable);
+    thread.history.makeBoardMoveRecorded(thread.board,moveLoc,thread.pla,rootKoHashTable,thread.moveRecords[depth]);
     thread.pla = getOpp(thread.pla);
   }
 
   //Recurse!
-  playoutDescend(thread,*child,posesWithChildBuf,false,searchParams.numVirtualLossesPerThread);
-
-  //Update this node stats
-  updateStatsAfterPlayout(node,thread,virtualLossesToSubtract,isRoot);
+  thread.descentPath.push_back(child);
+  thread.descentChildIdxs.push_back(bestChildIdx);
+  int outcome = playoutDescend(thread,*child,posesWithChildBuf,false);
+  thread.descentChildIdxs.pop_back();
+  thread.descentPath.pop_back();
+
+  //Deeper calls may have grown moveRecords, so index again rather than holding a reference across the recursion
+  thread.history.undoBoardMove(thread.board,thread.moveRecords[depth]);
+  thread.pla = getOpp(thread.pla);
+
+  //Finish the edge to the child. A pending leaf keeps its virtual losses and hasn't changed anything yet, so there's
+  //nothing to do until it completes, and a finished playout does it along with updating this node's stats.
+  if(outcome == PLAYOUT_FINISHED)
+    updateStatsAfterPlayout(node,thread,isRoot,bestChildIdx);
+  else if(outcome == PLAYOUT_COLLIDED) {
+    lock.lock();
+    updateChildEdge(node,bestChildIdx,searchParams.numVirtualLossesPerThread,false);
+    lock.unlock();
+  }
+  return outcome;
 }
 
 
@@ -2003,20 +2944,18 @@ void Search::printRootEndingScoreValueBonus(ostream& out) const {
   for(int i = 0; i<rootNode->numChildren; i++) {
     const SearchNode* child = rootNode->children[i];
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    double utilitySum = child->stats.utilitySum;
-    double scoreMeanSum = child->stats.scoreMeanSum;
-    double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    double weightSum = child->stats.weightSum;
-    child->statsLock.clear(std::memory_order_release);
+    int64_t childVisits = child->stats.visits.load(std::memory_order_acquire);
+    double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+    double scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+    double scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+    double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
 
     double utilityNoBonus = utilitySum / weightSum;
-    double endingScoreBonus = getEndingWhiteScoreBonus(*rootNode,child);
+    double endingScoreBonus = getEndingWhiteScoreBonus(*rootNode,getChildMoveLoc(*rootNode,i));
     double utilityDiff = getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
     double utilityWithBonus = utilityNoBonus + utilityDiff;
 
-    out << Location::toString(child->prevMoveLoc,rootBoard) << " " << Global::strprintf(
+    out << Location::toString(getChildMoveLoc(*rootNode,i),rootBoard) << " " << Global::strprintf(
       "visits %d utilityNoBonus %.2fc utilityWithBonus %.2fc endingScoreBonus %.2f",
       childVisits, utilityNoBonus*100, utilityWithBonus*100, endingScoreBonus
     );
@@ -2114,16 +3053,14 @@ AnalysisData Search::getAnalysisDataOfSingleChild(
   double utilitySum = 0.0;
 
   if(child != NULL) {
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    numVisits = child->stats.visits;
-    winValueSum = child->stats.winValueSum;
-    noResultValueSum = child->stats.noResultValueSum;
-    scoreMeanSum = child->stats.scoreMeanSum;
-    scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    weightSum = child->stats.weightSum;
-    weightSqSum = child->stats.weightSqSum;
-    utilitySum = child->stats.utilitySum;
-    child->statsLock.clear(std::memory_order_release);
+    numVisits = child->stats.visits.load(std::memory_order_acquire);
+    winValueSum = child->stats.winValueSum.load(std::memory_order_relaxed);
+    noResultValueSum = child->stats.noResultValueSum.load(std::memory_order_relaxed);
+    scoreMeanSum = child->stats.scoreMeanSum.load(std::memory_order_relaxed);
+    scoreMeanSqSum = child->stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+    weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+    weightSqSum = child->stats.weightSqSum.load(std::memory_order_relaxed);
+    utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
   }
 
   AnalysisData data;
@@ -2180,7 +3117,9 @@ void Search::getAnalysisData(
 ) const {
   buf.clear();
   vector<SearchNode*> children;
+  vector<Loc> moveLocs;
   children.reserve(rootBoard.x_size * rootBoard.y_size + 1);
+  moveLocs.reserve(rootBoard.x_size * rootBoard.y_size + 1);
 
   int numChildren;
   vector<Loc> scratchLocs;
@@ -2191,8 +3130,10 @@ void Search::getAnalysisData(
     std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
     lock_guard<std::mutex> lock(mutex);
     numChildren = node.numChildren;
-    for(int i = 0; i<numChildren; i++)
+    for(int i = 0; i<numChildren; i++) {
       children.push_back(node.children[i]);
+      moveLocs.push_back(getChildMoveLoc(node,i));
+    }
 
     if(numChildren <= 0)
       return;
@@ -2214,10 +3155,8 @@ void Search::getAnalysisData(
     for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
       policyProbs[i] = nnOutput.policyProbs[i];
 
-    for(int i = 0; i<numChildren; i++) {
-      const SearchNode* child = children[i];
-      policyProbMassVisited += policyProbs[getPos(child->prevMoveLoc)];
-    }
+    for(int i = 0; i<numChildren; i++)
+      policyProbMassVisited += policyProbs[getPos(moveLocs[i])];
     //Probability mass should not sum to more than 1, giving a generous allowance
     //for floating point error.
     assert(policyProbMassVisited <= 1.0001);
@@ -2227,13 +3166,11 @@ void Search::getAnalysisData(
   double parentScoreMean;
   double parentScoreStdev;
   {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double winValueSum = node.stats.winValueSum;
-    double noResultValueSum = node.stats.noResultValueSum;
-    double scoreMeanSum = node.stats.scoreMeanSum;
-    double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-    double weightSum = node.stats.weightSum;
-    node.statsLock.clear(std::memory_order_release);
+    double winValueSum = node.stats.winValueSum.load(std::memory_order_relaxed);
+    double noResultValueSum = node.stats.noResultValueSum.load(std::memory_order_relaxed);
+    double scoreMeanSum = node.stats.scoreMeanSum.load(std::memory_order_relaxed);
+    double scoreMeanSqSum = node.stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+    double weightSum = node.stats.weightSum.load(std::memory_order_relaxed);
     assert(weightSum > 0.0);
 
     double winValue = winValueSum / weightSum;
@@ -2250,9 +3187,9 @@ void Search::getAnalysisData(
 
   for(int i = 0; i<numChildren; i++) {
     SearchNode* child = children[i];
-    double policyProb = policyProbs[getPos(child->prevMoveLoc)];
+    double policyProb = policyProbs[getPos(moveLocs[i])];
     AnalysisData data = getAnalysisDataOfSingleChild(
-      child, scratchLocs, scratchValues, child->prevMoveLoc, policyProb, fpuValue, parentUtility, parentWinLossValue,
+      child, scratchLocs, scratchValues, moveLocs[i], policyProb, fpuValue, parentUtility, parentWinLossValue,
       parentScoreMean, parentScoreStdev, maxPVDepth
     );
     data.playSelectionValue = playSelectionValues[i];
@@ -2428,12 +3365,10 @@ void Search::printTreeHelper(
     }
 
     if(options.printSqs_) {
-      while(node.statsLock.test_and_set(std::memory_order_acquire));
-      double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-      double utilitySqSum = node.stats.utilitySqSum;
-      double weightSum = node.stats.weightSum;
-      double weightSqSum = node.stats.weightSqSum;
-      node.statsLock.clear(std::memory_order_release);
+      double scoreMeanSqSum = node.stats.scoreMeanSqSum.load(std::memory_order_relaxed);
+      double utilitySqSum = node.stats.utilitySqSum.load(std::memory_order_relaxed);
+      double weightSum = node.stats.weightSum.load(std::memory_order_relaxed);
+      double weightSqSum = node.stats.weightSqSum.load(std::memory_order_relaxed);
       sprintf(buf,"SMSQ %5.1f USQ %7.5f W %6.2f WSQ %8.2f ", scoreMeanSqSum/weightSum, utilitySqSum/weightSum, weightSum, weightSqSum);
       out << buf;
     }
@@ -2487,7 +3422,7 @@ void Search::printTreeHelper(
 
   for(int i = 0; i<numChildren; i++) {
     const SearchNode* child = analysisData[i].node;
-    Loc moveLoc = child->prevMoveLoc;
+    Loc moveLoc = analysisData[i].move;
 
     if((depth >= options.branch_.size() && i < numChildrenToRecurseOn) ||
        (depth < options.branch_.size() && moveLoc == options.branch_[depth]))
@@ -2513,13 +3448,25 @@ vector<double> Search::getAverageTreeOwnership(int64_t minVisits) const {
   if(!alwaysIncludeOwnerMap)
     throw StringError("Called Search::getAverageTreeOwnership when alwaysIncludeOwnerMap is false");
   vector<double> vec(nnXLen*nnYLen,0.0);
-  getAverageTreeOwnershipHelper(vec,minVisits,1.0,rootNode);
+  if(usingGraphSearch) {
+    vector<const SearchNode*> ancestors;
+    getAverageTreeOwnershipHelper(vec,minVisits,1.0,rootNode,&ancestors);
+  }
+  else
+    getAverageTreeOwnershipHelper(vec,minVisits,1.0,rootNode,NULL);
   return vec;
 }
 
-double Search::getAverageTreeOwnershipHelper(vector<double>& accum, int64_t minVisits, double desiredWeight, const SearchNode* node) const {
+double Search::getAverageTreeOwnershipHelper(
+  vector<double>& accum, int64_t minVisits, double desiredWeight, const SearchNode* node,
+  vector<const SearchNode*>* ancestors
+) const {
   if(node == NULL)
     return 0;
+  //A graph can in principle loop back through edges that were added by paths with different histories, so never go
+  //around a cycle. Such a node just gets no weight along this path.
+  if(ancestors != NULL && std::find(ancestors->begin(),ancestors->end(),node) != ancestors->end())
+    return 0;
 
   std::mutex& mutex = mutexPool->getMutex(node->lockIdx);
   unique_lock<std::mutex> lock(mutex);
@@ -2530,20 +3477,17 @@ double Search::getAverageTreeOwnershipHelper(vector<double>& accum, int64_t minV
 
   int numChildren = node->numChildren;
   vector<const SearchNode*> children(numChildren);
-  for(int i = 0; i<numChildren; i++)
+  vector<int64_t> visitsBuf(numChildren);
+  for(int i = 0; i<numChildren; i++) {
     children[i] = node->children[i];
+    visitsBuf[i] = getChildEdgeVisits(*node,i);
+  }
 
   //We can unlock now - during a search, children are never deallocated
   lock.unlock();
 
-  vector<int64_t> visitsBuf(numChildren);
-  for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = children[i];
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
-    visitsBuf[i] = childVisits;
-  }
+  if(ancestors != NULL)
+    ancestors->push_back(node);
 
   double relativeChildrenWeightSum = 0.0;
   int64_t usedChildrenVisitSum = 0;
@@ -2564,8 +3508,10 @@ double Search::getAverageTreeOwnershipHelper(vector<double>& accum, int64_t minV
     if(visits < minVisits)
       continue;
     double desiredWeightFromChild = (double)visits * visits / relativeChildrenWeightSum * desiredWeightFromChildren;
-    actualWeightFromChildren += getAverageTreeOwnershipHelper(accum,minVisits,desiredWeightFromChild,children[i]);
+    actualWeightFromChildren += getAverageTreeOwnershipHelper(accum,minVisits,desiredWeightFromChild,children[i],ancestors);
   }
+  if(ancestors != NULL)
+    ancestors->pop_back();
 
   double selfWeight = desiredWeight - actualWeightFromChildren;
   float* ownerMap = nnOutput->whiteOwnerMap;
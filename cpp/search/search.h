@@ -1,7 +1,10 @@
 #ifndef SEARCH_SEARCH_H_
 #define SEARCH_SEARCH_H_
 
+#include <exception>
+#include <functional>
 #include <memory>
+#include <unordered_set>
 
 #include "../core/global.h"
 #include "../core/hash.h"
@@ -12,7 +15,10 @@
 #include "../game/rules.h"
 #include "../neuralnet/nneval.h"
 #include "../search/analysisdata.h"
+#include "../search/childedges.h"
 #include "../search/mutexpool.h"
+#include "../search/nodearena.h"
+#include "../search/nodetable.h"
 #include "../search/searchparams.h"
 #include "../search/searchprint.h"
 #include "../search/timecontrols.h"
@@ -21,6 +27,7 @@ struct SearchNode;
 struct SearchThread;
 struct Search;
 struct DistributionTable;
+class AreaCache;
 
 struct ReportedSearchValues {
   double winValue;
@@ -56,28 +63,65 @@ struct NodeStats {
   double getResultUtilitySum(const SearchParams& searchParams) const;
 };
 
+//The stats of a SearchNode, readable at any time without any locking.
+//Writers hold the node's statsWriteLock, update the sums first, and publish visits last with release ordering, so
+//readers that load visits first with acquire ordering see sums at least as new as those visits, and in particular
+//weightSum > 0 whenever visits > 0. Readers racing with a write may still see some sums from before it and some
+//from after it, an inconsistency of at most about one visit that the search tolerates just like other races.
+struct NodeStatsAtomic {
+  std::atomic<int64_t> visits;
+  std::atomic<double> winValueSum;
+  std::atomic<double> noResultValueSum;
+  std::atomic<double> scoreMeanSum;
+  std::atomic<double> scoreMeanSqSum;
+  std::atomic<double> utilitySum;
+  std::atomic<double> utilitySqSum;
+  std::atomic<double> weightSum;
+  std::atomic<double> weightSqSum;
+
+  NodeStatsAtomic();
+  ~NodeStatsAtomic();
+
+  NodeStatsAtomic(const NodeStatsAtomic& other);
+  NodeStatsAtomic& operator=(const NodeStatsAtomic& other);
+
+  NodeStats snapshot() const;
+};
+
 struct SearchNode {
   //Locks------------------------------------------------------------------------------
   uint32_t lockIdx;
-  mutable std::atomic_flag statsLock = ATOMIC_FLAG_INIT;
+  //Serializes writers of stats. Readers never take it.
+  mutable std::atomic_flag statsWriteLock = ATOMIC_FLAG_INIT;
 
   //Constant during search--------------------------------------------------------------
   Player nextPla;
+  //The move that first reached this node. In a graph, other parents may reach it by other moves, so to get the move
+  //from a particular parent, use Search::getChildMoveLoc.
   Loc prevMoveLoc;
+  //With useGraphSearch, identifies the situation of this node for sharing it, see getGraphHash in search.cpp
+  Hash128 graphHash;
 
   //Mutable---------------------------------------------------------------------------
   //All of these values are protected under the mutex indicated by lockIdx
   std::shared_ptr<NNOutput> nnOutput; //Once set, constant thereafter
-
-  SearchNode** children;
+  //Some thread is evaluating this node with the nn, without holding the mutex while it waits on the nn.
+  //Other threads reaching it back off rather than waiting. See playoutDescend and maxLeavesInFlightPerThread.
+  bool nnEvalPending;
+  //The children were discarded to keep the tree within maxTreeNodes or maxTreeBytes, and stats now stand in for them
+  //as a summary. Further playouts reaching this node only repeat the summary. See Search::collapseLowVisitSubtrees.
+  bool isCollapsed;
+
+  SearchNode** children; //Allocated from the search's nodeArena, as are the children themselves. See SearchChildEdges.
   uint16_t numChildren;
   uint16_t childrenCapacity;
 
   //Lightweight mutable---------------------------------------------------------------
-  //Protected under statsLock
-  NodeStats stats;
-  //Also protected under statsLock
-  int32_t virtualLosses;
+  //Lock-free, see NodeStatsAtomic
+  NodeStatsAtomic stats;
+  //With useGraphSearch, the latest epoch in which this node was known to be reachable from the root,
+  //see Search::destroyUnreachableNodes
+  std::atomic<uint64_t> reachEpoch;
 
   //--------------------------------------------------------------------------------
   SearchNode(Search& search, SearchThread& thread, Loc prevMoveLoc);
@@ -88,6 +132,11 @@ struct SearchNode {
 
   SearchNode(SearchNode&& other) noexcept;
   SearchNode& operator=(SearchNode&& other) noexcept;
+
+  //Requires children != NULL
+  SearchChildEdges getChildEdges() const;
+  //Memory of the nn output this node holds, including the ownership map, or 0 if it has none yet
+  int64_t getNNOutputBytes() const;
 };
 
 //Per-thread state
@@ -116,9 +165,36 @@ struct SearchThread {
   std::vector<double> selfUtilityBuf;
   std::vector<int64_t> visitsBuf;
 
+  //Stats contributed by the leaf of the current playout, for adding along the path with useIncrementalBackup
+  NodeStats leafStats;
+
+  //Records for undoing the moves of the current playout, indexed by depth below the root
+  std::vector<BoardHistory::MoveRecord> moveRecords;
+  //Nodes of the current playout, starting from the root
+  std::vector<SearchNode*> descentPath;
+  //Index of each node of descentPath after the root among the children of the node before it
+  std::vector<int> descentChildIdxs;
+
+  //A leaf submitted to the nn without waiting, along with the path to it, whose virtual losses are still applied
+  struct PendingLeaf {
+    NNResultBuf nnResultBuf;
+    std::vector<SearchNode*> path;
+    std::vector<int> childIdxs;
+  };
+  std::vector<PendingLeaf*> pendingLeaves; //Oldest first
+  std::vector<PendingLeaf*> freePendingLeaves;
+  std::vector<NNResultBuf*> pendingResultBufs; //Scratch for submitting a batch of pendingLeaves, see leafBatchSizePerThread
+
+  //For allocating nodes from the search's nodeArena
+  SearchNodeArena::ThreadCache nodeAllocCache;
+
   SearchThread(int threadIdx, const Search& search, Logger* logger);
   ~SearchThread();
 
+  //Reset board, history, and rand to the start of a new search, so that this buffer can be reused across searches.
+  //Leaves the thread in exactly the same state as freshly constructing it would.
+  void resetForSearch(const Search& search, Logger* logger);
+
   SearchThread(const SearchThread&) = delete;
   SearchThread& operator=(const SearchThread&) = delete;
 };
@@ -132,6 +208,8 @@ struct Search {
 
   //Precomputed values at the root
   Color* rootSafeArea;
+  //Keeps the regions behind rootSafeArea, which mostly carry over as the root moves along a game
+  AreaCache* rootAreaCache;
   //Used to center for dynamic scorevalue
   double recentScoreCenter;
 
@@ -154,6 +232,15 @@ struct Search {
 
   //Mutable---------------------------------------------------------------
   SearchNode* rootNode;
+  //Owns all nodes of the tree
+  SearchNodeArena* nodeArena;
+  //Whether the nodes under rootNode form a graph built with useGraphSearch. Fixed until the search is cleared, so
+  //that changing the param without clearing takes effect only at the next beginSearch.
+  bool usingGraphSearch;
+  //With usingGraphSearch, every node of the graph, for finding the node of a situation reached by another path
+  SearchNodeTable* nodeTable;
+  //With usingGraphSearch, bumped whenever nodes may have become unreachable, see destroyUnreachableNodes
+  uint64_t graphReachEpoch;
 
   //Services--------------------------------------------------------------
   MutexPool* mutexPool;
@@ -163,6 +250,20 @@ struct Search {
   int policySize;
   Rand nonSearchRand; //only for use not in search, since rand isn't threadsafe
 
+  //Threads for runWholeSearch, kept alive across searches----------------
+  //searchThreads[i] is the reusable state for threadIdx i. Thread 0 is always run by the caller of
+  //runWholeSearch, the rest by searchWorkers, which sleep between searches.
+  std::vector<SearchThread*> searchThreads;
+  std::vector<std::thread> searchWorkers;
+  std::mutex searchWorkersMutex;
+  std::condition_variable searchWorkersStartCond;
+  std::condition_variable searchWorkersDoneCond;
+  std::function<void(SearchThread&)> searchWorkersTask;
+  uint64_t searchWorkersTaskGeneration;
+  int searchWorkersNumRunning;
+  bool searchWorkersShouldExit;
+  std::exception_ptr searchWorkersException;
+
   //Note - randSeed controls a few things in the search, but a lot of the randomness actually comes from
   //random symmetries of the neural net evaluations, see nneval.h
   Search(SearchParams params, NNEvaluator* nnEval, const std::string& randSeed);
@@ -192,6 +293,13 @@ struct Search {
   //Just directly clear search without changing anything
   void clearSearch();
 
+  //Write the whole search tree to a file, or read one back in place of the current tree to continue searching it.
+  //Loading requires the same root position, rules, and history as when saving, the same nn size, and the same
+  //useGraphSearch, else throws StringError. NN outputs are stored in half precision, so a loaded tree is not quite
+  //identical to the saved one.
+  void saveTree(const std::string& fileName) const;
+  void loadTree(const std::string& fileName);
+
   //Updates position and preserves the relevant subtree of search
   //If the move is not legal for the specified player, returns false and does nothing, else returns true
   //In the case where the player was not the expected one moving next, also clears history.
@@ -249,7 +357,17 @@ struct Search {
   void beginSearch(Logger& logger);
 
   //Within-search functions, threadsafe-------------------------------------------
-  void runSinglePlayout(SearchThread& thread);
+  //Returns the number of playouts started, which is 1 except when leaves are evaluated without waiting
+  //(searchParams.maxLeavesInFlightPerThread > 1), in which case it is 0 if this playout collided with a leaf
+  //already in flight. In that mode, playouts finish during later calls, or call finishPendingPlayouts.
+  //With searchParams.leafBatchSizePerThread > 1, instead runs up to that many playouts, but no more than
+  //maxPlayoutsToStart, all finished by the time it returns, and returns how many.
+  int runSinglePlayout(SearchThread& thread, int64_t maxPlayoutsToStart);
+  //Wait for and finish all of this thread's playouts with leaves still in flight
+  void finishPendingPlayouts(SearchThread& thread);
+  //Recompute the stats of every node in the tree from its children, which is where useIncrementalBackup only
+  //approximately keeps them when children are reweighted. Not threadsafe, call only between searches.
+  void recomputeAllNodeStats();
 
   //Tree-inspection functions---------------------------------------------------------------
   void printPV(std::ostream& out, const SearchNode* node, int maxDepth) const;
@@ -276,8 +394,25 @@ struct Search {
 
   int64_t numRootVisits() const;
 
+  //The move from node to its child at childIdx. Safe to call DURING search with the same caveats as above.
+  Loc getChildMoveLoc(const SearchNode& node, int childIdx) const;
+
+  //Size of the search tree, as limited by maxTreeNodes and maxTreeBytes. The bytes are an estimate of the nodes,
+  //their children arrays, and the nn output that each node evaluated so far keeps, with its ownership map if any. Lock-free and safe to call at any time, including DURING
+  //search, and include nodes that have been discarded but not yet destroyed in the background.
+  int64_t getNumTreeNodes() const;
+  int64_t getTreeMemoryBytes() const;
+
   //Helpers-----------------------------------------------------------------------
 private:
+  //Make sure we have numThreads SearchThreads reset to the current root and numThreads-1 running workers.
+  void prepareSearchThreads(int numThreads, Logger* logger);
+  //Run f on every SearchThread in parallel and block until all are done, rethrowing the first exception if any.
+  void runOnAllSearchThreads(const std::function<void(SearchThread&)>& f);
+  //Run tasks on searchThreads[threadIdx] as runOnAllSearchThreads posts them, starting after lastGeneration.
+  void searchWorkerLoop(int threadIdx, uint64_t lastGeneration);
+  void stopSearchWorkers();
+
   void maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool isRoot) const;
   int getPos(Loc moveLoc) const;
 
@@ -290,7 +425,7 @@ private:
   double getUtilityFromNN(const NNOutput& nnOutput) const;
 
   //Parent must be locked
-  double getEndingWhiteScoreBonus(const SearchNode& parent, const SearchNode* child) const;
+  double getEndingWhiteScoreBonus(const SearchNode& parent, Loc moveLoc) const;
 
   void getValueChildWeights(
     int numChildren,
@@ -300,7 +435,7 @@ private:
   ) const;
 
   //Parent must be locked
-  void getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNode* child, double& lcbBuf, double& radiusBuf) const;
+  void getSelfUtilityLCBAndRadius(const SearchNode& parent, int childIdx, double& lcbBuf, double& radiusBuf) const;
 
   double getExploreSelectionValue(
     double nnPolicyProb, int64_t totalChildVisits, int64_t childVisits,
@@ -316,17 +451,33 @@ private:
   ) const;
 
   //Parent must be locked
-  double getExploreSelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const;
+  double getExploreSelectionValue(const SearchNode& parent, int childIdx, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const;
   double getNewExploreSelectionValue(const SearchNode& parent, float nnPolicyProb, int64_t totalChildVisits, double fpuValue) const;
 
   //Parent must be locked
-  int64_t getReducedPlaySelectionVisits(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double bestChildExploreSelectionValue) const;
+  int64_t getReducedPlaySelectionVisits(const SearchNode& parent, int childIdx, int64_t totalChildVisits, double bestChildExploreSelectionValue) const;
+  //Parent must be locked. Visits that went to the child through this parent. In a graph, a child can also have visits
+  //from its other parents, so these are counted on the edge, while in a tree they are just the child's visits.
+  int64_t getChildEdgeVisits(const SearchNode& parent, int childIdx) const;
 
   double getFpuValueForChildrenAssumeVisited(const SearchNode& node, Player pla, bool isRoot, double policyProbMassVisited, double& parentUtility) const;
 
-  void updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int32_t virtualLossesToSubtract, bool isRoot);
-  void recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, int32_t virtualLossesToSubtract, bool isRoot);
-  void recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot);
+  //If childIdx >= 0, also finishes the playout's edge to that child (a visit, removing its virtual losses), in the same
+  //critical section as recomputing this node's stats when it does, rather than locking the node an extra time.
+  void updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, bool isRoot, int childIdx);
+  void recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, bool isRoot, int childIdxToUpdate = -1);
+  //In a graph, visited tracks the nodes already done so that shared ones are done once, and is NULL in a tree
+  void recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot, std::unordered_set<const SearchNode*>* visited);
+  //With usingGraphSearch, discard every node no longer reachable from rootNode. Finding them is left to the
+  //nodeArena's background thread, which marks everything reachable with a new epoch and then destroys the rest.
+  void destroyUnreachableNodes();
+
+  bool isTreeOverBudget() const;
+  //NOT threadsafe, no search threads may be running. Bring the tree back well under maxTreeNodes and maxTreeBytes by
+  //collapsing the subtrees with the fewest visits into leaves, returning false if there was nothing to collapse.
+  bool collapseLowVisitSubtrees(Logger& logger);
+  //Count a playout reaching a collapsed node, with the same values that the node already has
+  void addCollapsedLeafValue(SearchThread& thread, SearchNode& node);
 
   void maybeRecomputeNormToTApproxTable();
   double getNormToTApproxForLCB(int64_t numVisits) const;
@@ -337,19 +488,52 @@ private:
     bool isRoot
   ) const;
 
-  void addLeafValue(SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain);
+  void addLeafValue(SearchThread& thread, SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, bool isCertain);
+  void addStatsDelta(SearchNode& node, const NodeStats& delta);
+
+  //Node must be locked. Bring the edge of the child up to date with the child's stats, and remove virtual losses from it.
+  //addVisit is whether a playout through this edge just finished, which the edge counts in a graph.
+  void updateChildEdge(SearchNode& node, int childIdx, int32_t virtualLossesToSubtract, bool addVisit) const;
+  //Node must be locked. After the node's nnOutput changes, so that edges still agree with its policy.
+  void updateChildEdgePolicyProbs(SearchNode& node) const;
 
+  //Node must be locked by lock and must not already be nnEvalPending. Marks it nnEvalPending and unlocks it for the nn call,
+  //and returns with it locked again and the output set.
   void initNodeNNOutput(
-    SearchThread& thread, SearchNode& node,
-    bool isRoot, bool skipCache, int32_t virtualLossesToSubtract, bool isReInit
+    SearchThread& thread, SearchNode& node, std::unique_lock<std::mutex>& lock,
+    bool isRoot, bool skipCache, bool isReInit
+  );
+  //Node must be locked
+  void setNodeNNOutput(
+    SearchThread& thread, SearchNode& node, NNResultBuf& nnResultBuf,
+    bool isRoot, bool isReInit
   );
 
-  void playoutDescend(
+  //Outcomes of playoutDescend
+  static constexpr int PLAYOUT_FINISHED = 0; //Reached a leaf and updated the stats of the node
+  static constexpr int PLAYOUT_PENDING = 1; //Submitted the leaf to the nn without waiting, stats are updated once it returns
+  static constexpr int PLAYOUT_COLLIDED = 2; //Reached a leaf some thread is already evaluating, changed nothing
+
+  //Virtual losses live in the edges of the parent, so the parent adds them to the edge of the child it descends to,
+  //and removes them again once the playout is finished or collided.
+  int playoutDescend(
     SearchThread& thread, SearchNode& node,
     bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
-    bool isRoot, int32_t virtualLossesToSubtract
+    bool isRoot
   );
 
+  //For leaves in flight: finish pendingLeaves[idx], setting its nn output and updating stats along its path
+  void finishPendingLeaf(SearchThread& thread, size_t idx);
+  void finishReadyPendingLeaves(SearchThread& thread);
+  //For leafBatchSizePerThread: descend repeatedly to collect a batch of up to batchSize leaves, submit them to the nn
+  //together, and finish them all. Returns the number of playouts.
+  int runLeafBatchPlayouts(SearchThread& thread, int batchSize);
+  //runSinglePlayout for when leaves aren't batched, waiting on each leaf or leaving it in flight
+  int runUnbatchedPlayout(SearchThread& thread);
+  //After a playout throws, remove the virtual losses of its descent, put the thread back at the root,
+  //and wait for and finish any leaves still in flight, so that the tree is usable by later searches.
+  void cleanUpFailedPlayout(SearchThread& thread);
+
   AnalysisData getAnalysisDataOfSingleChild(
     const SearchNode* child, std::vector<Loc>& scratchLocs, std::vector<double>& scratchValues,
     Loc move, double policyProb, double fpuValue, double parentUtility, double parentWinLossValue,
@@ -363,7 +547,11 @@ private:
     std::string& prefix, int64_t origVisits, int depth, const AnalysisData& data, Player perspective
   ) const;
 
-  double getAverageTreeOwnershipHelper(std::vector<double>& accum, int64_t minVisits, double desiredWeight, const SearchNode* node) const;
+  //ancestors are the nodes above node, only tracked in a graph
+  double getAverageTreeOwnershipHelper(
+    std::vector<double>& accum, int64_t minVisits, double desiredWeight, const SearchNode* node,
+    std::vector<const SearchNode*>* ancestors
+  ) const;
 
 };
 
@@ -18,6 +18,9 @@ SearchParams::SearchParams()
    valueWeightExponent(0.5),
    visitsExponent(1.0),
    scaleParentWeight(true),
+   useIncrementalBackup(false),
+   incrementalBackupRecomputePeriod(16),
+   useGraphSearch(false),
    rootNoiseEnabled(false),
    rootDirichletNoiseTotalConcentration(10.83),
    rootDirichletNoiseWeight(0.25),
@@ -37,6 +40,8 @@ SearchParams::SearchParams()
    rootPruneUselessMoves(false),
    mutexPoolSize(8192),
    numVirtualLossesPerThread(3),
+   maxLeavesInFlightPerThread(1),
+   leafBatchSizePerThread(1),
    numThreads(1),
    maxVisits(((int64_t)1) << 50),
    maxPlayouts(((int64_t)1) << 50),
@@ -44,6 +49,8 @@ SearchParams::SearchParams()
    maxVisitsPondering(((int64_t)1) << 50),
    maxPlayoutsPondering(((int64_t)1) << 50),
    maxTimePondering(1.0e20),
+   maxTreeNodes(((int64_t)1) << 50),
+   maxTreeBytes(((int64_t)1) << 60),
    lagBuffer(0.0),
    searchFactorAfterOnePass(1.0),
    searchFactorAfterTwoPass(1.0)
@@ -51,3 +58,7 @@ SearchParams::SearchParams()
 
 SearchParams::~SearchParams()
 {}
+
+int SearchParams::getMaxNNEvalsInFlightPerThread() const {
+  return std::max(maxLeavesInFlightPerThread,leafBatchSizePerThread);
+}
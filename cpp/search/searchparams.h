@@ -22,6 +22,14 @@ struct SearchParams {
 
   bool scaleParentWeight; //Also scale parent weight when applying valueWeightExponent?
 
+  //Back up each playout by adding its leaf value along the path rather than recomputing each node from all children.
+  //Exact only when children aren't reweighted (valueWeightExponent 0, visitsExponent 1), otherwise an approximation of the full
+  //backup that drifts between recomputes.
+  bool useIncrementalBackup;
+  int64_t incrementalBackupRecomputePeriod; //With useIncrementalBackup, still fully recompute nodes every this many visits when children are reweighted
+
+  bool useGraphSearch; //Share one node between all move orders reaching the same situation, making the search a graph rather than a tree
+
   //Root parameters
   bool rootNoiseEnabled;
   double rootDirichletNoiseTotalConcentration; //Same as alpha * board size, to match alphazero this might be 0.03 * 361, total number of balls in the urn
@@ -52,6 +60,8 @@ struct SearchParams {
   //Threading-related
   uint32_t mutexPoolSize; //Size of mutex pool for synchronizing access to all search nodes
   int32_t numVirtualLossesPerThread; //Number of virtual losses for one thread to add
+  int maxLeavesInFlightPerThread; //If more than 1, each thread submits leaves to the nn without waiting, keeping up to this many in flight
+  int leafBatchSizePerThread; //If more than 1, each thread collects up to this many leaves, submits them together, and backs them all up once they return
 
   //Asyncbot
   int numThreads; //Number of threads
@@ -64,6 +74,11 @@ struct SearchParams {
   int64_t maxPlayoutsPondering;
   double maxTimePondering;
 
+  //Memory limits on the search tree, both applying at once. When exceeded, the search keeps going but collapses the
+  //subtrees with the fewest visits into leaves to make room.
+  int64_t maxTreeNodes; //Max number of nodes in the search tree
+  int64_t maxTreeBytes; //Max approximate memory of the search tree, see Search::getTreeMemoryBytes
+
   //Amount of time to reserve for lag when using a time control
   double lagBuffer;
 
@@ -73,6 +88,9 @@ struct SearchParams {
 
   SearchParams();
   ~SearchParams();
+
+  //The most nn evaluations one search thread may have in flight at once, for sizing the nn evaluator
+  int getMaxNNEvalsInFlightPerThread() const;
 };
 
 #endif  // SEARCH_SEARCHPARAMS_H_
@@ -0,0 +1,291 @@
+#include "../search/search.h"
+
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+
+#include "../core/sha2.h"
+
+using namespace std;
+
+//Binary format of a saved search tree, specific to the machine's endianness:
+//A header, then every node in breadth-first order from the root, which is node 0. Each node is
+//  nextPla, prevMoveLoc, flags, graphHash, stats, [nn output as an NNCompactOutput], numChildren, and then for each
+//  child its node index and the data of its edge.
+//Children refer to nodes by index rather than following in place, so that a search graph sharing nodes between
+//several parents can be saved the same way as a tree.
+static const char TREE_FILE_MAGIC[8] = {'K','A','T','A','T','R','E','E'};
+static const uint32_t TREE_FILE_FORMAT_VERSION = 1;
+
+static const uint8_t TREE_NODE_IS_COLLAPSED = 1;
+static const uint8_t TREE_NODE_HAS_NN_OUTPUT = 2;
+//Bytes of a node with no nn output and no children
+static const uint64_t TREE_NODE_MIN_BYTES = 1 + 2 + 1 + 16 + 8 * 9 + 2;
+
+namespace {
+  struct TreeFileHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    int32_t nnXLen;
+    int32_t nnYLen;
+    int32_t boardXSize;
+    int32_t boardYSize;
+    uint32_t isGraph;
+    uint64_t rootIdentity0;
+    uint64_t rootIdentity1;
+    uint64_t numNodes;
+  };
+}
+
+//Identifies the root position along with everything about its history that the search depends on, so that a tree is
+//only ever loaded back at the same position
+static Hash128 getRootIdentity(const Board& board, const BoardHistory& hist, Player pla) {
+  ostringstream out;
+  out << board.x_size << " " << board.y_size << " " << board.pos_hash << " " << board.ko_loc << " " << (int)pla
+      << " " << hist.rules << " " << hist.encorePhase << " " << hist.whiteBonusScore << " " << hist.koProhibitHash;
+  for(size_t i = 0; i<hist.koHashHistory.size(); i++)
+    out << " " << hist.koHashHistory[i];
+  string str = out.str();
+  uint64_t hash[4];
+  SHA2::get256((const uint8_t*)str.data(),str.size(),hash);
+  return Hash128(hash[0] ^ hash[2], hash[1] ^ hash[3]);
+}
+
+template<typename T>
+static void writeValue(ostream& out, T x) {
+  out.write(reinterpret_cast<const char*>(&x),sizeof(T));
+}
+
+template<typename T>
+static T readValue(istream& in, const string& fileName) {
+  T x;
+  if(!in.read(reinterpret_cast<char*>(&x),sizeof(T)))
+    throw StringError("Search tree file ended unexpectedly: " + fileName);
+  return x;
+}
+
+void Search::saveTree(const string& fileName) const {
+  if(rootNode == NULL)
+    throw StringError("No search tree to save");
+
+  ofstream out(fileName, ios::out | ios::binary);
+  if(!out.good())
+    throw StringError("Could not open file to save search tree: " + fileName);
+
+  //Filled in with the number of nodes at the end, once we know it
+  TreeFileHeader header;
+  std::memcpy(header.magic,TREE_FILE_MAGIC,sizeof(TREE_FILE_MAGIC));
+  header.formatVersion = TREE_FILE_FORMAT_VERSION;
+  header.nnXLen = nnXLen;
+  header.nnYLen = nnYLen;
+  header.boardXSize = rootBoard.x_size;
+  header.boardYSize = rootBoard.y_size;
+  header.isGraph = usingGraphSearch ? 1 : 0;
+  Hash128 rootIdentity = getRootIdentity(rootBoard,rootHistory,rootPla);
+  header.rootIdentity0 = rootIdentity.hash0;
+  header.rootIdentity1 = rootIdentity.hash1;
+  header.numNodes = 0;
+  writeValue(out,header);
+
+  //The queue of nodes to write doubles as the list of indices. In a tree every child is new, so only a graph needs
+  //to look up the indices of nodes already queued.
+  vector<const SearchNode*> queue;
+  std::unordered_map<const SearchNode*,uint64_t> indexOfNode;
+  queue.push_back(rootNode);
+  if(usingGraphSearch)
+    indexOfNode[rootNode] = 0;
+
+  for(size_t idx = 0; idx < queue.size(); idx++) {
+    const SearchNode& node = *(queue[idx]);
+    uint8_t flags = 0;
+    if(node.isCollapsed)
+      flags |= TREE_NODE_IS_COLLAPSED;
+    if(node.nnOutput != nullptr)
+      flags |= TREE_NODE_HAS_NN_OUTPUT;
+    writeValue<int8_t>(out,node.nextPla);
+    writeValue<int16_t>(out,node.prevMoveLoc);
+    writeValue<uint8_t>(out,flags);
+    writeValue<uint64_t>(out,node.graphHash.hash0);
+    writeValue<uint64_t>(out,node.graphHash.hash1);
+
+    NodeStats stats = node.stats.snapshot();
+    writeValue<int64_t>(out,stats.visits);
+    writeValue<double>(out,stats.winValueSum);
+    writeValue<double>(out,stats.noResultValueSum);
+    writeValue<double>(out,stats.scoreMeanSum);
+    writeValue<double>(out,stats.scoreMeanSqSum);
+    writeValue<double>(out,stats.utilitySum);
+    writeValue<double>(out,stats.utilitySqSum);
+    writeValue<double>(out,stats.weightSum);
+    writeValue<double>(out,stats.weightSqSum);
+
+    if(node.nnOutput != nullptr) {
+      const NNOutput& nnOutput = *(node.nnOutput);
+      NNCompactOutput* compact = NNCompactOutput::compress(nnOutput,rootBoard.x_size,rootBoard.y_size,nnOutput.whiteOwnerMap != NULL);
+      writeValue<uint32_t>(out,(uint32_t)compact->sizeInBytes());
+      out.write(compact->bytes(),compact->sizeInBytes());
+      NNCompactOutput::destroy(compact);
+    }
+
+    writeValue<uint16_t>(out,node.numChildren);
+    if(node.numChildren > 0) {
+      SearchChildEdges edges = node.getChildEdges();
+      for(int i = 0; i<node.numChildren; i++) {
+        const SearchNode* child = node.children[i];
+        uint64_t childIdx;
+        if(!usingGraphSearch) {
+          childIdx = queue.size();
+          queue.push_back(child);
+        }
+        else {
+          auto iter = indexOfNode.find(child);
+          if(iter != indexOfNode.end())
+            childIdx = iter->second;
+          else {
+            childIdx = queue.size();
+            indexOfNode[child] = childIdx;
+            queue.push_back(child);
+          }
+        }
+        writeValue<uint64_t>(out,childIdx);
+        writeValue<double>(out,edges.visits[i]);
+        writeValue<double>(out,edges.utilities[i]);
+        writeValue<float>(out,edges.policyProbs[i]);
+        writeValue<int16_t>(out,edges.movePoses[i]);
+      }
+    }
+  }
+
+  header.numNodes = queue.size();
+  out.seekp(0);
+  writeValue(out,header);
+  out.close();
+  if(out.fail())
+    throw StringError("Failed to write search tree file: " + fileName);
+}
+
+void Search::loadTree(const string& fileName) {
+  ifstream in(fileName, ios::in | ios::binary | ios::ate);
+  if(!in.good())
+    throw StringError("Could not open search tree file: " + fileName);
+  uint64_t fileBytes = (uint64_t)in.tellg();
+  in.seekg(0);
+
+  TreeFileHeader header = readValue<TreeFileHeader>(in,fileName);
+  if(std::memcmp(header.magic,TREE_FILE_MAGIC,sizeof(TREE_FILE_MAGIC)) != 0)
+    throw StringError("File is not a search tree: " + fileName);
+  if(header.formatVersion != TREE_FILE_FORMAT_VERSION)
+    throw StringError("Search tree file has unsupported format version " + Global::uint64ToString(header.formatVersion) + ": " + fileName);
+  if(header.nnXLen != nnXLen || header.nnYLen != nnYLen)
+    throw StringError("Search tree file was saved with a different neural net size: " + fileName);
+  Hash128 rootIdentity = getRootIdentity(rootBoard,rootHistory,rootPla);
+  if(header.boardXSize != rootBoard.x_size || header.boardYSize != rootBoard.y_size ||
+     header.rootIdentity0 != rootIdentity.hash0 || header.rootIdentity1 != rootIdentity.hash1)
+    throw StringError("Search tree file was saved at a different position, rules, or history than the current one: " + fileName);
+  if((header.isGraph != 0) != searchParams.useGraphSearch)
+    throw StringError(
+      string("Search tree file was saved with useGraphSearch = ") + (header.isGraph != 0 ? "true" : "false") +
+      ", which must match the current params: " + fileName
+    );
+  if(header.numNodes <= 0 || header.numNodes > fileBytes / TREE_NODE_MIN_BYTES)
+    throw StringError("Search tree file is corrupt: " + fileName);
+
+  clearSearch();
+  usingGraphSearch = searchParams.useGraphSearch;
+
+  //Allocate every node up front, so that children can refer to nodes not read yet
+  SearchThread dummyThread(-1, *this, NULL);
+  vector<SearchNode*> nodes;
+  nodes.reserve((size_t)header.numNodes);
+  for(uint64_t idx = 0; idx < header.numNodes; idx++)
+    nodes.push_back(new(nodeArena->allocNode(dummyThread.nodeAllocCache)) SearchNode(*this, dummyThread, Board::NULL_LOC));
+  rootNode = nodes[0];
+
+  //Anything wrong with the file beyond this point leaves the partially loaded tree, so throw it away rather than
+  //search it
+  try {
+    size_t maxCompactBytes = NNCompactOutput::sizeInBytes(rootBoard.x_size,rootBoard.y_size,true);
+    vector<char> compactBuf;
+    //In a tree, every node but the root is the child of exactly one node, in order
+    uint64_t nextNewChildIdx = 1;
+    for(uint64_t idx = 0; idx < header.numNodes; idx++) {
+      SearchNode& node = *(nodes[idx]);
+      int8_t nextPla = readValue<int8_t>(in,fileName);
+      if(nextPla != P_BLACK && nextPla != P_WHITE)
+        throw StringError("Search tree file is corrupt: " + fileName);
+      node.nextPla = nextPla;
+      node.prevMoveLoc = readValue<int16_t>(in,fileName);
+      uint8_t flags = readValue<uint8_t>(in,fileName);
+      node.isCollapsed = (flags & TREE_NODE_IS_COLLAPSED) != 0;
+      node.graphHash.hash0 = readValue<uint64_t>(in,fileName);
+      node.graphHash.hash1 = readValue<uint64_t>(in,fileName);
+
+      node.stats.visits.store(readValue<int64_t>(in,fileName),std::memory_order_relaxed);
+      node.stats.winValueSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.noResultValueSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.scoreMeanSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.scoreMeanSqSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.utilitySum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.utilitySqSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.weightSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+      node.stats.weightSqSum.store(readValue<double>(in,fileName),std::memory_order_relaxed);
+
+      if((flags & TREE_NODE_HAS_NN_OUTPUT) != 0) {
+        uint32_t numBytes = readValue<uint32_t>(in,fileName);
+        if(numBytes > maxCompactBytes)
+          throw StringError("Search tree file is corrupt: " + fileName);
+        compactBuf.resize(numBytes);
+        if(!in.read(compactBuf.data(),numBytes))
+          throw StringError("Search tree file ended unexpectedly: " + fileName);
+        NNCompactOutput* compact = NNCompactOutput::fromBytes(compactBuf.data(),numBytes);
+        if(compact == NULL)
+          throw StringError("Search tree file is corrupt: " + fileName);
+        if(compact->nnXLen != nnXLen || compact->nnYLen != nnYLen) {
+          NNCompactOutput::destroy(compact);
+          throw StringError("Search tree file is corrupt: " + fileName);
+        }
+        std::shared_ptr<NNOutput> nnOutput = std::make_shared<NNOutput>();
+        compact->decompress(*nnOutput);
+        NNCompactOutput::destroy(compact);
+        node.nnOutput = std::move(nnOutput);
+        nodeArena->addNNOutputBytes(node.getNNOutputBytes());
+      }
+
+      uint16_t numChildren = readValue<uint16_t>(in,fileName);
+      if(numChildren > policySize)
+        throw StringError("Search tree file is corrupt: " + fileName);
+      if(numChildren > 0) {
+        if(node.nnOutput == nullptr)
+          throw StringError("Search tree file is corrupt: " + fileName);
+        node.children = nodeArena->allocChildren(dummyThread.nodeAllocCache,numChildren);
+        node.childrenCapacity = numChildren;
+        SearchChildEdges edges = node.getChildEdges();
+        for(int i = 0; i<numChildren; i++) {
+          uint64_t childIdx = readValue<uint64_t>(in,fileName);
+          bool validIdx = usingGraphSearch ? (childIdx > 0 && childIdx < header.numNodes) : childIdx == nextNewChildIdx++;
+          if(!validIdx || childIdx >= header.numNodes)
+            throw StringError("Search tree file is corrupt: " + fileName);
+          node.children[i] = nodes[childIdx];
+          edges.visits[i] = readValue<double>(in,fileName);
+          edges.utilities[i] = readValue<double>(in,fileName);
+          edges.policyProbs[i] = readValue<float>(in,fileName);
+          edges.virtualLosses[i] = 0;
+          edges.movePoses[i] = readValue<int16_t>(in,fileName);
+          if(edges.movePoses[i] < 0 || edges.movePoses[i] >= policySize)
+            throw StringError("Search tree file is corrupt: " + fileName);
+          node.numChildren = (uint16_t)(i+1);
+        }
+      }
+      if(usingGraphSearch)
+        nodeTable->insert(node.graphHash,&node);
+    }
+    if(!usingGraphSearch && nextNewChildIdx != header.numNodes)
+      throw StringError("Search tree file is corrupt: " + fileName);
+  }
+  catch(const StringError&) {
+    clearSearch();
+    throw;
+  }
+}
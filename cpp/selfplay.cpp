@@ -325,8 +325,10 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
 
     logger.write("Found new neural net " + modelName);
 
+    //Each search thread may have several leaves in flight or batched at once
     // * 2 + 16 just in case to have plenty of room
-    int maxConcurrentEvals = cfg.getInt("numSearchThreads") * numGameThreads * 2 + 16;
+    SearchParams baseParams = Setup::loadSingleParams(cfg);
+    int maxConcurrentEvals = baseParams.numThreads * baseParams.getMaxNNEvalsInFlightPerThread() * numGameThreads * 2 + 16;
 
     Rand rand;
     NNEvaluator* nnEval = Setup::initializeNNEvaluator(
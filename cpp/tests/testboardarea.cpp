@@ -1,5 +1,7 @@
 #include "../tests/tests.h"
 
+#include "../game/areacache.h"
+
 using namespace std;
 using namespace TestCommon;
 
@@ -8,7 +10,10 @@ void Tests::runBoardAreaTests() {
   ostringstream out;
 
   //============================================================================
-  auto printAreas = [&out](const Board& board, Color result[Board::MAX_ARR_SIZE]) {
+  //Carried across all the boards below, which differ by a lot, to exercise them on more than single moves.
+  //One for each multiStoneSuicideLegal, since changing that starts over.
+  AreaCache areaCaches[2];
+  auto printAreas = [&out,&areaCaches](const Board& board, Color result[Board::MAX_ARR_SIZE]) {
     for(int mode = 0; mode < 8; mode++) {
       bool multiStoneSuicideLegal = (mode % 2 == 1);
       bool nonPassAliveStones = (mode >= 6);
@@ -30,6 +35,36 @@ void Tests::runBoardAreaTests() {
       out << endl;
       testAssert(boardsSeemEqual(copy,board));
       copy.checkConsistency();
+
+      Color cachedResult[Board::MAX_ARR_SIZE];
+      areaCaches[multiStoneSuicideLegal].calculateArea(copy,cachedResult,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+      for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+        testAssert(cachedResult[i] == result[i]);
+
+      //The bitboard benson should agree with calculateArea whenever only pass-alive area is marked
+      if(!nonPassAliveStones && !safeBigTerritories && !unsafeBigTerritories) {
+        Board::Bitboard blackBits = copy.calculatePassAliveBits(P_BLACK,multiStoneSuicideLegal);
+        Board::Bitboard whiteBits = copy.calculatePassAliveBits(P_WHITE,multiStoneSuicideLegal);
+        for(int y = 0; y<copy.y_size; y++) {
+          for(int x = 0; x<copy.x_size; x++) {
+            Loc loc = Location::getLoc(x,y,copy.x_size);
+            Color expected = whiteBits.contains(loc) ? C_WHITE : blackBits.contains(loc) ? C_BLACK : C_EMPTY;
+            testAssert(result[loc] == expected);
+          }
+        }
+
+        //And ending the game when everything is pass-alive, which uses the bitboard benson, agrees with the area cache
+        Rules rules = Rules::getTrompTaylorish();
+        rules.multiStoneSuicideLegal = multiStoneSuicideLegal;
+        BoardHistory hist(copy,P_BLACK,rules,0);
+        BoardHistory cachedHist(copy,P_BLACK,rules,0);
+        AreaCache areaCache;
+        hist.endGameIfAllPassAlive(copy);
+        cachedHist.endGameIfAllPassAlive(copy,areaCache);
+        testAssert(hist.isGameFinished == cachedHist.isGameFinished);
+        testAssert(hist.winner == cachedHist.winner);
+        testAssert(hist.finalWhiteMinusBlackScore == cachedHist.finalWhiteMinusBlackScore);
+      }
     }
   };
 
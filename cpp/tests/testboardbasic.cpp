@@ -1,5 +1,8 @@
 #include "../tests/tests.h"
 
+#include "../core/timer.h"
+#include "../game/areacache.h"
+
 using namespace std;
 using namespace TestCommon;
 
@@ -1211,6 +1214,156 @@ suicideCount 87
   expect("Board undo test move counts",out,expected);
 }
 
+void Tests::runBoardHistoryUndoTest() {
+  cout << "Running board history undo test" << endl;
+  Rand rand("runBoardHistoryUndoTest");
+
+  auto histsSeemEqual = [](const BoardHistory& h1, const Board& b1, const BoardHistory& h2, const Board& b2) {
+    if(h1.moveHistory.size() != h2.moveHistory.size())
+      return false;
+    for(size_t i = 0; i<h1.moveHistory.size(); i++)
+      if(h1.moveHistory[i].loc != h2.moveHistory[i].loc || h1.moveHistory[i].pla != h2.moveHistory[i].pla)
+        return false;
+    if(h1.koHashHistory != h2.koHashHistory)
+      return false;
+    if(h1.koHistoryLastClearedBeginningMoveIdx != h2.koHistoryLastClearedBeginningMoveIdx)
+      return false;
+    if(h1.numMovesSinceClear != h2.numMovesSinceClear)
+      return false;
+    for(int i = 0; i<BoardHistory::NUM_RECENT_BOARDS; i++) {
+      Board recent1 = h1.getRecentBoard(b1,i);
+      Board recent2 = h2.getRecentBoard(b2,i);
+      recent1.checkConsistency();
+      if(!boardsSeemEqual(recent1,recent2) || recent1.ko_loc != recent2.ko_loc)
+        return false;
+    }
+    for(int i = 0; i<Board::MAX_ARR_SIZE; i++) {
+      if(h1.wasEverOccupiedOrPlayed[i] != h2.wasEverOccupiedOrPlayed[i] ||
+         h1.superKoBanned[i] != h2.superKoBanned[i] ||
+         h1.blackKoProhibited[i] != h2.blackKoProhibited[i] ||
+         h1.whiteKoProhibited[i] != h2.whiteKoProhibited[i])
+        return false;
+      if(h1.encorePhase >= 2 && h1.secondEncoreStartColors[i] != h2.secondEncoreStartColors[i])
+        return false;
+    }
+    if(h1.consecutiveEndingPasses != h2.consecutiveEndingPasses)
+      return false;
+    if(h1.hashesAfterBlackPass != h2.hashesAfterBlackPass || h1.hashesAfterWhitePass != h2.hashesAfterWhitePass)
+      return false;
+    if(h1.encorePhase != h2.encorePhase || h1.koProhibitHash != h2.koProhibitHash)
+      return false;
+    if(h1.koCapturesInEncore.size() != h2.koCapturesInEncore.size())
+      return false;
+    for(size_t i = 0; i<h1.koCapturesInEncore.size(); i++) {
+      if(h1.koCapturesInEncore[i].posHashBeforeMove != h2.koCapturesInEncore[i].posHashBeforeMove ||
+         h1.koCapturesInEncore[i].moveLoc != h2.koCapturesInEncore[i].moveLoc ||
+         h1.koCapturesInEncore[i].movePla != h2.koCapturesInEncore[i].movePla)
+        return false;
+    }
+    if(h1.whiteBonusScore != h2.whiteBonusScore)
+      return false;
+    if(h1.isGameFinished != h2.isGameFinished || h1.winner != h2.winner || h1.isNoResult != h2.isNoResult || h1.isResignation != h2.isResignation)
+      return false;
+    if(h1.finalWhiteMinusBlackScore != h2.finalWhiteMinusBlackScore)
+      return false;
+    return true;
+  };
+
+  int numGames = 0;
+  int numMoves = 0;
+  int numFinished = 0;
+  int numEncoreMoves = 0;
+  int numPassForKo = 0;
+  for(int koRule = 0; koRule < 4; koRule++) {
+    for(int scoringRule = 0; scoringRule < 2; scoringRule++) {
+      for(int suicide = 0; suicide < 2; suicide++) {
+        Rules rules(koRule,scoringRule,suicide == 1,0.5f);
+        for(int rep = 0; rep < 5; rep++) {
+          static const int maxSteps = 200;
+          Board* boards = new Board[maxSteps+1];
+          BoardHistory* hists = new BoardHistory[maxSteps+1];
+          vector<BoardHistory::MoveRecord> records(maxSteps);
+
+          boards[0] = Board(4,5);
+          Player pla = P_BLACK;
+          hists[0] = BoardHistory(boards[0],pla,rules,0);
+          Board board = boards[0];
+          BoardHistory hist = hists[0];
+          int steps = 0;
+          while(steps < maxSteps && !hist.isGameFinished) {
+            Loc loc;
+            while(true) {
+              if(rand.nextUInt(5) == 0)
+                loc = Board::PASS_LOC;
+              else
+                loc = Location::getLoc(rand.nextUInt(board.x_size),rand.nextUInt(board.y_size),board.x_size);
+              if(hist.isLegal(board,loc,pla))
+                break;
+            }
+            if(hist.encorePhase > 0)
+              numEncoreMoves++;
+            hist.makeBoardMoveRecorded(board,loc,pla,NULL,records[steps]);
+            if(records[steps].wasPassForKo)
+              numPassForKo++;
+            pla = getOpp(pla);
+            steps++;
+            boards[steps] = board;
+            hists[steps] = hist;
+
+            //Check that recorded moves match unrecorded ones
+            Board boardCopy = boards[steps-1];
+            BoardHistory histCopy = hists[steps-1];
+            histCopy.makeBoardMoveAssumeLegal(boardCopy,loc,getOpp(pla),NULL);
+            testAssert(boardsSeemEqual(boardCopy,board));
+            testAssert(histsSeemEqual(histCopy,boardCopy,hist,board));
+            //Recent boards match the boards actually played through
+            for(int i = 0; i<BoardHistory::NUM_RECENT_BOARDS; i++)
+              testAssert(boardsSeemEqual(hist.getRecentBoard(board,i),boards[std::max(steps-i,0)]));
+          }
+          numGames++;
+          numMoves += steps;
+          if(hist.isGameFinished)
+            numFinished++;
+          Board initialBoard = hist.getInitialBoard();
+          initialBoard.checkConsistency();
+          testAssert(boardsSeemEqual(initialBoard,boards[0]));
+          testAssert(initialBoard.pos_hash == boards[0].pos_hash);
+
+          for(int n = steps-1; n >= 0; n--) {
+            hist.undoBoardMove(board,records[n]);
+            board.checkConsistency();
+            testAssert(boardsSeemEqual(boards[n],board));
+            testAssert(board.ko_loc == boards[n].ko_loc);
+            testAssert(histsSeemEqual(hists[n],boards[n],hist,board));
+          }
+
+          delete[] boards;
+          delete[] hists;
+        }
+      }
+    }
+  }
+
+  ostringstream out;
+  out << endl;
+  out << "numGames " << numGames << endl;
+  out << "numMoves " << numMoves << endl;
+  out << "numFinished " << numFinished << endl;
+  out << "numEncoreMoves " << numEncoreMoves << endl;
+  out << "numPassForKo " << numPassForKo << endl;
+
+  string expected = R"%%(
+
+numGames 80
+numMoves 1913
+numFinished 80
+numEncoreMoves 541
+numPassForKo 1
+
+)%%";
+  expect("Board history undo test move counts",out,expected);
+}
+
 
 void Tests::runBoardStressTest() {
   cout << "Running board stress test" << endl;
@@ -1224,6 +1377,8 @@ void Tests::runBoardStressTest() {
   boards[3] = Board(4,4);
   bool multiStoneSuicideLegal[4] = {false,false,true,false};
   Board copies[numBoards];
+  //Carried along with each board, and checked against calculateArea every few moves
+  AreaCache areaCaches[numBoards];
   Player pla = C_BLACK;
   int suicideCount = 0;
   int koBanCount = 0;
@@ -1306,8 +1461,43 @@ void Tests::runBoardStressTest() {
       }
     }
 
+    //Every so often, check the whole-board bitboard queries against the usual code
+    if(n % 50 == 0) {
+      for(int i = 0; i<numBoards; i++) {
+        const Board& board = boards[i];
+        Color area[Board::MAX_ARR_SIZE];
+        board.calculateArea(area,false,false,false,multiStoneSuicideLegal[i]);
+        Board::Bitboard blackArea = board.calculatePassAliveBits(P_BLACK,multiStoneSuicideLegal[i]);
+        Board::Bitboard whiteArea = board.calculatePassAliveBits(P_WHITE,multiStoneSuicideLegal[i]);
+        for(int y = 0; y<board.y_size; y++) {
+          for(int x = 0; x<board.x_size; x++) {
+            Loc loc = Location::getLoc(x,y,board.x_size);
+            Color expectedArea = whiteArea.contains(loc) ? C_WHITE : blackArea.contains(loc) ? C_BLACK : C_EMPTY;
+            testAssert(area[loc] == expectedArea);
+          }
+        }
+      }
+    }
+
+    if(n % 10 == 0) {
+      int mode = (n / 10) % 8;
+      bool nonPassAliveStones = (mode & 1) != 0;
+      bool safeBigTerritories = (mode & 2) != 0;
+      bool unsafeBigTerritories = (mode & 4) != 0;
+      for(int i = 0; i<numBoards; i++) {
+        Color area[Board::MAX_ARR_SIZE];
+        Color cachedArea[Board::MAX_ARR_SIZE];
+        boards[i].calculateArea(area,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal[i]);
+        areaCaches[i].calculateArea(boards[i],cachedArea,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal[i]);
+        for(int j = 0; j<Board::MAX_ARR_SIZE; j++)
+          testAssert(cachedArea[j] == area[j]);
+      }
+    }
+
     pla = rand.nextUInt(2) == 0 ? getOpp(pla) : pla;
   }
+  for(int i = 0; i<numBoards; i++)
+    testAssert(areaCaches[i].numRegionsKept > 0);
 
   ostringstream out;
   out << endl;
@@ -1334,3 +1524,161 @@ Caps 4364 4393
 )%%";
   expect("Board stress test move counts",out,expected);
 }
+
+void Tests::runBoardBenchmarks() {
+  Rand rand("runBoardBenchmarks");
+
+  //Positions from random playouts of varying lengths, avoiding filling simple eyes so that some
+  //pass-alive groups and territory show up.
+  vector<Board> boards;
+  const int numBoards = 200;
+  const bool multiStoneSuicideLegal = false;
+  for(int i = 0; i<numBoards; i++) {
+    Board board(19,19);
+    Player pla = P_BLACK;
+    int numMoves = (int)rand.nextUInt(400);
+    for(int m = 0; m<numMoves; m++) {
+      Loc loc = Board::PASS_LOC;
+      for(int tries = 0; tries < 20 && board.empty_list.size() > 0; tries++) {
+        Loc candidate = board.empty_list[rand.nextUInt(board.empty_list.size())];
+        if(board.isLegal(candidate,pla,multiStoneSuicideLegal) && !board.isSimpleEye(candidate,pla)) {
+          loc = candidate;
+          break;
+        }
+      }
+      board.playMoveAssumeLegal(loc,pla);
+      pla = getOpp(pla);
+    }
+    boards.push_back(board);
+  }
+
+  cout << "===================================================================" << endl;
+  cout << "Board queries, usual code vs word-parallel bitboards" << endl;
+  cout << "===================================================================" << endl;
+  cout << numBoards << " random 19x19 positions" << endl;
+
+  auto report = [](const char* label, int64_t numCalls, double seconds, int64_t checksum) {
+    cout << label << " " << Global::doubleToString(seconds / numCalls * 1e6) << " us/call" << " (checksum " << checksum << ")" << endl;
+  };
+
+  const int numIters = 50;
+  {
+    int64_t checksum = 0;
+    Color area[Board::MAX_ARR_SIZE];
+    ClockTimer timer;
+    for(int iter = 0; iter<numIters; iter++) {
+      for(const Board& board: boards) {
+        board.calculateArea(area,false,false,false,multiStoneSuicideLegal);
+        for(int loc = 0; loc<Board::MAX_ARR_SIZE; loc++)
+          checksum += (area[loc] == C_EMPTY ? 0 : 1);
+      }
+    }
+    report("Pass-alive area, calculateArea", (int64_t)numIters * numBoards, timer.getSeconds(), checksum);
+  }
+  {
+    int64_t checksum = 0;
+    ClockTimer timer;
+    for(int iter = 0; iter<numIters; iter++) {
+      for(const Board& board: boards) {
+        checksum += board.calculatePassAliveBits(P_BLACK,multiStoneSuicideLegal).count();
+        checksum += board.calculatePassAliveBits(P_WHITE,multiStoneSuicideLegal).count();
+      }
+    }
+    report("Pass-alive area, calculatePassAliveBits", (int64_t)numIters * numBoards, timer.getSeconds(), checksum);
+  }
+
+  //Ladders the way the nn input features read them, for every chain with 1 or 2 liberties
+  auto forEachLadderChain = [](const Board& board, std::function<void(Loc,int)> f) {
+    for(int y = 0; y<board.y_size; y++) {
+      for(int x = 0; x<board.x_size; x++) {
+        Loc loc = Location::getLoc(x,y,board.x_size);
+        if(board.colors[loc] != C_EMPTY && board.chain_head[loc] == loc) {
+          int libs = board.getNumLiberties(loc);
+          if(libs == 1 || libs == 2)
+            f(loc,libs);
+        }
+      }
+    }
+  };
+  {
+    int64_t checksum = 0;
+    int64_t numCalls = 0;
+    vector<Loc> buf;
+    vector<Loc> workingMoves;
+    ClockTimer timer;
+    for(const Board& board: boards) {
+      Board copy(board);
+      forEachLadderChain(board, [&](Loc loc, int libs) {
+        bool laddered = libs == 1 ? copy.searchIsLadderCaptured(loc,true,buf) : copy.searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+        checksum += laddered;
+        numCalls++;
+      });
+    }
+    report("Ladders, searchIsLadderCaptured on a board copy", numCalls, timer.getSeconds(), checksum);
+  }
+
+  //Pass-alive area after each move of some games, the way selfplay checks for the end of the game
+  {
+    vector<Board> gamePositions;
+    for(int i = 0; i<10; i++) {
+      Board board(19,19);
+      Player pla = P_BLACK;
+      for(int m = 0; m<400; m++) {
+        Loc loc = Board::PASS_LOC;
+        for(int tries = 0; tries < 20 && board.empty_list.size() > 0; tries++) {
+          Loc candidate = board.empty_list[rand.nextUInt(board.empty_list.size())];
+          if(board.isLegal(candidate,pla,multiStoneSuicideLegal) && !board.isSimpleEye(candidate,pla)) {
+            loc = candidate;
+            break;
+          }
+        }
+        board.playMoveAssumeLegal(loc,pla);
+        pla = getOpp(pla);
+        gamePositions.push_back(board);
+      }
+    }
+    Color area[Board::MAX_ARR_SIZE];
+    {
+      int64_t checksum = 0;
+      ClockTimer timer;
+      for(const Board& board: gamePositions) {
+        board.calculateArea(area,false,false,false,multiStoneSuicideLegal);
+        for(int loc = 0; loc<Board::MAX_ARR_SIZE; loc++)
+          checksum += (area[loc] == C_EMPTY ? 0 : 1);
+      }
+      report("Pass-alive area along games, calculateArea", (int64_t)gamePositions.size(), timer.getSeconds(), checksum);
+    }
+    {
+      int64_t checksum = 0;
+      AreaCache areaCache;
+      ClockTimer timer;
+      for(const Board& board: gamePositions) {
+        areaCache.calculateArea(board,area,false,false,false,multiStoneSuicideLegal);
+        for(int loc = 0; loc<Board::MAX_ARR_SIZE; loc++)
+          checksum += (area[loc] == C_EMPTY ? 0 : 1);
+      }
+      report("Pass-alive area along games, AreaCache", (int64_t)gamePositions.size(), timer.getSeconds(), checksum);
+      cout << "AreaCache regions kept " << areaCache.numRegionsKept << " traced " << areaCache.numRegionsTraced << endl;
+    }
+  }
+
+  {
+    const int numPlayouts = 2000;
+    int64_t numMoves = 0;
+    ClockTimer timer;
+    for(int i = 0; i<numPlayouts; i++) {
+      Board board(19,19);
+      Player pla = P_BLACK;
+      for(int m = 0; m<300; m++) {
+        Loc loc = board.empty_list[rand.nextUInt(board.empty_list.size())];
+        if(!board.isLegal(loc,pla,multiStoneSuicideLegal))
+          loc = Board::PASS_LOC;
+        board.playMoveAssumeLegal(loc,pla);
+        pla = getOpp(pla);
+        numMoves++;
+      }
+    }
+    double seconds = timer.getSeconds();
+    cout << "Random moves, incl. maintaining color_bits " << Global::doubleToString(seconds / numMoves * 1e9) << " ns/move" << endl;
+  }
+}
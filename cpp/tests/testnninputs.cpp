@@ -1,6 +1,8 @@
 #include "../tests/tests.h"
 
+#include <cstring>
 #include <iomanip>
+#include <limits>
 
 #include "../neuralnet/nninputs.h"
 #include "../neuralnet/modelversion.h"
@@ -642,4 +644,231 @@ xxx..xx
     delete sgf;
 
   }
+
+  {
+    const char* name = "NN Inputs V3V4 ladder cache";
+    cout << "-----------------------------------------------------------------" <<  endl;
+    cout << name << endl;
+    cout << "-----------------------------------------------------------------" <<  endl;
+
+    //A game with plenty of chains in atari along the way
+    const string sgfStr = "(;FF[4]GM[1]SZ[13]HA[0]KM[7.5]RU[koPOSITIONALscoreAREAsui0];B[ck];W[lb];B[ke];W[ld];B[jd];W[kc];B[jc];W[jb];B[ib];W[kk];B[ki];W[kh];B[ja];W[le];B[ic];W[kf];B[lj];W[li];B[kj];W[lk];B[jk];W[jl];B[ik];W[mj];B[kb];W[jj];B[ji];W[ij];B[ii];W[hj];B[lh];W[mi];B[kg];W[jg];B[jh];W[lg];B[hk];W[hi];B[mh];W[gk];B[mk];W[il];B[jf];W[lf];B[ig];W[cc];B[dc];W[cd];B[ed];W[kd];B[dj];W[el];B[eg];W[de];B[ee];W[ec];B[je];W[db];B[fc];W[eb];B[bj];W[fd];B[gc];W[cl];B[df];W[dd];B[cf];W[dl];B[gh];W[fk];B[la];W[hh];B[hg];W[fi];B[gg];W[mc];B[bk];W[fb];B[gb];W[ei];B[gi];W[fe];B[ef];W[ej];B[gj];W[hl];B[bh];W[mg];B[be];W[bd];B[ad];W[bb];B[ae];W[di];B[me];W[ci];B[bi];W[bl];B[ab];W[ba];B[ac];W[ml];B[ga];W[fa];B[al];W[bc];B[bf];W[mj];B[mi];W[mb];B[ge];W[mk];B[dk];W[md];B[ek];W[fj];B[jb];W[fh];B[ff];W[bm];B[ka];W[ce];B[ak];W[cj];B[ch])";
+    CompactSgf* sgf = CompactSgf::parse(sgfStr);
+
+    for(int version = 3; version <= 4; version++) {
+      int nnXLen = 13;
+      int nnYLen = 13;
+      double drawEquivalentWinsForWhite = 0.0;
+      bool inputsUseNHWC = true;
+      int numFeaturesBin;
+      int numFeaturesGlobal;
+      float* rowBin;
+      float* rowGlobal;
+      allocateRows(version,nnXLen,nnYLen,numFeaturesBin,numFeaturesGlobal,rowBin,rowGlobal);
+      int rowBinSize = numFeaturesBin * nnXLen * nnYLen;
+
+      //Features computed with an empty cache every time, versus with the cache carried along the game
+      vector<vector<float>> uncachedRows;
+      for(int pass = 0; pass < 2; pass++) {
+        Board board;
+        Player nextPla;
+        BoardHistory hist;
+        Rules initialRules;
+        initialRules = sgf->getRulesOrFailAllowUnspecified(initialRules);
+        sgf->setupInitialBoardAndHist(initialRules, board, nextPla, hist);
+        vector<Move>& moves = sgf->moves;
+
+        NNInputs::clearLadderCache();
+        for(size_t i = 0; i<moves.size(); i++) {
+          hist.makeBoardMoveAssumeLegal(board,moves[i].loc,moves[i].pla,NULL);
+          nextPla = getOpp(moves[i].pla);
+          if(pass == 0)
+            NNInputs::clearLadderCache();
+          Hash128 hash;
+          fillRows(version,hash,board,hist,nextPla,drawEquivalentWinsForWhite,nnXLen,nnYLen,inputsUseNHWC,rowBin,rowGlobal);
+          if(pass == 0)
+            uncachedRows.push_back(vector<float>(rowBin,rowBin+rowBinSize));
+          else
+            testAssert(uncachedRows[i] == vector<float>(rowBin,rowBin+rowBinSize));
+        }
+      }
+      //Going move by move, the previous two boards should be answered by the cache
+      uint64_t numHits;
+      uint64_t numMisses;
+      NNInputs::getLadderCacheStats(numHits,numMisses);
+      testAssert(numHits > numMisses);
+
+      delete[] rowBin;
+      delete[] rowGlobal;
+    }
+    delete sgf;
+  }
+
+  {
+    const char* name = "NN compact output half precision";
+    cout << "-----------------------------------------------------------------" <<  endl;
+    cout << name << endl;
+    cout << "-----------------------------------------------------------------" <<  endl;
+
+    auto toHalf = [](float f) { return NNCompactOutput::floatToHalf(f); };
+    auto toFloat = [](uint16_t h) { return NNCompactOutput::halfToFloat(h); };
+
+    //Exact values
+    testAssert(toHalf(0.0f) == 0x0000);
+    testAssert(toHalf(-0.0f) == 0x8000);
+    testAssert(toHalf(1.0f) == 0x3C00);
+    testAssert(toHalf(-2.0f) == 0xC000);
+    testAssert(toHalf(0.5f) == 0x3800);
+    testAssert(toHalf(65504.0f) == 0x7BFF);
+    testAssert(toFloat(0x3C00) == 1.0f);
+    testAssert(toFloat(0x7BFF) == 65504.0f);
+    testAssert(toFloat(0x0000) == 0.0f && !std::signbit(toFloat(0x0000)));
+    testAssert(toFloat(0x8000) == 0.0f && std::signbit(toFloat(0x8000)));
+
+    //Overflow, infinities, and nans
+    testAssert(toHalf(65520.0f) == 0x7C00);
+    testAssert(toHalf(-1e10f) == 0xFC00);
+    testAssert(toHalf(std::numeric_limits<float>::infinity()) == 0x7C00);
+    testAssert(std::isinf(toFloat(0x7C00)) && toFloat(0x7C00) > 0);
+    testAssert(std::isinf(toFloat(0xFC00)) && toFloat(0xFC00) < 0);
+    testAssert(std::isnan(toFloat(toHalf(std::numeric_limits<float>::quiet_NaN()))));
+
+    //Subnormals, the smallest is 2^-24
+    testAssert(toHalf(std::ldexp(1.0f,-24)) == 0x0001);
+    testAssert(toFloat(0x0001) == std::ldexp(1.0f,-24));
+    testAssert(toHalf(std::ldexp(1.0f,-15)) == 0x0200);
+    testAssert(toFloat(0x03FF) == std::ldexp(1023.0f,-24));
+    testAssert(toHalf(std::ldexp(1.0f,-26)) == 0x0000);
+    testAssert(toHalf(std::ldexp(1.5f,-25)) == 0x0001);
+
+    //Ties round to even, both for normals and subnormals
+    testAssert(toHalf(1.0f + std::ldexp(1.0f,-11)) == 0x3C00);
+    testAssert(toHalf(1.0f + 3.0f * std::ldexp(1.0f,-11)) == 0x3C02);
+    testAssert(toHalf(1.0f + std::ldexp(1.0f,-11) + std::ldexp(1.0f,-20)) == 0x3C01);
+    testAssert(toHalf(std::ldexp(1.0f,-25)) == 0x0000);
+    testAssert(toHalf(std::ldexp(3.0f,-25)) == 0x0002);
+
+    //Every finite half survives the roundtrip exactly
+    for(uint32_t h = 0; h < 0x10000; h++) {
+      if((h & 0x7C00) == 0x7C00)
+        continue;
+      testAssert(toHalf(toFloat((uint16_t)h)) == (uint16_t)h);
+    }
+
+    //And floats in the range of probabilities and ownership come back within half an ulp
+    Rand rand("halfPrecisionTest");
+    for(int i = 0; i<100000; i++) {
+      float f = (float)(rand.nextDouble() * 2.0 - 1.0);
+      float g = toFloat(toHalf(f));
+      float tolerance = std::fabs(f) < std::ldexp(1.0f,-14) ? std::ldexp(1.0f,-25) : std::fabs(f) * std::ldexp(1.0f,-11);
+      testAssert(std::fabs(f - g) <= tolerance);
+    }
+    cout << "Ok" << endl;
+  }
+
+  {
+    const char* name = "NN compact output roundtrip";
+    cout << "-----------------------------------------------------------------" <<  endl;
+    cout << name << endl;
+    cout << "-----------------------------------------------------------------" <<  endl;
+
+    //9x9 board in a 19x19 nn
+    const int nnXLen = 19;
+    const int nnYLen = 19;
+    const int boardXSize = 9;
+    const int boardYSize = 9;
+    Rand rand("compactOutputTest");
+
+    NNOutput output;
+    output.nnHash = Hash128(rand.nextUInt64(),rand.nextUInt64());
+    output.whiteWinProb = 0.6f;
+    output.whiteLossProb = 0.35f;
+    output.whiteNoResultProb = 0.05f;
+    output.whiteScoreMean = 3.25f;
+    output.whiteScoreMeanSq = 30.5f;
+    output.nnXLen = nnXLen;
+    output.nnYLen = nnYLen;
+    std::fill(output.policyProbs, output.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+    output.whiteOwnerMap = new float[nnXLen * nnYLen];
+    std::fill(output.whiteOwnerMap, output.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+    double policySum = 0.0;
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++) {
+        int pos = NNPos::xyToPos(x,y,nnXLen);
+        //A few illegal moves
+        if((x + y) % 7 != 0) {
+          output.policyProbs[pos] = (float)rand.nextDouble();
+          policySum += output.policyProbs[pos];
+        }
+        output.whiteOwnerMap[pos] = (float)(rand.nextDouble() * 2.0 - 1.0);
+      }
+    }
+    int passPos = NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen);
+    output.policyProbs[passPos] = 0.01f;
+    policySum += output.policyProbs[passPos];
+    for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++) {
+      if(output.policyProbs[pos] >= 0)
+        output.policyProbs[pos] = (float)(output.policyProbs[pos] / policySum);
+    }
+
+    for(int withOwnerMap = 0; withOwnerMap <= 1; withOwnerMap++) {
+      NNCompactOutput* compact = NNCompactOutput::compress(output,boardXSize,boardYSize,withOwnerMap != 0);
+      testAssert(compact->hasOwnerMap == (withOwnerMap != 0));
+      testAssert(compact->sizeInBytes() == NNCompactOutput::sizeInBytes(boardXSize,boardYSize,withOwnerMap != 0));
+      testAssert(compact->sizeInBytes() < NNCompactOutput::sizeInBytes(nnXLen,nnYLen,withOwnerMap != 0));
+
+      //Through bytes and back, as the disk cache does
+      NNCompactOutput* copy = NNCompactOutput::fromBytes(compact->bytes(),compact->sizeInBytes());
+      testAssert(copy != NULL);
+      testAssert(std::memcmp(copy->bytes(),compact->bytes(),compact->sizeInBytes()) == 0);
+      testAssert(NNCompactOutput::fromBytes(compact->bytes(),compact->sizeInBytes()-1) == NULL);
+
+      NNOutput result;
+      copy->decompress(result);
+      testAssert(result.nnHash == output.nnHash);
+      testAssert(result.whiteWinProb == output.whiteWinProb);
+      testAssert(result.whiteLossProb == output.whiteLossProb);
+      testAssert(result.whiteNoResultProb == output.whiteNoResultProb);
+      testAssert(result.whiteScoreMean == output.whiteScoreMean);
+      testAssert(result.whiteScoreMeanSq == output.whiteScoreMeanSq);
+      testAssert(result.nnXLen == nnXLen && result.nnYLen == nnYLen);
+
+      double resultPolicySum = 0.0;
+      for(int y = 0; y<nnYLen; y++) {
+        for(int x = 0; x<nnXLen; x++) {
+          int pos = NNPos::xyToPos(x,y,nnXLen);
+          if(x >= boardXSize || y >= boardYSize)
+            testAssert(result.policyProbs[pos] == -1.0f);
+          else if(output.policyProbs[pos] < 0)
+            testAssert(result.policyProbs[pos] < 0);
+          else
+            testAssert(std::fabs(result.policyProbs[pos] - output.policyProbs[pos]) <= output.policyProbs[pos] * 2e-3 + 1e-7);
+          if(result.policyProbs[pos] > 0)
+            resultPolicySum += result.policyProbs[pos];
+        }
+      }
+      testAssert(std::fabs(result.policyProbs[passPos] - output.policyProbs[passPos]) <= output.policyProbs[passPos] * 2e-3);
+      resultPolicySum += result.policyProbs[passPos];
+      testAssert(std::fabs(resultPolicySum - 1.0) < 1e-5);
+
+      if(withOwnerMap) {
+        testAssert(result.whiteOwnerMap != NULL);
+        for(int y = 0; y<nnYLen; y++) {
+          for(int x = 0; x<nnXLen; x++) {
+            int pos = NNPos::xyToPos(x,y,nnXLen);
+            if(x >= boardXSize || y >= boardYSize)
+              testAssert(result.whiteOwnerMap[pos] == 0.0f);
+            else
+              testAssert(std::fabs(result.whiteOwnerMap[pos] - output.whiteOwnerMap[pos]) <= 1e-3);
+          }
+        }
+      }
+      else
+        testAssert(result.whiteOwnerMap == NULL);
+
+      cout << "Owner map " << withOwnerMap << " bytes " << compact->sizeInBytes() << endl;
+      NNCompactOutput::destroy(copy);
+      NNCompactOutput::destroy(compact);
+    }
+  }
 }
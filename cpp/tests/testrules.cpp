@@ -2176,18 +2176,19 @@ isResignation: 0
     rules.multiStoneSuicideLegal = true;
     BoardHistory hist(board,P_BLACK,rules,0);
     BoardHistory hist2(board,P_BLACK,rules,0);
+    Board copy = board;
 
     auto compareHists = [&]() {
       out << hist.moveHistory.size() << " " << hist2.moveHistory.size() << endl;
       out << hist.koHashHistory.size() << " " << hist2.koHashHistory.size() << endl;
       out << hist.koHashHistory[0] << " " << hist2.koHashHistory[0] << endl;
       out << hist.koHistoryLastClearedBeginningMoveIdx << " " << hist2.koHistoryLastClearedBeginningMoveIdx << endl;
-      out << hist.getRecentBoard(0).pos_hash <<  " " << hist2.getRecentBoard(0).pos_hash << endl;
-      out << hist.getRecentBoard(1).pos_hash <<  " " << hist2.getRecentBoard(1).pos_hash << endl;
-      out << hist.getRecentBoard(2).pos_hash <<  " " << hist2.getRecentBoard(2).pos_hash << endl;
-      out << hist.getRecentBoard(3).pos_hash <<  " " << hist2.getRecentBoard(3).pos_hash << endl;
-      out << hist.getRecentBoard(4).pos_hash <<  " " << hist2.getRecentBoard(4).pos_hash << endl;
-      out << hist.getRecentBoard(5).pos_hash <<  " " << hist2.getRecentBoard(5).pos_hash << endl;
+      out << hist.getRecentBoard(copy,0).pos_hash <<  " " << hist2.getRecentBoard(board,0).pos_hash << endl;
+      out << hist.getRecentBoard(copy,1).pos_hash <<  " " << hist2.getRecentBoard(board,1).pos_hash << endl;
+      out << hist.getRecentBoard(copy,2).pos_hash <<  " " << hist2.getRecentBoard(board,2).pos_hash << endl;
+      out << hist.getRecentBoard(copy,3).pos_hash <<  " " << hist2.getRecentBoard(board,3).pos_hash << endl;
+      out << hist.getRecentBoard(copy,4).pos_hash <<  " " << hist2.getRecentBoard(board,4).pos_hash << endl;
+      out << hist.getRecentBoard(copy,5).pos_hash <<  " " << hist2.getRecentBoard(board,5).pos_hash << endl;
 
       for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
         testAssert(hist.wasEverOccupiedOrPlayed[i] == hist2.wasEverOccupiedOrPlayed[i]);
@@ -2230,7 +2231,6 @@ isResignation: 0
 
     };
 
-    Board copy = board;
     makeMoveAssertLegal(hist, copy, Board::PASS_LOC, P_BLACK, __LINE__);
     makeMoveAssertLegal(hist, copy, Board::PASS_LOC, P_WHITE, __LINE__);
 
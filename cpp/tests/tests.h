@@ -1,9 +1,11 @@
 #ifndef TESTS_H
 #define TESTS_H
 
+#include <cstdlib>
 #include <sstream>
 
 #include "../core/global.h"
+#include "../core/os.h"
 #include "../core/rand.h"
 #include "../core/test.h"
 #include "../game/board.h"
@@ -15,7 +17,9 @@ namespace Tests {
   void runBoardIOTests();
   void runBoardBasicTests();
   void runBoardUndoTest();
+  void runBoardHistoryUndoTest();
   void runBoardStressTest();
+  void runBoardBenchmarks();
 
   //testboardarea.cpp
   void runBoardAreaTests();
@@ -38,6 +42,7 @@ namespace Tests {
   void runSearchTestsV3(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
   void runNNOnTinyBoard(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
   void runNNOnManyPoses(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16, const std::string& comparisonFile);
+  void runSearchBenchmarks();
 
   //testtime.cpp
   void runTimeControlsTests();
@@ -63,6 +68,21 @@ namespace TestCommon {
     return true;
   }
 
+  //A path for a scratch file in the system's temp directory, rather than wherever the tests are run from
+  inline std::string getTempFilePath(const std::string& fileName) {
+#ifdef OS_IS_WINDOWS
+    const char* dir = std::getenv("TEMP");
+    if(dir == NULL || dir[0] == '\0')
+      dir = ".";
+    return std::string(dir) + "\\" + fileName;
+#else
+    const char* dir = std::getenv("TMPDIR");
+    if(dir == NULL || dir[0] == '\0')
+      dir = "/tmp";
+    return std::string(dir) + "/" + fileName;
+#endif
+  }
+
 }
 
 #endif
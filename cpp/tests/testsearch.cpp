@@ -1,9 +1,11 @@
 #include "../tests/tests.h"
 
 #include <algorithm>
+#include <fstream>
 #include <iterator>
 #include <iomanip>
 
+#include "../core/timer.h"
 #include "../dataio/sgf.h"
 #include "../neuralnet/nninputs.h"
 #include "../search/asyncbot.h"
@@ -116,12 +118,13 @@ static NNEvaluator* startNNEval(
   bool requireExactNNLen = false;
   //bool inputsUseNHWC = true;
   int nnCacheSizePowerOfTwo = 16;
-  int nnMutexPoolSizePowerOfTwo = 12;
+  int64_t nnCacheMaxBytes = 0;
   int maxConcurrentEvals = 1024;
   //bool debugSkipNeuralNet = false;
   bool openCLReTunePerBoardSize = false;
   const string& modelName = modelFile;
   const string openCLTunerFile = "";
+  int cpuNumThreadsPerServer = 0;
   NNEvaluator* nnEval = new NNEvaluator(
     modelName,
     modelFile,
@@ -135,11 +138,12 @@ static NNEvaluator* startNNEval(
     requireExactNNLen,
     inputsUseNHWC,
     nnCacheSizePowerOfTwo,
-    nnMutexPoolSizePowerOfTwo,
+    nnCacheMaxBytes,
     debugSkipNeuralNet,
     nnPolicyTemperature,
     openCLTunerFile,
-    openCLReTunePerBoardSize
+    openCLReTunePerBoardSize,
+    cpuNumThreadsPerServer
   );
   (void)inputsUseNHWC;
 
@@ -149,12 +153,14 @@ static NNEvaluator* startNNEval(
   //int defaultSymmetry = 0;
   //bool useFP16 = false;
   //bool useNHWC = false;
+  int numSymmetriesToAverage = 1;
 
   nnEval->spawnServerThreads(
     numNNServerThreadsPerModel,
     nnRandomize,
     nnRandSeed,
     defaultSymmetry,
+    numSymmetriesToAverage,
     logger,
     gpuIdxByServerThread,
     useFP16,
@@ -1157,6 +1163,1064 @@ o..o.oo
     run(11,7);
   }
 
+  {
+    cout << "===================================================================" << endl;
+    cout << "NN batching policy with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0f);
+    nnEval->setDebugLatencyModel(1000.0,100.0);
+
+    auto evalConcurrently = [&](int numThreads) {
+      vector<std::thread> threads;
+      for(int i = 0; i<numThreads; i++) {
+        threads.push_back(std::thread([&nnEval,i]() {
+          Board board(9,9);
+          board.playMoveAssumeLegal(Location::getLoc(i,i,board.x_size),P_BLACK);
+          BoardHistory hist(board,P_WHITE,Rules::getTrompTaylorish(),0);
+          NNResultBuf buf;
+          bool skipCache = true;
+          bool includeOwnerMap = false;
+          nnEval->evaluate(board,hist,P_WHITE,0.0,buf,NULL,skipCache,includeOwnerMap);
+          testAssert(buf.hasResult);
+        }));
+      }
+      for(int i = 0; i<numThreads; i++)
+        threads[i].join();
+    };
+    auto printStats = [&]() {
+      cout << "Fill target " << nnEval->getBatchFillTarget()
+           << " rows " << nnEval->numRowsProcessed() << " batches " << nnEval->numBatchesProcessed() << endl;
+    };
+
+    cout << "Waiting for a full batch of 4" << endl;
+    nnEval->setBatchingPolicy(4,1e7,false);
+    nnEval->clearStats();
+    evalConcurrently(4);
+    printStats();
+    cout << "Only 3 ever arrive, so the deadline passes" << endl;
+    nnEval->setBatchingPolicy(4,2e5,false);
+    nnEval->clearStats();
+    evalConcurrently(3);
+    printStats();
+
+    //Batch sizes from here on depend on timing, so only check that everything gets evaluated
+    cout << "Adaptive" << endl;
+    nnEval->setBatchingPolicy(1,5e4,true);
+    nnEval->clearStats();
+    for(int rep = 0; rep<10; rep++)
+      evalConcurrently(8);
+    int fillTarget = nnEval->getBatchFillTarget();
+    testAssert(fillTarget >= 1 && fillTarget <= nnEval->getMaxBatchSize());
+    cout << "Rows " << nnEval->numRowsProcessed() << endl;
+
+    delete nnEval;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Search node arena with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    SearchParams params;
+    params.maxVisits = 1500;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    std::function<int64_t(const SearchNode*)> countNodes = [&](const SearchNode* node) {
+      if(node == NULL)
+        return (int64_t)0;
+      int64_t count = 1;
+      for(int i = 0; i<node->numChildren; i++)
+        count += countNodes(node->children[i]);
+      return count;
+    };
+    auto printStats = [&]() {
+      //Discarded subtrees are destroyed in the background, so wait for that to settle first
+      search->nodeArena->waitForReclamation();
+      SearchNodeArena::Stats stats = search->nodeArena->getStats();
+      testAssert(stats.numLiveNodes == countNodes(search->rootNode));
+      cout << "Live nodes " << stats.numLiveNodes << " node slabs " << stats.numNodeSlabs
+           << " children slabs " << stats.numChildrenSlabs << endl;
+    };
+
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    cout << "After search" << endl;
+    printStats();
+
+    Loc moveLoc = search->getChosenMoveLoc();
+    search->makeMove(moveLoc,nextPla);
+    cout << "After makeMove keeping the subtree" << endl;
+    printStats();
+
+    search->runWholeSearch(getOpp(nextPla),logger,NULL);
+    cout << "After searching again, reusing freed nodes" << endl;
+    printStats();
+
+    search->clearSearch();
+    cout << "After clearSearch" << endl;
+    printStats();
+
+    delete search;
+    delete nnEval;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "NN disk cache with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    const string diskCacheFile = getTempFilePath("katago_nndiskcachetest.tmp.bin");
+    std::remove(diskCacheFile.c_str());
+
+    const int numPoses = 8;
+    auto evalPoses = [&](NNEvaluator* nnEval, bool includeOwnerMap, vector<shared_ptr<NNOutput>>& results) {
+      results.clear();
+      for(int i = 0; i<numPoses; i++) {
+        Board board(9,9);
+        board.playMoveAssumeLegal(Location::getLoc(i,i/2,board.x_size),P_BLACK);
+        BoardHistory hist(board,P_WHITE,Rules::getTrompTaylorish(),0);
+        NNResultBuf buf;
+        bool skipCache = false;
+        nnEval->evaluate(board,hist,P_WHITE,0.0,buf,NULL,skipCache,includeOwnerMap);
+        testAssert(buf.hasResult);
+        testAssert((buf.result->whiteOwnerMap != NULL) == includeOwnerMap);
+        results.push_back(buf.result);
+      }
+    };
+    auto printStats = [&](NNEvaluator* nnEval) {
+      cout << "Disk hits " << nnEval->numDiskCacheHits() << " misses " << nnEval->numDiskCacheMisses()
+           << " rows " << nnEval->numRowsProcessed() << endl;
+    };
+    auto checkSame = [&](const vector<shared_ptr<NNOutput>>& a, const vector<shared_ptr<NNOutput>>& b) {
+      testAssert(a.size() == b.size());
+      for(size_t i = 0; i<a.size(); i++) {
+        testAssert(a[i]->nnHash == b[i]->nnHash);
+        testAssert(std::fabs(a[i]->whiteWinProb - b[i]->whiteWinProb) < 1e-3);
+        testAssert(std::fabs(a[i]->whiteScoreMean - b[i]->whiteScoreMean) < 1e-2);
+        for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++)
+          testAssert(std::fabs(a[i]->policyProbs[pos] - b[i]->policyProbs[pos]) < 1e-3);
+      }
+    };
+
+    vector<shared_ptr<NNOutput>> firstResults;
+    vector<shared_ptr<NNOutput>> results;
+
+    cout << "Fresh file" << endl;
+    NNEvaluator* nnEval1 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    nnEval1->setDiskCache(diskCacheFile,1 << 20,NULL);
+    evalPoses(nnEval1,false,firstResults);
+    printStats(nnEval1);
+    delete nnEval1;
+
+    cout << "Reopened by a new evaluator, all positions come from the file" << endl;
+    NNEvaluator* nnEval2 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    nnEval2->setDiskCache(diskCacheFile,1 << 26,NULL);
+    evalPoses(nnEval2,false,results);
+    printStats(nnEval2);
+    checkSame(firstResults,results);
+    delete nnEval2;
+
+    cout << "Asking for ownership still needs the net but keeps the cached policy" << endl;
+    NNEvaluator* nnEval3 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    nnEval3->setDiskCache(diskCacheFile,1 << 20,NULL);
+    evalPoses(nnEval3,true,results);
+    printStats(nnEval3);
+    checkSame(firstResults,results);
+    delete nnEval3;
+
+    cout << "A different policy temperature does not share entries" << endl;
+    NNEvaluator* nnEval4 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.5f);
+    nnEval4->setDiskCache(diskCacheFile,1 << 20,NULL);
+    evalPoses(nnEval4,false,results);
+    printStats(nnEval4);
+    delete nnEval4;
+
+    cout << "A process that died while writing leaves slots locked, the next open unlocks them" << endl;
+    NNDiskCache::debugSimulateInterruptedWrites(diskCacheFile);
+    NNEvaluator* nnEval6 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    nnEval6->setDiskCache(diskCacheFile,1 << 20,NULL);
+    evalPoses(nnEval6,false,results);
+    printStats(nnEval6);
+    delete nnEval6;
+    NNEvaluator* nnEval7 = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    nnEval7->setDiskCache(diskCacheFile,1 << 20,NULL);
+    evalPoses(nnEval7,false,results);
+    printStats(nnEval7);
+    testAssert(nnEval7->numDiskCacheHits() == numPoses);
+    checkSame(firstResults,results);
+    delete nnEval7;
+
+    cout << "A different nn size cannot use the file" << endl;
+    NNEvaluator* nnEval5 = startNNEval(modelFile,logger,"",19,19,0,true,false,false,true,1.0f);
+    try {
+      nnEval5->setDiskCache(diskCacheFile,1 << 20,NULL);
+      testAssert(false);
+    }
+    catch(const StringError& e) {
+      cout << "Got error as expected" << endl;
+    }
+    delete nnEval5;
+
+    std::remove(diskCacheFile.c_str());
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "NN cache table byte budget" << endl;
+    cout << "===================================================================" << endl;
+
+    const int64_t maxBytes = 1 << 20;
+    NNCacheTable* table = new NNCacheTable(maxBytes,19,19);
+    Rand rand("nnCacheTableBudgetTest");
+
+    auto makeOutput = [&](int boardSize, bool withOwnerMap) {
+      NNOutput* output = new NNOutput();
+      output->nnHash = Hash128(rand.nextUInt64(),rand.nextUInt64());
+      output->whiteWinProb = 0.5f;
+      output->whiteLossProb = 0.5f;
+      output->whiteNoResultProb = 0.0f;
+      output->whiteScoreMean = 0.0f;
+      output->whiteScoreMeanSq = 1.0f;
+      output->nnXLen = 19;
+      output->nnYLen = 19;
+      std::fill(output->policyProbs, output->policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+      for(int y = 0; y<boardSize; y++)
+        for(int x = 0; x<boardSize; x++)
+          output->policyProbs[NNPos::xyToPos(x,y,19)] = 1.0f / (boardSize * boardSize);
+      if(withOwnerMap) {
+        output->whiteOwnerMap = new float[19 * 19];
+        std::fill(output->whiteOwnerMap, output->whiteOwnerMap + 19 * 19, 0.0f);
+      }
+      return output;
+    };
+
+    //Fill well past the budget with each kind of entry, the largest ones first
+    const int boardSizes[3] = {19,19,9};
+    const bool withOwnerMaps[3] = {true,false,false};
+    int64_t numKeptByKind[3];
+    for(int kind = 0; kind < 3; kind++) {
+      table->clear();
+      int64_t entryBytes = (int64_t)NNCompactOutput::sizeInBytes(boardSizes[kind],boardSizes[kind],withOwnerMaps[kind]);
+      int64_t numToSet = 3 * maxBytes / entryBytes;
+      Hash128 lastHash;
+      for(int64_t i = 0; i<numToSet; i++) {
+        NNOutput* output = makeOutput(boardSizes[kind],withOwnerMaps[kind]);
+        table->set(*output,boardSizes[kind],boardSizes[kind]);
+        lastHash = output->nnHash;
+        delete output;
+        testAssert(table->numBytesUsed() <= maxBytes);
+      }
+      numKeptByKind[kind] = table->numBytesUsed() / entryBytes;
+      //Most of the budget actually gets used
+      testAssert(table->numBytesUsed() > maxBytes / 2);
+      shared_ptr<NNOutput> result;
+      testAssert(table->get(lastHash,result));
+      testAssert((result->whiteOwnerMap != NULL) == withOwnerMaps[kind]);
+      cout << "Board " << boardSizes[kind] << " owner map " << withOwnerMaps[kind]
+           << " entries kept " << numKeptByKind[kind] << " evictions " << table->numEvictions() << endl;
+      table->clearStats();
+    }
+    //Smaller entries means more of them
+    testAssert(numKeptByKind[0] < numKeptByKind[1]);
+    testAssert(numKeptByKind[1] < numKeptByKind[2]);
+    testAssert((uint64_t)numKeptByKind[2] <= table->getNumEntries());
+
+    delete table;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Incremental backup with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    std::function<void(const SearchNode*)> checkWeightsAreVisits = [&](const SearchNode* node) {
+      NodeStats stats = node->stats.snapshot();
+      testAssert(stats.weightSum == (double)stats.visits);
+      for(int i = 0; i<node->numChildren; i++)
+        checkWeightsAreVisits(node->children[i]);
+    };
+
+    struct RootResult {
+      int64_t visits;
+      double winLossValue;
+      double expectedScore;
+      double utility;
+      //The same tree, with every node then recomputed from its children as the full backup would have
+      double recomputedWinLossValue;
+      double recomputedUtility;
+    };
+    //A fresh evaluator each time, since cached evals are stored in compressed form and differ slightly from fresh ones
+    auto runSearch = [&](double valueWeightExponent, bool useIncrementalBackup) {
+      NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 400;
+      params.valueWeightExponent = valueWeightExponent;
+      params.useIncrementalBackup = useIncrementalBackup;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,logger,NULL);
+      ReportedSearchValues values;
+      testAssert(search->getRootValues(values));
+      RootResult result;
+      result.visits = search->getRootVisits();
+      result.winLossValue = values.winLossValue;
+      result.expectedScore = values.expectedScore;
+      result.utility = search->getRootUtility();
+      if(useIncrementalBackup && valueWeightExponent == 0.0)
+        checkWeightsAreVisits(search->rootNode);
+      search->recomputeAllNodeStats();
+      testAssert(search->getRootValues(values));
+      testAssert(search->getRootVisits() == result.visits);
+      result.recomputedWinLossValue = values.winLossValue;
+      result.recomputedUtility = search->getRootUtility();
+      delete search;
+      delete nnEval;
+      return result;
+    };
+    auto printResult = [&](const string& label, const RootResult& result) {
+      cout << label << " visits " << result.visits
+           << " winLoss " << Global::strprintf("%.6f",result.winLossValue)
+           << " score " << Global::strprintf("%.6f",result.expectedScore)
+           << " utility " << Global::strprintf("%.6f",result.utility) << endl;
+    };
+
+    RootResult full = runSearch(0.0,false);
+    RootResult incremental = runSearch(0.0,true);
+    cout << "Without reweighting, should match up to floating point error" << endl;
+    printResult("Full",full);
+    printResult("Incremental",incremental);
+    testAssert(full.visits == incremental.visits);
+    testAssert(std::fabs(full.winLossValue - incremental.winLossValue) < 1e-9);
+    testAssert(std::fabs(full.utility - incremental.utility) < 1e-9);
+    testAssert(std::fabs(incremental.recomputedUtility - incremental.utility) < 1e-9);
+
+    full = runSearch(0.5,false);
+    incremental = runSearch(0.5,true);
+    cout << "With valueWeightExponent 0.5, approximate between periodic recomputes" << endl;
+    printResult("Full",full);
+    printResult("Incremental",incremental);
+    //The searches go different ways, so compare each tree against fully recomputing that same tree instead
+    cout << "Recomputing the same tree, full changes by "
+         << Global::strprintf("%.6f",full.recomputedUtility - full.utility) << " incremental by "
+         << Global::strprintf("%.6f",incremental.recomputedUtility - incremental.utility) << endl;
+    testAssert(std::fabs(full.recomputedUtility - full.utility) < 1e-9);
+    testAssert(std::fabs(incremental.recomputedUtility - incremental.utility) < 0.005);
+    testAssert(std::fabs(incremental.recomputedWinLossValue - incremental.winLossValue) < 0.005);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Child edge selection against scalar reference" << endl;
+    cout << "===================================================================" << endl;
+
+    //Same formula as Search::getExploreSelectionValue away from the root
+    auto referenceValue = [](
+      const SearchChildEdges& edges, int i, int64_t totalChildVisits, double fpuValue, double cpuct,
+      double virtualLossUtility, Player pla, double illegalValue
+    ) {
+      double nnPolicyProb = edges.policyProbs[i];
+      if(nnPolicyProb < 0)
+        return illegalValue;
+      int64_t childVisits = (int64_t)edges.visits[i];
+      double childUtility = childVisits <= 0 ? fpuValue : edges.utilities[i];
+      if(totalChildVisits < childVisits)
+        totalChildVisits = childVisits;
+      int32_t childVirtualLosses = edges.virtualLosses[i];
+      if(childVirtualLosses > 0) {
+        childVisits += childVirtualLosses;
+        double virtualLossVisitFrac = (double)childVirtualLosses / childVisits;
+        childUtility = childUtility + (virtualLossUtility - childUtility) * virtualLossVisitFrac;
+      }
+      double exploreComponent = cpuct * nnPolicyProb * sqrt((double)totalChildVisits + 0.01) / (1.0 + childVisits);
+      double valueComponent = pla == P_WHITE ? childUtility : -childUtility;
+      return exploreComponent + valueComponent;
+    };
+
+    Rand rand("childEdgeSelectionTest");
+    const int maxCapacity = 400;
+    vector<int64_t> block((SearchChildEdges::bytesForCapacity(maxCapacity) + 7) / 8);
+    int numChecked = 0;
+    for(int iter = 0; iter<2000; iter++) {
+      int capacity = 1 + (int)rand.nextUInt(iter % 10 == 0 ? maxCapacity : 40);
+      int numChildren = (int)rand.nextUInt(capacity+1);
+      SearchChildEdges edges(reinterpret_cast<SearchNode**>(block.data()),capacity);
+      int64_t totalChildVisits = 0;
+      for(int i = 0; i<numChildren; i++) {
+        edges.children[i] = NULL;
+        //Coarse values so that ties happen
+        edges.visits[i] = rand.nextBool(0.2) ? 0.0 : (double)rand.nextUInt(20);
+        edges.utilities[i] = rand.nextUInt(5) * 0.25 - 0.5;
+        edges.policyProbs[i] = rand.nextBool(0.1) ? -1.0f : (float)(rand.nextUInt(4) * 0.05);
+        edges.virtualLosses[i] = rand.nextBool(0.7) ? 0 : (int32_t)rand.nextUInt(4);
+        edges.movePoses[i] = (int16_t)i;
+        totalChildVisits += (int64_t)edges.visits[i];
+      }
+      //Sometimes out of sync, as with multithreading
+      if(rand.nextBool(0.2))
+        totalChildVisits = rand.nextUInt(10);
+      double fpuValue = rand.nextDouble(-1.0,1.0);
+      double cpuct = rand.nextDouble(0.5,2.0);
+      Player pla = rand.nextBool(0.5) ? P_WHITE : P_BLACK;
+      double virtualLossUtility = pla == P_WHITE ? -1.0 : 1.0;
+      double illegalValue = -1e50;
+
+      int expectedIdx = -1;
+      double expectedValue = -INFINITY;
+      for(int i = 0; i<numChildren; i++) {
+        double value = referenceValue(edges,i,totalChildVisits,fpuValue,cpuct,virtualLossUtility,pla,illegalValue);
+        if(value > expectedValue) {
+          expectedValue = value;
+          expectedIdx = i;
+        }
+      }
+      double bestValue;
+      int bestIdx = edges.getBestExploreSelection(numChildren,totalChildVisits,fpuValue,cpuct,virtualLossUtility,pla,illegalValue,bestValue);
+      testAssert(bestIdx == expectedIdx);
+      testAssert(bestIdx < 0 || bestValue == expectedValue);
+
+      float policyProbs[NNPos::MAX_NN_POLICY_SIZE];
+      bool posesWithChild[NNPos::MAX_NN_POLICY_SIZE];
+      int policySize = 1 + (int)rand.nextUInt(NNPos::MAX_NN_POLICY_SIZE);
+      for(int pos = 0; pos<policySize; pos++) {
+        policyProbs[pos] = rand.nextBool(0.3) ? -1.0f : (float)(rand.nextUInt(8) * 0.01);
+        posesWithChild[pos] = rand.nextBool(0.3);
+      }
+      int expectedPos = -1;
+      float expectedProb = -1.0f;
+      for(int pos = 0; pos<policySize; pos++) {
+        if(!posesWithChild[pos] && policyProbs[pos] > expectedProb) {
+          expectedProb = policyProbs[pos];
+          expectedPos = pos;
+        }
+      }
+      float bestProb;
+      int bestPos = SearchChildEdges::getBestUnexpandedPos(policyProbs,posesWithChild,policySize,bestProb);
+      testAssert(bestPos == expectedPos);
+      testAssert(bestPos < 0 || bestProb == expectedProb);
+      numChecked++;
+    }
+    cout << "Checked " << numChecked << " selections, all agree" << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Graph search with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    //Small enough that the search goes deep and reaches many positions by more than one order of moves
+    Board board(5,5);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    std::function<int64_t(const SearchNode*)> countTreeNodes = [&](const SearchNode* node) {
+      int64_t count = 1;
+      for(int i = 0; i<node->numChildren; i++)
+        count += countTreeNodes(node->children[i]);
+      return count;
+    };
+    auto countGraphNodes = [&](const SearchNode* root) {
+      std::set<const SearchNode*> seen;
+      vector<const SearchNode*> stack;
+      seen.insert(root);
+      stack.push_back(root);
+      while(stack.size() > 0) {
+        const SearchNode* node = stack.back();
+        stack.pop_back();
+        //Every edge counts only playouts through it, so no parent can have more visits than it has sent
+        int64_t edgeVisitSum = 0;
+        for(int i = 0; i<node->numChildren; i++)
+          edgeVisitSum += (int64_t)node->getChildEdges().visits[i];
+        testAssert(edgeVisitSum < std::max(node->stats.visits.load(),(int64_t)1));
+        for(int i = 0; i<node->numChildren; i++) {
+          if(seen.insert(node->children[i]).second)
+            stack.push_back(node->children[i]);
+        }
+      }
+      return (int64_t)seen.size();
+    };
+
+    //A fresh evaluator each time, since cached evals are stored in compressed form and differ slightly from fresh ones
+    auto runSearch = [&](bool useGraphSearch, int numThreads) {
+      NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 1000;
+      params.numThreads = numThreads;
+      params.useGraphSearch = useGraphSearch;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,logger,NULL);
+
+      int64_t numNodes = useGraphSearch ? countGraphNodes(search->rootNode) : countTreeNodes(search->rootNode);
+      if(useGraphSearch)
+        testAssert(search->nodeTable->size() == numNodes);
+      if(numThreads == 1) {
+        cout << (useGraphSearch ? "Graph" : "Tree") << " visits " << search->getRootVisits()
+             << " nodes " << numNodes << " move " << Location::toString(search->getChosenMoveLoc(),board) << endl;
+      }
+
+      //Keep what is reachable from the move, and drop the rest
+      Loc moveLoc = search->getChosenMoveLoc();
+      search->makeMove(moveLoc,nextPla);
+      search->runWholeSearch(getOpp(nextPla),logger,NULL);
+      search->nodeArena->waitForReclamation();
+      int64_t numNodesAfterMove = useGraphSearch ? countGraphNodes(search->rootNode) : countTreeNodes(search->rootNode);
+      testAssert(search->nodeArena->getStats().numLiveNodes == numNodesAfterMove);
+      if(useGraphSearch)
+        testAssert(search->nodeTable->size() == numNodesAfterMove);
+      if(numThreads == 1) {
+        cout << "After makeMove and searching again, visits " << search->getRootVisits()
+             << " nodes " << numNodesAfterMove << endl;
+      }
+
+      delete search;
+      delete nnEval;
+      return numNodes;
+    };
+
+    int64_t treeNodes = runSearch(false,1);
+    int64_t graphNodes = runSearch(true,1);
+    testAssert(graphNodes < treeNodes);
+    //Just for the asserts, with several threads sharing nodes
+    runSearch(true,4);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Search tree memory budget with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    std::function<void(const SearchNode*,int64_t&,int64_t&)> countNodes =
+      [&](const SearchNode* node, int64_t& numNodes, int64_t& numCollapsed) {
+      numNodes += 1;
+      if(node->isCollapsed) {
+        numCollapsed += 1;
+        testAssert(node->numChildren == 0);
+      }
+      for(int i = 0; i<node->numChildren; i++)
+        countNodes(node->children[i],numNodes,numCollapsed);
+    };
+
+    //Quiet, since every collapse gets logged
+    Logger quietLogger;
+    quietLogger.setLogToStdout(false);
+
+    //Recount the bytes of a tree the same way as getTreeMemoryBytes
+    std::function<int64_t(const SearchNode*)> countBytes = [&](const SearchNode* node) {
+      int64_t numBytes = (int64_t)sizeof(SearchNode) + node->getNNOutputBytes();
+      if(node->children != NULL)
+        numBytes += (int64_t)SearchChildEdges::bytesForCapacity(node->childrenCapacity);
+      for(int i = 0; i<node->numChildren; i++)
+        numBytes += countBytes(node->children[i]);
+      return numBytes;
+    };
+
+    //A playout can add a node and grow the children of its parent before the tree is next checked against the budget
+    const int64_t maxBytesPerPlayout =
+      (int64_t)(sizeof(SearchNode) + sizeof(NNOutput) + SearchChildEdges::bytesForCapacity(9 * 9 + 1));
+
+    auto runSearch = [&](bool useGraphSearch, int numThreads, bool limitBytes) {
+      NNEvaluator* nnEval = startNNEval(modelFile,quietLogger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 2000;
+      params.numThreads = numThreads;
+      params.useGraphSearch = useGraphSearch;
+      if(limitBytes)
+        params.maxTreeBytes = 300 * (int64_t)(sizeof(SearchNode) + sizeof(NNOutput));
+      else
+        params.maxTreeNodes = 300;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,quietLogger,NULL);
+
+      //The search keeps going to its full visits, while the tree only ever briefly goes over budget
+      int64_t numNodes = 0;
+      int64_t numCollapsed = 0;
+      countNodes(search->rootNode,numNodes,numCollapsed);
+      testAssert(search->getRootVisits() >= 2000);
+      testAssert(numCollapsed > 0);
+      testAssert(search->getNumTreeNodes() <= params.maxTreeNodes + numThreads);
+      testAssert(search->getTreeMemoryBytes() <= params.maxTreeBytes + numThreads * maxBytesPerPlayout);
+      search->nodeArena->waitForReclamation();
+      if(!useGraphSearch) {
+        testAssert(numNodes == search->getNumTreeNodes());
+        testAssert(countBytes(search->rootNode) == search->getTreeMemoryBytes());
+      }
+      if(numThreads == 1) {
+        cout << (useGraphSearch ? "Graph" : "Tree") << " visits " << search->getRootVisits()
+             << " nodes " << search->getNumTreeNodes() << " collapsed " << numCollapsed;
+        if(limitBytes)
+          cout << " bytes " << search->getTreeMemoryBytes() << " of " << params.maxTreeBytes;
+        cout << " move " << Location::toString(search->getChosenMoveLoc(),board) << endl;
+      }
+
+      //A collapsed child becoming the root gets searched again from scratch
+      Loc collapsedMoveLoc = Board::NULL_LOC;
+      for(int i = 0; i<search->rootNode->numChildren; i++) {
+        if(search->rootNode->children[i]->isCollapsed) {
+          collapsedMoveLoc = search->getChildMoveLoc(*search->rootNode,i);
+          break;
+        }
+      }
+      testAssert(collapsedMoveLoc != Board::NULL_LOC);
+      search->makeMove(collapsedMoveLoc,nextPla);
+      search->runWholeSearch(getOpp(nextPla),quietLogger,NULL);
+      testAssert(search->getRootVisits() >= 2000);
+      testAssert(!search->rootNode->isCollapsed);
+      testAssert(search->getNumTreeNodes() <= params.maxTreeNodes + numThreads);
+      testAssert(search->getTreeMemoryBytes() <= params.maxTreeBytes + numThreads * maxBytesPerPlayout);
+      if(numThreads == 1) {
+        cout << "After moving to collapsed " << Location::toString(collapsedMoveLoc,board)
+             << ", visits " << search->getRootVisits() << " nodes " << search->getNumTreeNodes() << endl;
+      }
+
+      delete search;
+      delete nnEval;
+    };
+
+    runSearch(false,1,false);
+    runSearch(true,1,false);
+    //Just for the asserts, with several threads stopping together to collapse
+    runSearch(false,4,false);
+    //Same but by the memory the tree takes, with the nn outputs counted only for nodes that have one
+    runSearch(false,1,true);
+    runSearch(true,1,true);
+    runSearch(false,4,true);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Saving and loading search trees with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board = Board::parseBoard(9,9,R"%%(
+.........
+.........
+..x...o..
+.........
+....x....
+.........
+..o...x..
+.........
+.........
+)%%");
+    Player nextPla = P_WHITE;
+    BoardHistory hist(board,nextPla,rules,0);
+    const string treeFile = getTempFilePath("katago_searchtreetest.tmp.bin");
+    const string badTreeFile = getTempFilePath("katago_searchtreetest.bad.tmp.bin");
+
+    std::function<void(const SearchNode*,const SearchNode*)> checkSame = [&](const SearchNode* a, const SearchNode* b) {
+      testAssert(a->nextPla == b->nextPla);
+      testAssert(a->prevMoveLoc == b->prevMoveLoc);
+      testAssert(a->isCollapsed == b->isCollapsed);
+      testAssert(a->graphHash == b->graphHash);
+      NodeStats statsA = a->stats.snapshot();
+      NodeStats statsB = b->stats.snapshot();
+      testAssert(statsA.visits == statsB.visits);
+      testAssert(statsA.utilitySum == statsB.utilitySum);
+      testAssert(statsA.weightSum == statsB.weightSum);
+      testAssert((a->nnOutput == nullptr) == (b->nnOutput == nullptr));
+      if(a->nnOutput != nullptr)
+        testAssert(std::fabs(a->nnOutput->whiteWinProb - b->nnOutput->whiteWinProb) < 0.001);
+      testAssert(a->numChildren == b->numChildren);
+      for(int i = 0; i<a->numChildren; i++) {
+        testAssert(a->getChildEdges().visits[i] == b->getChildEdges().visits[i]);
+        testAssert(a->getChildEdges().movePoses[i] == b->getChildEdges().movePoses[i]);
+        checkSame(a->children[i],b->children[i]);
+      }
+    };
+
+    std::function<int64_t(const SearchNode*)> countCollapsed = [&](const SearchNode* node) {
+      int64_t numCollapsed = node->isCollapsed ? 1 : 0;
+      for(int i = 0; i<node->numChildren; i++)
+        numCollapsed += countCollapsed(node->children[i]);
+      return numCollapsed;
+    };
+
+    //The file name is the temp dir's, which isn't the same everywhere
+    auto printError = [&](const StringError& e, const string& fileName) {
+      string msg = e.what();
+      size_t pos = msg.rfind(fileName);
+      if(pos != string::npos)
+        msg = msg.substr(0,pos) + "<file>";
+      cout << msg << endl;
+    };
+
+    //Every byte of a file after the first fraction of it replaced with junk or cut off
+    auto writeBadCopy = [&](double fraction, bool truncate) {
+      ifstream in(treeFile, ios::in | ios::binary);
+      string contents((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+      in.close();
+      size_t numKept = (size_t)(contents.size() * fraction);
+      if(truncate)
+        contents.resize(numKept);
+      else
+        std::fill(contents.begin() + numKept, contents.end(), (char)0xFF);
+      ofstream out(badTreeFile, ios::out | ios::binary);
+      out.write(contents.data(),contents.size());
+      out.close();
+    };
+
+    //Both tree sizes only at one thread so the output is stable
+    auto runSearch = [&](bool useGraphSearch, int64_t maxTreeNodes) {
+      //Quiet, since every collapse gets logged
+      Logger quietLogger;
+      quietLogger.setLogToStdout(false);
+      Logger& searchLogger = maxTreeNodes > 0 ? quietLogger : logger;
+
+      NNEvaluator* nnEval = startNNEval(modelFile,searchLogger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 500;
+      params.useGraphSearch = useGraphSearch;
+      if(maxTreeNodes > 0)
+        params.maxTreeNodes = maxTreeNodes;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,searchLogger,NULL);
+      search->saveTree(treeFile);
+
+      Search* loaded = new Search(params, nnEval, "autoSearchRandSeed");
+      loaded->setPosition(nextPla,board,hist);
+      loaded->loadTree(treeFile);
+      if(!useGraphSearch)
+        checkSame(search->rootNode,loaded->rootNode);
+      testAssert(loaded->getRootVisits() == search->getRootVisits());
+      testAssert(loaded->nodeArena->getNumLiveNodes() == search->nodeArena->getNumLiveNodes());
+      if(useGraphSearch)
+        testAssert(loaded->nodeTable->size() == search->nodeTable->size());
+      if(maxTreeNodes > 0) {
+        testAssert(countCollapsed(loaded->rootNode) > 0);
+        testAssert(countCollapsed(loaded->rootNode) == countCollapsed(search->rootNode));
+      }
+      testAssert(loaded->getChosenMoveLoc() == search->getChosenMoveLoc());
+      cout << (useGraphSearch ? "Graph" : "Tree") << " saved visits " << search->getRootVisits()
+           << " loaded visits " << loaded->getRootVisits() << " nodes " << loaded->nodeArena->getNumLiveNodes()
+           << " collapsed " << countCollapsed(loaded->rootNode)
+           << " move " << Location::toString(loaded->getChosenMoveLoc(),board) << endl;
+
+      //Searching on from the loaded tree gives the same as from the original one
+      SearchParams moreParams = params;
+      moreParams.maxVisits = 800;
+      search->setParamsNoClearing(moreParams);
+      loaded->setParamsNoClearing(moreParams);
+      search->runWholeSearch(nextPla,searchLogger,NULL);
+      loaded->runWholeSearch(nextPla,searchLogger,NULL);
+      testAssert(loaded->getRootVisits() == search->getRootVisits());
+      testAssert(loaded->getRootVisits() >= 800);
+      testAssert(loaded->getChosenMoveLoc() == search->getChosenMoveLoc());
+      {
+        const SearchNode* a = search->rootNode;
+        const SearchNode* b = loaded->rootNode;
+        testAssert(a->numChildren == b->numChildren);
+        for(int i = 0; i<a->numChildren; i++) {
+          testAssert(a->getChildEdges().movePoses[i] == b->getChildEdges().movePoses[i]);
+          testAssert(a->getChildEdges().visits[i] == b->getChildEdges().visits[i]);
+        }
+        NodeStats statsA = a->stats.snapshot();
+        NodeStats statsB = b->stats.snapshot();
+        testAssert(statsA.visits == statsB.visits);
+        testAssert(std::fabs(statsA.utilitySum / statsA.weightSum - statsB.utilitySum / statsB.weightSum) < 1e-3);
+      }
+      cout << "Continued visits " << search->getRootVisits() << " " << loaded->getRootVisits()
+           << " move " << Location::toString(search->getChosenMoveLoc(),board)
+           << " " << Location::toString(loaded->getChosenMoveLoc(),board) << endl;
+
+      //A truncated or corrupt file is refused, leaving no tree, and searching just starts over
+      for(int badness = 0; badness<3; badness++) {
+        if(badness == 0)
+          writeBadCopy(0.5,true);
+        else if(badness == 1)
+          writeBadCopy(0.0,true);
+        else
+          writeBadCopy(0.5,false);
+        Search* bad = new Search(params, nnEval, "autoSearchRandSeed");
+        bad->setPosition(nextPla,board,hist);
+        try {
+          bad->loadTree(badTreeFile);
+          testAssert(false);
+        }
+        catch(const StringError& e) {
+          printError(e,badTreeFile);
+        }
+        testAssert(bad->rootNode == NULL);
+        testAssert(bad->nodeArena->getNumLiveNodes() == 0);
+        bad->runWholeSearch(nextPla,searchLogger,NULL);
+        testAssert(bad->getRootVisits() == 500);
+        delete bad;
+      }
+      std::remove(badTreeFile.c_str());
+
+      //A different position or different params refuse the tree and keep the one they have
+      Search* other = new Search(params, nnEval, "autoSearchRandSeed");
+      other->setPosition(getOpp(nextPla),board,hist);
+      other->runWholeSearch(getOpp(nextPla),searchLogger,NULL);
+      try {
+        other->loadTree(treeFile);
+        testAssert(false);
+      }
+      catch(const StringError& e) {
+        printError(e,treeFile);
+      }
+      testAssert(other->getRootVisits() == 500);
+      SearchParams otherParams = params;
+      otherParams.useGraphSearch = !useGraphSearch;
+      other->setParams(otherParams);
+      other->setPosition(nextPla,board,hist);
+      try {
+        other->loadTree(treeFile);
+        testAssert(false);
+      }
+      catch(const StringError& e) {
+        printError(e,treeFile);
+      }
+
+      std::remove(treeFile.c_str());
+      delete other;
+      delete loaded;
+      delete search;
+      delete nnEval;
+    };
+
+    runSearch(false,0);
+    runSearch(true,0);
+    //A tree with collapsed nodes round trips too
+    runSearch(false,150);
+    runSearch(true,150);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Leaves in flight with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board = Board::parseBoard(9,9,R"%%(
+.........
+.........
+..x..o...
+.........
+..x...o..
+...o.....
+..o.x.x..
+.........
+.........
+)%%");
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    //Which leaves have returned by the time a thread looks depends on timing, so only check that every leaf
+    //was finished and backed up, and that the visits all add up
+    auto runSearch = [&](int maxLeavesInFlight, int numThreads) {
+      NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 500;
+      params.numThreads = numThreads;
+      params.maxLeavesInFlightPerThread = maxLeavesInFlight;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,logger,NULL);
+
+      testAssert(search->getRootVisits() >= 500);
+      std::function<void(const SearchNode*)> checkFinished = [&](const SearchNode* node) {
+        testAssert(!node->nnEvalPending);
+        int64_t childVisits = 0;
+        for(int i = 0; i<node->numChildren; i++) {
+          testAssert(node->getChildEdges().virtualLosses[i] == 0);
+          childVisits += node->children[i]->stats.visits.load(std::memory_order_acquire);
+          checkFinished(node->children[i]);
+        }
+        //Terminal nodes take all their visits themselves
+        if(node->numChildren > 0)
+          testAssert(node->stats.visits.load(std::memory_order_acquire) == childVisits + 1);
+      };
+      checkFinished(search->rootNode);
+      cout << "maxLeavesInFlightPerThread " << maxLeavesInFlight << " numThreads " << numThreads << " ok" << endl;
+
+      delete search;
+      delete nnEval;
+    };
+
+    runSearch(8,1);
+    runSearch(8,4);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Batches of leaves per thread with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    auto runSearch = [&](int leafBatchSize, int numThreads) {
+      NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 1000;
+      params.numThreads = numThreads;
+      params.leafBatchSizePerThread = leafBatchSize;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      nnEval->clearStats();
+      search->runWholeSearch(nextPla,logger,NULL);
+
+      //Every batch of leaves is finished before the next, so nothing is left in flight or holding virtual losses
+      testAssert(search->getRootVisits() >= 1000);
+      //And the last batch is cut short rather than running past maxVisits
+      if(numThreads == 1)
+        testAssert(search->getRootVisits() == 1000);
+      std::function<void(const SearchNode*)> checkNoVirtualLosses = [&](const SearchNode* node) {
+        testAssert(!node->nnEvalPending);
+        for(int i = 0; i<node->numChildren; i++) {
+          testAssert(node->getChildEdges().virtualLosses[i] == 0);
+          checkNoVirtualLosses(node->children[i]);
+        }
+      };
+      checkNoVirtualLosses(search->rootNode);
+      if(numThreads == 1) {
+        //The whole batch is queued at once, so with one thread, every nn batch is one batch of leaves, or as much of it
+        //as fits in an nn batch
+        int expectedBatchSize = std::min(leafBatchSize,nnEval->getMaxBatchSize());
+        testAssert(leafBatchSize <= 1 || nnEval->averageProcessedBatchSize() > expectedBatchSize / 2);
+        cout << "leafBatchSizePerThread " << leafBatchSize << " visits " << search->getRootVisits()
+             << " nn batches " << nnEval->numBatchesProcessed() << " rows " << nnEval->numRowsProcessed() << endl;
+      }
+
+      delete search;
+      delete nnEval;
+    };
+
+    runSearch(1,1);
+    runSearch(8,1);
+    runSearch(32,1);
+    //Just for the asserts, with several threads batching at once
+    runSearch(8,4);
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Changing numThreads between searches with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+    SearchParams params;
+    params.maxVisits = 200;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+
+    //Each change restarts the workers, which must wait for the next search rather than pick up an old one
+    const int numThreadsToRun[] = {1,4,4,2,8,1,3,6,6,2};
+    for(int rep = 0; rep<20; rep++) {
+      for(int numThreads: numThreadsToRun) {
+        params.numThreads = numThreads;
+        search->setParams(params);
+        search->runWholeSearch(nextPla,logger,NULL);
+        testAssert(search->getRootVisits() >= params.maxVisits);
+        testAssert(search->getRootVisits() < params.maxVisits + numThreads);
+        std::function<void(const SearchNode*)> checkNoVirtualLosses = [&](const SearchNode* node) {
+          testAssert(!node->nnEvalPending);
+          for(int i = 0; i<node->numChildren; i++) {
+            testAssert(node->getChildEdges().virtualLosses[i] == 0);
+            checkNoVirtualLosses(node->children[i]);
+          }
+        };
+        checkNoVirtualLosses(search->rootNode);
+      }
+    }
+    cout << "ok" << endl;
+
+    delete search;
+    delete nnEval;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Nn evaluation that throws with debugSkipNeuralNet" << endl;
+    cout << "===================================================================" << endl;
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    auto runSearch = [&](int maxLeavesInFlight, int leafBatchSize, int numThreads) {
+      cout << "maxLeavesInFlightPerThread " << maxLeavesInFlight << " leafBatchSizePerThread " << leafBatchSize
+           << " numThreads " << numThreads << endl;
+      NNEvaluator* nnEval = startNNEval(modelFile,logger,"",9,9,0,true,false,false,true,1.0f);
+      SearchParams params;
+      params.maxVisits = 200;
+      params.numThreads = numThreads;
+      params.maxLeavesInFlightPerThread = maxLeavesInFlight;
+      params.leafBatchSizePerThread = leafBatchSize;
+      Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+
+      nnEval->setDebugThrowAfterEvaluates(50);
+      try {
+        //How many threads fail and log it depends on timing, so don't log it
+        Logger quietLogger;
+        quietLogger.setLogToStdout(false);
+        search->runWholeSearch(nextPla,quietLogger,NULL);
+        testAssert(false);
+      }
+      catch(const StringError& e) {
+        cout << "Search threw: " << e.what() << endl;
+      }
+      nnEval->setDebugThrowAfterEvaluates(-1);
+
+      //No leaf may be left marked as being evaluated, nor any virtual losses left behind by the failed playouts
+      std::function<void(const SearchNode*)> checkNothingLeft = [&](const SearchNode* node) {
+        testAssert(!node->nnEvalPending);
+        for(int i = 0; i<node->numChildren; i++) {
+          testAssert(node->getChildEdges().virtualLosses[i] == 0);
+          checkNothingLeft(node->children[i]);
+        }
+      };
+      checkNothingLeft(search->rootNode);
+
+      //So the tree can be searched on
+      int64_t visitsBefore = search->getRootVisits();
+      search->runWholeSearch(nextPla,logger,NULL);
+      testAssert(search->getRootVisits() >= 200);
+      testAssert(search->getRootVisits() > visitsBefore);
+      checkNothingLeft(search->rootNode);
+      if(numThreads == 1)
+        cout << "Searched on to " << search->getRootVisits() << " visits" << endl;
+
+      delete search;
+      delete nnEval;
+    };
+
+    runSearch(1,1,1);
+    runSearch(8,1,1);
+    runSearch(1,8,1);
+    runSearch(8,1,4);
+    runSearch(1,8,4);
+  }
+
   NeuralNet::globalCleanup();
 }
 
@@ -1269,3 +2333,247 @@ void Tests::runNNOnManyPoses(const string& modelFile, bool inputsNHWC, bool cuda
   NeuralNet::globalCleanup();
 
 }
+
+void Tests::runSearchBenchmarks() {
+  NeuralNet::globalInitialize();
+
+  //Placeholder, doesn't actually do anything since we have debugSkipNeuralNet = true
+  string modelFile = "/dev/null";
+
+  Logger logger;
+  logger.setLogToStdout(false);
+  logger.setLogTime(false);
+
+  NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0f);
+  Rules rules = Rules::getTrompTaylorish();
+  Board board(19,19);
+  Player nextPla = P_BLACK;
+  BoardHistory hist(board,nextPla,rules,0);
+
+  cout << "===================================================================" << endl;
+  cout << "Per-search thread overhead" << endl;
+  cout << "===================================================================" << endl;
+  cout << "spawn = creating and joining fresh threads and SearchThreads each search, as if without the persistent pool" << endl;
+  cout << "pooled = runWholeSearch on a tree that is already at its visit cap, i.e. waking and waiting on the persistent pool" << endl;
+
+  const int numThreadsToTest[] = {1,2,4,8,16};
+  const int numIters = 2000;
+  for(int numThreads: numThreadsToTest) {
+    SearchParams params;
+    params.numThreads = numThreads;
+    params.maxVisits = 1;
+    Search* search = new Search(params, nnEval, "benchmarkSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+
+    ClockTimer spawnTimer;
+    for(int iter = 0; iter<numIters; iter++) {
+      auto loop = [search,&logger](int threadIdx) {
+        SearchThread* stbuf = new SearchThread(threadIdx,*search,&logger);
+        delete stbuf;
+      };
+      vector<std::thread> threads;
+      for(int i = 0; i<numThreads-1; i++)
+        threads.push_back(std::thread(loop,i+1));
+      loop(0);
+      for(int i = 0; i<numThreads-1; i++)
+        threads[i].join();
+    }
+    double spawnTime = spawnTimer.getSeconds();
+
+    ClockTimer pooledTimer;
+    for(int iter = 0; iter<numIters; iter++)
+      search->runWholeSearch(nextPla,logger,NULL);
+    double pooledTime = pooledTimer.getSeconds();
+
+    cout << "numThreads " << numThreads
+         << " spawn " << Global::doubleToString(spawnTime / numIters * 1e6) << " us/search"
+         << " pooled " << Global::doubleToString(pooledTime / numIters * 1e6) << " us/search" << endl;
+    delete search;
+  }
+
+  cout << "===================================================================" << endl;
+  cout << "Playouts per second, fresh search each time" << endl;
+  cout << "===================================================================" << endl;
+  for(int numThreads: numThreadsToTest) {
+    SearchParams params;
+    params.numThreads = numThreads;
+    params.maxVisits = 2000;
+    Search* search = new Search(params, nnEval, "benchmarkSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+
+    const int numSearches = 20;
+    int64_t numPlayouts = 0;
+    ClockTimer timer;
+    for(int iter = 0; iter<numSearches; iter++) {
+      search->clearSearch();
+      search->runWholeSearch(nextPla,logger,NULL);
+      numPlayouts += search->getRootVisits();
+    }
+    double seconds = timer.getSeconds();
+    cout << "numThreads " << numThreads
+         << " playouts/s " << Global::doubleToString(numPlayouts / seconds) << endl;
+    delete search;
+  }
+
+  cout << "===================================================================" << endl;
+  cout << "Node stats contention" << endl;
+  cout << "===================================================================" << endl;
+  cout << "Playouts per second on a 5x5 board, where every thread keeps selecting and backing up through the same few nodes" << endl;
+  cout << "An untimed search first fills the nn cache, so the timed searches are almost all tree work rather than nn server work" << endl;
+  cout << "speedup = relative to 1 thread, at most the number of cores, and short of that where threads wait on each other" << endl;
+  {
+    Board smallBoard(5,5);
+    BoardHistory smallHist(smallBoard,nextPla,rules,0);
+    const int contentionThreadsToTest[] = {1,2,4,8,16,32,64,128};
+    double oneThreadPlayoutsPerSecond = 0.0;
+    for(int numThreads: contentionThreadsToTest) {
+      SearchParams params;
+      params.numThreads = numThreads;
+      params.maxVisits = 5000;
+      Search* search = new Search(params, nnEval, "benchmarkSearchRandSeed");
+      search->setPosition(nextPla,smallBoard,smallHist);
+      search->runWholeSearch(nextPla,logger,NULL);
+
+      const int numSearches = 10;
+      int64_t numPlayouts = 0;
+      uint64_t nnRowsBefore = nnEval->numRowsProcessed();
+      ClockTimer timer;
+      for(int iter = 0; iter<numSearches; iter++) {
+        search->clearSearch();
+        search->runWholeSearch(nextPla,logger,NULL);
+        numPlayouts += search->getRootVisits();
+      }
+      double seconds = timer.getSeconds();
+      double playoutsPerSecond = numPlayouts / seconds;
+      if(numThreads == 1)
+        oneThreadPlayoutsPerSecond = playoutsPerSecond;
+      cout << "numThreads " << numThreads
+           << " playouts/s " << Global::doubleToString(playoutsPerSecond)
+           << " speedup " << Global::strprintf("%.2f",playoutsPerSecond / oneThreadPlayoutsPerSecond)
+           << " nn rows/playout " << Global::strprintf("%.3f",(double)(nnEval->numRowsProcessed() - nnRowsBefore) / numPlayouts) << endl;
+      delete search;
+    }
+  }
+
+  cout << "===================================================================" << endl;
+  cout << "Child selection" << endl;
+  cout << "===================================================================" << endl;
+  cout << "nodes = computing PUCT from each child node's own stats and the parent's policy, as selection used to" << endl;
+  cout << "edges = SearchChildEdges::getBestExploreSelection over the contiguous edge arrays" << endl;
+  {
+    SearchParams params;
+    Search* search = new Search(params, nnEval, "benchmarkSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+    SearchThread* stbuf = new SearchThread(0,*search,&logger);
+    Rand rand("childSelectionBenchmark");
+
+    const int maxChildren = 361;
+    vector<int64_t> block((SearchChildEdges::bytesForCapacity(maxChildren) + 7) / 8);
+    SearchChildEdges edges(reinterpret_cast<SearchNode**>(block.data()),maxChildren);
+    vector<float> policyProbs(NNPos::MAX_NN_POLICY_SIZE);
+    int64_t totalChildVisits = 0;
+    for(int i = 0; i<maxChildren; i++) {
+      Loc loc = Location::getLoc(i % 19, i / 19, 19);
+      int movePos = NNPos::locToPos(loc,19,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN);
+      SearchNode* child = new SearchNode(*search,*stbuf,loc);
+      int64_t visits = 1 + rand.nextUInt(100);
+      double utility = rand.nextDouble(-1.0,1.0);
+      child->stats.visits.store(visits);
+      child->stats.weightSum.store((double)visits);
+      child->stats.utilitySum.store(utility * visits);
+      policyProbs[movePos] = (float)rand.nextDouble(0.0,0.01);
+      edges.children[i] = child;
+      edges.visits[i] = (double)visits;
+      edges.utilities[i] = utility;
+      edges.policyProbs[i] = policyProbs[movePos];
+      edges.virtualLosses[i] = 0;
+      edges.movePoses[i] = (int16_t)movePos;
+      totalChildVisits += visits;
+    }
+
+    const int numChildrenToTest[] = {8,32,128,361};
+    const int64_t numSelections = 200000;
+    for(int numChildren: numChildrenToTest) {
+      double sink = 0.0;
+      ClockTimer nodesTimer;
+      for(int64_t iter = 0; iter<numSelections; iter++) {
+        double bestValue = -1e300;
+        for(int i = 0; i<numChildren; i++) {
+          const SearchNode* child = edges.children[i];
+          int movePos = NNPos::locToPos(child->prevMoveLoc,19,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN);
+          double nnPolicyProb = policyProbs[movePos];
+          int64_t childVisits = child->stats.visits.load(std::memory_order_acquire);
+          double utilitySum = child->stats.utilitySum.load(std::memory_order_relaxed);
+          double weightSum = child->stats.weightSum.load(std::memory_order_relaxed);
+          double value = params.cpuctExploration * nnPolicyProb * sqrt((double)totalChildVisits + 0.01) / (1.0 + childVisits) - utilitySum / weightSum;
+          if(value > bestValue)
+            bestValue = value;
+        }
+        sink += bestValue;
+      }
+      double nodesSeconds = nodesTimer.getSeconds();
+
+      ClockTimer edgesTimer;
+      for(int64_t iter = 0; iter<numSelections; iter++) {
+        double bestValue;
+        edges.getBestExploreSelection(numChildren,totalChildVisits,0.0,params.cpuctExploration,1.0,P_BLACK,-1e50,bestValue);
+        sink += bestValue;
+      }
+      double edgesSeconds = edgesTimer.getSeconds();
+
+      cout << "numChildren " << numChildren
+           << " nodes " << Global::doubleToString(nodesSeconds / numSelections * 1e9) << " ns/selection"
+           << " edges " << Global::doubleToString(edgesSeconds / numSelections * 1e9) << " ns/selection"
+           << (sink == 0.0 ? " " : "") << endl;
+    }
+
+    for(int i = 0; i<maxChildren; i++)
+      delete edges.children[i];
+    delete stbuf;
+    delete search;
+  }
+
+  cout << "===================================================================" << endl;
+  cout << "Saving and loading search trees" << endl;
+  cout << "===================================================================" << endl;
+  {
+    const string treeFile = getTempFilePath("katago_searchtreebenchmark.tmp.bin");
+    const int64_t visitsToTest[] = {1000,10000,100000};
+    for(int64_t maxVisits: visitsToTest) {
+      SearchParams params;
+      params.numThreads = 8;
+      params.maxVisits = maxVisits;
+      Search* search = new Search(params, nnEval, "benchmarkSearchRandSeed");
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,logger,NULL);
+
+      ClockTimer saveTimer;
+      search->saveTree(treeFile);
+      double saveSeconds = saveTimer.getSeconds();
+
+      Search* loaded = new Search(params, nnEval, "benchmarkSearchRandSeed");
+      loaded->setPosition(nextPla,board,hist);
+      ClockTimer loadTimer;
+      loaded->loadTree(treeFile);
+      double loadSeconds = loadTimer.getSeconds();
+      testAssert(loaded->getRootVisits() == search->getRootVisits());
+
+      ifstream in(treeFile, ios::in | ios::binary | ios::ate);
+      int64_t fileBytes = (int64_t)in.tellg();
+      in.close();
+      std::remove(treeFile.c_str());
+
+      cout << "visits " << search->getRootVisits()
+           << " nodes " << search->getNumTreeNodes()
+           << " file " << Global::doubleToString(fileBytes / 1048576.0) << " MB"
+           << " save " << Global::doubleToString(saveSeconds * 1000.0) << " ms"
+           << " load " << Global::doubleToString(loadSeconds * 1000.0) << " ms" << endl;
+      delete loaded;
+      delete search;
+    }
+  }
+
+  delete nnEval;
+  NeuralNet::globalCleanup();
+}
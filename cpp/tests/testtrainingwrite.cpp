@@ -21,11 +21,12 @@ static NNEvaluator* startNNEval(
   int nnYLen = NNPos::MAX_BOARD_LEN;
   bool requireExactNNLen = false;
   int nnCacheSizePowerOfTwo = 16;
-  int nnMutexPoolSizePowerOfTwo = 12;
+  int64_t nnCacheMaxBytes = 0;
   bool debugSkipNeuralNet = modelFile == "/dev/null";
   float nnPolicyTemperature = 1.0;
   const string openCLTunerFile = "";
   bool openCLReTunePerBoardSize = false;
+  int cpuNumThreadsPerServer = 0;
   NNEvaluator* nnEval = new NNEvaluator(
     modelName,
     modelFile,
@@ -39,22 +40,25 @@ static NNEvaluator* startNNEval(
     requireExactNNLen,
     inputsUseNHWC,
     nnCacheSizePowerOfTwo,
-    nnMutexPoolSizePowerOfTwo,
+    nnCacheMaxBytes,
     debugSkipNeuralNet,
     nnPolicyTemperature,
     openCLTunerFile,
-    openCLReTunePerBoardSize
+    openCLReTunePerBoardSize,
+    cpuNumThreadsPerServer
   );
   (void)inputsUseNHWC;
 
   int numNNServerThreadsPerModel = 1;
   bool nnRandomize = false;
+  int numSymmetriesToAverage = 1;
 
   nnEval->spawnServerThreads(
     numNNServerThreadsPerModel,
     nnRandomize,
     seed,
     defaultSymmetry,
+    numSymmetriesToAverage,
     logger,
     gpuIdxByServerThread,
     useFP16,
@@ -124,8 +128,8 @@ void Tests::runTrainingWriteTests() {
     );
 
     cout << "seedBase: " << seedBase << endl;
-    cout << gameData->startHist.getRecentBoard(0) << endl;
-    gameData->endHist.printDebugInfo(cout,gameData->endHist.getRecentBoard(0));
+    cout << gameData->startBoard << endl;
+    gameData->endHist.printDebugInfo(cout,gameData->endBoard);
 
     dataWriter.writeGame(*gameData);
     delete gameData;
@@ -215,9 +215,12 @@ static void fillRow(const Board& board, const BoardHistory& hist, const vector<M
   row[turnNumberStart+1] = moves.size();
 
   //Record recent captures, by marking any positions where stones vanished between one board and the next
+  vector<Board> recentBoards;
+  for(int i = 0; i<(int)BoardHistory::NUM_RECENT_BOARDS; i++)
+    recentBoards.push_back(hist.getRecentBoard(board,i));
   for(int i = (int)BoardHistory::NUM_RECENT_BOARDS-2; i >= 0; i--) {
-    const Board& b = hist.getRecentBoard(i);
-    const Board& bPrev = hist.getRecentBoard(i+1);
+    const Board& b = recentBoards[i];
+    const Board& bPrev = recentBoards[i+1];
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);